@@ -43,6 +43,15 @@ struct Material {
 uniform Light light;
 uniform Material material;
 
+// Normal maps are cooked to two channels (BC5), z is rebuilt from x and y
+vec3 sampleNormalMap(sampler2D normalMap, vec2 uv)
+{
+    vec3 normal;
+    normal.xy = texture(normalMap, uv).rg * 2.0 - 1.0;
+    normal.z = sqrt(max(1.0 - dot(normal.xy, normal.xy), 0.0));
+    return normal;
+}
+
 out vec4 FragColor;
 
 void main() {
@@ -56,12 +65,10 @@ void main() {
     vec4 roughnessMap = texture(material.texture_roughness, TexCoords);
     vec4 metalnessMap = texture(material.texture_metalness, TexCoords);
     
-    vec3 normal = texture(material.texture_normal, TexCoords).rgb;
-    normal = normal * 2.0 - 1.0;
+    vec3 normal = sampleNormalMap(material.texture_normal, TexCoords);
     normal = normalize(TBN * normal);
     
-    vec3 normalCamera = texture(material.texture_normal_camera, TexCoords).rgb;
-    normalCamera = normalCamera * 2.0 - 1.0;
+    vec3 normalCamera = sampleNormalMap(material.texture_normal_camera, TexCoords);
     
     vec3 finalNormal = normal;
     
@@ -1,10 +1,68 @@
 #version 460 core
 
+#ifdef PACKED_VERTEX
+// See PackedVertex/QuantizedVertex in VertexFormat.h
+layout(location = 0) in vec3 aPos;
+layout(location = 1) in vec2 aNormal;
+layout(location = 2) in vec2 aTexCoord;
+layout(location = 3) in vec4 aTangent;
+#else
 layout(location = 0) in vec3 aPos;
 layout(location = 1) in vec3 aNormal;
 layout(location = 2) in vec2 aTexCoord;
 layout(location = 3) in vec3 aTangent;
 layout(location = 4) in vec3 aBiTangent;
+#endif
+
+#ifdef MULTI_DRAW
+// Matches DrawData and DrawTransform in MultiDraw.h
+struct DrawData
+{
+    uint transformIndex;
+    uint materialIndex;
+    vec4 positionOffset;
+    vec4 positionScale;
+};
+
+struct DrawTransform
+{
+    mat4 model;
+    mat4 normalMatrix;
+};
+
+layout(std430, binding = 3) readonly buffer Draws
+{
+    DrawData draws[];
+};
+
+layout(std430, binding = 4) readonly buffer Transforms
+{
+    DrawTransform transforms[];
+};
+
+// Index of the first draw of the current glMultiDrawElementsIndirect, gl_DrawID counts from there
+uniform int drawBase;
+
+// Entry of the material buffer, see MaterialTable
+flat out uint MaterialIndex;
+#else
+// Dequantization of the positions, identity for float positions
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+
+uniform mat4 model;
+#endif
+
+#ifdef PACKED_VERTEX
+vec3 octDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+#endif
 
 out vec2 TexCoords;
 out vec3 Normal;
@@ -12,36 +70,50 @@ out vec3 ViewPos;
 out vec3 FragPos;
 out mat3 TBN;
 
-struct Camera {
+layout(std140, binding = 0) uniform View
+{
     mat4 view;
     mat4 projection;
     vec3 position;
-};
+} camera;
 
-uniform Camera camera;
-uniform mat4 model;
+void main() {
+#ifdef MULTI_DRAW
+    DrawData draw = draws[drawBase + gl_DrawID];
+    mat4 model = transforms[draw.transformIndex].model;
+    mat3 normalMatrix = mat3(transforms[draw.transformIndex].normalMatrix);
+    vec3 position = aPos * draw.positionScale.xyz + draw.positionOffset.xyz;
+    MaterialIndex = draw.materialIndex;
+#else
+    mat3 normalMatrix = mat3(transpose(inverse(model)));
+    vec3 position = aPos * positionScale + positionOffset;
+#endif
 
-uniform mat4 lightSpaceMatrix;
-out vec4 FragPosLightSpace;
+#ifdef PACKED_VERTEX
+    vec3 normal = octDecode(aNormal);
+    vec3 tangent = octDecode(aTangent.xy);
+    vec3 biTangent = cross(normal, tangent) * aTangent.z;
+#else
+    vec3 normal = aNormal;
+    vec3 tangent = aTangent;
+    vec3 biTangent = aBiTangent;
+#endif
 
-void main() {
-    vec3 WorldPos = vec3(model * vec4(aPos, 1.0));
+    vec3 WorldPos = vec3(model * vec4(position, 1.0));
 
     gl_Position = camera.projection * camera.view * vec4(WorldPos, 1.0);
     
     TexCoords = aTexCoord;
     
-    Normal = normalize(mat3(transpose(inverse(model))) * aNormal);
+    Normal = normalize(normalMatrix * normal);
     
     ViewPos = camera.position;
     
     FragPos = WorldPos;
     
-    vec3 T = normalize(mat3(model) * aTangent);
-    vec3 B = normalize(mat3(model) * aBiTangent);
-    vec3 N = normalize(mat3(model) * aNormal);
+    vec3 T = normalize(mat3(model) * tangent);
+    vec3 B = normalize(mat3(model) * biTangent);
+    vec3 N = normalize(mat3(model) * normal);
     
     TBN = mat3(T, B, N);
-
-     FragPosLightSpace = lightSpaceMatrix * vec4(FragPos,1.0);
 }
\ No newline at end of file
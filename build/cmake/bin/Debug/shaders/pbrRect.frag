@@ -10,8 +10,16 @@ in vec3 WorldPos;
 struct Light
 {
     vec3 position;
-    vec3 color;
+    float constant;
+    vec3 direction;
+    float linear;
+    vec3 ambient;
+    float quadratic;
+    vec3 diffuse;
+    float cutoff;
+    vec3 specular;
     int type;
+    vec3 color;
 };
 
 struct Material
@@ -22,8 +30,11 @@ struct Material
     float ao;
 };
 
-uniform Light light[6];
-uniform int lightCount;
+layout(std430, binding = 5) readonly buffer Lights
+{
+    int lightCount;
+    Light light[];
+};
 uniform Material material;
 
 const float PI = 3.14159265359;
@@ -13,13 +13,13 @@ out vec3 FragPos;
 out mat3 TBN;
 out vec3 WorldPos;
 
-struct Camera {
+layout(std140, binding = 0) uniform View
+{
     mat4 view;
     mat4 projection;
     vec3 position;
-};
+} camera;
 
-uniform Camera camera;
 uniform mat4 model;
 
 uniform mat4 lightSpaceMatrix;
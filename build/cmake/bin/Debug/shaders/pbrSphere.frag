@@ -10,8 +10,16 @@ in vec3 WorldPos;
 struct Light
 {
     vec3 position;
-    vec3 color;
+    float constant;
+    vec3 direction;
+    float linear;
+    vec3 ambient;
+    float quadratic;
+    vec3 diffuse;
+    float cutoff;
+    vec3 specular;
     int type;
+    vec3 color;
 };
 
 struct Material
@@ -22,9 +30,14 @@ struct Material
     float ao;
 };
 
-uniform Light light[6];
-uniform int lightCount;
-uniform Material material;
+layout(std430, binding = 5) readonly buffer Lights
+{
+    int lightCount;
+    Light light[];
+};
+
+// Written by the vertex shader, from uniforms or from the instance buffer
+flat in Material surface;
 
 const float PI = 3.14159265359;
 
@@ -101,7 +114,7 @@ void main()
     vec3 V = normalize(ViewPos - WorldPos);
 
     vec3 F0 = vec3(0.04);
-    F0 = mix(F0, material.albedo, material.metallic);
+    F0 = mix(F0, surface.albedo, surface.metallic);
 
     vec3 Lo = vec3(0.0);
 
@@ -115,8 +128,8 @@ void main()
         float attenuation = 1.0 / (distance * distance);
         vec3 radiance = light[i].color * attenuation;
 
-        float NDF = distributionGGX(N, H, material.roughness);
-        float G = geometrySmith(N, V, L, material.roughness);
+        float NDF = distributionGGX(N, H, surface.roughness);
+        float G = geometrySmith(N, V, L, surface.roughness);
         vec3 F = fresnelSchlick(clamp(dot(H, V), 0.0, 1.0), F0);
 
         vec3 numerator = NDF * G * F;
@@ -127,18 +140,18 @@ void main()
 
         vec3 kD = vec3(1.0) - kS;
 
-        kD *= 1.0 - material.metallic;
+        kD *= 1.0 - surface.metallic;
 
         float NdotL = max(dot(N, L), 0.0);
 
         //if(i == 0)
-           // Lo += (1.0 - shadow) * (kD * material.albedo / PI + specular) * radiance * NdotL;
+           // Lo += (1.0 - shadow) * (kD * surface.albedo / PI + specular) * radiance * NdotL;
         //else
-            Lo += (kD * material.albedo / PI + specular) * radiance * NdotL;
+            Lo += (kD * surface.albedo / PI + specular) * radiance * NdotL;
 
     }
 
-    vec3 ambient = vec3(0.03) * material.albedo * material.ao;
+    vec3 ambient = vec3(0.03) * surface.albedo * surface.ao;
 
     vec3 color = ambient + Lo;
 
@@ -0,0 +1,123 @@
+#version 460 core
+
+#ifdef PACKED_VERTEX
+// See PackedVertex/QuantizedVertex in VertexFormat.h
+layout(location = 0) in vec3 aPos;
+layout(location = 1) in vec2 aNormal;
+layout(location = 2) in vec2 aTexCoord;
+layout(location = 3) in vec4 aTangent;
+#else
+layout(location = 0) in vec3 aPos;
+layout(location = 1) in vec3 aNormal;
+layout(location = 2) in vec2 aTexCoord;
+layout(location = 3) in vec3 aTangent;
+layout(location = 4) in vec3 aBiTangent;
+#endif
+
+// Dequantization of the positions, identity for float positions
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+
+// Node of the mesh relative to the asset's root, applied before the instance's matrix (see InstanceBatch::render)
+uniform mat4 meshMatrix;
+uniform mat4 meshNormalMatrix;
+
+#ifdef PACKED_VERTEX
+vec3 octDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+#endif
+
+out vec2 TexCoords;
+out vec3 Normal;
+out vec3 ViewPos;
+out vec3 FragPos;
+out mat3 TBN;
+out vec3 WorldPos;
+
+struct Material
+{
+    vec3 albedo;
+    float metallic;
+    float roughness;
+    float ao;
+};
+
+// Matches InstanceData in ModelInstance.h
+struct Instance
+{
+    mat4 model;
+    mat4 normalMatrix;
+    vec3 albedo;
+    float roughness;
+    float metallic;
+    float ao;
+};
+
+layout(std430, binding = 1) readonly buffer Instances
+{
+    Instance instances[];
+};
+
+// Instance indices grouped by detail level, see InstanceBatch
+layout(std430, binding = 2) readonly buffer InstanceOrder
+{
+    uint instanceOrder[];
+};
+
+layout(std140, binding = 0) uniform View
+{
+    mat4 view;
+    mat4 projection;
+    vec3 position;
+} camera;
+
+flat out Material surface;
+
+uniform mat4 lightSpaceMatrix;
+out vec4 FragPosLightSpace;
+
+void main() {
+    Instance instance = instances[instanceOrder[gl_BaseInstance + gl_InstanceID]];
+
+    vec3 position = aPos * positionScale + positionOffset;
+
+#ifdef PACKED_VERTEX
+    vec3 normal = octDecode(aNormal);
+    vec3 tangent = octDecode(aTangent.xy);
+    vec3 biTangent = cross(normal, tangent) * aTangent.z;
+#else
+    vec3 normal = aNormal;
+    vec3 tangent = aTangent;
+    vec3 biTangent = aBiTangent;
+#endif
+
+    mat4 model = instance.model * meshMatrix;
+
+    WorldPos = vec3(model * vec4(position, 1.0));
+
+    gl_Position = camera.projection * camera.view * vec4(WorldPos, 1.0);
+
+    TexCoords = aTexCoord;
+
+    Normal = normalize(mat3(instance.normalMatrix) * mat3(meshNormalMatrix) * normal);
+
+    ViewPos = camera.position;
+
+    FragPos = WorldPos;
+
+    vec3 T = normalize(mat3(model) * tangent);
+    vec3 B = normalize(mat3(model) * biTangent);
+    vec3 N = normalize(mat3(model) * normal);
+
+    TBN = mat3(T, B, N);
+
+    FragPosLightSpace = lightSpaceMatrix * vec4(WorldPos, 1.0);
+
+    surface = Material(instance.albedo, instance.metallic, instance.roughness, instance.ao);
+}
@@ -2,10 +2,57 @@
 // Shadow map depth vertex shader
 layout (location = 0) in vec3 aPos;
 
+#ifndef CASCADES
 uniform mat4 lightSpaceMatrix;
+#endif
+
+#ifdef MULTI_DRAW
+// Matches DrawData and DrawTransform in MultiDraw.h
+struct DrawData
+{
+    uint transformIndex;
+    uint materialIndex;
+    vec4 positionOffset;
+    vec4 positionScale;
+};
+
+struct DrawTransform
+{
+    mat4 model;
+    mat4 normalMatrix;
+};
+
+layout(std430, binding = 3) readonly buffer Draws
+{
+    DrawData draws[];
+};
+
+layout(std430, binding = 4) readonly buffer Transforms
+{
+    DrawTransform transforms[];
+};
+
+// Index of the first draw of the current glMultiDrawElementsIndirect, gl_DrawID counts from there
+uniform int drawBase;
+#else
 uniform mat4 model;
 
+// Dequantization of the positions, identity for float positions. The position is read the same way for every vertex format
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+#endif
+
 void main()
 {
-    gl_Position = lightSpaceMatrix * model * vec4(aPos, 1.0);
+#ifdef CASCADES
+    // World space, shadowMap.geom projects it into every cascade
+    mat4 lightSpaceMatrix = mat4(1.0);
+#endif
+
+#ifdef MULTI_DRAW
+    DrawData draw = draws[drawBase + gl_DrawID];
+    gl_Position = lightSpaceMatrix * transforms[draw.transformIndex].model * vec4(aPos * draw.positionScale.xyz + draw.positionOffset.xyz, 1.0);
+#else
+    gl_Position = lightSpaceMatrix * model * vec4(aPos * positionScale + positionOffset, 1.0);
+#endif
 }
\ No newline at end of file
@@ -0,0 +1,42 @@
+#version 460 core
+// Shadow map depth vertex shader for instance batches
+layout (location = 0) in vec3 aPos;
+
+// Matches InstanceData in ModelInstance.h, only the transform is read here
+struct Instance
+{
+    mat4 model;
+    mat4 normalMatrix;
+    vec4 material[2];
+};
+
+layout(std430, binding = 1) readonly buffer Instances
+{
+    Instance instances[];
+};
+
+// Instance indices grouped by detail level, see InstanceBatch
+layout(std430, binding = 2) readonly buffer InstanceOrder
+{
+    uint instanceOrder[];
+};
+
+#ifndef CASCADES
+uniform mat4 lightSpaceMatrix;
+#endif
+
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+
+// Node of the mesh relative to the asset's root, see InstanceBatch::render
+uniform mat4 meshMatrix;
+
+void main()
+{
+#ifdef CASCADES
+    // World space, shadowMap.geom projects it into every cascade
+    mat4 lightSpaceMatrix = mat4(1.0);
+#endif
+
+    gl_Position = lightSpaceMatrix * instances[instanceOrder[gl_BaseInstance + gl_InstanceID]].model * meshMatrix * vec4(aPos * positionScale + positionOffset, 1.0);
+}
@@ -1,4 +1,7 @@
 #version 460 core
+#ifdef BINDLESS_TEXTURES
+#extension GL_ARB_bindless_texture : require
+#endif
 
 in vec2 TexCoords;
 in vec3 Normal;
@@ -9,54 +12,98 @@ in mat3 TBN;
 struct Light
 {
     vec3 position;
-    vec3 direction;
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-    vec3 color;
     float constant;
+    vec3 direction;
     float linear;
+    vec3 ambient;
     float quadratic;
+    vec3 diffuse;
     float cutoff;
+    vec3 specular;
     int type;
+    vec3 color;
+};
+
+#ifdef MULTI_DRAW
+// Matches MaterialData in MaterialTable.h, slot 0 is the diffuse texture and slot 1 the normal map
+struct MaterialData
+{
+    uvec2 handles[2];
+    uint layers[2];
+    float minLods[2];
+};
+
+layout(std430, binding = 6) readonly buffer Materials
+{
+    MaterialData materials[];
 };
 
+flat in uint MaterialIndex;
+
+#ifndef BINDLESS_TEXTURES
+uniform sampler2DArray diffuseArray;
+uniform sampler2DArray normalArray;
+#endif
+#else
 struct Material
 {
     sampler2D texture_diffuse;
     sampler2D texture_normal;
 };
+#endif
 
-uniform Light light[6];
-uniform int lightCount;
+layout(std430, binding = 5) readonly buffer Lights
+{
+    int lightCount;
+    Light light[];
+};
+#ifndef MULTI_DRAW
 uniform Material material;
+#endif
+
+uniform sampler2DArray shadowMap;
 
-in vec4 FragPosLightSpace;
-uniform sampler2D shadowMap;
+layout(std140, binding = 0) uniform View
+{
+    mat4 view;
+    mat4 projection;
+    vec3 position;
+} camera;
 
-float calculateShadow(vec4 fragPosLightSpace)
+// Matches CascadeBlock in ShadowCascades.h
+layout(std140, binding = 1) uniform Cascades
 {
-    vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
+    mat4 lightSpaceMatrices[4];
+    vec4 splitDepths;
+    vec4 texelSizes;
+    vec4 depthBiases;
+    int cascadeCount;
+    float blendBand;
+} cascades;
+
+float sampleCascade(int cascade, vec3 lightDir)
+{
+    float NdotL = max(dot(Normal, lightDir), 0.0);
 
-    projCoords = projCoords * 0.5 + 0.5;
+    // Moved off the surface by about a texel, more where the light grazes it
+    vec3 position = FragPos + Normal * cascades.texelSizes[cascade] * (2.0 - NdotL);
+    vec3 projCoords = (cascades.lightSpaceMatrices[cascade] * vec4(position, 1.0)).xyz * 0.5 + 0.5;
 
     if(projCoords.x < 0.0 || projCoords.x > 1.0 ||
         projCoords.y < 0.0 || projCoords.y > 1.0 ||
-        projCoords.z < 0.0 || projCoords.z > 1.0)
+        projCoords.z > 1.0)
         return 0.0;
 
     float currentDepth = projCoords.z;
-
-    vec3 lightDir = normalize(light[0].type == 1 ? -light[0].direction : light[0].position - FragPos);
-    float bias = max(0.05 * (1.0 - dot(Normal, lightDir)), 0.005);
+    float bias = cascades.depthBiases[cascade] * (1.0 + 2.0 * (1.0 - NdotL));
 
     float shadow = 0.0;
-    vec2 texelSize = 1.0 / textureSize(shadowMap, 0);
+    vec2 texelSize = 1.0 / vec2(textureSize(shadowMap, 0).xy);
     for(int x = -1; x <= 1; ++x)
     {
         for(int y = -1; y <= 1; ++y)
         {
-            float pcfDepth = texture(shadowMap, projCoords.xy + vec2(x, y) * texelSize).r;
+            float pcfDepth = texture(shadowMap, vec3(projCoords.xy + vec2(x, y) * texelSize, float(cascade))).r;
             shadow += currentDepth - bias > pcfDepth ? 1.0 : 0.0;
         }
     }
@@ -65,6 +112,29 @@ float calculateShadow(vec4 fragPosLightSpace)
     return shadow;
 }
 
+float calculateShadow()
+{
+    float viewDepth = -(camera.view * vec4(FragPos, 1.0)).z;
+
+    int cascade = 0;
+    while(cascade < cascades.cascadeCount && viewDepth > cascades.splitDepths[cascade])
+        ++cascade;
+    if(cascade == cascades.cascadeCount)
+        return 0.0;
+
+    vec3 lightDir = normalize(light[0].type == 1 ? -light[0].direction : light[0].position - FragPos);
+    float shadow = sampleCascade(cascade, lightDir);
+
+    // The end of each cascade fades into the next one and the last one fades out, so neither change shows as a seam
+    float sliceStart = cascade == 0 ? 0.0 : cascades.splitDepths[cascade - 1];
+    float band = (cascades.splitDepths[cascade] - sliceStart) * cascades.blendBand;
+    float blend = band > 0.0 ? clamp((viewDepth - cascades.splitDepths[cascade] + band) / band, 0.0, 1.0) : 0.0;
+    if(blend > 0.0)
+        shadow = mix(shadow, cascade + 1 < cascades.cascadeCount ? sampleCascade(cascade + 1, lightDir) : 0.0, blend);
+
+    return shadow;
+}
+
 vec3 processLight(int index, vec4 diffuseColor, vec3 normal)
 {
     float distance = length(light[index].position - FragPos) * 2.0;
@@ -87,7 +157,7 @@ vec3 processLight(int index, vec4 diffuseColor, vec3 normal)
 
     float shadow = 0.0;
     if(index == 0)
-        shadow = calculateShadow(FragPosLightSpace);
+        shadow = calculateShadow();
 
     return ambient + (1.0 - shadow) * (diffuse + specular);
 }
@@ -118,15 +188,51 @@ vec3 processDirectionalLight(int index, vec4 diffuseColor, vec3 normal)
     return ambient + diffuse + specular;
 }
 
+#if defined(MULTI_DRAW) && !defined(BINDLESS_TEXTURES)
+// Levels finer than the one copied into the layer so far hold nothing yet
+vec4 sampleArray(sampler2DArray array, uint layer, float minLod, vec2 uv)
+{
+    float lod = max(textureQueryLod(array, uv).y, minLod);
+    return textureLod(array, vec3(uv, float(layer)), lod);
+}
+#endif
+
+vec4 sampleDiffuse(vec2 uv)
+{
+#if defined(MULTI_DRAW) && defined(BINDLESS_TEXTURES)
+    return texture(sampler2D(materials[MaterialIndex].handles[0]), uv);
+#elif defined(MULTI_DRAW)
+    return sampleArray(diffuseArray, materials[MaterialIndex].layers[0], materials[MaterialIndex].minLods[0], uv);
+#else
+    return texture(material.texture_diffuse, uv);
+#endif
+}
+
+// Normal maps are cooked to two channels (BC5), z is rebuilt from x and y
+vec3 sampleNormalMap(vec2 uv)
+{
+#if defined(MULTI_DRAW) && defined(BINDLESS_TEXTURES)
+    vec2 encoded = texture(sampler2D(materials[MaterialIndex].handles[1]), uv).rg;
+#elif defined(MULTI_DRAW)
+    vec2 encoded = sampleArray(normalArray, materials[MaterialIndex].layers[1], materials[MaterialIndex].minLods[1], uv).rg;
+#else
+    vec2 encoded = texture(material.texture_normal, uv).rg;
+#endif
+
+    vec3 normal;
+    normal.xy = encoded * 2.0 - 1.0;
+    normal.z = sqrt(max(1.0 - dot(normal.xy, normal.xy), 0.0));
+    return normal;
+}
+
 out vec4 FragColor;
 
 void main()
 {
 
-    vec4 diffuseColor = texture(material.texture_diffuse, TexCoords);
+    vec4 diffuseColor = sampleDiffuse(TexCoords);
 
-    vec3 normalMap = texture(material.texture_normal, TexCoords).rgb;
-    normalMap = normalMap * 2.0 - 1.0;
+    vec3 normalMap = sampleNormalMap(TexCoords);
 
     vec3 normal = normalize(TBN * normalMap);
 
@@ -0,0 +1,172 @@
+#include "AllocationCounter.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+    std::atomic<unsigned long long> heapAllocations{0};
+
+    void *allocate(size_t size)
+    {
+        heapAllocations.fetch_add(1, std::memory_order_relaxed);
+
+        // malloc(0) may return null, operator new may not
+        return std::malloc(size ? size : 1);
+    }
+
+    void *allocateAligned(size_t size, std::align_val_t alignment)
+    {
+        heapAllocations.fetch_add(1, std::memory_order_relaxed);
+
+        size_t align = static_cast<size_t>(alignment);
+#ifdef _WIN32
+        return _aligned_malloc(size ? size : 1, align);
+#else
+        // aligned_alloc wants a non zero multiple of the alignment
+        size_t rounded = size ? (size + align - 1) / align * align : align;
+        return std::aligned_alloc(align, rounded);
+#endif
+    }
+
+    void freeAligned(void *pointer)
+    {
+#ifdef _WIN32
+        _aligned_free(pointer);
+#else
+        std::free(pointer);
+#endif
+    }
+
+    void *allocateOrThrow(size_t size)
+    {
+        // Same retry loop as the default operator new
+        void *pointer;
+        while (!(pointer = allocate(size)))
+        {
+            std::new_handler handler = std::get_new_handler();
+            if (!handler)
+                throw std::bad_alloc();
+            handler();
+        }
+        return pointer;
+    }
+
+    void *allocateAlignedOrThrow(size_t size, std::align_val_t alignment)
+    {
+        void *pointer;
+        while (!(pointer = allocateAligned(size, alignment)))
+        {
+            std::new_handler handler = std::get_new_handler();
+            if (!handler)
+                throw std::bad_alloc();
+            handler();
+        }
+        return pointer;
+    }
+}
+
+unsigned long long getHeapAllocationCount()
+{
+    return heapAllocations.load(std::memory_order_relaxed);
+}
+
+void *operator new(size_t size)
+{
+    return allocateOrThrow(size);
+}
+
+void *operator new[](size_t size)
+{
+    return allocateOrThrow(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    return allocate(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+    return allocate(size);
+}
+
+void *operator new(size_t size, std::align_val_t alignment)
+{
+    return allocateAlignedOrThrow(size, alignment);
+}
+
+void *operator new[](size_t size, std::align_val_t alignment)
+{
+    return allocateAlignedOrThrow(size, alignment);
+}
+
+void *operator new(size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    return allocateAligned(size, alignment);
+}
+
+void *operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    return allocateAligned(size, alignment);
+}
+
+void operator delete(void *pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete[](void *pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete[](void *pointer, size_t) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, const std::nothrow_t &) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete[](void *pointer, const std::nothrow_t &) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, std::align_val_t) noexcept
+{
+    freeAligned(pointer);
+}
+
+void operator delete[](void *pointer, std::align_val_t) noexcept
+{
+    freeAligned(pointer);
+}
+
+void operator delete(void *pointer, size_t, std::align_val_t) noexcept
+{
+    freeAligned(pointer);
+}
+
+void operator delete[](void *pointer, size_t, std::align_val_t) noexcept
+{
+    freeAligned(pointer);
+}
+
+void operator delete(void *pointer, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    freeAligned(pointer);
+}
+
+void operator delete[](void *pointer, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    freeAligned(pointer);
+}
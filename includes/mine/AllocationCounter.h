@@ -0,0 +1,8 @@
+#ifndef __ALLOCATIONCOUNTER_H__
+#define __ALLOCATIONCOUNTER_H__
+
+// Calls to the global operator new since startup, from every thread. The replacement operators live in
+// AllocationCounter.cpp, taking a difference of two reads gives the allocations made in between
+unsigned long long getHeapAllocationCount();
+
+#endif // __ALLOCATIONCOUNTER_H__
@@ -0,0 +1,467 @@
+#include "AssetStreamer.h"
+#include "TextureCache.h"
+#include "TextureStreamer.h"
+#include "LoadProfiler.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <unordered_map>
+
+namespace
+{
+    // Copies are split at this size so the time budget is checked often enough
+    constexpr size_t maxChunkSize = 1024 * 1024;
+
+    constexpr size_t stagingAlignment = 16;
+
+    size_t alignStaging(size_t offset)
+    {
+        return (offset + stagingAlignment - 1) & ~(stagingAlignment - 1);
+    }
+}
+
+AssetStreamer::AssetStreamer() : stagingBuffer(0), stagingSize(0), uploadedLastFrame(0)
+{
+}
+
+std::shared_ptr<Model> AssetStreamer::loadModel(const std::string &path, const Camera &camera, VertexFormat format)
+{
+    bool created;
+    std::shared_ptr<ModelAsset> asset = ResourceCache::get().acquireModel(path, format, created);
+
+    auto model = std::make_shared<Model>(asset, camera);
+    if (!created)
+        return model;
+
+    asset->loading = true;
+
+    auto load = std::make_shared<ModelLoad>();
+    load->asset = asset;
+    load->camera = &camera;
+    load->path = path;
+    load->start = std::chrono::steady_clock::now();
+    load->import = ThreadPool::getShared().submit([path, format]()
+                                                  {
+        LoadAssetScope profileScope(path);
+        auto result = std::make_shared<ImportResult>();
+        auto cache = std::make_shared<MeshCache>();
+
+        if (MeshCache::enabled && cache->load(path, Model::importFlags, format))
+        {
+            result->cache = cache;
+            result->meshes = cache->getMeshes();
+            result->nodes = cache->getNodes();
+            return result;
+        }
+
+        Model::importModel(path, result->imported, result->nodes, format);
+
+        result->meshes.reserve(result->imported.size());
+        for (const ImportedMesh &mesh : result->imported)
+            result->meshes.push_back(MeshCache::makeView(mesh));
+
+        if (MeshCache::enabled && !MeshCache::write(path, Model::importFlags, format, result->meshes, result->nodes))
+            std::cout << "Failed to write mesh cache for " << path << '\n';
+
+        return result; });
+
+    imports.push_back(load);
+    return model;
+}
+
+void AssetStreamer::onImported(const std::shared_ptr<ModelLoad> &load)
+{
+    ModelAsset &asset = *load->asset;
+    const std::vector<CookedMesh> &cookedMeshes = load->data->meshes;
+
+    std::unordered_map<std::string, Upload *> textureUploads;
+
+    asset.nodes = load->data->nodes;
+    asset.meshes.reserve(cookedMeshes.size());
+    load->remainingUploads.assign(cookedMeshes.size(), 2);
+    load->remainingMeshes = cookedMeshes.size();
+
+    for (size_t i = 0; i < cookedMeshes.size(); ++i)
+    {
+        const CookedMesh &cooked = cookedMeshes[i];
+
+        std::vector<MTexture> textures;
+        textures.reserve(cooked.textures.size());
+
+        for (const TextureRef &ref : cooked.textures)
+        {
+            std::string fullPath = asset.directory + '/' + ref.path;
+
+            MTexture texture;
+            texture.type = ref.type;
+            texture.path = ref.path;
+
+            bool created;
+            texture.resource = ResourceCache::get().acquireTexture(fullPath, created);
+            if (created)
+            {
+                glGenTextures(1, &texture.resource->id);
+
+                Upload &upload = uploads.emplace_back();
+                upload.type = UploadType::TEXTURE;
+                upload.load = load;
+                upload.target = texture.resource->id;
+                upload.texture = texture.resource;
+                upload.path = fullPath;
+                upload.textureType = ref.type;
+
+                upload.pendingImage = ThreadPool::getShared().submit([fullPath, type = ref.type, modelPath = load->path]()
+                                                                     {
+                    LoadAssetScope profileScope(modelPath);
+                    DecodedImage image;
+                    loadTextureImage(fullPath, type, true, image);
+                    return image; });
+
+                textureUploads[fullPath] = &upload;
+                ++load->textureCount;
+            }
+            texture.id = texture.resource->id;
+
+            // Textures still uploading for another model are shown as they are, only this load's uploads gate the mesh
+            auto pending = textureUploads.find(fullPath);
+            if (pending != textureUploads.end())
+            {
+                pending->second->meshIndices.push_back(i);
+                ++load->remainingUploads[i];
+            }
+
+            textures.push_back(texture);
+        }
+
+        // Storage only, the data arrives through the staging buffer
+        Mesh &mesh = asset.meshes.emplace_back(nullptr, cooked.vertexCount, cooked.layout, nullptr, cooked.indexCount, cooked.indexSize,
+                                               std::move(textures), *load->camera);
+        mesh.setLods(cooked.lods);
+        mesh.setBounds(cooked.boundsMin, cooked.boundsMax);
+        mesh.setBoundingSphere(cooked.sphereCenter, cooked.sphereRadius);
+        mesh.setUvDensity(cooked.uvDensity);
+        mesh.setNode(cooked.node);
+
+        Upload &vertexUpload = uploads.emplace_back();
+        vertexUpload.type = UploadType::BUFFER;
+        vertexUpload.load = load;
+        vertexUpload.meshIndices.push_back(i);
+        vertexUpload.pool = mesh.pool;
+        vertexUpload.destinationOffset = size_t(mesh.allocation.baseVertex) * cooked.layout.getStride();
+        vertexUpload.source = cooked.vertices;
+        vertexUpload.size = size_t(cooked.vertexCount) * cooked.layout.getStride();
+
+        Upload &indexUpload = uploads.emplace_back();
+        indexUpload.type = UploadType::BUFFER;
+        indexUpload.load = load;
+        indexUpload.meshIndices.push_back(i);
+        indexUpload.pool = mesh.pool;
+        indexUpload.indexData = true;
+        indexUpload.destinationOffset = mesh.allocation.indexOffset;
+        indexUpload.source = static_cast<const unsigned char *>(cooked.indices);
+        indexUpload.size = size_t(cooked.indexCount) * cooked.indexSize;
+    }
+
+    ResourceCache::get().setResidentBytes(asset);
+
+    if (load->remainingMeshes == 0)
+        asset.loading = false;
+}
+
+bool AssetStreamer::stage(Upload &upload, unsigned char *staging, size_t &used, std::vector<StagedCopy> &copies)
+{
+    size_t available = stagingSize - used;
+
+    if (upload.type == UploadType::BUFFER)
+    {
+        size_t chunk = std::min({upload.size - upload.uploaded, available, maxChunkSize});
+        if (chunk == 0 && upload.size != upload.uploaded)
+            return false;
+
+        std::memcpy(staging + used, upload.source + upload.uploaded, chunk);
+        copies.push_back({&upload, used, chunk, upload.uploaded, 0, 0});
+
+        upload.uploaded += chunk;
+        used = alignStaging(used + chunk);
+        return true;
+    }
+
+    if (!upload.decoded)
+    {
+        if (upload.pendingImage.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            return true;
+
+        upload.image = upload.pendingImage.get();
+        upload.decoded = true;
+
+        // The mesh is still shown, with a placeholder instead of a texture that has no storage and samples black
+        if (!upload.image.isValid())
+        {
+            std::cout << "Failed to load texture " << upload.path << " for " << upload.load->path << ", using a placeholder\n";
+            glBindTexture(GL_TEXTURE_2D, upload.target);
+            allocatePlaceholderTexture(upload.textureType);
+            upload.image.height = 0;
+            return true;
+        }
+
+        // An image already resident under another path leaves nothing to upload
+        if (!ResourceCache::get().deduplicate(upload.texture, upload.image.contentHash, getTextureBytes(upload.image)))
+        {
+            ++upload.load->duplicateTextures;
+            upload.image = DecodedImage();
+            return true;
+        }
+
+        upload.firstLevel = TextureStreamer::get().add(upload.texture, upload.path, upload.textureType, true, upload.image);
+        upload.uploadedLevel = upload.firstLevel;
+
+        glBindTexture(GL_TEXTURE_2D, upload.target);
+        allocateTexture(upload.image, upload.firstLevel);
+    }
+
+    if (upload.image.compressed)
+    {
+        const ImageLevel &level = upload.image.levels[upload.uploadedLevel];
+        size_t blockRowSize = getCompressedSize(upload.image.codec, level.width, 4);
+        int blockRows = (level.height + 3) / 4;
+
+        size_t rows = std::min<size_t>(blockRows - upload.uploadedRows, std::min(available, maxChunkSize) / blockRowSize);
+        if (rows == 0)
+            return false;
+
+        std::memcpy(staging + used, upload.image.blocks.data() + level.offset + upload.uploadedRows * blockRowSize, rows * blockRowSize);
+        copies.push_back({&upload, used, rows * blockRowSize, size_t(upload.uploadedRows), int(rows), upload.uploadedLevel});
+
+        upload.uploadedRows += int(rows);
+        if (upload.uploadedRows == blockRows)
+        {
+            ++upload.uploadedLevel;
+            upload.uploadedRows = 0;
+        }
+
+        used = alignStaging(used + rows * blockRowSize);
+        return true;
+    }
+
+    size_t rowSize = size_t(upload.image.width) * upload.image.channels;
+    if (rowSize == 0)
+        return true;
+
+    size_t rows = std::min<size_t>(upload.image.height - upload.uploadedRows, std::min(available, maxChunkSize) / rowSize);
+    if (rows == 0)
+        return upload.uploadedRows == upload.image.height;
+
+    std::memcpy(staging + used, upload.image.pixels.get() + upload.uploadedRows * rowSize, rows * rowSize);
+    copies.push_back({&upload, used, rows * rowSize, size_t(upload.uploadedRows), int(rows), 0});
+
+    upload.uploadedRows += int(rows);
+    used = alignStaging(used + rows * rowSize);
+    return true;
+}
+
+void AssetStreamer::complete(Upload &upload)
+{
+    if (upload.type == UploadType::TEXTURE && upload.image.isValid())
+    {
+        glBindTexture(GL_TEXTURE_2D, upload.target);
+        if (!upload.image.compressed)
+        {
+            LoadAssetScope profileScope(upload.load->path);
+            ScopedLoadTimer timer(LoadStage::MIP_GENERATION);
+            glGenerateMipmap(GL_TEXTURE_2D);
+        }
+
+        setTextureSampling(upload.image);
+
+        ResourceCache::get().setResidentBytes(*upload.texture, getTextureBytes(upload.image, upload.firstLevel));
+        upload.image = DecodedImage();
+    }
+
+    ModelLoad &load = *upload.load;
+
+    for (size_t meshIndex : upload.meshIndices)
+    {
+        if (--load.remainingUploads[meshIndex] != 0)
+            continue;
+
+        load.asset->meshes[meshIndex].ready = true;
+
+        if (--load.remainingMeshes == 0)
+        {
+            load.asset->loading = false;
+            load.data.reset();
+
+            double time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - load.start).count();
+            std::cout << "Model streamed: " << load.path << " (" << time << " ms, " << load.textureCount << " textures, "
+                      << load.duplicateTextures << " duplicates of textures loaded under another path)\n";
+        }
+    }
+}
+
+void AssetStreamer::update()
+{
+    for (size_t i = 0; i < imports.size();)
+    {
+        std::shared_ptr<ModelLoad> load = imports[i];
+
+        if (load->import.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            ++i;
+            continue;
+        }
+
+        try
+        {
+            load->data = load->import.get();
+            onImported(load);
+        }
+        catch (const std::exception &error)
+        {
+            std::cout << "Failed to stream " << load->path << ": " << error.what() << '\n';
+            load->asset->loading = false;
+        }
+
+        imports.erase(imports.begin() + i);
+    }
+
+    uploadedLastFrame = 0;
+
+    if (uploads.empty())
+        return;
+
+    auto start = std::chrono::steady_clock::now();
+
+    size_t budgetBytes = std::max(budget.bytesPerFrame, maxChunkSize);
+    if (stagingBuffer == 0 || stagingSize != budgetBytes)
+    {
+        if (stagingBuffer == 0)
+            glGenBuffers(1, &stagingBuffer);
+        stagingSize = budgetBytes;
+    }
+
+    // Orphan last frame's storage so the map never waits on copies still in flight
+    glBindBuffer(GL_COPY_READ_BUFFER, stagingBuffer);
+    glBufferData(GL_COPY_READ_BUFFER, stagingSize, nullptr, GL_STREAM_DRAW);
+    unsigned char *staging = static_cast<unsigned char *>(
+        glMapBufferRange(GL_COPY_READ_BUFFER, 0, stagingSize, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+
+    if (!staging)
+    {
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        return;
+    }
+
+    std::vector<StagedCopy> copies;
+    size_t used = 0;
+
+    auto withinTime = [&]()
+    {
+        return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count() < budget.millisecondsPerFrame;
+    };
+
+    for (Upload &upload : uploads)
+    {
+        if (used >= stagingSize || !withinTime())
+            break;
+
+        while (used < stagingSize && withinTime() && stage(upload, staging, used, copies))
+        {
+            bool waiting = upload.type == UploadType::TEXTURE && !upload.decoded;
+            if (waiting || isUploaded(upload))
+                break;
+        }
+    }
+
+    glUnmapBuffer(GL_COPY_READ_BUFFER);
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, stagingBuffer);
+
+    for (const StagedCopy &copy : copies)
+    {
+        LoadAssetScope profileScope(copy.upload->load->path);
+        ScopedLoadTimer timer(copy.upload->type == UploadType::BUFFER ? LoadStage::MESH_UPLOAD : LoadStage::TEXTURE_UPLOAD);
+        timer.addBytesUploaded(copy.size);
+
+        if (copy.upload->type == UploadType::BUFFER)
+        {
+            MeshPool &pool = *copy.upload->pool;
+            glBindBuffer(GL_COPY_WRITE_BUFFER, copy.upload->indexData ? pool.getIndexBuffer() : pool.getVertexBuffer());
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, copy.stagingOffset,
+                                copy.upload->destinationOffset + copy.destination, copy.size);
+        }
+        else if (copy.upload->image.compressed)
+        {
+            const DecodedImage &image = copy.upload->image;
+            const ImageLevel &level = image.levels[copy.level];
+            int y = int(copy.destination) * 4;
+
+            glBindTexture(GL_TEXTURE_2D, copy.upload->target);
+            glCompressedTexSubImage2D(GL_TEXTURE_2D, copy.level, 0, y, level.width, std::min(copy.rows * 4, level.height - y),
+                                      getCompressedFormat(image.codec), GLsizei(copy.size), reinterpret_cast<const void *>(copy.stagingOffset));
+        }
+        else
+        {
+            const DecodedImage &image = copy.upload->image;
+            glBindTexture(GL_TEXTURE_2D, copy.upload->target);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, GLint(copy.destination), image.width, copy.rows,
+                            getImageFormat(image.channels), GL_UNSIGNED_BYTE, reinterpret_cast<const void *>(copy.stagingOffset));
+        }
+
+        uploadedLastFrame += copy.size;
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    for (auto upload = uploads.begin(); upload != uploads.end();)
+    {
+        if (isUploaded(*upload))
+        {
+            complete(*upload);
+            upload = uploads.erase(upload);
+        }
+        else
+            ++upload;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+bool AssetStreamer::isUploaded(const Upload &upload)
+{
+    if (upload.type == UploadType::BUFFER)
+        return upload.uploaded == upload.size;
+
+    if (!upload.decoded)
+        return false;
+
+    if (upload.image.compressed)
+        return upload.uploadedLevel == int(upload.image.levels.size());
+
+    return upload.uploadedRows == upload.image.height;
+}
+
+size_t AssetStreamer::getPendingUploads() const
+{
+    return uploads.size() + imports.size();
+}
+
+size_t AssetStreamer::getUploadedLastFrame() const
+{
+    return uploadedLastFrame;
+}
+
+bool AssetStreamer::isIdle() const
+{
+    return uploads.empty() && imports.empty();
+}
+
+AssetStreamer::~AssetStreamer()
+{
+    if (stagingBuffer != 0)
+        glDeleteBuffers(1, &stagingBuffer);
+}
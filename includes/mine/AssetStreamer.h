@@ -0,0 +1,136 @@
+#ifndef __ASSETSTREAMER_H__
+#define __ASSETSTREAMER_H__
+#include "Model.h"
+#include "ResourceCache.h"
+#include <chrono>
+#include <future>
+#include <list>
+#include <memory>
+
+struct UploadBudget
+{
+    size_t bytesPerFrame = 8 * 1024 * 1024;
+    float millisecondsPerFrame = 2.f;
+};
+
+// Imports models and decodes their textures on the thread pool, then feeds the GPU data in through a
+// staging buffer without spending more than the budget on uploads in any one frame.
+// Meshes stay hidden (Mesh::ready == false) until their buffers and textures are complete.
+class AssetStreamer
+{
+    struct ImportResult
+    {
+        std::shared_ptr<MeshCache> cache;
+        std::vector<ImportedMesh> imported;
+        std::vector<CookedMesh> meshes;
+        std::vector<SceneNode> nodes;
+    };
+
+    struct ModelLoad
+    {
+        std::shared_ptr<ModelAsset> asset;
+        const Camera *camera;
+        std::string path;
+        std::chrono::steady_clock::time_point start;
+
+        std::future<std::shared_ptr<ImportResult>> import;
+        std::shared_ptr<ImportResult> data;
+
+        std::vector<unsigned int> remainingUploads;
+        size_t remainingMeshes = 0;
+
+        size_t textureCount = 0;
+        size_t duplicateTextures = 0;
+    };
+
+    enum class UploadType
+    {
+        BUFFER,
+        TEXTURE
+    };
+
+    struct Upload
+    {
+        UploadType type;
+        std::shared_ptr<ModelLoad> load;
+        std::vector<size_t> meshIndices;
+
+        unsigned int target = 0;
+        std::shared_ptr<TextureResource> texture;
+        std::string path;
+        // Material type of the texture, picks the placeholder when its image fails to load
+        std::string textureType;
+
+        // Buffer uploads write into a mesh's pool range, the pool's buffer is looked up per copy since it can grow in between
+        MeshPool *pool = nullptr;
+        bool indexData = false;
+        size_t destinationOffset = 0;
+
+        const unsigned char *source = nullptr;
+        size_t size = 0;
+        size_t uploaded = 0;
+
+        std::future<DecodedImage> pendingImage;
+        DecodedImage image;
+        bool decoded = false;
+        // Texel rows of the image, or block rows of the current level for compressed images
+        int uploadedRows = 0;
+        int uploadedLevel = 0;
+        // Coarser levels only when the TextureStreamer takes the texture over
+        int firstLevel = 0;
+    };
+
+    struct StagedCopy
+    {
+        Upload *upload;
+        size_t stagingOffset;
+        size_t size;
+        size_t destination;
+        int rows;
+        int level;
+    };
+
+    std::vector<std::shared_ptr<ModelLoad>> imports;
+
+    std::list<Upload> uploads;
+
+    unsigned int stagingBuffer;
+
+    size_t stagingSize;
+
+    size_t uploadedLastFrame;
+
+    void onImported(const std::shared_ptr<ModelLoad> &load);
+
+    bool stage(Upload &upload, unsigned char *staging, size_t &used, std::vector<StagedCopy> &copies);
+
+    void complete(Upload &upload);
+
+    static bool isUploaded(const Upload &upload);
+
+public:
+    UploadBudget budget;
+
+    AssetStreamer();
+
+    AssetStreamer(const AssetStreamer &) = delete;
+
+    AssetStreamer &operator=(const AssetStreamer &) = delete;
+
+    // Returns right away, the model fills in over the following frames.
+    // Paths already resident in the ResourceCache share the existing asset and are not loaded again
+    std::shared_ptr<Model> loadModel(const std::string &path, const Camera &camera, VertexFormat format = VertexFormat::FULL);
+
+    // Call once per frame on the context thread
+    void update();
+
+    size_t getPendingUploads() const;
+
+    size_t getUploadedLastFrame() const;
+
+    bool isIdle() const;
+
+    ~AssetStreamer();
+};
+
+#endif // __ASSETSTREAMER_H__
@@ -0,0 +1,491 @@
+#include "Benchmark.h"
+#include "FrameUniforms.h"
+#include "Model.h"
+#include "MeshCache.h"
+#include "ModelInstance.h"
+#include "MultiDraw.h"
+#include "ResourceCache.h"
+#include "TextureCache.h"
+#include "ThreadPool.h"
+#include "ShadowCascades.h"
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <algorithm>
+#include <map>
+#include <string>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#endif
+
+namespace
+{
+    // The light the PBR benchmarks are lit by
+    LightData getBenchmarkLight()
+    {
+        LightData light{};
+        light.position = glm::vec3(0.f, 5.f, 0.f);
+        light.color = glm::vec3(25.f);
+        light.type = 3;
+        return light;
+    }
+
+    double timeModelLoad(const char *path, const Camera &camera, double &meshLoadTime)
+    {
+        auto start = std::chrono::steady_clock::now();
+        {
+            Model model(path, camera);
+            glFinish();
+            meshLoadTime = model.getLoadTime();
+        }
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    double toMB(size_t bytes)
+    {
+        return bytes / (1024.0 * 1024.0);
+    }
+
+    struct FrameTimes
+    {
+        double cpu = 0.0;
+        double gpu = 0.0;
+    };
+
+    struct LodRun
+    {
+        FrameTimes times;
+        double triangles = 0.0;
+    };
+
+    template <typename Draw>
+    FrameTimes timeFrames(int frames, Draw draw)
+    {
+        unsigned int query;
+        glGenQueries(1, &query);
+
+        FrameTimes times;
+        for (int i = 0; i < frames; ++i)
+        {
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+            glBeginQuery(GL_TIME_ELAPSED, query);
+            auto start = std::chrono::steady_clock::now();
+            draw();
+            times.cpu += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            glEndQuery(GL_TIME_ELAPSED);
+
+            GLuint64 elapsed;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+            times.gpu += elapsed / 1e6;
+        }
+
+        glDeleteQueries(1, &query);
+
+        times.cpu /= frames;
+        times.gpu /= frames;
+        return times;
+    }
+}
+
+void runLoaderBenchmark(const char *path, const Camera &camera, int warmRuns)
+{
+    // The averages need at least one warm run
+    warmRuns = std::max(warmRuns, 1);
+
+    std::error_code error;
+    std::filesystem::remove(MeshCache::getCachePath(path), error);
+
+    bool cacheEnabled = MeshCache::enabled;
+    MeshCache::enabled = true;
+
+    double coldLoad;
+    double coldTotal = timeModelLoad(path, camera, coldLoad);
+
+    double warmLoad = 0.0, warmTotal = 0.0, warmBest = 0.0;
+    for (int i = 0; i < warmRuns; ++i)
+    {
+        double load;
+        double total = timeModelLoad(path, camera, load);
+        warmLoad += load;
+        warmTotal += total;
+        if (i == 0 || load < warmBest)
+            warmBest = load;
+    }
+
+    MeshCache::enabled = cacheEnabled;
+
+    warmLoad /= warmRuns;
+    warmTotal /= warmRuns;
+
+    std::cout << std::fixed << std::setprecision(2)
+              << "\nLoader benchmark: " << path << '\n'
+              << "  cold import : " << coldLoad << " ms (" << coldTotal << " ms including cache write)\n"
+              << "  warm cache  : " << warmLoad << " ms avg, " << warmBest << " ms best over " << warmRuns << " runs ("
+              << warmTotal << " ms avg total)\n"
+              << "  speedup     : " << (warmLoad > 0.0 ? coldLoad / warmLoad : 0.0) << "x\n";
+}
+
+void runInstancingBenchmark(const char *path, const Camera &camera, int instanceCount, int frames)
+{
+    MShader singleShader;
+    singleShader.autoCompileAndLink("shaders/pbrSphere.vert", "shaders/pbrSphere.frag");
+
+    MShader instancedShader;
+    instancedShader.autoCompileAndLink("shaders/pbrSphereInstanced.vert", "shaders/pbrSphere.frag");
+
+    Model model(path, camera);
+
+    InstanceBatch batch(model.getAsset());
+
+    int side = static_cast<int>(std::ceil(std::sqrt(static_cast<double>(instanceCount))));
+    constexpr float spacing = 0.25f;
+
+    batch.instances.resize(instanceCount);
+    for (int i = 0; i < instanceCount; ++i)
+    {
+        ModelInstance &instance = batch.instances[i];
+        instance.position = glm::vec3((i % side - side * 0.5f) * spacing, 0.f, -(i / side) * spacing);
+        instance.scale = glm::vec3(0.1f);
+        instance.albedo = glm::vec3(float(i % side) / side, 0.5f, float(i / side) / side);
+    }
+    batch.update();
+
+    FrameUniforms frameUniforms;
+    frameUniforms.setView(camera);
+    frameUniforms.setLights({getBenchmarkLight()});
+
+    singleShader.setVec3("material.albedo", glm::vec3(0.5f));
+    singleShader.setFloat("material.roughness", 0.5f);
+    singleShader.setFloat("material.metallic", 0.5f);
+    singleShader.setFloat("material.ao", 1.f);
+
+    glEnable(GL_DEPTH_TEST);
+
+    FrameTimes single = timeFrames(frames, [&]()
+                                   {
+        for (const ModelInstance &instance : batch.instances)
+        {
+            model.position = instance.position;
+            model.scale = instance.scale;
+            model.render(singleShader);
+        } });
+
+    FrameTimes instanced = timeFrames(frames, [&]()
+                                      { batch.render(instancedShader); });
+
+    std::cout << std::fixed << std::setprecision(2)
+              << "\nInstancing benchmark: " << path << ", " << instanceCount << " instances, " << frames << " frames\n"
+              << "  per model : " << single.cpu << " ms cpu, " << single.gpu << " ms gpu\n"
+              << "  instanced : " << instanced.cpu << " ms cpu, " << instanced.gpu << " ms gpu\n"
+              << "  speedup   : " << (instanced.cpu > 0.0 ? single.cpu / instanced.cpu : 0.0) << "x cpu, "
+              << (instanced.gpu > 0.0 ? single.gpu / instanced.gpu : 0.0) << "x gpu\n";
+}
+
+void runLodBenchmark(const char *path, Camera &camera, int instanceCount, int frames)
+{
+    MShader instancedShader;
+    instancedShader.autoCompileAndLink("shaders/pbrSphereInstanced.vert", "shaders/pbrSphere.frag");
+
+    MShader shadowShader;
+    shadowShader.autoCompileAndLink("shaders/shadowMapInstanced.vert", "shaders/shadowMap.frag");
+
+    Model model(path, camera);
+
+    InstanceBatch batch(model.getAsset());
+
+    int side = static_cast<int>(std::ceil(std::sqrt(static_cast<double>(instanceCount))));
+    constexpr float spacing = 1.f;
+
+    batch.instances.resize(instanceCount);
+    for (int i = 0; i < instanceCount; ++i)
+    {
+        ModelInstance &instance = batch.instances[i];
+        instance.position = glm::vec3((i % side - (side - 1) * 0.5f) * spacing, 0.f, (i / side - (side - 1) * 0.5f) * spacing);
+        instance.scale = glm::vec3(0.25f);
+    }
+    batch.update();
+
+    FrameUniforms frameUniforms;
+    frameUniforms.setLights({getBenchmarkLight()});
+
+    constexpr float shadowExtent = 20.f;
+    constexpr int shadowResolution = 2048;
+    glm::mat4 lightSpaceMatrix = glm::ortho(-shadowExtent * 0.5f, shadowExtent * 0.5f, -shadowExtent * 0.5f, shadowExtent * 0.5f, 0.1f, 20.f) *
+                                 glm::lookAt(glm::vec3(0.f, 10.f, 0.1f), glm::vec3(0.f), glm::vec3(0.f, 1.f, 0.f));
+    shadowShader.setMat4("lightSpaceMatrix", lightSpaceMatrix);
+
+    glEnable(GL_DEPTH_TEST);
+
+    // Orbits the grid center at 'radius', one step per frame
+    auto orbit = [&](float radius, int frame)
+    {
+        float angle = 6.2831853f * frame / frames;
+        camera.getPosition() = glm::vec3(std::cos(angle) * radius, radius * 0.3f + 0.5f, std::sin(angle) * radius);
+        camera.getView() = glm::lookAt(camera.getPosition(), glm::vec3(0.f), glm::vec3(0.f, 1.f, 0.f));
+        frameUniforms.setView(camera);
+    };
+
+    auto runPath = [&](float radius, bool lodEnabled)
+    {
+        LodRun run;
+        int frame = 0;
+        Mesh::drawnTriangles = 0;
+
+        run.times = timeFrames(frames, [&]()
+                               {
+            orbit(radius, frame++);
+            LodSelector lod = LodSelector::forCamera(camera, 1080, 1.f);
+            batch.render(instancedShader, true, lodEnabled ? &lod : nullptr); });
+
+        run.triangles = double(Mesh::drawnTriangles) / frames;
+        return run;
+    };
+
+    auto runShadow = [&](bool lodEnabled)
+    {
+        LodRun run;
+        Mesh::drawnTriangles = 0;
+
+        LodSelector lod = LodSelector::forOrthographic(shadowExtent, shadowResolution, 2.f, 1);
+        run.times = timeFrames(frames, [&]()
+                               { batch.render(shadowShader, false, lodEnabled ? &lod : nullptr); });
+
+        run.triangles = double(Mesh::drawnTriangles) / frames;
+        return run;
+    };
+
+    const float nearRadius = 1.5f;
+    const float farRadius = side * spacing * 2.f;
+
+    struct Row
+    {
+        const char *name;
+        LodRun off;
+        LodRun on;
+    };
+
+    Row rows[] = {
+        {"near", runPath(nearRadius, false), runPath(nearRadius, true)},
+        {"far", runPath(farRadius, false), runPath(farRadius, true)},
+        {"shadow", runShadow(false), runShadow(true)},
+    };
+
+    std::cout << std::fixed << std::setprecision(2)
+              << "\nLOD benchmark: " << path << ", " << instanceCount << " instances, " << frames << " frames per run\n";
+
+    std::vector<float> errors = model.getAsset()->getLodErrors();
+    for (size_t level = 0; level < errors.size(); ++level)
+    {
+        size_t triangles = 0;
+        for (const Mesh &mesh : model.getAsset()->meshes)
+            triangles += mesh.getLods()[std::min(level, mesh.getLods().size() - 1)].indexCount / 3;
+
+        std::cout << "  level " << level << " : " << triangles << " triangles, error " << std::setprecision(5) << errors[level]
+                  << std::setprecision(2) << '\n';
+    }
+
+    std::cout << "  pass      triangles (off -> on)           cpu ms (off -> on)   gpu ms (off -> on)\n";
+    for (const Row &row : rows)
+        std::cout << "  " << std::left << std::setw(8) << row.name << std::right
+                  << std::setw(14) << std::setprecision(0) << row.off.triangles << " -> " << std::setw(12) << row.on.triangles
+                  << std::setprecision(2)
+                  << std::setw(12) << row.off.times.cpu << " -> " << std::setw(6) << row.on.times.cpu
+                  << std::setw(12) << row.off.times.gpu << " -> " << std::setw(6) << row.on.times.gpu << '\n';
+}
+
+void runMultiDrawBenchmark(const char *path, const Camera &camera, int frames)
+{
+    constexpr VertexFormat format = VertexFormat::PACKED_QUANTIZED;
+    std::string multiDrawDefines = getMultiDrawDefines(format);
+
+    MShader sceneShader;
+    sceneShader.autoCompileAndLink("shaders/common.vert", "shaders/sponzaScene.frag", getVertexFormatDefines(format));
+
+    MShader sceneMultiDrawShader;
+    sceneMultiDrawShader.autoCompileAndLink("shaders/common.vert", "shaders/sponzaScene.frag", multiDrawDefines.c_str());
+
+    MShader shadowShader;
+    shadowShader.autoCompileAndLink("shaders/shadowMap.vert", "shaders/shadowMap.frag");
+
+    MShader shadowMultiDrawShader;
+    shadowMultiDrawShader.autoCompileAndLink("shaders/shadowMap.vert", "shaders/shadowMap.frag", multiDrawDefines.c_str());
+
+    Model model(path, camera, false, format);
+    // Sponza's root node already scales by 0.008
+    model.scale = glm::vec3(0.625f);
+
+    MultiDrawBatch shadowDraws(model, false);
+    MultiDrawBatch sceneDraws(model, true);
+
+    glm::mat4 lightSpaceMatrix = glm::ortho(-10.f, 10.f, -10.f, 10.f, 0.1f, 20.f) *
+                                 glm::lookAt(glm::vec3(0.f, 10.f, 0.1f), glm::vec3(0.f), glm::vec3(0.f, 1.f, 0.f));
+    shadowShader.setMat4("lightSpaceMatrix", lightSpaceMatrix);
+    shadowMultiDrawShader.setMat4("lightSpaceMatrix", lightSpaceMatrix);
+
+    FrameUniforms frameUniforms;
+    frameUniforms.setView(camera);
+
+    // The scene shader reads the cascades, the shadow pass here stays a single unlayered map
+    ShadowCascades cascades(1024);
+    cascades.update(camera, glm::vec3(0.f, -1.f, -0.01f));
+
+    glEnable(GL_DEPTH_TEST);
+
+    FrameTimes shadowSingle = timeFrames(frames, [&]()
+                                         {
+        shadowShader.setMat4("model", model.getModel());
+        model.render(shadowShader, false); });
+
+    FrameTimes shadowMulti = timeFrames(frames, [&]()
+                                        { shadowDraws.render(shadowMultiDrawShader); });
+
+    FrameTimes mainSingle = timeFrames(frames, [&]()
+                                       { model.render(sceneShader); });
+
+    FrameTimes mainMulti = timeFrames(frames, [&]()
+                                      { sceneDraws.render(sceneMultiDrawShader); });
+
+    std::cout << std::fixed << std::setprecision(3)
+              << "\nMulti-draw benchmark: " << path << ", " << model.getAsset()->meshes.size() << " meshes, " << frames << " frames\n"
+              << "  shadow pass : " << shadowSingle.cpu << " -> " << shadowMulti.cpu << " ms cpu, "
+              << shadowSingle.gpu << " -> " << shadowMulti.gpu << " ms gpu (" << shadowDraws.getGroupCount() << " multi draws)\n"
+              << "  main pass   : " << mainSingle.cpu << " -> " << mainMulti.cpu << " ms cpu, "
+              << mainSingle.gpu << " -> " << mainMulti.gpu << " ms gpu (" << sceneDraws.getGroupCount() << " multi draws)\n";
+}
+
+MemoryUsage getMemoryUsage()
+{
+    MemoryUsage usage;
+
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    {
+        usage.current = counters.WorkingSetSize;
+        usage.peak = counters.PeakWorkingSetSize;
+    }
+#else
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line))
+    {
+        // Values are reported in kB
+        if (line.rfind("VmRSS:", 0) == 0)
+            usage.current = std::stoull(line.substr(6)) * 1024;
+        else if (line.rfind("VmHWM:", 0) == 0)
+            usage.peak = std::stoull(line.substr(6)) * 1024;
+    }
+#endif
+
+    return usage;
+}
+
+void runMemoryReport(const char *path, const Camera &camera, VertexFormat format)
+{
+    MemoryUsage before = getMemoryUsage();
+
+    size_t gpuBytes, cpuBytes, textureBytes;
+    MemoryUsage loaded;
+    {
+        Model model(path, camera, false, format);
+        glFinish();
+
+        loaded = getMemoryUsage();
+        gpuBytes = model.getAsset()->getGeometryBytes();
+        cpuBytes = model.getAsset()->getCpuBytes();
+        textureBytes = ResourceCache::get().getStats().residentTextureBytes;
+    }
+    glFinish();
+
+    MemoryUsage after = getMemoryUsage();
+
+    std::cout << std::fixed << std::setprecision(2)
+              << "\nMemory report: " << path << (Mesh::retainCpuGeometry ? " (CPU geometry retained)" : "") << '\n'
+              << "  rss before load : " << toMB(before.current) << " MB\n"
+              << "  rss loaded      : " << toMB(loaded.current) << " MB (+" << toMB(loaded.current - before.current) << " MB)\n"
+              << "  rss peak        : " << toMB(loaded.peak) << " MB (+" << toMB(loaded.peak - before.current) << " MB)\n"
+              << "  rss released    : " << toMB(after.current) << " MB\n"
+              << "  gpu geometry    : " << toMB(gpuBytes) << " MB\n"
+              << "  gpu textures    : " << toMB(textureBytes) << " MB (" << (TextureCache::enabled ? "block compressed" : "uncompressed") << ")\n"
+              << "  cpu geometry    : " << toMB(cpuBytes) << " MB\n"
+              << "  vertex stride   : " << VertexLayout{format}.getStride() << " bytes (" << sizeof(MVertex) << " unpacked)\n";
+}
+
+void runTextureCook(const char *path)
+{
+    struct CookResult
+    {
+        std::string path;
+        DecodedImage image;
+        bool current = false;
+        double time = 0.0;
+    };
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<ImportedMesh> imported;
+    std::vector<SceneNode> nodes;
+    Model::importModel(path, imported, nodes);
+
+    // Keyed by full path, the first material slot decides the format like it does in the ResourceCache
+    std::string source = path;
+    std::string directory = source.substr(0, source.find_last_of('/'));
+    std::map<std::string, std::string> textures;
+    for (const ImportedMesh &mesh : imported)
+        for (const TextureRef &texture : mesh.textures)
+            textures.emplace(directory + '/' + texture.path, texture.type);
+
+    std::vector<std::future<CookResult>> cooks;
+    for (const auto &[texturePath, type] : textures)
+        cooks.push_back(ThreadPool::getShared().submit([texturePath = texturePath, type = type]()
+                                                       {
+            CookResult result;
+            result.path = texturePath;
+
+            auto cookStart = std::chrono::steady_clock::now();
+            result.current = TextureCache::load(texturePath, type, true, result.image);
+            if (!result.current && cookTexture(texturePath, type, true, result.image) &&
+                !TextureCache::write(texturePath, type, true, result.image))
+                std::cout << "Failed to write texture cache for " << texturePath << '\n';
+
+            result.time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - cookStart).count();
+            return result; }));
+
+    size_t compressedBytes = 0, rawBytes = 0, cooked = 0;
+
+    std::cout << std::fixed << std::setprecision(2)
+              << "\nTexture cook: " << path << '\n'
+              << std::setw(8) << "format" << std::setw(12) << "size" << std::setw(10) << "MB" << std::setw(12) << "ms" << "  path\n";
+
+    for (std::future<CookResult> &cook : cooks)
+    {
+        CookResult result = cook.get();
+        if (!result.image.isValid())
+        {
+            std::cout << std::setw(8) << "failed" << std::setw(34) << ' ' << "  " << result.path << '\n';
+            continue;
+        }
+
+        std::string size = std::to_string(result.image.width) + "x" + std::to_string(result.image.height);
+        std::cout << std::setw(8) << getCodecName(result.image.codec) << std::setw(12) << size
+                  << std::setw(10) << toMB(getTextureBytes(result.image)) << std::setw(12) << result.time
+                  << "  " << result.path << (result.current ? " (current)" : "") << '\n';
+
+        compressedBytes += getTextureBytes(result.image);
+        rawBytes += getTextureBytes(result.image.width, result.image.height, 4);
+        cooked += result.current ? 0 : 1;
+    }
+
+    double time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << textures.size() << " textures, " << cooked << " cooked, " << toMB(compressedBytes) << " MB compressed vs "
+              << toMB(rawBytes) << " MB as RGBA8 (" << (compressedBytes > 0 ? double(rawBytes) / compressedBytes : 0.0) << "x), "
+              << time << " ms\n";
+}
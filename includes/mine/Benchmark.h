@@ -0,0 +1,41 @@
+#ifndef __BENCHMARK_H__
+#define __BENCHMARK_H__
+#include "VertexFormat.h"
+#include <cstddef>
+
+class Camera;
+
+struct MemoryUsage
+{
+    size_t current = 0;
+    size_t peak = 0;
+};
+
+// Resident set size of the process, zero where the platform gives no way to query it
+MemoryUsage getMemoryUsage();
+
+// Imports the model once without a cooked cache, then reloads it from the cache and prints both timings. At least one warm run
+void runLoaderBenchmark(const char *path, const Camera &camera, int warmRuns = 3);
+
+// Draws a grid of copies of the model once per instance with Model::render and once with an InstanceBatch,
+// then prints the CPU submit and GPU times of both
+void runInstancingBenchmark(const char *path, const Camera &camera, int instanceCount = 10000, int frames = 20);
+
+// Draws a grid of instances along a near and a far camera orbit with and without LOD selection,
+// plus a shadow map pass with the coarser shadow policy, and prints triangles and frame times of each.
+// Moves the camera, it is left at the last position of the far orbit
+void runLodBenchmark(const char *path, Camera &camera, int instanceCount = 400, int frames = 60);
+
+// Renders the model's shadow and main passes once per mesh with Model::render and once with glMultiDrawElementsIndirect,
+// then prints the CPU submit and GPU times of every pass
+void runMultiDrawBenchmark(const char *path, const Camera &camera, int frames = 60);
+
+// Loads the model and prints the resident set size before, during (peak) and after loading,
+// together with the geometry and textures kept on the GPU, the geometry kept in system memory and the vertex stride of the format
+void runMemoryReport(const char *path, const Camera &camera, VertexFormat format = VertexFormat::FULL);
+
+// Cooks the block compressed cache of every texture the model references (skipping those already current)
+// and prints the format and size of each against uncompressed RGBA8. Needs no GL context
+void runTextureCook(const char *path);
+
+#endif // __BENCHMARK_H__
@@ -0,0 +1,499 @@
+#include "BlockCompression.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+    typedef float BlockTexels[16][4];
+
+    void loadTexels(const uint8_t *texels, BlockTexels &data, float *mean, int channels)
+    {
+        std::fill(mean, mean + 4, 0.f);
+
+        for (int i = 0; i < 16; ++i)
+            for (int c = 0; c < 4; ++c)
+            {
+                data[i][c] = texels[i * 4 + c];
+                mean[c] += data[i][c] / 16.f;
+            }
+
+        for (int c = channels; c < 4; ++c)
+            mean[c] = 0.f;
+    }
+
+    // Direction of the largest variance over the first 'channels' channels, zero for blocks of a single colour
+    void principalAxis(const BlockTexels &data, const float *mean, int channels, float *axis)
+    {
+        float covariance[4][4] = {};
+        for (int i = 0; i < 16; ++i)
+            for (int a = 0; a < channels; ++a)
+                for (int b = 0; b < channels; ++b)
+                    covariance[a][b] += (data[i][a] - mean[a]) * (data[i][b] - mean[b]);
+
+        // Power iteration, started from the row of the channel that varies most
+        int largest = 0;
+        for (int c = 1; c < channels; ++c)
+            if (covariance[c][c] > covariance[largest][largest])
+                largest = c;
+
+        std::fill(axis, axis + 4, 0.f);
+        for (int c = 0; c < channels; ++c)
+            axis[c] = covariance[largest][c];
+
+        for (int iteration = 0; iteration < 8; ++iteration)
+        {
+            float next[4] = {};
+            for (int a = 0; a < channels; ++a)
+                for (int b = 0; b < channels; ++b)
+                    next[a] += covariance[a][b] * axis[b];
+
+            float length = 0.f;
+            for (int c = 0; c < channels; ++c)
+                length += next[c] * next[c];
+
+            if (length < 1e-12f)
+            {
+                std::fill(axis, axis + 4, 0.f);
+                return;
+            }
+
+            length = std::sqrt(length);
+            for (int c = 0; c < channels; ++c)
+                axis[c] = next[c] / length;
+        }
+    }
+
+    // Ends of the texels' projection onto 'axis', pulled in by 'inset' of the range
+    void axisEndpoints(const BlockTexels &data, const float *mean, const float *axis, int channels, float inset, float *low, float *high)
+    {
+        float minimum = FLT_MAX, maximum = -FLT_MAX;
+        for (int i = 0; i < 16; ++i)
+        {
+            float t = 0.f;
+            for (int c = 0; c < channels; ++c)
+                t += (data[i][c] - mean[c]) * axis[c];
+
+            minimum = std::min(minimum, t);
+            maximum = std::max(maximum, t);
+        }
+
+        float range = (maximum - minimum) * inset;
+        minimum += range;
+        maximum -= range;
+
+        for (int c = 0; c < 4; ++c)
+        {
+            low[c] = std::clamp(mean[c] + axis[c] * minimum, 0.f, 255.f);
+            high[c] = std::clamp(mean[c] + axis[c] * maximum, 0.f, 255.f);
+        }
+    }
+
+    // Endpoints minimizing the squared error for fixed interpolation weights (the weight of 'first' per texel)
+    bool leastSquaresEndpoints(const BlockTexels &data, const float *weights, int channels, float *first, float *second)
+    {
+        float aa = 0.f, ab = 0.f, bb = 0.f;
+        float ax[4] = {}, bx[4] = {};
+
+        for (int i = 0; i < 16; ++i)
+        {
+            float a = weights[i];
+            float b = 1.f - a;
+            aa += a * a;
+            ab += a * b;
+            bb += b * b;
+
+            for (int c = 0; c < channels; ++c)
+            {
+                ax[c] += a * data[i][c];
+                bx[c] += b * data[i][c];
+            }
+        }
+
+        float determinant = aa * bb - ab * ab;
+        if (std::fabs(determinant) < 1e-6f)
+            return false;
+
+        for (int c = 0; c < channels; ++c)
+        {
+            first[c] = std::clamp((ax[c] * bb - bx[c] * ab) / determinant, 0.f, 255.f);
+            second[c] = std::clamp((bx[c] * aa - ax[c] * ab) / determinant, 0.f, 255.f);
+        }
+        return true;
+    }
+
+    uint16_t packColor565(const float *color)
+    {
+        int r = std::clamp(int(color[0] * 31.f / 255.f + 0.5f), 0, 31);
+        int g = std::clamp(int(color[1] * 63.f / 255.f + 0.5f), 0, 63);
+        int b = std::clamp(int(color[2] * 31.f / 255.f + 0.5f), 0, 31);
+        return static_cast<uint16_t>(r << 11 | g << 5 | b);
+    }
+
+    void unpackColor565(uint16_t color, int *rgb)
+    {
+        int r = color >> 11, g = (color >> 5) & 63, b = color & 31;
+        rgb[0] = r << 3 | r >> 2;
+        rgb[1] = g << 2 | g >> 4;
+        rgb[2] = b << 3 | b >> 2;
+    }
+
+    // Nearest entry of the four colour palette for every texel, returns the squared error
+    float fitColorIndices(const BlockTexels &data, uint16_t color0, uint16_t color1, uint32_t &indices)
+    {
+        int palette[4][3];
+        unpackColor565(color0, palette[0]);
+        unpackColor565(color1, palette[1]);
+        for (int c = 0; c < 3; ++c)
+        {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+
+        indices = 0;
+        float error = 0.f;
+        for (int i = 0; i < 16; ++i)
+        {
+            float best = FLT_MAX;
+            uint32_t bestIndex = 0;
+            for (uint32_t p = 0; p < 4; ++p)
+            {
+                float distance = 0.f;
+                for (int c = 0; c < 3; ++c)
+                    distance += (data[i][c] - palette[p][c]) * (data[i][c] - palette[p][c]);
+
+                if (distance < best)
+                {
+                    best = distance;
+                    bestIndex = p;
+                }
+            }
+
+            indices |= bestIndex << (2 * i);
+            error += best;
+        }
+        return error;
+    }
+
+    // Four colour block shared by BC1 and BC3, colour0 > colour1 selects the opaque mode
+    float encodeColorBlock(const uint8_t *texels, uint8_t *block)
+    {
+        static const float paletteWeights[4] = {1.f, 0.f, 2.f / 3.f, 1.f / 3.f};
+
+        BlockTexels data;
+        float mean[4], axis[4], low[4], high[4];
+        loadTexels(texels, data, mean, 3);
+        principalAxis(data, mean, 3, axis);
+        axisEndpoints(data, mean, axis, 3, 1.f / 16.f, low, high);
+
+        uint16_t color0 = packColor565(high), color1 = packColor565(low);
+        uint32_t indices;
+        float error = fitColorIndices(data, color0, color1, indices);
+
+        for (int iteration = 0; iteration < 2 && error > 0.f; ++iteration)
+        {
+            float weights[16];
+            for (int i = 0; i < 16; ++i)
+                weights[i] = paletteWeights[(indices >> (2 * i)) & 3];
+
+            if (!leastSquaresEndpoints(data, weights, 3, high, low))
+                break;
+
+            uint16_t fitted0 = packColor565(high), fitted1 = packColor565(low);
+            uint32_t fittedIndices;
+            float fittedError = fitColorIndices(data, fitted0, fitted1, fittedIndices);
+            if (fittedError >= error)
+                break;
+
+            color0 = fitted0;
+            color1 = fitted1;
+            indices = fittedIndices;
+            error = fittedError;
+        }
+
+        if (color0 < color1)
+        {
+            // Swapping the endpoints swaps index 0 with 1 and 2 with 3
+            std::swap(color0, color1);
+            indices ^= 0x55555555u;
+        }
+        else if (color0 == color1)
+            indices = 0;
+
+        block[0] = color0 & 0xFF;
+        block[1] = color0 >> 8;
+        block[2] = color1 & 0xFF;
+        block[3] = color1 >> 8;
+        for (int b = 0; b < 4; ++b)
+            block[4 + b] = (indices >> (8 * b)) & 0xFF;
+
+        return error;
+    }
+
+    class BitWriter
+    {
+        uint8_t *block;
+        int position;
+
+    public:
+        BitWriter(uint8_t *block, size_t size) : block(block), position(0)
+        {
+            std::memset(block, 0, size);
+        }
+
+        void write(uint32_t value, int bits)
+        {
+            for (int b = 0; b < bits; ++b, ++position)
+                if (value >> b & 1)
+                    block[position >> 3] |= uint8_t(1 << (position & 7));
+        }
+    };
+
+    const int bc7Weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+    // 7 bit endpoint plus the p-bit shared by its four channels
+    struct Bc7Endpoint
+    {
+        int quantized[4];
+        int pbit;
+        int value[4];
+    };
+
+    Bc7Endpoint quantizeBC7Endpoint(const float *color)
+    {
+        Bc7Endpoint best{};
+        float bestError = FLT_MAX;
+
+        for (int pbit = 0; pbit < 2; ++pbit)
+        {
+            Bc7Endpoint endpoint{};
+            endpoint.pbit = pbit;
+
+            float error = 0.f;
+            for (int c = 0; c < 4; ++c)
+            {
+                endpoint.quantized[c] = std::clamp(int((color[c] - pbit) / 2.f + 0.5f), 0, 127);
+                endpoint.value[c] = endpoint.quantized[c] << 1 | pbit;
+                error += (endpoint.value[c] - color[c]) * (endpoint.value[c] - color[c]);
+            }
+
+            if (error < bestError)
+            {
+                bestError = error;
+                best = endpoint;
+            }
+        }
+        return best;
+    }
+
+    float fitBC7Indices(const BlockTexels &data, const Bc7Endpoint &first, const Bc7Endpoint &second, int *indices)
+    {
+        int palette[16][4];
+        for (int p = 0; p < 16; ++p)
+            for (int c = 0; c < 4; ++c)
+                palette[p][c] = ((64 - bc7Weights[p]) * first.value[c] + bc7Weights[p] * second.value[c] + 32) >> 6;
+
+        float error = 0.f;
+        for (int i = 0; i < 16; ++i)
+        {
+            float best = FLT_MAX;
+            for (int p = 0; p < 16; ++p)
+            {
+                float distance = 0.f;
+                for (int c = 0; c < 4; ++c)
+                    distance += (data[i][c] - palette[p][c]) * (data[i][c] - palette[p][c]);
+
+                if (distance < best)
+                {
+                    best = distance;
+                    indices[i] = p;
+                }
+            }
+            error += best;
+        }
+        return error;
+    }
+}
+
+const char *getCodecName(TextureCodec codec)
+{
+    switch (codec)
+    {
+    case TextureCodec::BC1:
+        return "BC1";
+    case TextureCodec::BC3:
+        return "BC3";
+    case TextureCodec::BC4:
+        return "BC4";
+    case TextureCodec::BC5:
+        return "BC5";
+    default:
+        return "BC7";
+    }
+}
+
+size_t getBlockBytes(TextureCodec codec)
+{
+    return codec == TextureCodec::BC1 || codec == TextureCodec::BC4 ? 8 : 16;
+}
+
+size_t getCompressedSize(TextureCodec codec, int width, int height)
+{
+    return size_t((width + 3) / 4) * ((height + 3) / 4) * getBlockBytes(codec);
+}
+
+float encodeBC1(const uint8_t *texels, uint8_t *block)
+{
+    return encodeColorBlock(texels, block);
+}
+
+float encodeBC3(const uint8_t *texels, uint8_t *block)
+{
+    return encodeBC4(texels, 3, block) + encodeColorBlock(texels, block + 8);
+}
+
+float encodeBC4(const uint8_t *texels, int channel, uint8_t *block)
+{
+    int minimum = 255, maximum = 0;
+    for (int i = 0; i < 16; ++i)
+    {
+        minimum = std::min<int>(minimum, texels[i * 4 + channel]);
+        maximum = std::max<int>(maximum, texels[i * 4 + channel]);
+    }
+
+    // value0 > value1 selects the mode with six interpolated values
+    block[0] = static_cast<uint8_t>(maximum);
+    block[1] = static_cast<uint8_t>(minimum);
+
+    uint64_t indices = 0;
+    float error = 0.f;
+    if (maximum > minimum)
+    {
+        int palette[8] = {maximum, minimum};
+        for (int k = 2; k < 8; ++k)
+            palette[k] = ((8 - k) * maximum + (k - 1) * minimum + 3) / 7;
+
+        for (int i = 0; i < 16; ++i)
+        {
+            int value = texels[i * 4 + channel];
+            int best = 0;
+            for (int k = 1; k < 8; ++k)
+                if (std::abs(value - palette[k]) < std::abs(value - palette[best]))
+                    best = k;
+
+            indices |= uint64_t(best) << (3 * i);
+            error += float((value - palette[best]) * (value - palette[best]));
+        }
+    }
+
+    for (int b = 0; b < 6; ++b)
+        block[2 + b] = (indices >> (8 * b)) & 0xFF;
+
+    return error;
+}
+
+float encodeBC5(const uint8_t *texels, uint8_t *block)
+{
+    return encodeBC4(texels, 0, block) + encodeBC4(texels, 1, block + 8);
+}
+
+float encodeBC7(const uint8_t *texels, uint8_t *block)
+{
+    BlockTexels data;
+    float mean[4], axis[4], low[4], high[4];
+    loadTexels(texels, data, mean, 4);
+    principalAxis(data, mean, 4, axis);
+    axisEndpoints(data, mean, axis, 4, 0.f, low, high);
+
+    Bc7Endpoint first = quantizeBC7Endpoint(low), second = quantizeBC7Endpoint(high);
+    int indices[16];
+    float error = fitBC7Indices(data, first, second, indices);
+
+    for (int iteration = 0; iteration < 2 && error > 0.f; ++iteration)
+    {
+        float weights[16];
+        for (int i = 0; i < 16; ++i)
+            weights[i] = 1.f - bc7Weights[indices[i]] / 64.f;
+
+        if (!leastSquaresEndpoints(data, weights, 4, low, high))
+            break;
+
+        Bc7Endpoint fittedFirst = quantizeBC7Endpoint(low), fittedSecond = quantizeBC7Endpoint(high);
+        int fittedIndices[16];
+        float fittedError = fitBC7Indices(data, fittedFirst, fittedSecond, fittedIndices);
+        if (fittedError >= error)
+            break;
+
+        first = fittedFirst;
+        second = fittedSecond;
+        std::copy(fittedIndices, fittedIndices + 16, indices);
+        error = fittedError;
+    }
+
+    // The first texel's index is stored without its top bit, so it has to be below 8
+    if (indices[0] >= 8)
+    {
+        std::swap(first, second);
+        for (int &index : indices)
+            index = 15 - index;
+    }
+
+    BitWriter writer(block, 16);
+    writer.write(1 << 6, 7);
+    for (int c = 0; c < 4; ++c)
+    {
+        writer.write(first.quantized[c], 7);
+        writer.write(second.quantized[c], 7);
+    }
+    writer.write(first.pbit, 1);
+    writer.write(second.pbit, 1);
+
+    writer.write(indices[0], 3);
+    for (int i = 1; i < 16; ++i)
+        writer.write(indices[i], 4);
+
+    return error;
+}
+
+double compressImage(TextureCodec codec, const uint8_t *rgba, int width, int height, uint8_t *output)
+{
+    size_t blockBytes = getBlockBytes(codec);
+    uint8_t texels[64];
+    double error = 0.0;
+
+    for (int blockY = 0; blockY < height; blockY += 4)
+        for (int blockX = 0; blockX < width; blockX += 4)
+        {
+            for (int y = 0; y < 4; ++y)
+                for (int x = 0; x < 4; ++x)
+                {
+                    int sourceX = std::min(blockX + x, width - 1);
+                    int sourceY = std::min(blockY + y, height - 1);
+                    std::memcpy(texels + (y * 4 + x) * 4, rgba + (size_t(sourceY) * width + sourceX) * 4, 4);
+                }
+
+            switch (codec)
+            {
+            case TextureCodec::BC1:
+                error += encodeBC1(texels, output);
+                break;
+            case TextureCodec::BC3:
+                error += encodeBC3(texels, output);
+                break;
+            case TextureCodec::BC4:
+                error += encodeBC4(texels, 0, output);
+                break;
+            case TextureCodec::BC5:
+                error += encodeBC5(texels, output);
+                break;
+            case TextureCodec::BC7:
+                error += encodeBC7(texels, output);
+                break;
+            }
+
+            output += blockBytes;
+        }
+
+    return error;
+}
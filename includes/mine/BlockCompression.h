@@ -0,0 +1,46 @@
+#ifndef __BLOCKCOMPRESSION_H__
+#define __BLOCKCOMPRESSION_H__
+#include <cstddef>
+#include <cstdint>
+
+// Block compressed texture formats, every 4x4 texel block is stored in 8 (BC1, BC4) or 16 bytes
+enum class TextureCodec : uint32_t
+{
+    // RGB, opaque
+    BC1,
+    // RGB plus a separately coded alpha channel
+    BC3,
+    // One channel, sampled through a red swizzle
+    BC4,
+    // Two channels, used for tangent space normals (z is rebuilt in the shader)
+    BC5,
+    // RGBA, higher quality than BC3 for colour with alpha
+    BC7
+};
+
+const char *getCodecName(TextureCodec codec);
+
+size_t getBlockBytes(TextureCodec codec);
+
+// Bytes of one level of 'width' x 'height' texels, partial blocks count as whole ones
+size_t getCompressedSize(TextureCodec codec, int width, int height);
+
+// Single block encoders, 'texels' is a 4x4 block of RGBA8 texels in row major order.
+// Each returns the squared error of the encoded channels
+float encodeBC1(const uint8_t *texels, uint8_t *block);
+
+float encodeBC3(const uint8_t *texels, uint8_t *block);
+
+// Encodes only 'channel' of the texels
+float encodeBC4(const uint8_t *texels, int channel, uint8_t *block);
+
+float encodeBC5(const uint8_t *texels, uint8_t *block);
+
+// Uses mode 6 only (one subset, 7 bit endpoints with a p-bit, 4 bit indices), which suits smooth colour and alpha
+float encodeBC7(const uint8_t *texels, uint8_t *block);
+
+// Encodes a whole RGBA8 image into 'output' (getCompressedSize bytes), edge texels are repeated to fill partial blocks.
+// Returns the summed squared error
+double compressImage(TextureCodec codec, const uint8_t *rgba, int width, int height, uint8_t *output);
+
+#endif // __BLOCKCOMPRESSION_H__
@@ -0,0 +1,107 @@
+#include "FrameUniforms.h"
+#include <algorithm>
+#include <cstring>
+
+unsigned long long FrameUniforms::lightBytesWritten = 0;
+
+FrameUniforms::FrameUniforms() : view{}, lightCapacity(0), viewWritten(false)
+{
+    // Zeroed until the first update, no lights
+    glGenBuffers(1, &viewBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, viewBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(ViewBlock), &view, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    LightsHeader header{};
+    glGenBuffers(1, &lightsBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, lightsBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(LightsHeader), &header, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    glBindBufferBase(GL_UNIFORM_BUFFER, viewBindingPoint, viewBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, lightsBindingPoint, lightsBuffer);
+}
+
+void FrameUniforms::setView(const Camera &camera)
+{
+    ViewBlock block{};
+    block.view = camera.getView();
+    block.projection = camera.getProjection();
+    block.position = glm::vec4(camera.getPosition(), 1.f);
+
+    if (viewWritten && std::memcmp(&block, &view, sizeof(block)) == 0)
+        return;
+
+    view = block;
+    viewWritten = true;
+    glBindBuffer(GL_UNIFORM_BUFFER, viewBuffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(ViewBlock), &view);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void FrameUniforms::uploadLights(size_t first, size_t last)
+{
+    size_t bytes = (last - first) * sizeof(LightData);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(LightsHeader) + first * sizeof(LightData), bytes, lights.data() + first);
+    lightBytesWritten += bytes;
+}
+
+void FrameUniforms::setLights(const std::vector<LightData> &lights)
+{
+    bool countChanged = lights.size() != this->lights.size();
+    bool grown = lights.size() > lightCapacity;
+
+    // Compared before the copy is overwritten, lights past the old count are always new
+    size_t first = lights.size(), last = 0;
+    if (!grown)
+    {
+        size_t common = std::min(lights.size(), this->lights.size());
+        for (size_t i = 0; i < common; ++i)
+            if (std::memcmp(&lights[i], &this->lights[i], sizeof(LightData)) != 0)
+            {
+                first = std::min(first, i);
+                last = i + 1;
+            }
+        if (lights.size() > common)
+        {
+            first = std::min(first, common);
+            last = lights.size();
+        }
+    }
+
+    if (!grown && !countChanged && first >= last)
+        return;
+
+    // Copy assignment keeps the capacity, no allocation once the light count settles
+    this->lights = lights;
+
+    LightsHeader header{};
+    header.lightCount = static_cast<int32_t>(lights.size());
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, lightsBuffer);
+
+    if (grown)
+    {
+        // Room for twice as many, so adding lights one by one doesn't reallocate each time
+        lightCapacity = std::max<size_t>(lights.size(), lightCapacity * 2);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(LightsHeader) + lightCapacity * sizeof(LightData), nullptr, GL_DYNAMIC_DRAW);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(LightsHeader), &header);
+        uploadLights(0, lights.size());
+    }
+    else
+    {
+        // Removed lights stay in the buffer past lightCount
+        if (countChanged)
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(LightsHeader), &header);
+        if (first < last)
+            uploadLights(first, last);
+    }
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+FrameUniforms::~FrameUniforms()
+{
+    glDeleteBuffers(1, &viewBuffer);
+    glDeleteBuffers(1, &lightsBuffer);
+}
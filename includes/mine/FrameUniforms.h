@@ -0,0 +1,90 @@
+#ifndef __FRAMEUNIFORMS_H__
+#define __FRAMEUNIFORMS_H__
+#include "../GL/glad.h"
+#include "Camera.h"
+#include "../glm/glm.hpp"
+#include <cstdint>
+#include <vector>
+
+// Mirror of the std140 View block, 'camera' in the shaders
+struct ViewBlock
+{
+    glm::mat4 view;
+    glm::mat4 projection;
+    // xyz used
+    glm::vec4 position;
+};
+
+// Mirror of the std430 Light struct, the vec3s share their 16 bytes with the scalar after them
+struct LightData
+{
+    glm::vec3 position;
+    float constant;
+    glm::vec3 direction;
+    float linear;
+    glm::vec3 ambient;
+    float quadratic;
+    glm::vec3 diffuse;
+    float cutoff;
+    glm::vec3 specular;
+    int32_t type;
+    glm::vec3 color;
+    float padding;
+};
+
+// Start of the std430 Lights buffer, the unsized light array follows at the struct's 16 byte alignment
+struct LightsHeader
+{
+    int32_t lightCount;
+    int32_t padding[3];
+};
+
+static_assert(sizeof(ViewBlock) == 144, "ViewBlock must match the std140 layout of the shaders");
+static_assert(sizeof(LightData) == 96, "LightData must match the std430 layout of the shaders");
+static_assert(sizeof(LightsHeader) == 16, "LightsHeader must match the std430 layout of the shaders");
+
+// The buffers shared by every scene shader: a uniform block with the camera of the view being drawn and a storage
+// buffer with every light. Both are bound to their fixed binding points when the object is created.
+// The view is replaced whole and skipped when unchanged, the lights only rewrite the span that differs from the
+// last upload, the storage grows when more lights come in than it holds
+class FrameUniforms
+{
+    unsigned int viewBuffer, lightsBuffer;
+
+    ViewBlock view;
+
+    // What the light buffer holds, compared against on every update
+    std::vector<LightData> lights;
+
+    size_t lightCapacity;
+
+    bool viewWritten;
+
+    // Writes lights [first, last) from the cached copy, the buffer has to be bound
+    void uploadLights(size_t first, size_t last);
+
+public:
+    static constexpr unsigned int viewBindingPoint = 0;
+
+    // Storage buffer binding, 1 to 4 are taken by the instance and multi draw buffers
+    static constexpr unsigned int lightsBindingPoint = 5;
+
+    // Bytes written to the light buffer since the counter was last reset
+    static unsigned long long lightBytesWritten;
+
+    FrameUniforms();
+
+    FrameUniforms(const FrameUniforms &) = delete;
+
+    FrameUniforms &operator=(const FrameUniforms &) = delete;
+
+    // Per view, before the passes that draw with the camera
+    void setView(const Camera &camera);
+
+    // Per frame, any count
+    void setLights(const std::vector<LightData> &lights);
+
+    ~FrameUniforms();
+};
+
+#endif // __FRAMEUNIFORMS_H__
@@ -0,0 +1,144 @@
+#include "Frustum.h"
+#include <algorithm>
+#include <stdexcept>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FRUSTUM_SSE
+#endif
+
+void SphereSet::clear()
+{
+    x.clear();
+    y.clear();
+    z.clear();
+    radius.clear();
+}
+
+void SphereSet::push(const glm::vec3 &center, float radius)
+{
+    x.push_back(center.x);
+    y.push_back(center.y);
+    z.push_back(center.z);
+    this->radius.push_back(radius);
+}
+
+size_t SphereSet::size() const
+{
+    return x.size();
+}
+
+Frustum::Frustum() : planeCount(0)
+{
+}
+
+Frustum Frustum::fromMatrix(const glm::mat4 &viewProjection)
+{
+    // Rows of the matrix, glm stores columns
+    glm::vec4 rows[4];
+    for (int row = 0; row < 4; ++row)
+        rows[row] = glm::vec4(viewProjection[0][row], viewProjection[1][row], viewProjection[2][row], viewProjection[3][row]);
+
+    Frustum frustum;
+    frustum.planeCount = 6;
+    frustum.planes[0] = rows[3] + rows[0];
+    frustum.planes[1] = rows[3] - rows[0];
+    frustum.planes[2] = rows[3] + rows[1];
+    frustum.planes[3] = rows[3] - rows[1];
+    frustum.planes[4] = rows[3] + rows[2];
+    frustum.planes[5] = rows[3] - rows[2];
+
+    // Unit normals, so a plane's value at a point is the distance to it
+    for (int plane = 0; plane < frustum.planeCount; ++plane)
+        frustum.planes[plane] /= glm::length(glm::vec3(frustum.planes[plane]));
+
+    return frustum;
+}
+
+Frustum Frustum::fromCamera(const Camera &camera)
+{
+    return fromMatrix(camera.getProjection() * camera.getView());
+}
+
+int Frustum::getPlaneCount() const
+{
+    return planeCount;
+}
+
+const glm::vec4 &Frustum::getPlane(int plane) const
+{
+    return planes[plane];
+}
+
+Frustum Frustum::intersect(const Frustum &other) const
+{
+    if (planeCount + other.planeCount > maxPlanes)
+        throw std::runtime_error("Too many frustum planes");
+
+    Frustum result = *this;
+    for (int plane = 0; plane < other.planeCount; ++plane)
+        result.planes[result.planeCount++] = other.planes[plane];
+
+    return result;
+}
+
+Frustum Frustum::extrude(const glm::vec3 &sweep) const
+{
+    // Along the sweep the distance to a plane changes linearly, so its largest value is at one of the two ends
+    Frustum result = *this;
+    for (int plane = 0; plane < planeCount; ++plane)
+        result.planes[plane].w += std::max(0.f, glm::dot(glm::vec3(planes[plane]), sweep));
+
+    return result;
+}
+
+bool Frustum::intersectsSphere(const glm::vec3 &center, float radius) const
+{
+    for (int plane = 0; plane < planeCount; ++plane)
+        if (glm::dot(glm::vec3(planes[plane]), center) + planes[plane].w < -radius)
+            return false;
+
+    return true;
+}
+
+void Frustum::cullSpheres(const SphereSet &spheres, std::vector<uint8_t> &visible) const
+{
+    size_t count = spheres.size();
+    visible.resize(count);
+
+    size_t i = 0;
+#ifdef FRUSTUM_SSE
+    __m128 planeX[maxPlanes], planeY[maxPlanes], planeZ[maxPlanes], planeW[maxPlanes];
+    for (int plane = 0; plane < planeCount; ++plane)
+    {
+        planeX[plane] = _mm_set1_ps(planes[plane].x);
+        planeY[plane] = _mm_set1_ps(planes[plane].y);
+        planeZ[plane] = _mm_set1_ps(planes[plane].z);
+        planeW[plane] = _mm_set1_ps(planes[plane].w);
+    }
+
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 x = _mm_loadu_ps(&spheres.x[i]);
+        __m128 y = _mm_loadu_ps(&spheres.y[i]);
+        __m128 z = _mm_loadu_ps(&spheres.z[i]);
+        __m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&spheres.radius[i]));
+
+        // Lanes stay set while the sphere is not fully behind any plane
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (int plane = 0; plane < planeCount; ++plane)
+        {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX[plane], x), _mm_mul_ps(planeY[plane], y)),
+                                         _mm_add_ps(_mm_mul_ps(planeZ[plane], z), planeW[plane]));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negativeRadius));
+        }
+
+        int mask = _mm_movemask_ps(inside);
+        for (int lane = 0; lane < 4; ++lane)
+            visible[i + lane] = (mask >> lane) & 1;
+    }
+#endif
+
+    for (; i < count; ++i)
+        visible[i] = intersectsSphere(glm::vec3(spheres.x[i], spheres.y[i], spheres.z[i]), spheres.radius[i]);
+}
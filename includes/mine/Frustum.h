@@ -0,0 +1,69 @@
+#ifndef __FRUSTUM_H__
+#define __FRUSTUM_H__
+#include "../GL/glad.h"
+#include "Camera.h"
+#include "../glm/glm.hpp"
+#include <cstdint>
+#include <vector>
+
+// World space bounding spheres stored as a structure of arrays, so the frustum test loads four of them per SSE register
+struct SphereSet
+{
+    std::vector<float> x, y, z, radius;
+
+    void clear();
+
+    void push(const glm::vec3 &center, float radius);
+
+    size_t size() const;
+};
+
+// What the culls against one frustum let through, level 0 triangles
+struct CullStats
+{
+    unsigned long long testedMeshes = 0;
+    unsigned long long visibleMeshes = 0;
+    unsigned long long testedTriangles = 0;
+    unsigned long long visibleTriangles = 0;
+};
+
+// Convex volume bounded by planes with their normals pointing inside, the six of a view projection or
+// the twelve of two of them intersected
+class Frustum
+{
+    static constexpr int maxPlanes = 12;
+
+    glm::vec4 planes[maxPlanes];
+
+    int planeCount;
+
+public:
+    // Added to by Model::cull, so the passes can count what they culled separately
+    CullStats *stats = nullptr;
+
+    // No planes, everything is inside
+    Frustum();
+
+    // Planes of the clip volume of 'viewProjection', OpenGL's -w..w depth range
+    static Frustum fromMatrix(const glm::mat4 &viewProjection);
+
+    static Frustum fromCamera(const Camera &camera);
+
+    int getPlaneCount() const;
+
+    const glm::vec4 &getPlane(int plane) const;
+
+    // Inside both, keeps this one's stats
+    Frustum intersect(const Frustum &other) const;
+
+    // Holds the spheres that touch this volume somewhere along 'sweep' from their center. With the light direction
+    // times the depth of the light's projection, that is every caster whose shadow can fall into the volume
+    Frustum extrude(const glm::vec3 &sweep) const;
+
+    bool intersectsSphere(const glm::vec3 &center, float radius) const;
+
+    // visible[i] is 1 when sphere i is at least partly inside. Four spheres per step with SSE, the remainder one at a time
+    void cullSpheres(const SphereSet &spheres, std::vector<uint8_t> &visible) const;
+};
+
+#endif // __FRUSTUM_H__
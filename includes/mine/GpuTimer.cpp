@@ -0,0 +1,41 @@
+#include "GpuTimer.h"
+
+GpuTimer::GpuTimer() : spans(0), milliseconds(0.0)
+{
+    glGenQueries(queryCount, queries);
+}
+
+void GpuTimer::begin()
+{
+    glBeginQuery(GL_TIME_ELAPSED, queries[spans % queryCount]);
+}
+
+void GpuTimer::end()
+{
+    glEndQuery(GL_TIME_ELAPSED);
+    ++spans;
+
+    // The oldest query, begun again by the next span. Its result is dropped if it still isn't there
+    if (spans < queryCount)
+        return;
+
+    unsigned int query = queries[spans % queryCount];
+    GLint available = 0;
+    glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+        return;
+
+    GLuint64 elapsed = 0;
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+    milliseconds += (elapsed / 1e6 - milliseconds) * 0.05;
+}
+
+double GpuTimer::getMilliseconds() const
+{
+    return milliseconds;
+}
+
+GpuTimer::~GpuTimer()
+{
+    glDeleteQueries(queryCount, queries);
+}
@@ -0,0 +1,35 @@
+#ifndef __GPUTIMER_H__
+#define __GPUTIMER_H__
+#include "../GL/glad.h"
+
+// GPU time of a span of commands measured with GL_TIME_ELAPSED queries. The results are read a few frames late so
+// waiting for them never stalls the CPU. Only one timer can be running at a time
+class GpuTimer
+{
+    static constexpr int queryCount = 4;
+
+    unsigned int queries[queryCount];
+
+    // Spans measured so far, the query of each is queries[spans % queryCount]
+    unsigned long long spans;
+
+    double milliseconds;
+
+public:
+    GpuTimer();
+
+    GpuTimer(const GpuTimer &) = delete;
+
+    GpuTimer &operator=(const GpuTimer &) = delete;
+
+    void begin();
+
+    void end();
+
+    // Smoothed over the last frames like the CPU timings of the panels
+    double getMilliseconds() const;
+
+    ~GpuTimer();
+};
+
+#endif // __GPUTIMER_H__
@@ -0,0 +1,264 @@
+#include "LoadProfiler.h"
+#include <fstream>
+#include <iomanip>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+namespace
+{
+    const char *stageNames[] = {
+        "model parse",
+        "model post-process",
+        "mesh convert",
+        "mesh optimize",
+        "mesh cache read",
+        "mesh cache write",
+        "mesh upload",
+        "image decode",
+        "texture cache read",
+        "texture cook",
+        "texture upload",
+        "mip generation",
+        "shader compile"};
+
+    static_assert(sizeof(stageNames) / sizeof(stageNames[0]) == size_t(LoadStage::COUNT), "Every LoadStage needs a name");
+
+    thread_local std::string currentAsset = "(other)";
+
+    // Taken during static initialization, so the report's elapsed time starts with the process rather than the first timer
+    const std::chrono::steady_clock::time_point processStart = std::chrono::steady_clock::now();
+
+    // Milliseconds of CPU time the calling thread has used
+    double getThreadCpuTime()
+    {
+#ifdef _WIN32
+        FILETIME creation, exit, kernel, user;
+        if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+            return 0.0;
+
+        auto toTicks = [](const FILETIME &time)
+        { return (uint64_t(time.dwHighDateTime) << 32) | time.dwLowDateTime; };
+
+        // 100 ns ticks
+        return double(toTicks(kernel) + toTicks(user)) / 1e4;
+#else
+        timespec time;
+        if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time) != 0)
+            return 0.0;
+
+        return time.tv_sec * 1e3 + time.tv_nsec / 1e6;
+#endif
+    }
+
+    double toMegabytes(uint64_t bytes)
+    {
+        return bytes / (1024.0 * 1024.0);
+    }
+
+    std::string escapeJson(const std::string &text)
+    {
+        std::string escaped;
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+                escaped += '\\';
+            escaped += c;
+        }
+        return escaped;
+    }
+
+    void writeStats(std::ostream &out, const LoadStageStats &stats)
+    {
+        out << "\"calls\": " << stats.calls << ", \"wallMs\": " << stats.wallTime << ", \"cpuMs\": " << stats.cpuTime
+            << ", \"bytesRead\": " << stats.bytesRead << ", \"bytesUploaded\": " << stats.bytesUploaded;
+    }
+
+    void printRow(std::ostream &out, const std::string &name, const LoadStageStats &stats)
+    {
+        out << std::setw(8) << stats.calls << std::setw(12) << stats.wallTime << std::setw(12) << stats.cpuTime
+            << std::setw(12) << toMegabytes(stats.bytesRead) << std::setw(12) << toMegabytes(stats.bytesUploaded) << "  " << name << '\n';
+    }
+}
+
+const char *getLoadStageName(LoadStage stage)
+{
+    return stage < LoadStage::COUNT ? stageNames[size_t(stage)] : "unknown";
+}
+
+void LoadStageStats::add(const LoadStageStats &other)
+{
+    calls += other.calls;
+    wallTime += other.wallTime;
+    cpuTime += other.cpuTime;
+    bytesRead += other.bytesRead;
+    bytesUploaded += other.bytesUploaded;
+}
+
+bool LoadProfiler::enabled = true;
+
+LoadProfiler::LoadProfiler() : start(processStart)
+{
+}
+
+LoadProfiler &LoadProfiler::get()
+{
+    static LoadProfiler profiler;
+    return profiler;
+}
+
+void LoadProfiler::add(const std::string &asset, LoadStage stage, const LoadStageStats &stats)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto entry = assets.find(asset);
+    if (entry == assets.end())
+    {
+        assetOrder.push_back(asset);
+        entry = assets.emplace(asset, AssetStats()).first;
+    }
+
+    entry->second[size_t(stage)].add(stats);
+}
+
+void LoadProfiler::printReport(std::ostream &out) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    AssetStats totals;
+    for (const auto &asset : assets)
+        for (size_t stage = 0; stage < totals.size(); ++stage)
+            totals[stage].add(asset.second[stage]);
+
+    auto header = [&out](const char *name)
+    {
+        out << std::setw(8) << "calls" << std::setw(12) << "wall ms" << std::setw(12) << "cpu ms"
+            << std::setw(12) << "MB read" << std::setw(12) << "MB upload" << "  " << name << '\n';
+    };
+
+    out << std::fixed << std::setprecision(2)
+        << "\nLoad profile (" << getElapsedTime() << " ms since start, stage times summed over threads)\n";
+
+    header("stage");
+    for (size_t stage = 0; stage < totals.size(); ++stage)
+        if (totals[stage].calls != 0)
+            printRow(out, getLoadStageName(LoadStage(stage)), totals[stage]);
+
+    for (const std::string &name : assetOrder)
+    {
+        const AssetStats &stats = assets.at(name);
+
+        LoadStageStats total;
+        for (const LoadStageStats &stage : stats)
+            total.add(stage);
+
+        out << '\n';
+        header(name.c_str());
+        for (size_t stage = 0; stage < stats.size(); ++stage)
+            if (stats[stage].calls != 0)
+                printRow(out, getLoadStageName(LoadStage(stage)), stats[stage]);
+        printRow(out, "total", total);
+    }
+}
+
+bool LoadProfiler::writeJson(const std::string &path) const
+{
+    std::ofstream out(path);
+    if (!out.is_open())
+        return false;
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    out << std::fixed << std::setprecision(3) << "{\n  \"elapsedMs\": " << getElapsedTime() << ",\n  \"assets\": [";
+
+    for (size_t i = 0; i < assetOrder.size(); ++i)
+    {
+        const AssetStats &stats = assets.at(assetOrder[i]);
+        out << (i == 0 ? "\n" : ",\n") << "    {\"asset\": \"" << escapeJson(assetOrder[i]) << "\", \"stages\": [";
+
+        bool first = true;
+        for (size_t stage = 0; stage < stats.size(); ++stage)
+        {
+            if (stats[stage].calls == 0)
+                continue;
+
+            out << (first ? "\n" : ",\n") << "      {\"stage\": \"" << getLoadStageName(LoadStage(stage)) << "\", ";
+            writeStats(out, stats[stage]);
+            out << '}';
+            first = false;
+        }
+
+        out << "\n    ]}";
+    }
+
+    out << "\n  ]\n}\n";
+    return out.good();
+}
+
+double LoadProfiler::getElapsedTime() const
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void LoadProfiler::reset()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    assetOrder.clear();
+    assets.clear();
+    start = std::chrono::steady_clock::now();
+}
+
+LoadAssetScope::LoadAssetScope(const std::string &asset) : previous(currentAsset)
+{
+    currentAsset = asset;
+}
+
+LoadAssetScope::~LoadAssetScope()
+{
+    currentAsset = previous;
+}
+
+const std::string &LoadAssetScope::getCurrent()
+{
+    return currentAsset;
+}
+
+ScopedLoadTimer::ScopedLoadTimer(LoadStage stage) : stage(stage), cpuStart(0.0), bytesRead(0), bytesUploaded(0)
+{
+    if (!LoadProfiler::enabled)
+        return;
+
+    wallStart = std::chrono::steady_clock::now();
+    cpuStart = getThreadCpuTime();
+}
+
+void ScopedLoadTimer::addBytesRead(uint64_t bytes)
+{
+    bytesRead += bytes;
+}
+
+void ScopedLoadTimer::addBytesUploaded(uint64_t bytes)
+{
+    bytesUploaded += bytes;
+}
+
+ScopedLoadTimer::~ScopedLoadTimer()
+{
+    if (!LoadProfiler::enabled)
+        return;
+
+    LoadStageStats stats;
+    stats.calls = 1;
+    stats.wallTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wallStart).count();
+    stats.cpuTime = getThreadCpuTime() - cpuStart;
+    stats.bytesRead = bytesRead;
+    stats.bytesUploaded = bytesUploaded;
+
+    LoadProfiler::get().add(currentAsset, stage, stats);
+}
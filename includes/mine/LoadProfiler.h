@@ -0,0 +1,131 @@
+#ifndef __LOADPROFILER_H__
+#define __LOADPROFILER_H__
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Steps of the asset pipeline the startup time is broken into, in pipeline order
+enum class LoadStage
+{
+    // Assimp reading the file and its buffers
+    MODEL_PARSE,
+    // Assimp's post processing steps (triangulation, tangents, ...)
+    MODEL_POST_PROCESS,
+    // proccesNode / proccesMesh, aiMesh to MVertex
+    MESH_CONVERT,
+    // Welding, vertex cache and fetch order, LOD chains and vertex packing
+    MESH_OPTIMIZE,
+    MESH_CACHE_READ,
+    MESH_CACHE_WRITE,
+    MESH_UPLOAD,
+    // stbi_load of an image the texture cache is not used for
+    IMAGE_DECODE,
+    TEXTURE_CACHE_READ,
+    // Decode plus block compression of a texture missing from the cache
+    TEXTURE_COOK,
+    TEXTURE_UPLOAD,
+    MIP_GENERATION,
+    SHADER_COMPILE,
+    COUNT
+};
+
+const char *getLoadStageName(LoadStage stage);
+
+struct LoadStageStats
+{
+    unsigned int calls = 0;
+    // Both summed over the threads the stage ran on
+    double wallTime = 0.0;
+    double cpuTime = 0.0;
+    uint64_t bytesRead = 0;
+    uint64_t bytesUploaded = 0;
+
+    void add(const LoadStageStats &other);
+};
+
+// Collects the ScopedLoadTimer results of every thread per asset and stage.
+// Assets are model paths (their meshes and textures roll up into them) and shader file pairs
+class LoadProfiler
+{
+    typedef std::array<LoadStageStats, size_t(LoadStage::COUNT)> AssetStats;
+
+    mutable std::mutex mutex;
+
+    // Assets in the order they were first seen
+    std::vector<std::string> assetOrder;
+
+    std::unordered_map<std::string, AssetStats> assets;
+
+    std::chrono::steady_clock::time_point start;
+
+    LoadProfiler();
+
+public:
+    static bool enabled;
+
+    static LoadProfiler &get();
+
+    void add(const std::string &asset, LoadStage stage, const LoadStageStats &stats);
+
+    // Per stage totals, then every asset with the stages it went through
+    void printReport(std::ostream &out) const;
+
+    bool writeJson(const std::string &path) const;
+
+    // Wall time since the process started or the profiler was reset
+    double getElapsedTime() const;
+
+    void reset();
+};
+
+// Names the asset the timers on this thread are attributed to until the scope ends, scopes nest
+class LoadAssetScope
+{
+    std::string previous;
+
+public:
+    explicit LoadAssetScope(const std::string &asset);
+
+    LoadAssetScope(const LoadAssetScope &) = delete;
+
+    LoadAssetScope &operator=(const LoadAssetScope &) = delete;
+
+    ~LoadAssetScope();
+
+    // "(other)" outside of any scope
+    static const std::string &getCurrent();
+};
+
+// Adds its lifetime's wall and thread CPU time to one stage of the current asset
+class ScopedLoadTimer
+{
+    LoadStage stage;
+
+    std::chrono::steady_clock::time_point wallStart;
+
+    double cpuStart;
+
+    uint64_t bytesRead;
+
+    uint64_t bytesUploaded;
+
+public:
+    explicit ScopedLoadTimer(LoadStage stage);
+
+    ScopedLoadTimer(const ScopedLoadTimer &) = delete;
+
+    ScopedLoadTimer &operator=(const ScopedLoadTimer &) = delete;
+
+    void addBytesRead(uint64_t bytes);
+
+    void addBytesUploaded(uint64_t bytes);
+
+    ~ScopedLoadTimer();
+};
+
+#endif // __LOADPROFILER_H__
@@ -0,0 +1,77 @@
+#include "LodSelector.h"
+#include <algorithm>
+
+LodSelector LodSelector::forCamera(const Camera &camera, int viewportHeight, float maxPixelError)
+{
+    LodSelector selector;
+    selector.perspective = true;
+    // projection[1][1] is 1 / tan(fov / 2), so this is the pixel size of one unit one unit away
+    selector.pixelsPerUnit = camera.getProjection()[1][1] * viewportHeight * 0.5f;
+    selector.viewPosition = camera.getPosition();
+    selector.maxError = maxPixelError;
+    return selector;
+}
+
+LodSelector LodSelector::forOrthographic(float extent, int resolution, float maxTexelError, int levelBias)
+{
+    LodSelector selector;
+    selector.perspective = false;
+    selector.pixelsPerUnit = resolution / extent;
+    selector.maxError = maxTexelError;
+    selector.levelBias = levelBias;
+    return selector;
+}
+
+float LodSelector::getProjectedScale(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, const glm::mat4 &model) const
+{
+    glm::mat3 linear(model);
+    float scale = std::max({glm::length(linear[0]), glm::length(linear[1]), glm::length(linear[2])});
+
+    if (!perspective)
+        return scale * pixelsPerUnit;
+
+    glm::vec3 center = glm::vec3(model * glm::vec4((boundsMin + boundsMax) * 0.5f, 1.f));
+    float radius = glm::length(boundsMax - boundsMin) * 0.5f * scale;
+
+    // Distance to the nearest point of the bounding sphere, inside it the full mesh is used
+    float distance = glm::length(center - viewPosition) - radius;
+    if (distance <= 0.f)
+        return -1.f;
+
+    return scale * pixelsPerUnit / distance;
+}
+
+unsigned int LodSelector::applyOverrides(unsigned int level, size_t levelCount) const
+{
+    if (levelCount == 0)
+        return 0;
+
+    long long biased = forcedLevel >= 0 ? forcedLevel : (long long)level + levelBias;
+    return static_cast<unsigned int>(std::clamp<long long>(biased, 0, (long long)levelCount - 1));
+}
+
+unsigned int LodSelector::select(const Mesh &mesh, const glm::mat4 &model) const
+{
+    const std::vector<MeshLod> &lods = mesh.getLods();
+
+    float projected = getProjectedScale(mesh.getBoundsMin(), mesh.getBoundsMax(), model);
+
+    unsigned int level = 0;
+    if (projected >= 0.f)
+        while (level + 1 < lods.size() && lods[level + 1].error * projected <= maxError)
+            ++level;
+
+    return applyOverrides(level, lods.size());
+}
+
+unsigned int LodSelector::select(const std::vector<float> &errors, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, const glm::mat4 &model) const
+{
+    float projected = getProjectedScale(boundsMin, boundsMax, model);
+
+    unsigned int level = 0;
+    if (projected >= 0.f)
+        while (level + 1 < errors.size() && errors[level + 1] * projected <= maxError)
+            ++level;
+
+    return applyOverrides(level, errors.size());
+}
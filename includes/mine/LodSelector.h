@@ -0,0 +1,43 @@
+#ifndef __LODSELECTOR_H__
+#define __LODSELECTOR_H__
+#include "Mesh.h"
+
+// Picks the coarsest detail level whose simplification error stays below a threshold once projected.
+// Camera passes measure the error in screen pixels, orthographic passes like the shadow map in texels
+struct LodSelector
+{
+    bool perspective = true;
+
+    // Pixels one world unit covers, at a distance of one unit for perspective selectors
+    float pixelsPerUnit = 0.f;
+
+    glm::vec3 viewPosition = glm::vec3(0.f);
+
+    // Largest projected error accepted, in pixels or texels
+    float maxError = 1.f;
+
+    // Added to the selected level, positive values give up detail for fewer triangles
+    int levelBias = 0;
+
+    // Overrides the selection when not negative, clamped to each chain
+    int forcedLevel = -1;
+
+    static LodSelector forCamera(const Camera &camera, int viewportHeight, float maxPixelError);
+
+    // 'extent' is the world size the orthographic projection maps onto 'resolution' texels
+    static LodSelector forOrthographic(float extent, int resolution, float maxTexelError, int levelBias = 0);
+
+    unsigned int select(const Mesh &mesh, const glm::mat4 &model) const;
+
+    // For callers that pick one level for several meshes at once, 'errors' holds the error of every level
+    unsigned int select(const std::vector<float> &errors, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, const glm::mat4 &model) const;
+
+    // Pixels one object space unit of the bounds covers after the model transform, negative when the viewer is inside the bounds
+    float getProjectedScale(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, const glm::mat4 &model) const;
+
+private:
+
+    unsigned int applyOverrides(unsigned int level, size_t levelCount) const;
+};
+
+#endif // __LODSELECTOR_H__
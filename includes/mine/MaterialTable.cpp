@@ -0,0 +1,417 @@
+#include "MaterialTable.h"
+#include "ResourceCache.h"
+#include "TextureStreamer.h"
+#include "TextureCache.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+namespace
+{
+    // GL_ARB_bindless_texture is not part of the generated loader, its entry points are fetched when the mode is decided
+    typedef GLuint64(APIENTRYP GetTextureHandleProc)(GLuint texture);
+    typedef void(APIENTRYP MakeTextureHandleResidentProc)(GLuint64 handle);
+    typedef void(APIENTRYP MakeTextureHandleNonResidentProc)(GLuint64 handle);
+
+    GetTextureHandleProc getTextureHandle = nullptr;
+    MakeTextureHandleResidentProc makeTextureHandleResident = nullptr;
+    MakeTextureHandleNonResidentProc makeTextureHandleNonResident = nullptr;
+
+    // Sampled by the TEXTURE_ARRAYS shader variant, one per slot
+    const char *const arraySamplers[MaterialTable::slotCount] = {"diffuseArray", "normalArray"};
+
+    // Duplicates share the storage of the texture they matched
+    const TextureResource *getStorage(const TextureResource &resource)
+    {
+        return resource.duplicateOf ? resource.duplicateOf.get() : &resource;
+    }
+
+    size_t getLevelBytes(unsigned int internalFormat, int width, int height)
+    {
+        width = std::max(1, width);
+        height = std::max(1, height);
+
+        for (TextureCodec codec : {TextureCodec::BC1, TextureCodec::BC3, TextureCodec::BC4, TextureCodec::BC5, TextureCodec::BC7})
+            if (getCompressedFormat(codec) == internalFormat)
+                return getCompressedSize(codec, width, height);
+
+        // RGB is padded to four bytes per texel like in getTextureBytes()
+        size_t texelBytes = internalFormat == GL_R8 ? 1 : internalFormat == GL_RG8 ? 2 : 4;
+        return size_t(width) * height * texelBytes;
+    }
+}
+
+const char *const MaterialTable::slotTypes[slotCount] = {"texture_diffuse", "texture_normal"};
+
+MaterialMode MaterialTable::getMode()
+{
+    static const MaterialMode mode = []()
+    {
+        if (TextureStreamer::get().enabled || !glfwExtensionSupported("GL_ARB_bindless_texture"))
+            return MaterialMode::TEXTURE_ARRAYS;
+
+        getTextureHandle = reinterpret_cast<GetTextureHandleProc>(glfwGetProcAddress("glGetTextureHandleARB"));
+        makeTextureHandleResident = reinterpret_cast<MakeTextureHandleResidentProc>(glfwGetProcAddress("glMakeTextureHandleResidentARB"));
+        makeTextureHandleNonResident = reinterpret_cast<MakeTextureHandleNonResidentProc>(glfwGetProcAddress("glMakeTextureHandleNonResidentARB"));
+
+        return getTextureHandle && makeTextureHandleResident && makeTextureHandleNonResident ? MaterialMode::BINDLESS
+                                                                                           : MaterialMode::TEXTURE_ARRAYS;
+    }();
+
+    return mode;
+}
+
+MaterialTable::MaterialTable()
+{
+    glGenBuffers(1, &materialBuffer);
+
+    // Immutable like cooked textures, so they can have handles
+    const unsigned char white[4] = {255, 255, 255, 255};
+    const unsigned char flat[2] = {128, 128};
+
+    glGenTextures(2, defaultTextures);
+
+    glBindTexture(GL_TEXTURE_2D, defaultTextures[0]);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, 1, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, white);
+
+    glBindTexture(GL_TEXTURE_2D, defaultTextures[1]);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RG8, 1, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 1, 1, GL_RG, GL_UNSIGNED_BYTE, flat);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void MaterialTable::describe(Source &source) const
+{
+    const TextureResource *resource = source.resource ? getStorage(*source.resource) : nullptr;
+
+    if (resource)
+    {
+        source.width = resource->width;
+        source.height = resource->height;
+        source.levelCount = resource->levelCount;
+        source.internalFormat = resource->internalFormat;
+        source.residentLevel = resource->baseLevel;
+        source.version = resource->version;
+        source.baseLevel = source.levelCount;
+        return;
+    }
+
+    // Never streamed, level 0 is always there
+    GLint width = 0, height = 0, format = 0, maxLevel = 0;
+    glBindTexture(GL_TEXTURE_2D, source.id);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &format);
+    glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, &maxLevel);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    source.width = width;
+    source.height = height;
+    source.internalFormat = format;
+    source.levelCount = width > 0 && height > 0 ? std::min(int(std::log2(std::max(width, height))) + 1, maxLevel + 1) : 0;
+    source.residentLevel = 0;
+    source.version = 0;
+    source.baseLevel = source.levelCount;
+}
+
+void MaterialTable::copyLevels(const Source &source, int first, int last) const
+{
+    const TextureArray &array = arrays[source.array];
+
+    for (int level = first; level < last; ++level)
+        glCopyImageSubData(source.id, GL_TEXTURE_2D, level, 0, 0, 0,
+                           array.id, GL_TEXTURE_2D_ARRAY, level - array.baseLevel, 0, 0, GLint(source.layer),
+                           std::max(1, source.width >> level), std::max(1, source.height >> level), 1);
+}
+
+void MaterialTable::allocate(TextureArray &array, int baseLevel, uint32_t layerCapacity)
+{
+    unsigned int previous = array.id;
+
+    glGenTextures(1, &array.id);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, array.id);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, array.levelCount - baseLevel, array.internalFormat, std::max(1, array.width >> baseLevel),
+                   std::max(1, array.height >> baseLevel), layerCapacity);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    if (array.internalFormat == GL_COMPRESSED_RED_RGTC1)
+    {
+        const GLint swizzle[] = {GL_RED, GL_RED, GL_RED, GL_ONE};
+        glTexParameteriv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+    }
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    if (previous != 0)
+    {
+        // Every layer at once, layers handed out since the previous storage have nothing in it yet and are copied later
+        GLsizei layers = GLsizei(std::min(array.layerCapacity, layerCapacity));
+        for (int level = std::max(array.baseLevel, baseLevel); level < array.levelCount; ++level)
+            glCopyImageSubData(previous, GL_TEXTURE_2D_ARRAY, level - array.baseLevel, 0, 0, 0,
+                               array.id, GL_TEXTURE_2D_ARRAY, level - baseLevel, 0, 0, 0,
+                               std::max(1, array.width >> level), std::max(1, array.height >> level), layers);
+        glDeleteTextures(1, &previous);
+    }
+
+    array.baseLevel = baseLevel;
+    array.layerCapacity = layerCapacity;
+}
+
+bool MaterialTable::syncArrays()
+{
+    bool changed = false;
+
+    for (Source &source : sources)
+    {
+        if (source.resource)
+        {
+            const TextureResource *resource = getStorage(*source.resource);
+            if (resource->version != source.version)
+            {
+                source.version = resource->version;
+                source.residentLevel = resource->baseLevel;
+            }
+        }
+
+        // Dropped levels are no longer sampled, their storage goes once no layer of the array has them
+        if (source.residentLevel > source.baseLevel)
+        {
+            source.baseLevel = source.residentLevel;
+            changed = true;
+        }
+    }
+
+    std::vector<int> baseLevels(arrays.size(), INT_MAX);
+    for (const Source &source : sources)
+        baseLevels[source.array] = std::min(baseLevels[source.array], source.residentLevel);
+
+    for (size_t i = 0; i < arrays.size(); ++i)
+    {
+        TextureArray &array = arrays[i];
+
+        // Doubled, so a model whose meshes become ready one by one doesn't copy its arrays for every one of them
+        uint32_t layerCapacity = array.layerCapacity;
+        if (array.layerCount > layerCapacity)
+            layerCapacity = std::max(array.layerCount, layerCapacity * 2);
+
+        if (array.id == 0 || baseLevels[i] != array.baseLevel || layerCapacity != array.layerCapacity)
+        {
+            allocate(array, baseLevels[i], layerCapacity);
+            changed = true;
+        }
+    }
+
+    for (Source &source : sources)
+        if (source.residentLevel < source.baseLevel)
+        {
+            copyLevels(source, source.residentLevel, source.baseLevel);
+            source.baseLevel = source.residentLevel;
+            changed = true;
+        }
+
+    if (!changed)
+        return false;
+
+    // What the arrays hold besides the copies the streamer already counts for its textures
+    size_t arrayBytes = 0, streamedBytes = 0;
+    for (const TextureArray &array : arrays)
+        for (int level = array.baseLevel; level < array.levelCount; ++level)
+            arrayBytes += getLevelBytes(array.internalFormat, array.width >> level, array.height >> level) * array.layerCapacity;
+
+    for (const Source &source : sources)
+        if (source.streamed)
+            for (int level = source.baseLevel; level < source.levelCount; ++level)
+                streamedBytes += getLevelBytes(source.internalFormat, source.width >> level, source.height >> level);
+
+    TextureStreamer::get().setCopyOverhead(this, arrayBytes - std::min(arrayBytes, streamedBytes));
+    return true;
+}
+
+void MaterialTable::writeMaterials()
+{
+    groups.clear();
+    materialGroups.assign(materials.size(), 0);
+
+    if (getMode() == MaterialMode::BINDLESS)
+    {
+        for (size_t material = 0; material < materials.size(); ++material)
+            for (unsigned int slot = 0; slot < slotCount; ++slot)
+                materials[material].handles[slot] = sources[materialSources[material * slotCount + slot]].handle;
+
+        groups.push_back({0, 0});
+    }
+    else
+    {
+        std::map<std::array<uint32_t, slotCount>, uint32_t> groupIds;
+        for (size_t material = 0; material < materials.size(); ++material)
+        {
+            std::array<uint32_t, slotCount> key;
+            for (unsigned int slot = 0; slot < slotCount; ++slot)
+            {
+                const Source &source = sources[materialSources[material * slotCount + slot]];
+                key[slot] = source.array;
+                materials[material].layers[slot] = source.layer;
+                materials[material].minLods[slot] = float(source.baseLevel - arrays[source.array].baseLevel);
+            }
+
+            auto inserted = groupIds.emplace(key, static_cast<uint32_t>(groups.size()));
+            if (inserted.second)
+                groups.push_back(key);
+            materialGroups[material] = inserted.first->second;
+        }
+    }
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, materialBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, materials.size() * sizeof(MaterialData), materials.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void MaterialTable::release()
+{
+    for (const Source &source : sources)
+    {
+        if (source.handle)
+            makeTextureHandleNonResident(source.handle);
+        if (source.streamed)
+            TextureStreamer::get().removeCopy(*getStorage(*source.resource));
+    }
+
+    for (const TextureArray &array : arrays)
+        glDeleteTextures(1, &array.id);
+
+    TextureStreamer::get().setCopyOverhead(this, 0);
+
+    sources.clear();
+    sourceIds.clear();
+    arrays.clear();
+    arrayIds.clear();
+    groups.clear();
+    materials.clear();
+    materialSources.clear();
+    materialGroups.clear();
+}
+
+void MaterialTable::build(const std::vector<const std::vector<MTexture> *> &textures)
+{
+    materials.assign(textures.size(), MaterialData{});
+    materialSources.resize(textures.size() * slotCount);
+
+    bool bindless = getMode() == MaterialMode::BINDLESS;
+
+    for (size_t material = 0; material < textures.size(); ++material)
+        for (unsigned int slot = 0; slot < slotCount; ++slot)
+        {
+            const std::vector<MTexture> &list = *textures[material];
+            auto texture = std::find_if(list.begin(), list.end(), [&](const MTexture &texture)
+                                        { return texture.type == slotTypes[slot]; });
+
+            unsigned int id = texture != list.end() ? texture->getId() : defaultTextures[slot];
+            auto known = sourceIds.find(id);
+            if (known != sourceIds.end())
+            {
+                materialSources[material * slotCount + slot] = known->second;
+                continue;
+            }
+
+            Source source{};
+            source.id = id;
+            if (texture != list.end())
+                source.resource = texture->resource;
+            describe(source);
+
+            // Not uploaded yet, looked at again by the next build
+            if (source.levelCount == 0)
+            {
+                source = Source{};
+                source.id = defaultTextures[slot];
+                auto fallback = sourceIds.find(source.id);
+                if (fallback != sourceIds.end())
+                {
+                    materialSources[material * slotCount + slot] = fallback->second;
+                    continue;
+                }
+                describe(source);
+            }
+
+            if (bindless)
+            {
+                source.handle = getTextureHandle(source.id);
+                makeTextureHandleResident(source.handle);
+            }
+            else
+            {
+                auto key = std::make_tuple(source.width, source.height, source.levelCount, source.internalFormat);
+                auto inserted = arrayIds.emplace(key, static_cast<uint32_t>(arrays.size()));
+                if (inserted.second)
+                    arrays.push_back({0, source.width, source.height, source.levelCount, source.internalFormat, 0, 0, 0});
+
+                source.array = inserted.first->second;
+                source.layer = arrays[source.array].layerCount++;
+                source.streamed = source.resource && TextureStreamer::get().addCopy(*getStorage(*source.resource));
+            }
+
+            uint32_t index = static_cast<uint32_t>(sources.size());
+            sourceIds.emplace(source.id, index);
+            sources.push_back(std::move(source));
+            materialSources[material * slotCount + slot] = index;
+        }
+
+    if (!bindless)
+        syncArrays();
+
+    writeMaterials();
+}
+
+void MaterialTable::update()
+{
+    if (getMode() == MaterialMode::BINDLESS || !syncArrays())
+        return;
+
+    writeMaterials();
+}
+
+uint32_t MaterialTable::getGroup(uint32_t material) const
+{
+    return materialGroups[material];
+}
+
+size_t MaterialTable::getGroupCount() const
+{
+    return groups.size();
+}
+
+size_t MaterialTable::getArrayCount() const
+{
+    return arrays.size();
+}
+
+void MaterialTable::bind(MShader &shader, uint32_t group)
+{
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, bindingPoint, materialBuffer);
+
+    if (getMode() == MaterialMode::BINDLESS)
+        return;
+
+    for (unsigned int slot = 0; slot < slotCount; ++slot)
+    {
+        glActiveTexture(GL_TEXTURE0 + slot);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, arrays[groups[group][slot]].id);
+        shader.setInt(arraySamplers[slot], slot);
+    }
+
+    glActiveTexture(GL_TEXTURE0);
+}
+
+MaterialTable::~MaterialTable()
+{
+    release();
+
+    glDeleteBuffers(1, &materialBuffer);
+    glDeleteTextures(2, defaultTextures);
+}
@@ -0,0 +1,155 @@
+#ifndef __MATERIALTABLE_H__
+#define __MATERIALTABLE_H__
+#include "Mesh.h"
+#include <array>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+// Per material entry of the material buffer, read as materials[MaterialIndex] by the MULTI_DRAW shader variants (std430).
+// Slot 0 is the diffuse texture, slot 1 the normal map
+struct MaterialData
+{
+    // BINDLESS mode, uvec2 in the shaders
+    uint64_t handles[2];
+    // TEXTURE_ARRAYS mode, the layer of the slot's array and the finest level copied into it
+    uint32_t layers[2];
+    float minLods[2];
+};
+
+static_assert(sizeof(MaterialData) == 32, "MaterialData must match the std430 layout of the shaders");
+
+enum class MaterialMode
+{
+    // GL_ARB_bindless_texture handles of the textures themselves, nothing is bound per draw
+    BINDLESS,
+    // Copies of the textures grouped by size and format into GL_TEXTURE_2D_ARRAYs, bound per group of materials sharing arrays
+    TEXTURE_ARRAYS
+};
+
+// The textures of a set of materials in a form whole multi draws can sample without binding anything per draw.
+// Bindless handles freeze a texture's state, which the TextureStreamer keeps changing, so they are only used when
+// the extension is there and streaming is off. The arrays hold the levels the streamer has resident of every texture:
+// each array only stores the levels from the finest one any of its layers has, it is reallocated when a finer level
+// streams in or the finest ones are all dropped, and its storage counts against the streamer's budget.
+// Sources are kept across builds, a build only copies the textures it hasn't seen yet
+class MaterialTable
+{
+    struct Source
+    {
+        unsigned int id;
+        // Empty for textures loaded directly and the default textures, their storage is read back from GL
+        std::shared_ptr<TextureResource> resource;
+
+        int width, height, levelCount;
+        unsigned int internalFormat;
+
+        // Finest level copied into the array (levelCount before the first copy), or resident when the handle was made
+        int baseLevel;
+        // Finest level the texture has resident
+        int residentLevel;
+        uint32_t version;
+
+        uint32_t array, layer;
+        uint64_t handle;
+
+        // Registered with TextureStreamer::addCopy()
+        bool streamed;
+    };
+
+    struct TextureArray
+    {
+        unsigned int id;
+        int width, height, levelCount;
+        unsigned int internalFormat;
+        // Layers handed out and layers allocated
+        uint32_t layerCount, layerCapacity;
+        // Level of the textures stored as level 0 of the array
+        int baseLevel;
+    };
+
+    unsigned int materialBuffer;
+
+    // 1x1 white diffuse and flat normal map, for materials missing a slot
+    unsigned int defaultTextures[2];
+
+    std::vector<MaterialData> materials;
+
+    // Source of every slot of every material, materials.size() * slotCount entries
+    std::vector<uint32_t> materialSources;
+
+    std::vector<Source> sources;
+
+    // Textures shared by several materials, or loaded twice and deduplicated, get one source
+    std::unordered_map<unsigned int, uint32_t> sourceIds;
+
+    std::vector<TextureArray> arrays;
+
+    // One array per storage, BC4 textures are told apart by their format and get the same swizzle as the originals
+    std::map<std::tuple<int, int, int, unsigned int>, uint32_t> arrayIds;
+
+    // Array of every slot, per group
+    std::vector<std::array<uint32_t, 2>> groups;
+
+    std::vector<uint32_t> materialGroups;
+
+    void describe(Source &source) const;
+
+    // Copies levels [first, last) of the source into its layer
+    void copyLevels(const Source &source, int first, int last) const;
+
+    // New storage for the array from 'baseLevel' on, the levels both storages have are carried over
+    void allocate(TextureArray &array, int baseLevel, uint32_t layerCapacity);
+
+    // Brings the arrays in line with the levels the sources have resident, true when a layer's levels changed
+    bool syncArrays();
+
+    // Layers, levels and groups of the materials into the material buffer
+    void writeMaterials();
+
+    void release();
+
+public:
+    static constexpr unsigned int bindingPoint = 6;
+
+    static constexpr unsigned int slotCount = 2;
+
+    // Texture type of every slot, as in MTexture::type
+    static const char *const slotTypes[slotCount];
+
+    // Decided once, the MULTI_DRAW shaders are built for it
+    static MaterialMode getMode();
+
+    MaterialTable();
+
+    MaterialTable(const MaterialTable &) = delete;
+
+    MaterialTable &operator=(const MaterialTable &) = delete;
+
+    // 'textures[m]' are the textures of material m, replaces the materials the table held.
+    // Textures seen by an earlier build keep their layers, only new ones are copied
+    void build(const std::vector<const std::vector<MTexture> *> &textures);
+
+    // Follows the levels the streamer uploaded or dropped since the last call, per frame before drawing
+    void update();
+
+    // Materials of one group sample the same arrays, there is a single group in BINDLESS mode
+    uint32_t getGroup(uint32_t material) const;
+
+    size_t getGroupCount() const;
+
+    size_t getArrayCount() const;
+
+    // Binds the material buffer and the arrays of the group to the units matching the slots
+    void bind(MShader &shader, uint32_t group);
+
+    ~MaterialTable();
+};
+
+// Appended to the MULTI_DRAW defines when the mode is BINDLESS
+constexpr const char *bindlessTexturesDefine = "#define BINDLESS_TEXTURES\n";
+
+#endif // __MATERIALTABLE_H__
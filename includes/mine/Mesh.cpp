@@ -1,176 +1,367 @@
 #include "Mesh.h"
+#include "TextureLoader.h"
+#include "ResourceCache.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
+#include <algorithm>
+#include <cstdio>
 #include <stdexcept>
 #include <iostream>
 
-Mesh::Mesh(const std::vector<MVertex> &vertices, const std::vector<unsigned int> &indices,
-           const std::vector<MTexture> &textures, const Camera &camera) : vertices(vertices), indices(indices), textures(textures)
+bool Mesh::retainCpuGeometry = false;
+
+unsigned long long Mesh::drawnTriangles = 0;
+
+unsigned long long Mesh::drawnMeshes = 0;
+
+Mesh::Mesh(std::vector<MVertex> &&vertices, std::vector<unsigned int> &&indices,
+           std::vector<MTexture> textures, const Camera &camera) : vertices(std::move(vertices)), indices(std::move(indices)), textures(std::move(textures))
 {
     this->camera = &camera;
-    setupMesh();
+    indexType = GL_UNSIGNED_INT;
+    setupMesh(this->vertices.data(), this->vertices.size(), this->indices.data(), this->indices.size());
+
+    if (!this->vertices.empty())
+    {
+        boundsMin = boundsMax = this->vertices[0].position;
+        for (const MVertex &vertex : this->vertices)
+        {
+            boundsMin = glm::min(boundsMin, vertex.position);
+            boundsMax = glm::max(boundsMax, vertex.position);
+        }
+        sphereCenter = (boundsMin + boundsMax) * 0.5f;
+        sphereRadius = computeBoundingRadius(this->vertices, sphereCenter);
+        uvDensity = computeUvDensity(this->vertices, this->indices);
+    }
+
+    if (!retainCpuGeometry)
+    {
+        std::vector<MVertex>().swap(this->vertices);
+        std::vector<unsigned int>().swap(this->indices);
+    }
 }
 
-void Mesh::render(MShader &shader, bool hasTexture)
+Mesh::Mesh(const void *vertices, size_t vertexCount, const VertexLayout &layout, const void *indices, size_t indexCount, size_t indexSize,
+           std::vector<MTexture> textures, const Camera &camera) : textures(std::move(textures)), layout(layout)
 {
-    if (hasTexture)
-        for (unsigned int i = 0; i < textures.size(); i++)
-        {
-            glActiveTexture(GL_TEXTURE0 + i);
+    this->camera = &camera;
+    indexType = indexSize == sizeof(uint16_t) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    setupMesh(vertices, vertexCount, indices, indexCount);
 
-            std::string uniformName = "material." + textures[i].type;
+    // Only full vertices are kept, packed ones can not be handed out as MVertex
+    if (retainCpuGeometry && vertices && indices && layout.format == VertexFormat::FULL)
+    {
+        const MVertex *fullVertices = static_cast<const MVertex *>(vertices);
+        this->vertices.assign(fullVertices, fullVertices + vertexCount);
 
-            shader.setInt(uniformName.c_str(), i);
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);
+        if (indexType == GL_UNSIGNED_SHORT)
+        {
+            const uint16_t *shortIndices = static_cast<const uint16_t *>(indices);
+            this->indices.assign(shortIndices, shortIndices + indexCount);
+        }
+        else
+        {
+            const unsigned int *fullIndices = static_cast<const unsigned int *>(indices);
+            this->indices.assign(fullIndices, fullIndices + indexCount);
         }
+    }
+}
 
-    glActiveTexture(GL_TEXTURE0);
+Mesh::Mesh(Mesh &&other) noexcept : vertices(std::move(other.vertices)), indices(std::move(other.indices)), textures(std::move(other.textures)),
+                                     ready(other.ready), pool(other.pool), allocation(other.allocation),
+                                     vertexCount(other.vertexCount), indexCount(other.indexCount), indexType(other.indexType), layout(other.layout),
+                                     lods(std::move(other.lods)), boundsMin(other.boundsMin), boundsMax(other.boundsMax),
+                                     sphereCenter(other.sphereCenter), sphereRadius(other.sphereRadius),
+                                     uvDensity(other.uvDensity), node(other.node), camera(other.camera)
+{
+    other.pool = nullptr;
+    other.ready = false;
+}
+
+Mesh &Mesh::operator=(Mesh &&other) noexcept
+{
+    if (this != &other)
+    {
+        release();
+
+        vertices = std::move(other.vertices);
+        indices = std::move(other.indices);
+        textures = std::move(other.textures);
+        ready = other.ready;
+        pool = other.pool;
+        allocation = other.allocation;
+        vertexCount = other.vertexCount;
+        indexCount = other.indexCount;
+        indexType = other.indexType;
+        layout = other.layout;
+        lods = std::move(other.lods);
+        boundsMin = other.boundsMin;
+        sphereCenter = other.sphereCenter;
+        sphereRadius = other.sphereRadius;
+        boundsMax = other.boundsMax;
+        uvDensity = other.uvDensity;
+        node = other.node;
+        camera = other.camera;
+
+        other.pool = nullptr;
+        other.ready = false;
+    }
+    return *this;
+}
+
+unsigned int Mesh::bindTextures(MShader &shader, bool numbered, unsigned int *boundTextures, unsigned int trackedUnits)
+{
+    // Types that get a number in numbered mode, others keep the bare name
+    static const char *const numberedTypes[] = {
+        "texture_diffuse", "texture_normal", "texture_lightmap", "texture_basecolor", "texture_normal_camera",
+        "texture_emission", "texture_specular", "texture_ambient", "texture_emissive", "texture_height",
+        "texture_shininess", "texture_opacity", "texture_displacement", "texture_reflection", "texture_metalness",
+        "texture_ao"};
+
+    unsigned int skipped = 0;
 
-    glBindVertexArray(vao);
-    glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
-}
-
-void Mesh::renderMultipleTextures(MShader &shader)
-{
-    // Counters for each texture type
-    unsigned int diffuseNr = 1;
-    unsigned int normalNr = 1;
-    unsigned int lightmapNr = 1;
-    unsigned int basecolorNr = 1;
-    unsigned int normalCameraNr = 1;
-    unsigned int emissionNr = 1;
-    unsigned int specularNr = 1;
-    unsigned int ambientNr = 1;
-    unsigned int emissiveNr = 1;
-    unsigned int heightNr = 1;
-    unsigned int shininessNr = 1;
-    unsigned int opacityNr = 1;
-    unsigned int displacementNr = 1;
-    unsigned int reflectionNr = 1;
-    unsigned int metalnessNr = 1;
-    unsigned int aoNr = 1;
-
-    // Bind each texture with the appropriate counter
     for (unsigned int i = 0; i < textures.size(); i++)
     {
-        // Activate texture unit
-        glActiveTexture(GL_TEXTURE0 + i);
+        const std::string &type = textures[i].type;
 
-        // Get texture info
-        std::string name = textures[i].type;
-        std::string number;
-
-        // Determine which counter to use based on texture type
-        if (name == "texture_diffuse")
-            number = std::to_string(diffuseNr++);
-        else if (name == "texture_normal")
-            number = std::to_string(normalNr++);
-        else if (name == "texture_lightmap")
-            number = std::to_string(lightmapNr++);
-        else if (name == "texture_basecolor")
-            number = std::to_string(basecolorNr++);
-        else if (name == "texture_normal_camera")
-            number = std::to_string(normalCameraNr++);
-        else if (name == "texture_emission")
-            number = std::to_string(emissionNr++);
-        else if (name == "texture_specular")
-            number = std::to_string(specularNr++);
-        else if (name == "texture_ambient")
-            number = std::to_string(ambientNr++);
-        else if (name == "texture_emissive")
-            number = std::to_string(emissiveNr++);
-        else if (name == "texture_height")
-            number = std::to_string(heightNr++);
-        else if (name == "texture_shininess")
-            number = std::to_string(shininessNr++);
-        else if (name == "texture_opacity")
-            number = std::to_string(opacityNr++);
-        else if (name == "texture_displacement")
-            number = std::to_string(displacementNr++);
-        else if (name == "texture_reflection")
-            number = std::to_string(reflectionNr++);
-        else if (name == "texture_metalness")
-            number = std::to_string(metalnessNr++);
-        else if (name == "texture_ao")
-            number = std::to_string(aoNr++);
-
-        // Set the sampler uniform and bind the texture
-        std::string uniformName = "material." + name + number;
-        shader.setInt(uniformName.c_str(), i);
-        glBindTexture(GL_TEXTURE_2D, textures[i].id);
+        // Counted from 1 per type, in texture order
+        unsigned int number = 0;
+        if (numbered && std::find(std::begin(numberedTypes), std::end(numberedTypes), type) != std::end(numberedTypes))
+        {
+            number = 1;
+            for (unsigned int j = 0; j < i; ++j)
+                number += textures[j].type == type;
+        }
+
+        // Built on the stack, this runs for every mesh drawn
+        char uniformName[64];
+        int length = number ? std::snprintf(uniformName, sizeof(uniformName), "material.%s%u", type.c_str(), number)
+                            : std::snprintf(uniformName, sizeof(uniformName), "material.%s", type.c_str());
+        shader.getUniform<int>(std::string_view(uniformName, std::min<size_t>(length, sizeof(uniformName) - 1))).set(i);
+
+        unsigned int id = textures[i].getId();
+        if (i < trackedUnits && boundTextures[i] == id)
+        {
+            ++skipped;
+            continue;
+        }
+
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_2D, id);
+        if (i < trackedUnits)
+            boundTextures[i] = id;
     }
 
-    // Reset active texture
     glActiveTexture(GL_TEXTURE0);
+    return skipped;
+}
 
-    // Draw mesh
-    glBindVertexArray(vao);
-    glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
+void Mesh::bindLayout(MShader &shader)
+{
+    shader.setVec3("positionOffset", layout.positionOffset);
+    shader.setVec3("positionScale", layout.positionScale);
 }
 
-void Mesh::setupMesh()
+const MeshLod &Mesh::getLod(unsigned int lod) const
 {
-    glGenVertexArrays(1, &vao);
-    glGenBuffers(1, &vbo);
-    glGenBuffers(1, &ebo);
+    return lods[std::min<size_t>(lod, lods.size() - 1)];
+}
 
-    glBindVertexArray(vao);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+void Mesh::draw(unsigned int lod, unsigned int instanceCount, unsigned int baseInstance)
+{
+    const MeshLod &level = getLod(lod);
+    const void *offset = reinterpret_cast<const void *>(allocation.indexOffset + size_t(level.firstIndex) * getIndexSize());
+    GLint baseVertex = static_cast<GLint>(allocation.baseVertex);
+
+    // Meshes of one format share the vertex array, so consecutive draws don't rebind anything
+    pool->bind();
+    if (instanceCount == 1 && baseInstance == 0)
+        glDrawElementsBaseVertex(GL_TRIANGLES, level.indexCount, indexType, offset, baseVertex);
+    else
+        glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, level.indexCount, indexType, offset, instanceCount, baseVertex, baseInstance);
 
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(MVertex), &vertices[0], GL_STATIC_DRAW);
+    drawnTriangles += (unsigned long long)(level.indexCount / 3) * instanceCount;
+    ++drawnMeshes;
+}
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+void Mesh::render(MShader &shader, bool hasTexture, unsigned int lod)
+{
+    shader.use();
+    bindLayout(shader);
 
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(MVertex), (void *)0);
+    if (hasTexture)
+        bindTextures(shader);
 
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(MVertex), (void *)offsetof(MVertex, normal));
+    draw(lod, 1, 0);
+}
 
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(MVertex), (void *)offsetof(MVertex, texCoords));
+void Mesh::renderInstanced(MShader &shader, unsigned int instanceCount, bool hasTexture, unsigned int lod, unsigned int baseInstance)
+{
+    shader.use();
+    bindLayout(shader);
 
-    glEnableVertexAttribArray(3);
-    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(MVertex), (void *)offsetof(MVertex, tangent));
+    if (hasTexture)
+        bindTextures(shader);
+
+    draw(lod, instanceCount, baseInstance);
+}
+
+void Mesh::renderMultipleTextures(MShader &shader, unsigned int lod)
+{
+    shader.use();
+    bindLayout(shader);
+    bindTextures(shader, true);
+    draw(lod, 1, 0);
+}
+
+void Mesh::setupMesh(const void *vertexData, size_t vertexCount, const void *indexData, size_t indexCount)
+{
+    this->vertexCount = static_cast<unsigned int>(vertexCount);
+    this->indexCount = static_cast<unsigned int>(indexCount);
+    ready = vertexData != nullptr && indexData != nullptr;
+
+    lods.assign(1, MeshLod{0, this->indexCount, 0.f});
+
+    // Quantized positions already come with their box, callers with the source vertices set the exact one
+    boundsMin = layout.format == VertexFormat::PACKED_QUANTIZED ? layout.positionOffset : glm::vec3(0.f);
+    boundsMax = layout.format == VertexFormat::PACKED_QUANTIZED ? layout.positionOffset + layout.positionScale : glm::vec3(0.f);
+    sphereCenter = (boundsMin + boundsMax) * 0.5f;
+    sphereRadius = glm::length(boundsMax - boundsMin) * 0.5f;
+    uvDensity = 0.f;
+    node = 0;
+
+    pool = &MeshPool::get(layout.format);
+    allocation = pool->allocate(vertexCount, indexCount * getIndexSize());
+    pool->upload(allocation, vertexData, indexData);
+}
+
+size_t Mesh::getGeometryBytes() const
+{
+    return size_t(vertexCount) * layout.getStride() + size_t(indexCount) * getIndexSize();
+}
 
-    glEnableVertexAttribArray(4);
-    glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(MVertex), (void *)offsetof(MVertex, biTangent));
+void Mesh::setLods(std::vector<MeshLod> lods)
+{
+    if (lods.empty())
+        return;
+
+    for (const MeshLod &lod : lods)
+        if (size_t(lod.firstIndex) + lod.indexCount > indexCount)
+            throw std::runtime_error("Mesh LOD range outside of the index buffer");
 
-    glBindVertexArray(0);
+    this->lods = std::move(lods);
+}
+
+const std::vector<MeshLod> &Mesh::getLods() const
+{
+    return lods;
+}
+
+void Mesh::setBounds(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax)
+{
+    this->boundsMin = boundsMin;
+    this->boundsMax = boundsMax;
+}
+
+const glm::vec3 &Mesh::getBoundsMin() const
+{
+    return boundsMin;
+}
+
+const glm::vec3 &Mesh::getBoundsMax() const
+{
+    return boundsMax;
+}
+
+void Mesh::setBoundingSphere(const glm::vec3 &center, float radius)
+{
+    sphereCenter = center;
+    sphereRadius = radius;
+}
+
+const glm::vec3 &Mesh::getSphereCenter() const
+{
+    return sphereCenter;
+}
+
+float Mesh::getSphereRadius() const
+{
+    return sphereRadius;
+}
+
+void Mesh::setUvDensity(float uvDensity)
+{
+    this->uvDensity = uvDensity;
+}
+
+float Mesh::getUvDensity() const
+{
+    return uvDensity;
+}
+
+void Mesh::setNode(unsigned int node)
+{
+    this->node = node;
+}
+
+unsigned int Mesh::getNode() const
+{
+    return node;
+}
+
+size_t Mesh::getIndexSize() const
+{
+    return indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(unsigned int);
+}
+
+const VertexLayout &Mesh::getLayout() const
+{
+    return layout;
+}
+
+size_t Mesh::getCpuBytes() const
+{
+    return vertices.capacity() * sizeof(MVertex) + indices.capacity() * sizeof(unsigned int);
+}
+
+MeshPool *Mesh::getPool() const
+{
+    return pool;
+}
+
+const MeshPool::Allocation &Mesh::getAllocation() const
+{
+    return allocation;
+}
+
+void Mesh::release()
+{
+    if (pool)
+        pool->free(allocation);
+
+    pool = nullptr;
+    ready = false;
+}
+
+Mesh::~Mesh()
+{
+    release();
+}
+
+unsigned int MTexture::getId() const
+{
+    return resource ? resource->id : id;
 }
 
 void MTexture::loadTexture(const char *path)
 {
     glGenTextures(1, &id);
-    glBindTexture(GL_TEXTURE_2D, id);
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    int width, height, channels;
-    unsigned char *pixels = stbi_load(path, &width, &height, &channels, 0);
-    if (pixels)
-    {
-        GLenum format;
-        if (channels == 1)
-            format = GL_RED;
-        else if (channels == 3)
-            format = GL_RGB;
-        else if (channels == 4)
-            format = GL_RGBA;
-
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, pixels);
-        glGenerateMipmap(GL_TEXTURE_2D);
-    }
-    else
+    DecodedImage image;
+    if (!decodeImage(path, false, image))
         throw std::runtime_error("Failed to load texture");
 
-    stbi_image_free(pixels);
+    uploadTexture(id, image);
 }
 
 bool MTexture::loadTexture(const char *path, const std::string &directory, bool gamma)
@@ -180,31 +371,10 @@ bool MTexture::loadTexture(const char *path, const std::string &directory, bool
 
     glGenTextures(1, &id);
 
-    int width, height, channels;
-    stbi_set_flip_vertically_on_load(1);
-    unsigned char *pixels = stbi_load(filename.c_str(), &width, &height, &channels, 0);
-    if (pixels)
-    {
-        GLenum format;
-        if (channels == 1)
-            format = GL_RED;
-        else if (channels == 3)
-            format = GL_RGB;
-        else if (channels == 4)
-            format = GL_RGBA;
-
-        glBindTexture(GL_TEXTURE_2D, id);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, pixels);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    }
-    else
+    DecodedImage image;
+    if (!decodeImage(filename, true, image))
         throw std::runtime_error("Failed to load texture");
 
-    stbi_image_free(pixels);
+    uploadTexture(id, image);
     return true;
 }
@@ -1,19 +1,16 @@
 #ifndef __MESH_H__
 #define __MESH_H__
 #include "Shader.h"
+#include <memory>
 #include <string>
 #include <vector>
 #include "Camera.h"
+#include "VertexFormat.h"
+#include "MeshOptimizer.h"
+#include "MeshPool.h"
 #include "vector/Vec2.hpp"
 
-struct MVertex
-{
-    glm::vec3 position;
-    glm::vec3 normal;
-    glm::vec2 texCoords;
-    glm::vec3 tangent;
-    glm::vec3 biTangent;
-};
+struct TextureResource;
 
 struct MTexture
 {
@@ -21,34 +18,191 @@ struct MTexture
     std::string type;
     std::string path;
 
+    // Keeps a texture shared through the ResourceCache alive, empty for textures loaded directly
+    std::shared_ptr<TextureResource> resource;
+
+    // The resource's name, which changes when its image turns out to be a duplicate, otherwise 'id'
+    unsigned int getId() const;
+
     void loadTexture(const char *path);
 
     bool loadTexture(const char *path, const std::string &directory, bool gamma = false);
 };
 
+// Texture as referenced by a material, before it is loaded
+struct TextureRef
+{
+    std::string type;
+    std::string path;
+};
+
+// CPU side mesh produced by the importer, no GL objects attached yet
+struct ImportedMesh
+{
+    std::vector<MVertex> vertices;
+    std::vector<unsigned int> indices;
+    std::vector<TextureRef> textures;
+
+    // For formats other than FULL the vertices are converted into 'packedVertices' and 'vertices' is emptied
+    VertexLayout layout;
+    std::vector<unsigned char> packedVertices;
+
+    // Replaces 'indices' when every index fits in 16 bits
+    std::vector<uint16_t> shortIndices;
+
+    // Ranges of the detail levels inside the indices, see buildLodChain
+    std::vector<MeshLod> lods;
+
+    // Object space box around the vertices
+    glm::vec3 boundsMin = glm::vec3(0.f);
+    glm::vec3 boundsMax = glm::vec3(0.f);
+
+    // Object space sphere around the vertices, centered on the box, see computeBoundingRadius
+    glm::vec3 sphereCenter = glm::vec3(0.f);
+    float sphereRadius = 0.f;
+
+    // See computeUvDensity
+    float uvDensity = 0.f;
+
+    // Scene node the mesh was found under, its vertices are relative to that node
+    uint32_t node = 0;
+};
+
 typedef Shader MShader;
 
+// Owns a range of the MeshPool of its vertex format, so it can be moved but not copied
 class Mesh
 {
 public:
+    // Only filled when retainCpuGeometry is set, otherwise dropped as soon as the data is on the GPU
     std::vector<MVertex> vertices;
     std::vector<unsigned int> indices;
     std::vector<MTexture> textures;
 
-    Mesh(const std::vector<MVertex> &vertices, const std::vector<unsigned int> &indices,
-         const std::vector<MTexture> &textures, const Camera &camera);
+    static bool retainCpuGeometry;
+
+    Mesh(std::vector<MVertex> &&vertices, std::vector<unsigned int> &&indices,
+         std::vector<MTexture> textures, const Camera &camera);
+
+    // 'vertices' holds 'vertexCount' vertices in the layout's format, 'indices' holds 16 or 32 bit indices depending on 'indexSize'
+    Mesh(const void *vertices, size_t vertexCount, const VertexLayout &layout, const void *indices, size_t indexCount, size_t indexSize,
+         std::vector<MTexture> textures, const Camera &camera);
+
+    Mesh(const Mesh &) = delete;
+
+    Mesh &operator=(const Mesh &) = delete;
+
+    Mesh(Mesh &&other) noexcept;
+
+    Mesh &operator=(Mesh &&other) noexcept;
+
+    // False while a streamed mesh still has uploads in flight, such meshes are skipped when rendering
+    bool ready;
+
+    // Level 0 is the full mesh, levels past the end of the chain draw the coarsest one
+    void render(MShader &shader, bool hasTexture = true, unsigned int lod = 0);
+
+     void renderMultipleTextures(MShader& shader, unsigned int lod = 0);
+
+    // Draws 'instanceCount' copies in one call, per instance data is read by the shader through gl_BaseInstance + gl_InstanceID
+    void renderInstanced(MShader &shader, unsigned int instanceCount, bool hasTexture = true, unsigned int lod = 0, unsigned int baseInstance = 0);
+
+    // Replaces the single full detail level every mesh starts with, the ranges index the whole index buffer
+    void setLods(std::vector<MeshLod> lods);
+
+    const std::vector<MeshLod> &getLods() const;
 
-    void render(MShader &shader, bool hasTexture = true);
+    void setBounds(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax);
 
-     void renderMultipleTextures(MShader& shader);
+    const glm::vec3 &getBoundsMin() const;
+
+    const glm::vec3 &getBoundsMax() const;
+
+    void setBoundingSphere(const glm::vec3 &center, float radius);
+
+    const glm::vec3 &getSphereCenter() const;
+
+    float getSphereRadius() const;
+
+    // Texture coordinate units per object space unit, the TextureStreamer turns it into texel density on screen
+    void setUvDensity(float uvDensity);
+
+    float getUvDensity() const;
+
+    // Index into the scene nodes of the model's asset, see SceneGraph
+    void setNode(unsigned int node);
+
+    unsigned int getNode() const;
+
+    // Triangles submitted by all draws since the counter was last reset, includes every instance
+    static unsigned long long drawnTriangles;
+
+    // Meshes drawn since the counter was last reset, an instanced draw counts once, a multi draw once per command
+    static unsigned long long drawnMeshes;
+
+    size_t getGeometryBytes() const;
+
+    const VertexLayout &getLayout() const;
+
+    size_t getIndexSize() const;
+
+    // Bytes still held in 'vertices' and 'indices'
+    size_t getCpuBytes() const;
+
+    // Where the mesh lives inside its pool, the pool's vertex array draws it with baseVertex and indexOffset
+    MeshPool *getPool() const;
+
+    const MeshPool::Allocation &getAllocation() const;
+
+    // Returns the pool range, the mesh can not be rendered afterwards
+    void release();
+
+    ~Mesh();
 
     friend class Model;
+    friend class AssetStreamer;
+    friend class MultiDrawBatch;
+    friend class RenderQueue;
 private:
-    unsigned int vao, vbo, ebo;
+    MeshPool *pool;
+
+    MeshPool::Allocation allocation;
+
+    unsigned int vertexCount;
+
+    unsigned int indexCount;
+
+    // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+    unsigned int indexType;
+
+    VertexLayout layout;
+
+    std::vector<MeshLod> lods;
+
+    glm::vec3 boundsMin, boundsMax;
+
+    glm::vec3 sphereCenter;
+
+    float sphereRadius;
+
+    float uvDensity;
+
+    unsigned int node;
 
     const Camera *camera;
 
-    void setupMesh();
+    const MeshLod &getLod(unsigned int lod) const;
+
+    void draw(unsigned int lod, unsigned int instanceCount, unsigned int baseInstance);
+
+    // Samplers are named "material.<type>", numbered per type ("material.texture_diffuse1") when 'numbered' is set.
+    // Units below 'trackedUnits' that 'boundTextures' says already hold the texture are not rebound, returns how many were skipped
+    unsigned int bindTextures(MShader &shader, bool numbered = false, unsigned int *boundTextures = nullptr, unsigned int trackedUnits = 0);
+
+    // Dequantization of the vertex positions, see VertexLayout
+    void bindLayout(MShader &shader);
+
+    void setupMesh(const void *vertexData, size_t vertexCount, const void *indexData, size_t indexCount);
 
 };
 
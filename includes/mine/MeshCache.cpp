@@ -0,0 +1,536 @@
+#include "MeshCache.h"
+#include "LoadProfiler.h"
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <cstring>
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    constexpr char cacheMagic[4] = {'M', 'C', 'H', 'E'};
+
+    // Vertex and index streams start on this boundary so they can be used in place
+    constexpr size_t streamAlignment = 16;
+
+    // Writers of the same cache each get their own temporary file, the rename publishes whichever finishes last
+    std::atomic<uint64_t> tempCounter{0};
+
+    struct CacheHeader
+    {
+        char magic[4];
+        uint32_t version;
+        uint32_t importFlags;
+        uint32_t meshCount;
+        int64_t sourceTime;
+        uint64_t sourceSize;
+        uint32_t pathLength;
+        uint32_t vertexFormat;
+        uint32_t nodeCount;
+    };
+
+    struct CacheMeshHeader
+    {
+        uint32_t vertexCount;
+        uint32_t indexCount;
+        uint32_t textureCount;
+        uint32_t indexSize;
+        float positionOffset[3];
+        float positionScale[3];
+        uint32_t lodCount;
+        float boundsMin[3];
+        float boundsMax[3];
+        float sphereCenter[3];
+        float sphereRadius;
+        float uvDensity;
+        uint32_t node;
+    };
+
+    bool getSourceKey(const std::string &sourcePath, int64_t &time, uint64_t &size)
+    {
+        std::error_code error;
+        auto lastWrite = std::filesystem::last_write_time(sourcePath, error);
+        if (error)
+            return false;
+
+        size = std::filesystem::file_size(sourcePath, error);
+        if (error)
+            return false;
+
+        time = static_cast<int64_t>(lastWrite.time_since_epoch().count());
+        return true;
+    }
+
+    class CacheWriter
+    {
+        std::ofstream &out;
+
+    public:
+        CacheWriter(std::ofstream &out) : out(out)
+        {
+        }
+
+        void bytes(const void *data, size_t size)
+        {
+            out.write(static_cast<const char *>(data), size);
+        }
+
+        template <typename T>
+        void pod(const T &value)
+        {
+            bytes(&value, sizeof(T));
+        }
+
+        void string(const std::string &str)
+        {
+            pod(static_cast<uint32_t>(str.size()));
+            bytes(str.data(), str.size());
+        }
+
+        void align()
+        {
+            static const char zeros[streamAlignment] = {};
+            size_t offset = static_cast<size_t>(out.tellp());
+            size_t padding = (streamAlignment - offset % streamAlignment) % streamAlignment;
+            bytes(zeros, padding);
+        }
+    };
+
+    class CacheReader
+    {
+        const unsigned char *begin;
+        const unsigned char *current;
+        const unsigned char *end;
+
+    public:
+        CacheReader(const unsigned char *data, size_t size) : begin(data), current(data), end(data + size)
+        {
+        }
+
+        const unsigned char *bytes(size_t size)
+        {
+            if (static_cast<size_t>(end - current) < size)
+                return nullptr;
+
+            const unsigned char *result = current;
+            current += size;
+            return result;
+        }
+
+        template <typename T>
+        bool pod(T &value)
+        {
+            const unsigned char *src = bytes(sizeof(T));
+            if (!src)
+                return false;
+
+            std::memcpy(&value, src, sizeof(T));
+            return true;
+        }
+
+        bool string(std::string &str)
+        {
+            uint32_t length;
+            if (!pod(length))
+                return false;
+
+            const unsigned char *src = bytes(length);
+            if (!src)
+                return false;
+
+            str.assign(reinterpret_cast<const char *>(src), length);
+            return true;
+        }
+
+        bool align()
+        {
+            size_t offset = static_cast<size_t>(current - begin);
+            size_t padding = (streamAlignment - offset % streamAlignment) % streamAlignment;
+            return bytes(padding) != nullptr;
+        }
+    };
+}
+
+MappedFile::MappedFile() : data(nullptr), size(0)
+{
+#ifdef _WIN32
+    file = INVALID_HANDLE_VALUE;
+    mapping = nullptr;
+#else
+    fd = -1;
+#endif
+}
+
+bool MappedFile::open(const std::string &path)
+{
+    close();
+
+#ifdef _WIN32
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                       FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+    {
+        close();
+        return false;
+    }
+    size = static_cast<size_t>(fileSize.QuadPart);
+
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping)
+    {
+        close();
+        return false;
+    }
+
+    data = static_cast<const unsigned char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0)
+    {
+        close();
+        return false;
+    }
+    size = static_cast<size_t>(info.st_size);
+
+    void *view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    data = view == MAP_FAILED ? nullptr : static_cast<const unsigned char *>(view);
+#endif
+
+    if (!data)
+    {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void MappedFile::close()
+{
+#ifdef _WIN32
+    if (data)
+        UnmapViewOfFile(data);
+    if (mapping)
+        CloseHandle(mapping);
+    if (file != INVALID_HANDLE_VALUE)
+        CloseHandle(file);
+
+    file = INVALID_HANDLE_VALUE;
+    mapping = nullptr;
+#else
+    if (data)
+        munmap(const_cast<unsigned char *>(data), size);
+    if (fd >= 0)
+        ::close(fd);
+
+    fd = -1;
+#endif
+
+    data = nullptr;
+    size = 0;
+}
+
+const unsigned char *MappedFile::getData() const
+{
+    return data;
+}
+
+size_t MappedFile::getSize() const
+{
+    return size;
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MeshCache::enabled = true;
+
+std::string MeshCache::getCachePath(const std::string &sourcePath, VertexFormat format)
+{
+    switch (format)
+    {
+    case VertexFormat::PACKED:
+        return sourcePath + ".packed.mcache";
+    case VertexFormat::PACKED_QUANTIZED:
+        return sourcePath + ".quantized.mcache";
+    default:
+        return sourcePath + ".mcache";
+    }
+}
+
+bool MeshCache::write(const std::string &sourcePath, unsigned int importFlags, VertexFormat format, const std::vector<CookedMesh> &meshes,
+                      const std::vector<SceneNode> &nodes)
+{
+    ScopedLoadTimer timer(LoadStage::MESH_CACHE_WRITE);
+
+    CacheHeader header{};
+    std::memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+    header.version = version;
+    header.importFlags = importFlags;
+    header.meshCount = static_cast<uint32_t>(meshes.size());
+    header.pathLength = static_cast<uint32_t>(sourcePath.size());
+    header.vertexFormat = static_cast<uint32_t>(format);
+    header.nodeCount = static_cast<uint32_t>(nodes.size());
+
+    if (!getSourceKey(sourcePath, header.sourceTime, header.sourceSize))
+        return false;
+
+    std::string cachePath = getCachePath(sourcePath, format);
+    std::string tempPath = cachePath + '.' + std::to_string(tempCounter++) + ".tmp";
+
+    bool written;
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        if (!out.is_open())
+            return false;
+
+        CacheWriter writer(out);
+        writer.pod(header);
+        writer.bytes(sourcePath.data(), sourcePath.size());
+
+        for (const SceneNode &node : nodes)
+        {
+            writer.pod(node.parent);
+            writer.pod(node.local);
+            writer.string(node.name);
+        }
+
+        for (const CookedMesh &mesh : meshes)
+        {
+            CacheMeshHeader meshHeader{};
+            meshHeader.vertexCount = mesh.vertexCount;
+            meshHeader.indexCount = mesh.indexCount;
+            meshHeader.textureCount = static_cast<uint32_t>(mesh.textures.size());
+            meshHeader.indexSize = mesh.indexSize;
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                meshHeader.positionOffset[axis] = mesh.layout.positionOffset[axis];
+                meshHeader.positionScale[axis] = mesh.layout.positionScale[axis];
+                meshHeader.boundsMin[axis] = mesh.boundsMin[axis];
+                meshHeader.boundsMax[axis] = mesh.boundsMax[axis];
+                meshHeader.sphereCenter[axis] = mesh.sphereCenter[axis];
+            }
+            meshHeader.sphereRadius = mesh.sphereRadius;
+            meshHeader.lodCount = static_cast<uint32_t>(mesh.lods.size());
+            meshHeader.uvDensity = mesh.uvDensity;
+            meshHeader.node = mesh.node;
+            writer.pod(meshHeader);
+
+            for (const MeshLod &lod : mesh.lods)
+                writer.pod(lod);
+
+            for (const TextureRef &texture : mesh.textures)
+            {
+                writer.string(texture.type);
+                writer.string(texture.path);
+            }
+
+            writer.align();
+            writer.bytes(mesh.vertices, size_t(mesh.vertexCount) * mesh.layout.getStride());
+            writer.align();
+            writer.bytes(mesh.indices, size_t(mesh.indexCount) * mesh.indexSize);
+        }
+
+        written = out.good();
+    }
+
+    std::error_code error;
+    if (!written)
+    {
+        std::filesystem::remove(tempPath, error);
+        return false;
+    }
+
+    std::filesystem::rename(tempPath, cachePath, error);
+    if (error)
+    {
+        std::filesystem::remove(tempPath, error);
+        return false;
+    }
+
+    return true;
+}
+
+bool MeshCache::load(const std::string &sourcePath, unsigned int importFlags, VertexFormat format)
+{
+    ScopedLoadTimer timer(LoadStage::MESH_CACHE_READ);
+
+    meshes.clear();
+    nodes.clear();
+
+    int64_t sourceTime;
+    uint64_t sourceSize;
+    if (!getSourceKey(sourcePath, sourceTime, sourceSize))
+        return false;
+
+    if (!file.open(getCachePath(sourcePath, format)))
+        return false;
+
+    // Mapped, the pages are read as the meshes are used
+    timer.addBytesRead(file.getSize());
+
+    CacheReader reader(file.getData(), file.getSize());
+
+    CacheHeader header;
+    if (!reader.pod(header) ||
+        std::memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) != 0 ||
+        header.version != version ||
+        header.importFlags != importFlags ||
+        header.vertexFormat != static_cast<uint32_t>(format) ||
+        header.sourceTime != sourceTime ||
+        header.sourceSize != sourceSize ||
+        header.pathLength != sourcePath.size())
+    {
+        file.close();
+        return false;
+    }
+
+    const unsigned char *storedPath = reader.bytes(header.pathLength);
+    if (!storedPath || std::memcmp(storedPath, sourcePath.data(), header.pathLength) != 0)
+    {
+        file.close();
+        return false;
+    }
+
+    // Parents are stored before their children, SceneGraph relies on it
+    bool nodesValid = true;
+    for (uint32_t i = 0; i < header.nodeCount && nodesValid; ++i)
+    {
+        SceneNode node;
+        nodesValid = reader.pod(node.parent) && node.parent < int32_t(i) && reader.pod(node.local) && reader.string(node.name);
+        nodes.push_back(std::move(node));
+    }
+
+    meshes.reserve(header.meshCount);
+
+    for (uint32_t i = 0; i < header.meshCount && nodesValid; ++i)
+    {
+        CacheMeshHeader meshHeader;
+        if (!reader.pod(meshHeader))
+            break;
+
+        CookedMesh mesh;
+        mesh.vertexCount = meshHeader.vertexCount;
+        mesh.indexCount = meshHeader.indexCount;
+        mesh.indexSize = meshHeader.indexSize;
+        mesh.layout.format = format;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            mesh.layout.positionOffset[axis] = meshHeader.positionOffset[axis];
+            mesh.layout.positionScale[axis] = meshHeader.positionScale[axis];
+            mesh.boundsMin[axis] = meshHeader.boundsMin[axis];
+            mesh.boundsMax[axis] = meshHeader.boundsMax[axis];
+            mesh.sphereCenter[axis] = meshHeader.sphereCenter[axis];
+        }
+        mesh.sphereRadius = meshHeader.sphereRadius;
+        mesh.uvDensity = meshHeader.uvDensity;
+        mesh.node = meshHeader.node;
+
+        bool valid = (meshHeader.node < header.nodeCount || header.nodeCount == 0) &&
+                     (mesh.indexSize == sizeof(uint16_t) || mesh.indexSize == sizeof(uint32_t)) &&
+                     meshHeader.lodCount > 0 && meshHeader.lodCount <= maxLodLevels;
+        for (uint32_t j = 0; j < meshHeader.lodCount && valid; ++j)
+        {
+            MeshLod lod;
+            valid = reader.pod(lod) && size_t(lod.firstIndex) + lod.indexCount <= mesh.indexCount;
+            mesh.lods.push_back(lod);
+        }
+        for (uint32_t j = 0; j < meshHeader.textureCount && valid; ++j)
+        {
+            TextureRef texture;
+            valid = reader.string(texture.type) && reader.string(texture.path);
+            mesh.textures.push_back(std::move(texture));
+        }
+
+        const unsigned char *vertexData = valid && reader.align() ? reader.bytes(size_t(mesh.vertexCount) * mesh.layout.getStride()) : nullptr;
+        const unsigned char *indexData = vertexData && reader.align() ? reader.bytes(size_t(mesh.indexCount) * mesh.indexSize) : nullptr;
+
+        if (!vertexData || !indexData)
+            break;
+
+        mesh.vertices = vertexData;
+        mesh.indices = indexData;
+        meshes.push_back(std::move(mesh));
+    }
+
+    if (!nodesValid || meshes.size() != header.meshCount)
+    {
+        std::cout << "Mesh cache corrupted: " << getCachePath(sourcePath, format) << '\n';
+        meshes.clear();
+        nodes.clear();
+        file.close();
+        return false;
+    }
+
+    return true;
+}
+
+CookedMesh MeshCache::makeView(const ImportedMesh &mesh)
+{
+    CookedMesh view;
+    view.layout = mesh.layout;
+    if (mesh.layout.format == VertexFormat::FULL)
+    {
+        view.vertices = reinterpret_cast<const unsigned char *>(mesh.vertices.data());
+        view.vertexCount = static_cast<uint32_t>(mesh.vertices.size());
+    }
+    else
+    {
+        view.vertices = mesh.packedVertices.data();
+        view.vertexCount = static_cast<uint32_t>(mesh.packedVertices.size() / mesh.layout.getStride());
+    }
+    if (!mesh.shortIndices.empty())
+    {
+        view.indices = mesh.shortIndices.data();
+        view.indexCount = static_cast<uint32_t>(mesh.shortIndices.size());
+        view.indexSize = sizeof(uint16_t);
+    }
+    else
+    {
+        view.indices = mesh.indices.data();
+        view.indexCount = static_cast<uint32_t>(mesh.indices.size());
+        view.indexSize = sizeof(uint32_t);
+    }
+    view.lods = mesh.lods;
+    if (view.lods.empty())
+        view.lods.push_back({0, view.indexCount, 0.f});
+    view.boundsMin = mesh.boundsMin;
+    view.boundsMax = mesh.boundsMax;
+    view.sphereCenter = mesh.sphereCenter;
+    view.sphereRadius = mesh.sphereRadius;
+    view.uvDensity = mesh.uvDensity;
+    view.node = mesh.node;
+    view.textures = mesh.textures;
+    return view;
+}
+
+const std::vector<CookedMesh> &MeshCache::getMeshes() const
+{
+    return meshes;
+}
+
+const std::vector<SceneNode> &MeshCache::getNodes() const
+{
+    return nodes;
+}
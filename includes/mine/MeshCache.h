@@ -0,0 +1,99 @@
+#ifndef __MESHCACHE_H__
+#define __MESHCACHE_H__
+#include "Mesh.h"
+#include "SceneGraph.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Read only memory mapping of a whole file
+class MappedFile
+{
+    const unsigned char *data;
+    size_t size;
+
+#ifdef _WIN32
+    void *file;
+    void *mapping;
+#else
+    int fd;
+#endif
+
+public:
+    MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool open(const std::string &path);
+
+    void close();
+
+    const unsigned char *getData() const;
+
+    size_t getSize() const;
+
+    ~MappedFile();
+};
+
+// Points straight into the mapped cache file (valid while the MeshCache is alive) or into an ImportedMesh
+struct CookedMesh
+{
+    // vertexCount vertices in layout.format
+    const unsigned char *vertices;
+    uint32_t vertexCount;
+    VertexLayout layout;
+
+    // indexCount 16 or 32 bit indices, see indexSize
+    const void *indices;
+    uint32_t indexCount;
+    uint32_t indexSize;
+
+    // Detail levels inside the indices, level 0 first
+    std::vector<MeshLod> lods;
+
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+
+    glm::vec3 sphereCenter;
+    float sphereRadius;
+
+    float uvDensity;
+
+    uint32_t node;
+
+    std::vector<TextureRef> textures;
+};
+
+// Cooked binary copy of an imported model, written after the first Assimp import
+// and keyed by the source path, its modification time, the import flags and the vertex format
+class MeshCache
+{
+    MappedFile file;
+
+    std::vector<CookedMesh> meshes;
+
+    std::vector<SceneNode> nodes;
+
+public:
+    static constexpr uint32_t version = 7;
+
+    static bool enabled;
+
+    // Every vertex format gets its own file so models imported with different formats don't evict each other
+    static std::string getCachePath(const std::string &sourcePath, VertexFormat format = VertexFormat::FULL);
+
+    static bool write(const std::string &sourcePath, unsigned int importFlags, VertexFormat format, const std::vector<CookedMesh> &meshes,
+                      const std::vector<SceneNode> &nodes);
+
+    static CookedMesh makeView(const ImportedMesh &mesh);
+
+    bool load(const std::string &sourcePath, unsigned int importFlags, VertexFormat format);
+
+    const std::vector<CookedMesh> &getMeshes() const;
+
+    const std::vector<SceneNode> &getNodes() const;
+};
+
+#endif // __MESHCACHE_H__
@@ -0,0 +1,615 @@
+#include "MeshOptimizer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <string_view>
+#include <unordered_map>
+
+namespace
+{
+    // Scoring parameters of Forsyth's algorithm
+    constexpr unsigned int maxCacheSize = 32;
+    constexpr float cacheDecayPower = 1.5f;
+    constexpr float lastTriangleScore = 0.75f;
+    constexpr float valenceBoostScale = 2.f;
+    constexpr float valenceBoostPower = 0.5f;
+
+    float vertexScore(int cachePosition, unsigned int remainingTriangles)
+    {
+        if (remainingTriangles == 0)
+            return -1.f;
+
+        float score = 0.f;
+        if (cachePosition >= 0)
+        {
+            // The three vertices of the last triangle get a fixed score so the next one doesn't just reuse them
+            if (cachePosition < 3)
+                score = lastTriangleScore;
+            else
+                score = std::pow(1.f - float(cachePosition - 3) / (maxCacheSize - 3), cacheDecayPower);
+        }
+
+        // Vertices with few triangles left are finished first so they can leave the cache
+        return score + valenceBoostScale * std::pow(float(remainingTriangles), -valenceBoostPower);
+    }
+
+    std::string_view vertexBytes(const MVertex &vertex)
+    {
+        return std::string_view(reinterpret_cast<const char *>(&vertex), sizeof(MVertex));
+    }
+
+    // Symmetric 4x4 matrix summing area weighted squared distances to a set of planes, upper triangle row by row
+    struct Quadric
+    {
+        double m[10] = {};
+        double weight = 0.0;
+
+        void addPlane(const glm::dvec3 &normal, double d, double area)
+        {
+            double p[4] = {normal.x, normal.y, normal.z, d};
+            int k = 0;
+            for (int row = 0; row < 4; ++row)
+                for (int column = row; column < 4; ++column)
+                    m[k++] += area * p[row] * p[column];
+            weight += area;
+        }
+
+        void add(const Quadric &other)
+        {
+            for (int k = 0; k < 10; ++k)
+                m[k] += other.m[k];
+            weight += other.weight;
+        }
+
+        // Mean squared distance of the point to the planes
+        double evaluate(const glm::vec3 &point) const
+        {
+            if (weight <= 0.0)
+                return 0.0;
+
+            double x = point.x, y = point.y, z = point.z;
+            double result = m[0] * x * x + 2.0 * m[1] * x * y + 2.0 * m[2] * x * z + 2.0 * m[3] * x +
+                            m[4] * y * y + 2.0 * m[5] * y * z + 2.0 * m[6] * y +
+                            m[7] * z * z + 2.0 * m[8] * z +
+                            m[9];
+            return result > 0.0 ? result / weight : 0.0;
+        }
+    };
+
+    struct Collapse
+    {
+        unsigned int from;
+        unsigned int to;
+        double cost;
+    };
+
+    // Triangles using each vertex, rebuilt after every collapse pass
+    struct TriangleAdjacency
+    {
+        std::vector<unsigned int> offsets;
+        std::vector<unsigned int> triangles;
+
+        void build(const std::vector<unsigned int> &indices, size_t vertexCount)
+        {
+            offsets.assign(vertexCount + 1, 0);
+            for (unsigned int index : indices)
+                ++offsets[index + 1];
+            for (size_t v = 0; v < vertexCount; ++v)
+                offsets[v + 1] += offsets[v];
+
+            triangles.resize(indices.size());
+            std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+            for (size_t i = 0; i < indices.size(); ++i)
+                triangles[fill[indices[i]]++] = static_cast<unsigned int>(i / 3);
+        }
+    };
+
+    // Moving 'from' onto 'to' must not turn any remaining triangle around 'from' upside down
+    bool flipsTriangle(const std::vector<MVertex> &vertices, const std::vector<unsigned int> &indices,
+                       const TriangleAdjacency &adjacency, unsigned int from, unsigned int to)
+    {
+        const glm::vec3 &target = vertices[to].position;
+
+        for (unsigned int i = adjacency.offsets[from]; i < adjacency.offsets[from + 1]; ++i)
+        {
+            const unsigned int *triangle = &indices[adjacency.triangles[i] * 3];
+            if (triangle[0] == to || triangle[1] == to || triangle[2] == to)
+                continue;
+
+            glm::vec3 before[3], after[3];
+            for (int k = 0; k < 3; ++k)
+            {
+                before[k] = vertices[triangle[k]].position;
+                after[k] = triangle[k] == from ? target : before[k];
+            }
+
+            glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+            glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+            if (glm::dot(normalBefore, normalAfter) <= 0.f)
+                return true;
+        }
+
+        return false;
+    }
+}
+
+VertexCacheStats analyzeVertexCache(const std::vector<unsigned int> &indices, size_t vertexCount, unsigned int cacheSize)
+{
+    VertexCacheStats stats;
+    if (indices.empty() || vertexCount == 0)
+        return stats;
+
+    // Miss count right after each vertex was loaded, 0 for vertices never loaded.
+    // A vertex stays in the FIFO until cacheSize more vertices were loaded after it
+    std::vector<unsigned int> loadedAt(vertexCount, 0);
+    std::vector<bool> referenced(vertexCount, false);
+    unsigned int misses = 0;
+    size_t unique = 0;
+
+    for (unsigned int index : indices)
+    {
+        if (loadedAt[index] == 0 || misses - loadedAt[index] >= cacheSize)
+        {
+            ++misses;
+            loadedAt[index] = misses;
+        }
+
+        if (!referenced[index])
+        {
+            referenced[index] = true;
+            ++unique;
+        }
+    }
+
+    stats.acmr = float(misses) / float(indices.size() / 3);
+    stats.atvr = float(misses) / float(unique);
+    return stats;
+}
+
+size_t weldVertices(std::vector<MVertex> &vertices, std::vector<unsigned int> &indices)
+{
+    std::vector<MVertex> welded;
+    welded.reserve(vertices.size());
+
+    std::vector<unsigned int> remap(vertices.size());
+    std::unordered_map<std::string_view, unsigned int> unique;
+    unique.reserve(vertices.size());
+
+    for (size_t i = 0; i < vertices.size(); ++i)
+    {
+        auto entry = unique.emplace(vertexBytes(vertices[i]), static_cast<unsigned int>(welded.size()));
+        if (entry.second)
+            welded.push_back(vertices[i]);
+
+        remap[i] = entry.first->second;
+    }
+
+    // The keys point into 'vertices', so it is only replaced once the map is done
+    unique.clear();
+
+    for (unsigned int &index : indices)
+        index = remap[index];
+
+    vertices.swap(welded);
+    return vertices.size();
+}
+
+void optimizeVertexCache(std::vector<unsigned int> &indices, size_t vertexCount)
+{
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return;
+
+    // Triangles using each vertex, the first 'remaining[v]' entries of a vertex are the ones not emitted yet
+    std::vector<unsigned int> offsets(vertexCount + 1, 0);
+    for (unsigned int index : indices)
+        ++offsets[index + 1];
+    for (size_t v = 0; v < vertexCount; ++v)
+        offsets[v + 1] += offsets[v];
+
+    std::vector<unsigned int> remaining(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v)
+        remaining[v] = offsets[v + 1] - offsets[v];
+
+    std::vector<unsigned int> adjacency(indices.size());
+    {
+        std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < indices.size(); ++i)
+            adjacency[fill[indices[i]]++] = static_cast<unsigned int>(i / 3);
+    }
+
+    std::vector<int> cachePosition(vertexCount, -1);
+    std::vector<float> scores(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v)
+        scores[v] = vertexScore(-1, remaining[v]);
+
+    std::vector<float> triangleScores(triangleCount);
+    for (size_t t = 0; t < triangleCount; ++t)
+        triangleScores[t] = scores[indices[t * 3]] + scores[indices[t * 3 + 1]] + scores[indices[t * 3 + 2]];
+
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<unsigned int> result;
+    result.reserve(indices.size());
+
+    std::vector<unsigned int> cache, nextCache;
+    cache.reserve(maxCacheSize + 3);
+    nextCache.reserve(maxCacheSize + 3);
+
+    size_t scanCursor = 0;
+    long long best = 0;
+    for (size_t t = 1; t < triangleCount; ++t)
+        if (triangleScores[t] > triangleScores[best])
+            best = static_cast<long long>(t);
+
+    while (result.size() < indices.size())
+    {
+        // Nothing useful in the cache, continue with the next triangle that is left
+        if (best < 0)
+        {
+            while (emitted[scanCursor])
+                ++scanCursor;
+            best = static_cast<long long>(scanCursor);
+        }
+
+        const unsigned int *triangle = &indices[best * 3];
+        emitted[best] = true;
+        nextCache.clear();
+
+        for (int k = 0; k < 3; ++k)
+        {
+            unsigned int v = triangle[k];
+            result.push_back(v);
+
+            unsigned int *begin = &adjacency[offsets[v]];
+            for (unsigned int i = 0; i < remaining[v]; ++i)
+                if (begin[i] == best)
+                {
+                    std::swap(begin[i], begin[remaining[v] - 1]);
+                    --remaining[v];
+                    break;
+                }
+
+            if (std::find(nextCache.begin(), nextCache.end(), v) == nextCache.end())
+                nextCache.push_back(v);
+        }
+
+        for (unsigned int v : cache)
+            if (std::find(nextCache.begin(), nextCache.end(), v) == nextCache.end())
+                nextCache.push_back(v);
+
+        for (size_t i = 0; i < nextCache.size(); ++i)
+        {
+            unsigned int v = nextCache[i];
+            cachePosition[v] = i < maxCacheSize ? static_cast<int>(i) : -1;
+            scores[v] = vertexScore(cachePosition[v], remaining[v]);
+        }
+
+        best = -1;
+        float bestScore = -1.f;
+
+        for (unsigned int v : nextCache)
+            for (unsigned int i = 0; i < remaining[v]; ++i)
+            {
+                unsigned int t = adjacency[offsets[v] + i];
+                const unsigned int *candidate = &indices[t * 3];
+                triangleScores[t] = scores[candidate[0]] + scores[candidate[1]] + scores[candidate[2]];
+
+                if (triangleScores[t] > bestScore)
+                {
+                    bestScore = triangleScores[t];
+                    best = t;
+                }
+            }
+
+        if (nextCache.size() > maxCacheSize)
+            nextCache.resize(maxCacheSize);
+        cache.swap(nextCache);
+    }
+
+    indices.swap(result);
+}
+
+size_t optimizeVertexFetch(std::vector<MVertex> &vertices, std::vector<unsigned int> &indices)
+{
+    constexpr unsigned int unused = ~0u;
+    std::vector<unsigned int> remap(vertices.size(), unused);
+    unsigned int next = 0;
+
+    for (unsigned int &index : indices)
+    {
+        if (remap[index] == unused)
+            remap[index] = next++;
+        index = remap[index];
+    }
+
+    std::vector<MVertex> reordered(next);
+    for (size_t i = 0; i < vertices.size(); ++i)
+        if (remap[i] != unused)
+            reordered[remap[i]] = vertices[i];
+
+    vertices.swap(reordered);
+    return vertices.size();
+}
+
+MeshOptimizationStats optimizeMesh(std::vector<MVertex> &vertices, std::vector<unsigned int> &indices)
+{
+    MeshOptimizationStats stats;
+    stats.verticesBefore = vertices.size();
+    stats.triangles = indices.size() / 3;
+    stats.before = analyzeVertexCache(indices, vertices.size());
+
+    weldVertices(vertices, indices);
+    optimizeVertexCache(indices, vertices.size());
+    optimizeVertexFetch(vertices, indices);
+
+    stats.verticesAfter = vertices.size();
+    stats.after = analyzeVertexCache(indices, vertices.size());
+    stats.shortIndices = vertices.size() <= 0xFFFF;
+    return stats;
+}
+
+std::vector<MeshLod> buildLodChain(const std::vector<MVertex> &vertices, std::vector<unsigned int> &indices,
+                                   unsigned int maxLevels, float ratio)
+{
+    std::vector<MeshLod> lods;
+    lods.push_back({0, static_cast<uint32_t>(indices.size()), 0.f});
+
+    const size_t vertexCount = vertices.size();
+    if (maxLevels <= 1 || indices.size() < 3 * 64)
+        return lods;
+
+    // Attribute copies of one position collapse as one, the id is the first vertex with that position
+    std::vector<unsigned int> positionId(vertexCount);
+    std::vector<unsigned int> copies(vertexCount, 0);
+    {
+        std::unordered_map<std::string_view, unsigned int> unique;
+        unique.reserve(vertexCount);
+        for (size_t v = 0; v < vertexCount; ++v)
+        {
+            auto bytes = std::string_view(reinterpret_cast<const char *>(&vertices[v].position), sizeof(glm::vec3));
+            positionId[v] = unique.emplace(bytes, static_cast<unsigned int>(v)).first->second;
+            ++copies[positionId[v]];
+        }
+    }
+
+    std::vector<bool> locked(vertexCount, false);
+    for (size_t v = 0; v < vertexCount; ++v)
+        locked[v] = copies[positionId[v]] > 1;
+
+    // Edges used by a single triangle are open borders, their ends stay put so holes don't grow
+    {
+        std::unordered_map<uint64_t, unsigned int> edgeUse;
+        edgeUse.reserve(indices.size());
+        auto edgeKey = [&](unsigned int a, unsigned int b)
+        {
+            a = positionId[a];
+            b = positionId[b];
+            return a < b ? (uint64_t(a) << 32) | b : (uint64_t(b) << 32) | a;
+        };
+
+        for (size_t i = 0; i < indices.size(); i += 3)
+            for (int k = 0; k < 3; ++k)
+                ++edgeUse[edgeKey(indices[i + k], indices[i + (k + 1) % 3])];
+
+        for (size_t i = 0; i < indices.size(); i += 3)
+            for (int k = 0; k < 3; ++k)
+            {
+                unsigned int a = indices[i + k], b = indices[i + (k + 1) % 3];
+                if (edgeUse[edgeKey(a, b)] == 1)
+                    locked[a] = locked[b] = true;
+            }
+    }
+
+    std::vector<Quadric> quadrics(vertexCount);
+    for (size_t i = 0; i < indices.size(); i += 3)
+    {
+        glm::dvec3 p0 = vertices[indices[i]].position;
+        glm::dvec3 p1 = vertices[indices[i + 1]].position;
+        glm::dvec3 p2 = vertices[indices[i + 2]].position;
+
+        glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+        double length = glm::length(normal);
+        if (length <= 0.0)
+            continue;
+        normal /= length;
+
+        for (int k = 0; k < 3; ++k)
+            quadrics[indices[i + k]].addPlane(normal, -glm::dot(normal, p0), length * 0.5);
+    }
+
+    // Collapses moving the surface by more than this are never taken, it keeps the coarsest levels recognizable
+    glm::vec3 boundsMin = vertices[0].position, boundsMax = vertices[0].position;
+    for (const MVertex &vertex : vertices)
+    {
+        boundsMin = glm::min(boundsMin, vertex.position);
+        boundsMax = glm::max(boundsMax, vertex.position);
+    }
+    double maxCollapseError = 0.02 * glm::length(boundsMax - boundsMin);
+    double maxCollapseCost = maxCollapseError * maxCollapseError;
+
+    std::vector<unsigned int> current = indices;
+    std::vector<unsigned int> chain = indices;
+    std::vector<unsigned int> remap(vertexCount);
+    std::vector<bool> touched(vertexCount);
+    std::vector<Collapse> collapses;
+    TriangleAdjacency adjacency;
+    double maxCost = 0.0;
+
+    size_t previousTriangles = indices.size() / 3;
+
+    while (lods.size() < maxLevels)
+    {
+        size_t target = static_cast<size_t>(previousTriangles * ratio);
+
+        // Every pass collapses an independent set of the cheapest edges, no two of them share a triangle
+        while (current.size() / 3 > target)
+        {
+            adjacency.build(current, vertexCount);
+
+            collapses.clear();
+            for (size_t i = 0; i < current.size(); i += 3)
+                for (int k = 0; k < 3; ++k)
+                {
+                    unsigned int a = current[i + k], b = current[i + (k + 1) % 3];
+                    Quadric combined = quadrics[a];
+                    combined.add(quadrics[b]);
+
+                    if (!locked[a])
+                        collapses.push_back({a, b, combined.evaluate(vertices[b].position)});
+                    if (!locked[b])
+                        collapses.push_back({b, a, combined.evaluate(vertices[a].position)});
+                }
+
+            if (collapses.empty())
+                break;
+
+            std::sort(collapses.begin(), collapses.end(), [](const Collapse &a, const Collapse &b)
+                      { return a.cost < b.cost; });
+
+            for (size_t v = 0; v < vertexCount; ++v)
+                remap[v] = static_cast<unsigned int>(v);
+            std::fill(touched.begin(), touched.end(), false);
+
+            size_t removable = current.size() / 3 - target;
+            size_t removed = 0;
+
+            for (const Collapse &collapse : collapses)
+            {
+                if (collapse.cost > maxCollapseCost)
+                    break;
+
+                if (touched[collapse.from] || touched[collapse.to])
+                    continue;
+
+                if (flipsTriangle(vertices, current, adjacency, collapse.from, collapse.to))
+                    continue;
+
+                remap[collapse.from] = collapse.to;
+                quadrics[collapse.to].add(quadrics[collapse.from]);
+                maxCost = std::max(maxCost, collapse.cost);
+
+                // The whole one-ring is frozen for this pass so the flip test above stays valid
+                for (unsigned int i = adjacency.offsets[collapse.from]; i < adjacency.offsets[collapse.from + 1]; ++i)
+                {
+                    const unsigned int *triangle = &current[adjacency.triangles[i] * 3];
+                    touched[triangle[0]] = touched[triangle[1]] = touched[triangle[2]] = true;
+                    if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to)
+                        ++removed;
+                }
+
+                if (removed >= removable)
+                    break;
+            }
+
+            if (removed == 0)
+                break;
+
+            size_t write = 0;
+            for (size_t i = 0; i < current.size(); i += 3)
+            {
+                unsigned int a = remap[current[i]], b = remap[current[i + 1]], c = remap[current[i + 2]];
+                if (a == b || b == c || a == c)
+                    continue;
+
+                current[write++] = a;
+                current[write++] = b;
+                current[write++] = c;
+            }
+            current.resize(write);
+        }
+
+        size_t triangles = current.size() / 3;
+
+        // Not worth another level, the simplifier ran into locked vertices
+        if (triangles == 0 || triangles > previousTriangles * 0.9)
+            break;
+
+        std::vector<unsigned int> level = current;
+        optimizeVertexCache(level, vertexCount);
+
+        // The root of the mean squared plane distance of the worst collapse so far
+        lods.push_back({static_cast<uint32_t>(chain.size()), static_cast<uint32_t>(level.size()),
+                        static_cast<float>(std::sqrt(maxCost))});
+        chain.insert(chain.end(), level.begin(), level.end());
+
+        previousTriangles = triangles;
+    }
+
+    indices.swap(chain);
+    return lods;
+}
+
+float computeUvDensity(const std::vector<MVertex> &vertices, const std::vector<unsigned int> &indices)
+{
+    double uvArea = 0.0, area = 0.0;
+
+    for (size_t i = 0; i + 2 < indices.size(); i += 3)
+    {
+        const MVertex &a = vertices[indices[i]];
+        const MVertex &b = vertices[indices[i + 1]];
+        const MVertex &c = vertices[indices[i + 2]];
+
+        area += glm::length(glm::cross(b.position - a.position, c.position - a.position));
+
+        glm::vec2 u = b.texCoords - a.texCoords, v = c.texCoords - a.texCoords;
+        uvArea += std::abs(u.x * v.y - u.y * v.x);
+    }
+
+    if (area <= 0.0 || uvArea <= 0.0)
+        return 0.f;
+
+    return static_cast<float>(std::sqrt(uvArea / area));
+}
+
+float computeBoundingRadius(const std::vector<MVertex> &vertices, const glm::vec3 &center)
+{
+    float radiusSquared = 0.f;
+    for (const MVertex &vertex : vertices)
+    {
+        glm::vec3 offset = vertex.position - center;
+        radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+    }
+
+    return std::sqrt(radiusSquared);
+}
+
+std::string formatOptimizationReport(const std::string &path, const std::vector<MeshOptimizationStats> &stats)
+{
+    std::ostringstream report;
+    report << std::fixed << std::setprecision(3)
+           << "Mesh optimization: " << path << " (FIFO " << statsCacheSize << ")\n"
+           << "  mesh    triangles    vertices before -> after     ACMR before -> after    ATVR before -> after   indices   LOD triangles\n";
+
+    size_t triangles = 0, verticesBefore = 0, verticesAfter = 0;
+    double missesBefore = 0.0, missesAfter = 0.0;
+
+    for (size_t i = 0; i < stats.size(); ++i)
+    {
+        const MeshOptimizationStats &mesh = stats[i];
+        report << "  " << std::setw(4) << i
+               << std::setw(13) << mesh.triangles
+               << std::setw(19) << mesh.verticesBefore << " -> " << std::setw(8) << mesh.verticesAfter
+               << std::setw(15) << mesh.before.acmr << " -> " << std::setw(6) << mesh.after.acmr
+               << std::setw(15) << mesh.before.atvr << " -> " << std::setw(6) << mesh.after.atvr
+               << std::setw(10) << (mesh.shortIndices ? "16 bit" : "32 bit") << "   ";
+
+        for (size_t level = 1; level < mesh.lodTriangles.size(); ++level)
+            report << (level > 1 ? " / " : "") << mesh.lodTriangles[level];
+        report << '\n';
+
+        triangles += mesh.triangles;
+        verticesBefore += mesh.verticesBefore;
+        verticesAfter += mesh.verticesAfter;
+        missesBefore += double(mesh.before.acmr) * mesh.triangles;
+        missesAfter += double(mesh.after.acmr) * mesh.triangles;
+    }
+
+    if (triangles > 0)
+        report << "  total" << std::setw(12) << triangles
+               << std::setw(19) << verticesBefore << " -> " << std::setw(8) << verticesAfter
+               << std::setw(15) << missesBefore / triangles << " -> " << std::setw(6) << missesAfter / triangles << '\n';
+
+    return report.str();
+}
@@ -0,0 +1,76 @@
+#ifndef __MESHOPTIMIZER_H__
+#define __MESHOPTIMIZER_H__
+#include "VertexFormat.h"
+#include <string>
+#include <vector>
+
+// Post-transform cache efficiency of an index buffer, simulated with a FIFO cache.
+// acmr: transformed vertices per triangle (0.5 is the ideal for regular grids, 3 the worst)
+// atvr: transformed vertices per unique vertex (1 is the ideal)
+struct VertexCacheStats
+{
+    float acmr = 0.f;
+    float atvr = 0.f;
+};
+
+struct MeshOptimizationStats
+{
+    size_t verticesBefore = 0;
+    size_t verticesAfter = 0;
+    size_t triangles = 0;
+
+    VertexCacheStats before;
+    VertexCacheStats after;
+
+    bool shortIndices = false;
+
+    // Triangles of every detail level, filled in by the importer after buildLodChain
+    std::vector<uint32_t> lodTriangles;
+};
+
+// Cache size the stats are simulated with, matches the smaller post-transform caches of current GPUs
+constexpr unsigned int statsCacheSize = 16;
+
+VertexCacheStats analyzeVertexCache(const std::vector<unsigned int> &indices, size_t vertexCount, unsigned int cacheSize = statsCacheSize);
+
+// Merges bit-identical vertices and rewrites the indices, returns the new vertex count
+size_t weldVertices(std::vector<MVertex> &vertices, std::vector<unsigned int> &indices);
+
+// Reorders triangles for post-transform cache reuse (Forsyth's linear-speed algorithm)
+void optimizeVertexCache(std::vector<unsigned int> &indices, size_t vertexCount);
+
+// Reorders vertices into first-use order of the indices and drops unreferenced ones, returns the new vertex count
+size_t optimizeVertexFetch(std::vector<MVertex> &vertices, std::vector<unsigned int> &indices);
+
+// Runs all of the above in order
+MeshOptimizationStats optimizeMesh(std::vector<MVertex> &vertices, std::vector<unsigned int> &indices);
+
+// Index range of one detail level inside a mesh's index buffer.
+// 'error' is the largest object space distance the level deviates from the full mesh by
+struct MeshLod
+{
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    float error;
+};
+
+constexpr unsigned int maxLodLevels = 5;
+
+// Simplifies the mesh by edge collapses driven by quadric error metrics, reusing the existing vertices.
+// Every level keeps about 'ratio' of the previous level's triangles, the chain ends early once a level barely shrinks.
+// Vertices on open borders and on attribute seams are never moved.
+// 'indices' is replaced by all levels back to back (level 0 first, unchanged), each one cache optimized
+std::vector<MeshLod> buildLodChain(const std::vector<MVertex> &vertices, std::vector<unsigned int> &indices,
+                                   unsigned int maxLevels = maxLodLevels, float ratio = 0.25f);
+
+// Texture coordinate units per object space unit, the square root of the summed uv area over the summed triangle area.
+// Multiplied with a texture's size it gives the texels one unit of the mesh covers, 0 without texture coordinates
+float computeUvDensity(const std::vector<MVertex> &vertices, const std::vector<unsigned int> &indices);
+
+// Distance from 'center' to the farthest vertex, centered on the box this is tighter than half its diagonal
+float computeBoundingRadius(const std::vector<MVertex> &vertices, const glm::vec3 &center);
+
+// One line per mesh plus totals, for the import log
+std::string formatOptimizationReport(const std::string &path, const std::vector<MeshOptimizationStats> &stats);
+
+#endif // __MESHOPTIMIZER_H__
@@ -0,0 +1,300 @@
+#include "../GL/glad.h"
+#include "MeshPool.h"
+#include <algorithm>
+#include <memory>
+
+namespace
+{
+    size_t alignUp(size_t value, size_t alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    // Replaces 'buffer' by a larger one holding the same contents
+    void growBuffer(unsigned int &buffer, size_t oldSize, size_t newSize)
+    {
+        unsigned int grown;
+        glGenBuffers(1, &grown);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, grown);
+        glBufferData(GL_COPY_WRITE_BUFFER, newSize, nullptr, GL_STATIC_DRAW);
+
+        if (oldSize > 0)
+        {
+            glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, oldSize);
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        }
+
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        glDeleteBuffers(1, &buffer);
+        buffer = grown;
+    }
+}
+
+bool RangeAllocator::allocate(size_t size, size_t alignment, size_t &offset)
+{
+    for (auto range = freeRanges.begin(); range != freeRanges.end(); ++range)
+    {
+        size_t start = alignUp(range->first, alignment);
+        size_t end = range->first + range->second;
+        if (start + size > end)
+            continue;
+
+        size_t rangeStart = range->first;
+        freeRanges.erase(range);
+
+        if (start > rangeStart)
+            freeRanges.emplace(rangeStart, start - rangeStart);
+        if (start + size < end)
+            freeRanges.emplace(start + size, end - start - size);
+
+        offset = start;
+        return true;
+    }
+
+    return false;
+}
+
+void RangeAllocator::free(size_t offset, size_t size)
+{
+    if (size == 0)
+        return;
+
+    auto next = freeRanges.lower_bound(offset);
+
+    if (next != freeRanges.end() && offset + size == next->first)
+    {
+        size += next->second;
+        next = freeRanges.erase(next);
+    }
+
+    if (next != freeRanges.begin())
+    {
+        auto previous = std::prev(next);
+        if (previous->first + previous->second == offset)
+        {
+            previous->second += size;
+            return;
+        }
+    }
+
+    freeRanges.emplace(offset, size);
+}
+
+void RangeAllocator::grow(size_t newCapacity)
+{
+    if (newCapacity <= capacity)
+        return;
+
+    size_t oldCapacity = capacity;
+    capacity = newCapacity;
+    free(oldCapacity, newCapacity - oldCapacity);
+}
+
+size_t RangeAllocator::getCapacity() const
+{
+    return capacity;
+}
+
+size_t RangeAllocator::getFreeTail() const
+{
+    if (freeRanges.empty())
+        return 0;
+
+    auto last = std::prev(freeRanges.end());
+    return last->first + last->second == capacity ? last->second : 0;
+}
+
+unsigned int MeshPool::boundVao = 0;
+
+std::unique_ptr<MeshPool> MeshPool::pools[3];
+
+MeshPool &MeshPool::get(VertexFormat format)
+{
+    std::unique_ptr<MeshPool> &pool = pools[static_cast<size_t>(format)];
+    if (!pool)
+        pool.reset(new MeshPool(format));
+    return *pool;
+}
+
+void MeshPool::releaseAll()
+{
+    for (std::unique_ptr<MeshPool> &pool : pools)
+        pool.reset();
+    boundVao = 0;
+}
+
+MeshPool::MeshPool(VertexFormat format) : format(format), vao(0), vbo(0), ebo(0), usedVertices(0), usedIndexBytes(0)
+{
+}
+
+void MeshPool::create()
+{
+    glGenVertexArrays(1, &vao);
+
+    size_t stride = getStride();
+    size_t vertexCapacity = initialVertexBytes / stride;
+
+    growBuffer(vbo, 0, vertexCapacity * stride);
+    growBuffer(ebo, 0, initialIndexBytes);
+
+    vertexRanges.grow(vertexCapacity);
+    indexRanges.grow(initialIndexBytes);
+
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    setupVertexAttributes(format);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    boundVao = 0;
+}
+
+void MeshPool::growVertices(size_t minimumVertices)
+{
+    size_t capacity = vertexRanges.getCapacity();
+    size_t needed = capacity - vertexRanges.getFreeTail() + minimumVertices;
+    size_t grown = std::max(capacity * 2, needed);
+
+    size_t stride = getStride();
+    growBuffer(vbo, capacity * stride, grown * stride);
+    vertexRanges.grow(grown);
+
+    // The attribute pointers captured the old buffer
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    setupVertexAttributes(format);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    boundVao = 0;
+}
+
+void MeshPool::growIndices(size_t minimumBytes)
+{
+    size_t capacity = indexRanges.getCapacity();
+    size_t needed = capacity - indexRanges.getFreeTail() + minimumBytes;
+    size_t grown = alignUp(std::max(capacity * 2, needed), sizeof(uint32_t));
+
+    growBuffer(ebo, capacity, grown);
+    indexRanges.grow(grown);
+
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    glBindVertexArray(0);
+    boundVao = 0;
+}
+
+MeshPool::Allocation MeshPool::allocate(size_t vertexCount, size_t indexBytes)
+{
+    if (vao == 0)
+        create();
+
+    Allocation allocation;
+    allocation.vertexCount = static_cast<uint32_t>(vertexCount);
+    allocation.indexBytes = indexBytes;
+
+    // Every range starts on a 32 bit boundary so either index size can be read from it
+    size_t reservedIndexBytes = alignUp(indexBytes, sizeof(uint32_t));
+
+    size_t baseVertex;
+    if (!vertexRanges.allocate(vertexCount, 1, baseVertex))
+    {
+        growVertices(vertexCount);
+        vertexRanges.allocate(vertexCount, 1, baseVertex);
+    }
+    allocation.baseVertex = static_cast<uint32_t>(baseVertex);
+
+    if (!indexRanges.allocate(reservedIndexBytes, sizeof(uint32_t), allocation.indexOffset))
+    {
+        growIndices(reservedIndexBytes);
+        indexRanges.allocate(reservedIndexBytes, sizeof(uint32_t), allocation.indexOffset);
+    }
+
+    usedVertices += vertexCount;
+    usedIndexBytes += reservedIndexBytes;
+    return allocation;
+}
+
+void MeshPool::free(const Allocation &allocation)
+{
+    vertexRanges.free(allocation.baseVertex, allocation.vertexCount);
+    size_t reservedIndexBytes = alignUp(allocation.indexBytes, sizeof(uint32_t));
+    indexRanges.free(allocation.indexOffset, reservedIndexBytes);
+
+    usedVertices -= allocation.vertexCount;
+    usedIndexBytes -= reservedIndexBytes;
+}
+
+void MeshPool::upload(const Allocation &allocation, const void *vertices, const void *indices)
+{
+    if (vertices && allocation.vertexCount > 0)
+    {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, vbo);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, size_t(allocation.baseVertex) * getStride(), size_t(allocation.vertexCount) * getStride(), vertices);
+    }
+
+    if (indices && allocation.indexBytes > 0)
+    {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, ebo);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, allocation.indexOffset, allocation.indexBytes, indices);
+    }
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void MeshPool::bind()
+{
+    if (boundVao == vao)
+        return;
+
+    glBindVertexArray(vao);
+    boundVao = vao;
+}
+
+unsigned int MeshPool::getVertexBuffer() const
+{
+    return vbo;
+}
+
+unsigned int MeshPool::getIndexBuffer() const
+{
+    return ebo;
+}
+
+size_t MeshPool::getStride() const
+{
+    return VertexLayout{format}.getStride();
+}
+
+size_t MeshPool::getCapacityBytes() const
+{
+    return vertexRanges.getCapacity() * getStride() + indexRanges.getCapacity();
+}
+
+size_t MeshPool::getUsedBytes() const
+{
+    return usedVertices * getStride() + usedIndexBytes;
+}
+
+size_t MeshPool::getTotalCapacityBytes()
+{
+    return get(VertexFormat::FULL).getCapacityBytes() + get(VertexFormat::PACKED).getCapacityBytes() +
+           get(VertexFormat::PACKED_QUANTIZED).getCapacityBytes();
+}
+
+size_t MeshPool::getTotalUsedBytes()
+{
+    return get(VertexFormat::FULL).getUsedBytes() + get(VertexFormat::PACKED).getUsedBytes() +
+           get(VertexFormat::PACKED_QUANTIZED).getUsedBytes();
+}
+
+MeshPool::~MeshPool()
+{
+    if (vao != 0)
+        glDeleteVertexArrays(1, &vao);
+    if (vbo != 0)
+        glDeleteBuffers(1, &vbo);
+    if (ebo != 0)
+        glDeleteBuffers(1, &ebo);
+}
@@ -0,0 +1,110 @@
+#ifndef __MESHPOOL_H__
+#define __MESHPOOL_H__
+#include "VertexFormat.h"
+#include <cstddef>
+#include <map>
+#include <memory>
+
+// First fit allocator over a linear range, free ranges are merged with their neighbours when released
+class RangeAllocator
+{
+    // Offset to size of every free range
+    std::map<size_t, size_t> freeRanges;
+
+    size_t capacity = 0;
+
+public:
+    // False when no free range is large enough, grow and try again
+    bool allocate(size_t size, size_t alignment, size_t &offset);
+
+    void free(size_t offset, size_t size);
+
+    // Adds the new space at the end as a free range
+    void grow(size_t newCapacity);
+
+    size_t getCapacity() const;
+
+    // Size of the free range touching the end of the capacity, 0 if the last bytes are in use
+    size_t getFreeTail() const;
+};
+
+// One vertex buffer, one index buffer and one vertex array shared by every mesh of a vertex format.
+// Meshes own ranges inside the buffers and draw with glDrawElementsBaseVertex, so switching between
+// meshes of the same format needs no rebinding. The buffers grow by copying into larger ones
+class MeshPool
+{
+public:
+    struct Allocation
+    {
+        uint32_t baseVertex = 0;
+        uint32_t vertexCount = 0;
+
+        // Byte offset of the first index, 16 and 32 bit indices share the index buffer
+        size_t indexOffset = 0;
+        size_t indexBytes = 0;
+    };
+
+    static MeshPool &get(VertexFormat format);
+
+    // Deletes the pools of all formats, before the context goes away. Meshes still holding allocations must be gone
+    static void releaseAll();
+
+    MeshPool(const MeshPool &) = delete;
+
+    MeshPool &operator=(const MeshPool &) = delete;
+
+    Allocation allocate(size_t vertexCount, size_t indexBytes);
+
+    void free(const Allocation &allocation);
+
+    // Either pointer may be null to leave that part for a later upload
+    void upload(const Allocation &allocation, const void *vertices, const void *indices);
+
+    // Binds the shared vertex array unless it is already bound.
+    // Only pools bind vertex arrays in this renderer (ImGui restores the previous binding), so the binding is tracked instead of queried
+    void bind();
+
+    unsigned int getVertexBuffer() const;
+
+    unsigned int getIndexBuffer() const;
+
+    size_t getStride() const;
+
+    size_t getCapacityBytes() const;
+
+    size_t getUsedBytes() const;
+
+    // Sum over the pools of all formats
+    static size_t getTotalCapacityBytes();
+
+    static size_t getTotalUsedBytes();
+
+    ~MeshPool();
+
+private:
+    static constexpr size_t initialVertexBytes = 16 * 1024 * 1024;
+    static constexpr size_t initialIndexBytes = 8 * 1024 * 1024;
+
+    static unsigned int boundVao;
+
+    static std::unique_ptr<MeshPool> pools[3];
+
+    VertexFormat format;
+
+    unsigned int vao, vbo, ebo;
+
+    RangeAllocator vertexRanges;
+    RangeAllocator indexRanges;
+
+    size_t usedVertices, usedIndexBytes;
+
+    explicit MeshPool(VertexFormat format);
+
+    void create();
+
+    void growVertices(size_t minimumVertices);
+
+    void growIndices(size_t minimumBytes);
+};
+
+#endif // __MESHPOOL_H__
@@ -1,80 +1,311 @@
 #include "Model.h"
+#include "ResourceCache.h"
+#include "MeshOptimizer.h"
+#include "LoadProfiler.h"
+#include "../assimp/DefaultIOSystem.h"
+#include "../assimp/IOStream.hpp"
+#include <algorithm>
 #include <stdexcept>
 #include <iostream>
+#include <chrono>
+#include <mutex>
 #include "../glm/gtc/matrix_transform.hpp"
 #include "../glm/gtc/type_ptr.hpp"
 
-void Model::render(MShader &shader, bool hasTexture)
+namespace
 {
-    model = glm::mat4(1.f);
-    if (translate_before_rotation)
+    // Counts the bytes Assimp reads through it, for the load profile
+    class CountingIOStream : public Assimp::IOStream
     {
-        model = glm::translate(model, position);
-        model = glm::rotate(model, glm::radians(angles.x), glm::vec3(rotation.x, 0.f, 0.f));
-        model = glm::rotate(model, glm::radians(angles.y), glm::vec3(0.f, rotation.y, 0.f));
-        model = glm::rotate(model, glm::radians(angles.z), glm::vec3(0.f, 0.f, rotation.z));
-    }
-    else
+        Assimp::IOStream *stream;
+        size_t &bytesRead;
+
+    public:
+        CountingIOStream(Assimp::IOStream *stream, size_t &bytesRead) : stream(stream), bytesRead(bytesRead)
+        {
+        }
+
+        size_t Read(void *buffer, size_t size, size_t count) override
+        {
+            size_t read = stream->Read(buffer, size, count);
+            bytesRead += read * size;
+            return read;
+        }
+
+        size_t Write(const void *buffer, size_t size, size_t count) override
+        {
+            return stream->Write(buffer, size, count);
+        }
+
+        aiReturn Seek(size_t offset, aiOrigin origin) override
+        {
+            return stream->Seek(offset, origin);
+        }
+
+        size_t Tell() const override
+        {
+            return stream->Tell();
+        }
+
+        size_t FileSize() const override
+        {
+            return stream->FileSize();
+        }
+
+        void Flush() override
+        {
+            stream->Flush();
+        }
+
+        Assimp::IOStream *getStream() const
+        {
+            return stream;
+        }
+    };
+
+    class CountingIOSystem : public Assimp::DefaultIOSystem
     {
-        model = glm::rotate(model, glm::radians(angles.x), glm::vec3(rotation.x, 0.f, 0.f));
-        model = glm::rotate(model, glm::radians(angles.y), glm::vec3(0.f, rotation.y, 0.f));
-        model = glm::rotate(model, glm::radians(angles.z), glm::vec3(0.f, 0.f, rotation.z));
-        model = glm::translate(model, position);
+    public:
+        size_t bytesRead = 0;
+
+        Assimp::IOStream *Open(const char *file, const char *mode) override
+        {
+            Assimp::IOStream *stream = Assimp::DefaultIOSystem::Open(file, mode);
+            return stream ? new CountingIOStream(stream, bytesRead) : nullptr;
+        }
+
+        void Close(Assimp::IOStream *file) override
+        {
+            CountingIOStream *counting = static_cast<CountingIOStream *>(file);
+            Assimp::DefaultIOSystem::Close(counting->getStream());
+            delete counting;
+        }
+    };
+}
+
+void Model::render(MShader &shader, bool hasTexture, const LodSelector *lod, const Frustum *frustum)
+{
+    updateTransforms();
+    if (frustum)
+        cull(*frustum);
+
+    // Meshes of one node are stored next to each other, so the matrix is only set when the node changes
+    Uniform<glm::mat4> modelUniform = shader.getUniform<glm::mat4>("model");
+    const glm::mat4 *boundMatrix = nullptr;
+
+    for (size_t i = 0; i < asset->meshes.size(); ++i)
+    {
+        Mesh &mesh = asset->meshes[i];
+        if (!mesh.ready || (frustum && !visibleMeshes[i]))
+            continue;
+
+        const glm::mat4 &matrix = getMeshMatrix(mesh);
+        if (&matrix != boundMatrix)
+        {
+            modelUniform.set(matrix);
+            boundMatrix = &matrix;
+        }
+
+        unsigned int level = lod ? lod->select(mesh, matrix) : 0;
+        if (!multiple_textures)
+            mesh.render(shader, hasTexture, level);
+        else
+            mesh.renderMultipleTextures(shader, level);
     }
-   
-    model = glm::scale(model, scale);
+}
 
-    shader.setMat4("camera.view", camera->getView());
-    shader.setMat4("camera.projection", camera->getProjection());
-    shader.setVec3("camera.position", camera->getPosition());
+void Model::submit(RenderQueue &queue, RenderPass pass, MShader &shader, bool hasTexture, const LodSelector *lod, const Frustum *frustum)
+{
+    updateTransforms();
+    if (frustum)
+        cull(*frustum);
 
-    shader.setMat4("model", model);
+    for (size_t i = 0; i < asset->meshes.size(); ++i)
+    {
+        Mesh &mesh = asset->meshes[i];
+        if (!mesh.ready || (frustum && !visibleMeshes[i]))
+            continue;
 
-    if (!multiple_textures)
-        for (Mesh &mesh : meshes)
-            mesh.render(shader, hasTexture);
-    else
-        for (Mesh &mesh : meshes)
-            mesh.renderMultipleTextures(shader);
+        const glm::mat4 &matrix = getMeshMatrix(mesh);
+        unsigned int level = lod ? lod->select(mesh, matrix) : 0;
+        queue.submit(pass, shader, mesh, matrix, level, hasTexture, multiple_textures);
+    }
 }
 
 void Model::loadModel(const std::string &path)
 {
+    auto start = std::chrono::steady_clock::now();
+
+    // Covers the texture requests as well, their decodes are attributed to this model
+    LoadAssetScope profileScope(path);
+
+    MeshCache cache;
+    if (MeshCache::enabled && cache.load(path, importFlags, asset->format))
+    {
+        asset->nodes = cache.getNodes();
+        createMeshes(cache.getMeshes());
+        textureLoader.finish();
+        asset->loadTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "Model loaded from cache: " << path << " (" << asset->loadTime << " ms)\n";
+        return;
+    }
+
+    std::vector<ImportedMesh> imported;
+    importModel(path, imported, asset->nodes, asset->format);
+
+    std::vector<CookedMesh> views;
+    views.reserve(imported.size());
+    for (const ImportedMesh &mesh : imported)
+        views.push_back(MeshCache::makeView(mesh));
+
+    createMeshes(views);
+    textureLoader.finish();
+
+    asset->loadTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Model imported: " << path << " (" << asset->loadTime << " ms)\n";
+
+    if (MeshCache::enabled && !MeshCache::write(path, importFlags, asset->format, views, asset->nodes))
+        std::cout << "Failed to write mesh cache for " << path << '\n';
+}
+
+void Model::createMeshes(const std::vector<CookedMesh> &cookedMeshes)
+{
+    ScopedLoadTimer timer(LoadStage::MESH_UPLOAD);
+
+    asset->meshes.reserve(asset->meshes.size() + cookedMeshes.size());
+
+    for (const CookedMesh &cooked : cookedMeshes)
+    {
+        timer.addBytesUploaded(size_t(cooked.vertexCount) * cooked.layout.getStride() + size_t(cooked.indexCount) * cooked.indexSize);
+
+        std::vector<MTexture> textures;
+        textures.reserve(cooked.textures.size());
+
+        for (const TextureRef &texture : cooked.textures)
+            textures.push_back(loadTexture(texture.path, texture.type));
+
+        Mesh &mesh = asset->meshes.emplace_back(cooked.vertices, cooked.vertexCount, cooked.layout, cooked.indices, cooked.indexCount, cooked.indexSize,
+                                                std::move(textures), *camera);
+        mesh.setLods(cooked.lods);
+        mesh.setBounds(cooked.boundsMin, cooked.boundsMax);
+        mesh.setBoundingSphere(cooked.sphereCenter, cooked.sphereRadius);
+        mesh.setUvDensity(cooked.uvDensity);
+        mesh.setNode(cooked.node);
+    }
+
+    ResourceCache::get().setResidentBytes(*asset);
+}
+
+void Model::importModel(const std::string &path, std::vector<ImportedMesh> &imported, std::vector<SceneNode> &nodes, VertexFormat format)
+{
+    initTexturesMap();
+
+    LoadAssetScope profileScope(path);
+
+    // Owned by the importer, parsing and post processing run as separate calls so the profile can tell them apart
     Assimp::Importer import;
-    const aiScene *scene = import.ReadFile(path, aiProcess_Triangulate |
-                                                     aiProcess_GenSmoothNormals |
-                                                     aiProcess_FlipUVs |
-                                                     aiProcess_CalcTangentSpace);
+    CountingIOSystem *io = new CountingIOSystem();
+    import.SetIOHandler(io);
+
+    const aiScene *scene;
+    {
+        ScopedLoadTimer timer(LoadStage::MODEL_PARSE);
+        scene = import.ReadFile(path, 0);
+        timer.addBytesRead(io->bytesRead);
+    }
+
+    if (scene)
+    {
+        ScopedLoadTimer timer(LoadStage::MODEL_POST_PROCESS);
+        scene = import.ApplyPostProcessing(importFlags);
+    }
 
     if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
         throw std::runtime_error(std::string("ERROR::ASSIMP::") + import.GetErrorString());
 
-    directory = path.substr(0, path.find_last_of('/'));
+    {
+        ScopedLoadTimer timer(LoadStage::MESH_CONVERT);
+        proccesNode(scene->mRootNode, scene, imported, nodes, -1);
+    }
+
+    ScopedLoadTimer optimizeTimer(LoadStage::MESH_OPTIMIZE);
+
+    std::vector<MeshOptimizationStats> stats;
+    stats.reserve(imported.size());
+
+    for (ImportedMesh &mesh : imported)
+    {
+        stats.push_back(optimizeMesh(mesh.vertices, mesh.indices));
 
-    proccesNode(scene->mRootNode, scene);
+        if (!mesh.vertices.empty())
+        {
+            mesh.boundsMin = mesh.boundsMax = mesh.vertices[0].position;
+            for (const MVertex &vertex : mesh.vertices)
+            {
+                mesh.boundsMin = glm::min(mesh.boundsMin, vertex.position);
+                mesh.boundsMax = glm::max(mesh.boundsMax, vertex.position);
+            }
+            mesh.sphereCenter = (mesh.boundsMin + mesh.boundsMax) * 0.5f;
+            mesh.sphereRadius = computeBoundingRadius(mesh.vertices, mesh.sphereCenter);
+        }
+        mesh.uvDensity = computeUvDensity(mesh.vertices, mesh.indices);
+
+        mesh.lods = buildLodChain(mesh.vertices, mesh.indices);
+        for (const MeshLod &lod : mesh.lods)
+            stats.back().lodTriangles.push_back(lod.indexCount / 3);
+
+        if (stats.back().shortIndices)
+        {
+            mesh.shortIndices.assign(mesh.indices.begin(), mesh.indices.end());
+            std::vector<unsigned int>().swap(mesh.indices);
+        }
+
+        if (format != VertexFormat::FULL)
+        {
+            mesh.layout.format = format;
+            packVertices(mesh.vertices, mesh.layout, mesh.packedVertices);
+            std::vector<MVertex>().swap(mesh.vertices);
+        }
+    }
+
+    // One write so reports of models imported on different threads don't interleave
+    std::cout << formatOptimizationReport(path, stats);
 }
 
-void Model::proccesNode(aiNode *node, const aiScene *scene)
+void Model::proccesNode(aiNode *node, const aiScene *scene, std::vector<ImportedMesh> &imported, std::vector<SceneNode> &nodes, int32_t parent)
 {
+    int32_t index = static_cast<int32_t>(nodes.size());
+
+    // aiMatrix4x4 is row major
+    SceneNode &sceneNode = nodes.emplace_back();
+    sceneNode.name = node->mName.C_Str();
+    sceneNode.parent = parent;
+    sceneNode.local = glm::transpose(glm::make_mat4(&node->mTransformation.a1));
+
     for (unsigned int i = 0; i < node->mNumMeshes; ++i)
     {
         aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
-        meshes.push_back(proccesMesh(mesh, scene));
+        imported.push_back(proccesMesh(mesh, scene));
+        imported.back().node = static_cast<uint32_t>(index);
     }
 
     for (unsigned int i = 0; i < node->mNumChildren; ++i)
-        proccesNode(node->mChildren[i], scene);
+        proccesNode(node->mChildren[i], scene, imported, nodes, index);
 }
 
-Mesh Model::proccesMesh(aiMesh *mesh, const aiScene *scene)
+ImportedMesh Model::proccesMesh(aiMesh *mesh, const aiScene *scene)
 {
-    std::vector<MVertex> vertices;
-    std::vector<unsigned int> indices;
-    std::vector<MTexture> textures;
+    ImportedMesh result;
+    std::vector<MVertex> &vertices = result.vertices;
+    std::vector<unsigned int> &indices = result.indices;
+    std::vector<TextureRef> &textures = result.textures;
+
+    vertices.reserve(mesh->mNumVertices);
+    indices.reserve(size_t(mesh->mNumFaces) * 3);
 
     for (unsigned int i = 0; i < mesh->mNumVertices; ++i)
     {
-        MVertex vertex;
+        MVertex vertex{};
         glm::vec3 vector;
         vector.x = mesh->mVertices[i].x;
         vector.y = mesh->mVertices[i].y;
@@ -161,84 +392,89 @@ Mesh Model::proccesMesh(aiMesh *mesh, const aiScene *scene)
 
         for (const auto &type : types)
         {
-            auto texs = loadMaterialTextures(material, type, "");
+            std::vector<TextureRef> texs = loadMaterialTextures(material, type, "");
             textures.insert(textures.end(), texs.begin(), texs.end());
         }
     }
 
-    return Mesh(vertices, indices, textures, *camera);
+    return result;
 }
 
-std::vector<MTexture> Model::loadMaterialTextures(aiMaterial *mat, aiTextureType type, const std::string &typeName)
+std::vector<TextureRef> Model::loadMaterialTextures(aiMaterial *mat, aiTextureType type, const std::string &typeName)
 {
-    std::vector<MTexture> textures;
+    auto typeEntry = texturesMap.find(type);
+    std::string typeString = typeEntry != texturesMap.end() ? typeEntry->second : std::string();
+
+    std::vector<TextureRef> textures;
     for (unsigned int i = 0; i < mat->GetTextureCount(type); ++i)
     {
         aiString str;
         mat->GetTexture(type, i, &str);
-        std::string texturePath = str.C_Str();
-
-        bool skip = false;
-
-        auto lTex = loadedTextures.find(texturePath.c_str());
-
-        if (lTex != loadedTextures.end())
-        {
-            textures.push_back(lTex->second);
-            skip = true;
-        }
-
-        if (!skip)
-        {
-            MTexture texture;
+        textures.push_back({typeString, str.C_Str()});
+    }
+    return textures;
+}
 
-            std::string fullPath = directory + texturePath;
-            std::string filename = texturePath;
+MTexture Model::loadTexture(const std::string &texturePath, const std::string &type)
+{
+    std::string fullPath = asset->directory + '/' + texturePath;
 
-            size_t lastSlash = texturePath.find_last_of("/\\");
-            if (lastSlash != std::string::npos)
-                filename = texturePath.substr(lastSlash + 1);
+    MTexture texture;
+    texture.type = type;
+    texture.path = texturePath;
 
-            if (!texture.loadTexture(texturePath.c_str(), directory))
-                throw std::runtime_error("Texture not found");
+    bool created;
+    texture.resource = ResourceCache::get().acquireTexture(fullPath, created);
+    if (created)
+        textureLoader.request(texture.resource, fullPath, type);
 
-            texture.type = texturesMap[type];
-            std::cout << "Texture loaded: " << texture.type << '\n';
-            texture.path = texturePath;
-            textures.push_back(texture);
-            loadedTextures[texturePath] = texture;
-        }
-    }
-    return textures;
+    texture.id = texture.resource->id;
+    return texture;
 }
 
 std::unordered_map<int, std::string> Model::texturesMap;
 
 void Model::initTexturesMap()
 {
-    texturesMap[aiTextureType_DIFFUSE] = "texture_diffuse";
-    texturesMap[aiTextureType_NORMALS] = "texture_normal";
-    texturesMap[aiTextureType_LIGHTMAP] = "texture_lightmap";
-    texturesMap[aiTextureType_BASE_COLOR] = "texture_basecolor";
-    texturesMap[aiTextureType_NORMAL_CAMERA] = "texture_normal_camera";
-    texturesMap[aiTextureType_EMISSION_COLOR] = "texture_emission";
-    texturesMap[aiTextureType_SPECULAR] = "texture_specular";
-    texturesMap[aiTextureType_AMBIENT] = "texture_ambient";
-    texturesMap[aiTextureType_EMISSIVE] = "texture_emissive";
-    texturesMap[aiTextureType_HEIGHT] = "texture_height";
-    texturesMap[aiTextureType_SHININESS] = "texture_shininess";
-    texturesMap[aiTextureType_OPACITY] = "texture_opacity";
-    texturesMap[aiTextureType_DISPLACEMENT] = "texture_displacement";
-    texturesMap[aiTextureType_REFLECTION] = "texture_reflection";
-    texturesMap[aiTextureType_METALNESS] = "texture_metalness";
-    texturesMap[aiTextureType_AMBIENT_OCCLUSION] = "texture_ao";
+    static std::once_flag initialized;
+    std::call_once(initialized, []()
+                   {
+        texturesMap[aiTextureType_DIFFUSE] = "texture_diffuse";
+        texturesMap[aiTextureType_NORMALS] = "texture_normal";
+        texturesMap[aiTextureType_LIGHTMAP] = "texture_lightmap";
+        texturesMap[aiTextureType_BASE_COLOR] = "texture_basecolor";
+        texturesMap[aiTextureType_NORMAL_CAMERA] = "texture_normal_camera";
+        texturesMap[aiTextureType_EMISSION_COLOR] = "texture_emission";
+        texturesMap[aiTextureType_SPECULAR] = "texture_specular";
+        texturesMap[aiTextureType_AMBIENT] = "texture_ambient";
+        texturesMap[aiTextureType_EMISSIVE] = "texture_emissive";
+        texturesMap[aiTextureType_HEIGHT] = "texture_height";
+        texturesMap[aiTextureType_SHININESS] = "texture_shininess";
+        texturesMap[aiTextureType_OPACITY] = "texture_opacity";
+        texturesMap[aiTextureType_DISPLACEMENT] = "texture_displacement";
+        texturesMap[aiTextureType_REFLECTION] = "texture_reflection";
+        texturesMap[aiTextureType_METALNESS] = "texture_metalness";
+        texturesMap[aiTextureType_AMBIENT_OCCLUSION] = "texture_ao"; });
 }
 
 Model::Model()
 {
 }
 
-Model::Model(const char *path, const Camera &camera, bool multiple_textures)
+Model::Model(const Camera &camera)
+{
+    this->camera = &camera;
+    multiple_textures = false;
+    model = glm::mat4(1.f);
+    position = glm::vec3(0.f);
+    rotation = scale = glm::vec3(1.f);
+    angles = glm::vec3(0.f);
+    translate_before_rotation = true;
+    asset = std::make_shared<ModelAsset>();
+    initTexturesMap();
+}
+
+Model::Model(const char *path, const Camera &camera, bool multiple_textures, VertexFormat format)
 {
     this->camera = &camera;
     this->multiple_textures = multiple_textures;
@@ -248,22 +484,42 @@ Model::Model(const char *path, const Camera &camera, bool multiple_textures)
     angles = glm::vec3(0.f);
     translate_before_rotation = true;
     initTexturesMap();
-    loadModel(path);
+
+    bool created;
+    asset = ResourceCache::get().acquireModel(path, format, created);
+    if (created)
+        loadModel(path);
+}
+
+Model::Model(std::vector<Mesh>&& meshes, const Camera& camera)
+{
+    this->camera = &camera;
+    model = glm::mat4(1.f);
+    position = glm::vec3(0.f);
+    rotation = scale = glm::vec3(1.f);
+    angles = glm::vec3(0.f);
+    translate_before_rotation = true;
+    asset = std::make_shared<ModelAsset>();
+    asset->meshes = std::move(meshes);
 }
 
-Model::Model(const std::vector<Mesh>& meshes, const Camera& camera)
+Model::Model(const std::shared_ptr<ModelAsset> &asset, const Camera &camera) : asset(asset)
 {
     this->camera = &camera;
+    multiple_textures = false;
     model = glm::mat4(1.f);
     position = glm::vec3(0.f);
     rotation = scale = glm::vec3(1.f);
     angles = glm::vec3(0.f);
     translate_before_rotation = true;
-   this->meshes = meshes;
 }
 
- glm::mat4& Model::getModel()
+const glm::mat4 &Model::getModel()
 {
+    if (modelValid && position == builtPosition && scale == builtScale && rotation == builtRotation && angles == builtAngles &&
+        translate_before_rotation == builtTranslateBeforeRotation)
+        return model;
+
     model = glm::mat4(1.f);
     if (translate_before_rotation)
     {
@@ -282,5 +538,103 @@ Model::Model(const std::vector<Mesh>& meshes, const Camera& camera)
    
     model = glm::scale(model, scale);
 
+    builtPosition = position;
+    builtScale = scale;
+    builtRotation = rotation;
+    builtAngles = angles;
+    builtTranslateBeforeRotation = translate_before_rotation;
+    modelValid = true;
+
+    sceneGraph.setRoot(model);
     return model;
 }
+
+void Model::updateTransforms()
+{
+    getModel();
+
+    // Streamed assets get their nodes once the import finishes
+    if (sceneGraph.size() != asset->nodes.size())
+    {
+        sceneGraph.build(asset->nodes);
+        sceneGraph.setRoot(model);
+    }
+
+    sceneGraph.update();
+}
+
+const glm::mat4 &Model::getMeshMatrix(const Mesh &mesh) const
+{
+    return mesh.getNode() < sceneGraph.size() ? sceneGraph.getWorld(mesh.getNode()) : model;
+}
+
+const std::vector<uint8_t> &Model::cull(const Frustum &frustum)
+{
+    updateTransforms();
+
+    const std::vector<Mesh> &meshes = asset->meshes;
+
+    worldSpheres.clear();
+    for (const Mesh &mesh : meshes)
+    {
+        const glm::mat4 &matrix = getMeshMatrix(mesh);
+
+        // Non uniform scales stretch the sphere by their largest axis
+        float scale = std::max({glm::length(glm::vec3(matrix[0])), glm::length(glm::vec3(matrix[1])), glm::length(glm::vec3(matrix[2]))});
+        worldSpheres.push(glm::vec3(matrix * glm::vec4(mesh.getSphereCenter(), 1.f)), mesh.getSphereRadius() * scale);
+    }
+
+    frustum.cullSpheres(worldSpheres, visibleMeshes);
+
+    for (size_t i = 0; i < meshes.size(); ++i)
+    {
+        if (!meshes[i].ready)
+        {
+            visibleMeshes[i] = 0;
+            continue;
+        }
+
+        if (!frustum.stats)
+            continue;
+
+        unsigned long long triangles = meshes[i].getLods()[0].indexCount / 3;
+        ++frustum.stats->testedMeshes;
+        frustum.stats->testedTriangles += triangles;
+        if (visibleMeshes[i])
+        {
+            ++frustum.stats->visibleMeshes;
+            frustum.stats->visibleTriangles += triangles;
+        }
+    }
+
+    return visibleMeshes;
+}
+
+SceneGraph &Model::getSceneGraph()
+{
+    return sceneGraph;
+}
+
+double Model::getLoadTime() const
+{
+    return asset->loadTime;
+}
+
+size_t Model::getReadyMeshCount() const
+{
+    size_t count = 0;
+    for (const Mesh &mesh : asset->meshes)
+        count += mesh.ready;
+
+    return count;
+}
+
+bool Model::isLoaded() const
+{
+    return !asset->loading;
+}
+
+const std::shared_ptr<ModelAsset> &Model::getAsset() const
+{
+    return asset;
+}
@@ -1,6 +1,13 @@
 #ifndef __MODEL_H__
 #define __MODEL_H__
 #include "Mesh.h"
+#include "TextureLoader.h"
+#include "MeshCache.h"
+#include "ModelAsset.h"
+#include "LodSelector.h"
+#include "SceneGraph.h"
+#include "RenderQueue.h"
+#include "Frustum.h"
 #include "../assimp/Importer.hpp"
 #include "../assimp/scene.h"
 #include "../assimp/postprocess.h"
@@ -8,18 +15,21 @@
 
 class Model
 {
-   std::vector<Mesh> meshes;
-   std::string directory;
+   std::shared_ptr<ModelAsset> asset;
 
-   std::unordered_map<std::string, MTexture> loadedTextures;
+   TextureLoader textureLoader;
 
    void loadModel(const std::string& path);
 
-   void proccesNode(aiNode* node, const aiScene* scene);
+   void createMeshes(const std::vector<CookedMesh>& cookedMeshes);
 
-   Mesh proccesMesh(aiMesh* mesh, const aiScene* scene);
+   static void proccesNode(aiNode* node, const aiScene* scene, std::vector<ImportedMesh>& imported, std::vector<SceneNode>& nodes, int32_t parent);
 
-   std::vector<MTexture> loadMaterialTextures(aiMaterial* mat, aiTextureType type, const std::string& typeName);
+   static ImportedMesh proccesMesh(aiMesh* mesh, const aiScene* scene);
+
+   static std::vector<TextureRef> loadMaterialTextures(aiMaterial* mat, aiTextureType type, const std::string& typeName);
+
+   MTexture loadTexture(const std::string& texturePath, const std::string& type);
  
    const Camera* camera;
 
@@ -29,14 +39,39 @@ class Model
 
    glm::mat4 model;
 
+   // The fields 'model' was last built from, it is only rebuilt when one of them changes
+   glm::vec3 builtPosition, builtScale, builtRotation, builtAngles;
+   bool builtTranslateBeforeRotation;
+   bool modelValid = false;
+
+   // This model's copy of the asset's node hierarchy, its root is 'model'
+   SceneGraph sceneGraph;
+
    bool multiple_textures;
 
+   // World space spheres of the meshes and the result of the last cull, indexed like the asset's meshes
+   SphereSet worldSpheres;
+   std::vector<uint8_t> visibleMeshes;
+
+   friend class AssetStreamer;
+
    public:
+   static constexpr unsigned int importFlags = aiProcess_Triangulate |
+                                               aiProcess_GenSmoothNormals |
+                                               aiProcess_FlipUVs |
+                                               aiProcess_CalcTangentSpace;
+
    Model();
 
-   Model(const char* path, const Camera& camera, bool multiple_textures = false);
+   // Empty model that gets its meshes later, see AssetStreamer
+   Model(const Camera& camera);
+
+   Model(const char* path, const Camera& camera, bool multiple_textures = false, VertexFormat format = VertexFormat::FULL);
 
-   Model(const std::vector<Mesh>& meshes, const Camera& camera);
+   Model(std::vector<Mesh>&& meshes, const Camera& camera);
+
+   // Shares the meshes of an asset that is already loaded (or still streaming)
+   Model(const std::shared_ptr<ModelAsset>& asset, const Camera& camera);
 
    glm::vec3 position;
    glm::vec3 scale;
@@ -45,9 +80,38 @@ class Model
 
    bool translate_before_rotation;
    
-    glm::mat4& getModel();
+   const glm::mat4& getModel();
+
+   // Brings the model matrix and the world matrices of the nodes up to date, a model that did not move does no matrix math
+   void updateTransforms();
+
+   // World matrix of the node the mesh hangs from, the model matrix for meshes of assets without nodes. Valid after updateTransforms()
+   const glm::mat4& getMeshMatrix(const Mesh& mesh) const;
+
+   SceneGraph& getSceneGraph();
+
+   // Frustum test of the bounding spheres of the meshes, 1 for the ready meshes at least partly inside. Counts into the frustum's stats
+   const std::vector<uint8_t>& cull(const Frustum& frustum);
+
+   // Meshes drawn so far, grows while the asset streams in
+   size_t getReadyMeshCount() const;
+
+   double getLoadTime() const;
+
+   bool isLoaded() const;
+
+   const std::shared_ptr<ModelAsset>& getAsset() const;
+
+   // Runs Assimp and converts the scene to CPU side meshes, touches no GL state so it is safe on worker threads
+   static void importModel(const std::string& path, std::vector<ImportedMesh>& imported, std::vector<SceneNode>& nodes, VertexFormat format = VertexFormat::FULL);
+
+   // Without a selector every mesh is drawn at full detail. The camera comes from the View uniform block, see FrameUniforms
+   // With a frustum only the meshes whose spheres touch it are drawn
+   void render(MShader& shader, bool hasTexture = true, const LodSelector* lod = nullptr, const Frustum* frustum = nullptr);
 
-   void render(MShader& shader, bool hasTexture = true);
+   // Same draws as render, queued instead of drawn. The queue keeps pointers to the meshes and matrices until it is flushed
+   void submit(RenderQueue& queue, RenderPass pass, MShader& shader, bool hasTexture = true, const LodSelector* lod = nullptr,
+               const Frustum* frustum = nullptr);
 };
 
 #endif // __MODEL_H__
\ No newline at end of file
@@ -0,0 +1,76 @@
+#include "ModelAsset.h"
+#include "ResourceCache.h"
+#include <algorithm>
+#include <cmath>
+
+size_t ModelAsset::getGeometryBytes() const
+{
+    size_t bytes = 0;
+    for (const Mesh &mesh : meshes)
+        bytes += mesh.getGeometryBytes();
+    return bytes;
+}
+
+size_t ModelAsset::getCpuBytes() const
+{
+    size_t bytes = 0;
+    for (const Mesh &mesh : meshes)
+        bytes += mesh.getCpuBytes();
+    return bytes;
+}
+
+std::vector<float> ModelAsset::getLodErrors() const
+{
+    size_t levels = 0;
+    for (const Mesh &mesh : meshes)
+        levels = std::max(levels, mesh.getLods().size());
+
+    std::vector<float> errors(levels, 0.f);
+    for (const Mesh &mesh : meshes)
+    {
+        const std::vector<MeshLod> &lods = mesh.getLods();
+        for (size_t level = 0; level < levels && !lods.empty(); ++level)
+            errors[level] = std::max(errors[level], lods[std::min(level, lods.size() - 1)].error);
+    }
+    return errors;
+}
+
+std::vector<glm::mat4> ModelAsset::getNodeMatrices() const
+{
+    // Parents come before their children
+    std::vector<glm::mat4> matrices(nodes.size());
+    for (size_t i = 0; i < nodes.size(); ++i)
+        matrices[i] = nodes[i].parent < 0 ? nodes[i].local : matrices[nodes[i].parent] * nodes[i].local;
+    return matrices;
+}
+
+void ModelAsset::getBounds(glm::vec3 &boundsMin, glm::vec3 &boundsMax) const
+{
+    std::vector<glm::mat4> matrices = getNodeMatrices();
+
+    boundsMin = boundsMax = glm::vec3(0.f);
+    for (size_t i = 0; i < meshes.size(); ++i)
+    {
+        const Mesh &mesh = meshes[i];
+        glm::mat4 matrix = mesh.getNode() < matrices.size() ? matrices[mesh.getNode()] : glm::mat4(1.f);
+
+        // Box around the corners of the mesh's box as its node places it
+        glm::vec3 meshMin(INFINITY), meshMax(-INFINITY);
+        for (int corner = 0; corner < 8; ++corner)
+        {
+            glm::vec3 point(corner & 1 ? mesh.getBoundsMax().x : mesh.getBoundsMin().x, corner & 2 ? mesh.getBoundsMax().y : mesh.getBoundsMin().y,
+                            corner & 4 ? mesh.getBoundsMax().z : mesh.getBoundsMin().z);
+            point = glm::vec3(matrix * glm::vec4(point, 1.f));
+            meshMin = glm::min(meshMin, point);
+            meshMax = glm::max(meshMax, point);
+        }
+
+        boundsMin = i == 0 ? meshMin : glm::min(boundsMin, meshMin);
+        boundsMax = i == 0 ? meshMax : glm::max(boundsMax, meshMax);
+    }
+}
+
+ModelAsset::~ModelAsset()
+{
+    ResourceCache::get().onModelReleased(*this);
+}
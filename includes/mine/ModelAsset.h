@@ -0,0 +1,53 @@
+#ifndef __MODELASSET_H__
+#define __MODELASSET_H__
+#include "Mesh.h"
+#include "SceneGraph.h"
+
+// Meshes loaded from one file, shared by every Model created from that file through the ResourceCache
+struct ModelAsset
+{
+    std::string path;
+    std::string directory;
+
+    std::vector<Mesh> meshes;
+
+    // Node hierarchy of the file, meshes hang from it through Mesh::getNode. Every Model keeps its own SceneGraph of it
+    std::vector<SceneNode> nodes;
+
+    // Vertex format the meshes were imported with, part of the cache key
+    VertexFormat format = VertexFormat::FULL;
+
+    // Set while the AssetStreamer is still filling the meshes in
+    bool loading = false;
+
+    double loadTime = 0.0;
+
+    // Bookkeeping of the ResourceCache, empty for assets that were not created through it
+    std::string cacheKey;
+    size_t residentBytes = 0;
+
+    ModelAsset() = default;
+
+    ModelAsset(const ModelAsset &) = delete;
+
+    ModelAsset &operator=(const ModelAsset &) = delete;
+
+    // Vertex and index bytes of all meshes, reported to the ResourceCache
+    size_t getGeometryBytes() const;
+
+    // Geometry still kept in system memory, zero unless Mesh::retainCpuGeometry is set
+    size_t getCpuBytes() const;
+
+    // Largest error of each detail level over all meshes, meshes with shorter chains count with their coarsest level
+    std::vector<float> getLodErrors() const;
+
+    // World matrix of every node with the asset's root at the origin, what a Model's SceneGraph holds for an identity model matrix
+    std::vector<glm::mat4> getNodeMatrices() const;
+
+    // Box around the bounds of all meshes placed by their nodes, relative to the asset's root
+    void getBounds(glm::vec3 &boundsMin, glm::vec3 &boundsMax) const;
+
+    ~ModelAsset();
+};
+
+#endif // __MODELASSET_H__
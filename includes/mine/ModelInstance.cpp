@@ -0,0 +1,164 @@
+#include "ModelInstance.h"
+#include <algorithm>
+
+glm::mat4 ModelInstance::getModel() const
+{
+    glm::mat4 model = glm::mat4(1.f);
+    if (translate_before_rotation)
+    {
+        model = glm::translate(model, position);
+        model = glm::rotate(model, glm::radians(angles.x), glm::vec3(rotation.x, 0.f, 0.f));
+        model = glm::rotate(model, glm::radians(angles.y), glm::vec3(0.f, rotation.y, 0.f));
+        model = glm::rotate(model, glm::radians(angles.z), glm::vec3(0.f, 0.f, rotation.z));
+    }
+    else
+    {
+        model = glm::rotate(model, glm::radians(angles.x), glm::vec3(rotation.x, 0.f, 0.f));
+        model = glm::rotate(model, glm::radians(angles.y), glm::vec3(0.f, rotation.y, 0.f));
+        model = glm::rotate(model, glm::radians(angles.z), glm::vec3(0.f, 0.f, rotation.z));
+        model = glm::translate(model, position);
+    }
+
+    return glm::scale(model, scale);
+}
+
+InstanceBatch::InstanceBatch(const std::shared_ptr<ModelAsset> &asset) : asset(asset), capacity(0), uploadedCount(0)
+{
+    glGenBuffers(1, &instanceBuffer);
+    glGenBuffers(1, &orderBuffer);
+}
+
+void InstanceBatch::update()
+{
+    data.resize(instances.size());
+
+    for (size_t i = 0; i < instances.size(); ++i)
+    {
+        const ModelInstance &instance = instances[i];
+        InstanceData &entry = data[i];
+
+        entry.model = instance.getModel();
+        // Computed once here instead of per vertex in the shader
+        entry.normalMatrix = glm::mat4(glm::transpose(glm::inverse(glm::mat3(entry.model))));
+        entry.albedo = instance.albedo;
+        entry.roughness = instance.roughness;
+        entry.metallic = instance.metallic;
+        entry.ao = instance.ao;
+    }
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, instanceBuffer);
+
+    if (data.size() > capacity)
+    {
+        capacity = data.size();
+        glBufferData(GL_SHADER_STORAGE_BUFFER, capacity * sizeof(InstanceData), data.data(), GL_DYNAMIC_DRAW);
+    }
+    else if (!data.empty())
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, data.size() * sizeof(InstanceData), data.data());
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    uploadedCount = data.size();
+}
+
+void InstanceBatch::sortByLevel(const LodSelector *lod)
+{
+    std::vector<float> errors = asset->getLodErrors();
+    size_t levelCount = std::max<size_t>(errors.size(), 1);
+
+    glm::vec3 boundsMin, boundsMax;
+    asset->getBounds(boundsMin, boundsMax);
+
+    instanceLevels.resize(uploadedCount);
+    std::vector<unsigned int> offsets(levelCount + 1, 0);
+
+    for (size_t i = 0; i < uploadedCount; ++i)
+    {
+        instanceLevels[i] = lod ? lod->select(errors, boundsMin, boundsMax, data[i].model) : 0;
+        ++offsets[instanceLevels[i] + 1];
+    }
+
+    for (size_t level = 0; level < levelCount; ++level)
+        offsets[level + 1] += offsets[level];
+
+    // Counting sort, instances keep their relative order inside a level
+    sortedOrder.resize(uploadedCount);
+    levelOffsets = offsets;
+    for (size_t i = 0; i < uploadedCount; ++i)
+        sortedOrder[offsets[instanceLevels[i]]++] = static_cast<unsigned int>(i);
+
+    if (sortedOrder == order)
+        return;
+
+    order = sortedOrder;
+
+    // Orphans the previous contents, the other pass of the frame may still be reading them
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, orderBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, order.size() * sizeof(unsigned int), order.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void InstanceBatch::render(MShader &shader, bool hasTexture, const LodSelector *lod)
+{
+    if (uploadedCount == 0)
+        return;
+
+    sortByLevel(lod);
+
+    if (nodeMatrices.size() != asset->nodes.size())
+    {
+        nodeMatrices = asset->getNodeMatrices();
+        nodeNormalMatrices.resize(nodeMatrices.size());
+        for (size_t node = 0; node < nodeMatrices.size(); ++node)
+            nodeNormalMatrices[node] = glm::mat4(glm::transpose(glm::inverse(glm::mat3(nodeMatrices[node]))));
+    }
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, bindingPoint, instanceBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, orderBindingPoint, orderBuffer);
+
+    // Meshes of one node are stored next to each other, so the matrices are only set when the node changes
+    Uniform<glm::mat4> meshUniform = shader.getUniform<glm::mat4>("meshMatrix");
+    Uniform<glm::mat4> meshNormalUniform = shader.getUniform<glm::mat4>("meshNormalMatrix");
+    size_t boundNode = ~size_t(0);
+
+    for (Mesh &mesh : asset->meshes)
+    {
+        if (!mesh.ready)
+            continue;
+
+        // Meshes of assets without nodes use the instance's matrix alone
+        size_t node = std::min<size_t>(mesh.getNode(), nodeMatrices.size());
+        if (node != boundNode)
+        {
+            meshUniform.set(node < nodeMatrices.size() ? nodeMatrices[node] : glm::mat4(1.f));
+            meshNormalUniform.set(node < nodeMatrices.size() ? nodeNormalMatrices[node] : glm::mat4(1.f));
+            boundNode = node;
+        }
+
+        for (size_t level = 0; level + 1 < levelOffsets.size(); ++level)
+        {
+            unsigned int count = levelOffsets[level + 1] - levelOffsets[level];
+            if (count > 0)
+                mesh.renderInstanced(shader, count, hasTexture, static_cast<unsigned int>(level), levelOffsets[level]);
+        }
+    }
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, bindingPoint, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, orderBindingPoint, 0);
+}
+
+size_t InstanceBatch::getInstanceCount() const
+{
+    return uploadedCount;
+}
+
+const std::shared_ptr<ModelAsset> &InstanceBatch::getAsset() const
+{
+    return asset;
+}
+
+InstanceBatch::~InstanceBatch()
+{
+    glDeleteBuffers(1, &instanceBuffer);
+    glDeleteBuffers(1, &orderBuffer);
+}
@@ -0,0 +1,96 @@
+#ifndef __MODELINSTANCE_H__
+#define __MODELINSTANCE_H__
+#include "ModelAsset.h"
+#include "LodSelector.h"
+
+// Placement and surface parameters of one copy of a ModelAsset, owns no GL objects
+struct ModelInstance
+{
+    glm::vec3 position = glm::vec3(0.f);
+    glm::vec3 scale = glm::vec3(1.f);
+    glm::vec3 rotation = glm::vec3(1.f);
+    glm::vec3 angles = glm::vec3(0.f);
+
+    bool translate_before_rotation = true;
+
+    glm::vec3 albedo = glm::vec3(0.5f);
+    float roughness = 0.5f;
+    float metallic = 0.5f;
+    float ao = 1.f;
+
+    glm::mat4 getModel() const;
+};
+
+// Layout of one element of the instance buffer, matches 'Instance' in the *Instanced.vert shaders (std430)
+struct InstanceData
+{
+    glm::mat4 model;
+    glm::mat4 normalMatrix;
+    glm::vec3 albedo;
+    float roughness;
+    float metallic;
+    float ao;
+    float padding[2];
+};
+
+static_assert(sizeof(InstanceData) == 160, "InstanceData must match the std430 layout of the shaders");
+
+// Every instance of one asset, drawn with one glDrawElementsInstancedBaseInstance per mesh and detail level.
+// Instances are grouped by level through the order buffer at 'orderBindingPoint', the shader reads
+// instances[order[gl_BaseInstance + gl_InstanceID]] from the instance buffer bound at 'bindingPoint'
+class InstanceBatch
+{
+    std::shared_ptr<ModelAsset> asset;
+
+    unsigned int instanceBuffer;
+
+    unsigned int orderBuffer;
+
+    size_t capacity;
+
+    size_t uploadedCount;
+
+    std::vector<InstanceData> data;
+
+    // Instance indices sorted by level as last uploaded, and where each level starts in it
+    std::vector<unsigned int> order;
+    std::vector<unsigned int> levelOffsets;
+
+    std::vector<unsigned int> sortedOrder;
+    std::vector<unsigned int> instanceLevels;
+
+    // ModelAsset::getNodeMatrices and their normal matrices, taken again when a streamed asset gets its nodes
+    std::vector<glm::mat4> nodeMatrices;
+    std::vector<glm::mat4> nodeNormalMatrices;
+
+    // Groups the instances by the level 'lod' picks for them (all level 0 without one) and uploads the order if it changed
+    void sortByLevel(const LodSelector *lod);
+
+public:
+    static constexpr unsigned int bindingPoint = 1;
+
+    static constexpr unsigned int orderBindingPoint = 2;
+
+    std::vector<ModelInstance> instances;
+
+    InstanceBatch(const std::shared_ptr<ModelAsset> &asset);
+
+    InstanceBatch(const InstanceBatch &) = delete;
+
+    InstanceBatch &operator=(const InstanceBatch &) = delete;
+
+    // Rebuilds the instance buffer, call after changing 'instances'
+    void update();
+
+    // Every instance picks one level for all meshes of the asset, from the asset's bounds and the worst error of each level.
+    // Each mesh's node matrix is set as 'meshMatrix' (and 'meshNormalMatrix'), the shaders apply it before the instance's
+    void render(MShader &shader, bool hasTexture = true, const LodSelector *lod = nullptr);
+
+    size_t getInstanceCount() const;
+
+    const std::shared_ptr<ModelAsset> &getAsset() const;
+
+    ~InstanceBatch();
+};
+
+#endif // __MODELINSTANCE_H__
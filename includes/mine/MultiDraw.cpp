@@ -0,0 +1,252 @@
+#include "MultiDraw.h"
+#include <algorithm>
+#include <map>
+#include <tuple>
+
+std::string getMultiDrawDefines(VertexFormat format)
+{
+    std::string defines = std::string(getVertexFormatDefines(format)) + multiDrawDefine;
+    if (MaterialTable::getMode() == MaterialMode::BINDLESS)
+        defines += bindlessTexturesDefine;
+    return defines;
+}
+
+MultiDrawBatch::MultiDrawBatch(Model &model, bool textured) : model(model), textured(textured), builtReadyCount(0), transformVersion(0)
+{
+    if (textured)
+        materialTable = std::make_unique<MaterialTable>();
+
+    glGenBuffers(1, &commandBuffer);
+    glGenBuffers(1, &drawBuffer);
+    glGenBuffers(1, &transformBuffer);
+}
+
+void MultiDrawBatch::assignMaterials()
+{
+    const std::vector<Mesh> &meshes = model.getAsset()->meshes;
+
+    std::map<std::vector<unsigned int>, uint32_t> unique;
+    materials.resize(meshes.size());
+
+    for (size_t i = 0; i < meshes.size(); ++i)
+    {
+        std::vector<unsigned int> key;
+        for (const MTexture &texture : meshes[i].textures)
+            key.push_back(texture.getId());
+
+        materials[i] = unique.emplace(std::move(key), static_cast<uint32_t>(unique.size())).first->second;
+    }
+
+    if (!materialTable)
+        return;
+
+    std::vector<const std::vector<MTexture> *> materialTextures(unique.size());
+    for (size_t i = 0; i < meshes.size(); ++i)
+        materialTextures[materials[i]] = &meshes[i].textures;
+    materialTable->build(materialTextures);
+}
+
+void MultiDrawBatch::build(const std::vector<unsigned int> &levels, size_t readyCount)
+{
+    const std::vector<Mesh> &meshes = model.getAsset()->meshes;
+    size_t nodeCount = model.getSceneGraph().size();
+
+    // Textures of meshes that just became ready may have been uploaded since the last build
+    if (materials.size() != meshes.size() || readyCount != builtReadyCount)
+        assignMaterials();
+
+    std::vector<unsigned int> order;
+    order.reserve(readyCount);
+    for (size_t i = 0; i < meshes.size(); ++i)
+        if (meshes[i].ready && levels[i] != culledLevel)
+            order.push_back(static_cast<unsigned int>(i));
+
+    auto groupKey = [&](unsigned int i)
+    {
+        return std::make_tuple(meshes[i].getPool(), meshes[i].getIndexSize(), textured ? materialTable->getGroup(materials[i]) : 0u);
+    };
+
+    std::stable_sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b)
+                     { return groupKey(a) < groupKey(b); });
+
+    commands.clear();
+    draws.clear();
+    groups.clear();
+    drawMeshes.clear();
+    drawLevels.clear();
+
+    for (unsigned int i : order)
+    {
+        const Mesh &mesh = meshes[i];
+        const std::vector<MeshLod> &lods = mesh.getLods();
+        unsigned int level = std::min<unsigned int>(levels[i], static_cast<unsigned int>(lods.size() - 1));
+        size_t indexSize = mesh.getIndexSize();
+
+        if (groups.empty() || groupKey(i) != groupKey(drawMeshes.back()))
+        {
+            Group group;
+            group.pool = mesh.getPool();
+            group.indexType = indexSize == sizeof(uint16_t) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+            group.materialGroup = textured ? materialTable->getGroup(materials[i]) : 0u;
+            group.firstDraw = static_cast<uint32_t>(commands.size());
+            group.drawCount = 0;
+            groups.push_back(group);
+        }
+        ++groups.back().drawCount;
+
+        // firstIndex counts indices, pool ranges start on 4 byte boundaries so the division is exact for both sizes
+        DrawElementsIndirectCommand command;
+        command.count = lods[level].indexCount;
+        command.instanceCount = 1;
+        command.firstIndex = static_cast<uint32_t>(mesh.getAllocation().indexOffset / indexSize) + lods[level].firstIndex;
+        command.baseVertex = static_cast<int32_t>(mesh.getAllocation().baseVertex);
+        command.baseInstance = 0;
+        commands.push_back(command);
+
+        DrawData draw{};
+        draw.transformIndex = mesh.getNode() < nodeCount ? mesh.getNode() : 0;
+        draw.materialIndex = materials[i];
+        draw.positionOffset = glm::vec4(mesh.getLayout().positionOffset, 0.f);
+        draw.positionScale = glm::vec4(mesh.getLayout().positionScale, 0.f);
+        draws.push_back(draw);
+
+        drawMeshes.push_back(i);
+        drawLevels.push_back(levels[i]);
+    }
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, draws.size() * sizeof(DrawData), draws.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    builtReadyCount = readyCount;
+}
+
+void MultiDrawBatch::uploadTransforms()
+{
+    const SceneGraph &graph = model.getSceneGraph();
+    size_t count = std::max<size_t>(graph.size(), 1);
+
+    // The graph's version only moves when one of its world matrices changed, without nodes the one matrix is compared
+    if (transforms.size() == count &&
+        (graph.size() != 0 ? transformVersion == graph.getVersion() : transforms[0].model == model.getModel()))
+        return;
+
+    transforms.resize(count);
+    for (size_t node = 0; node < count; ++node)
+    {
+        const glm::mat4 &matrix = graph.size() != 0 ? graph.getWorld(node) : model.getModel();
+        transforms[node].model = matrix;
+        transforms[node].normalMatrix = glm::mat4(glm::transpose(glm::inverse(glm::mat3(matrix))));
+    }
+    transformVersion = graph.getVersion();
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, transformBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, transforms.size() * sizeof(DrawTransform), transforms.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void MultiDrawBatch::render(MShader &shader, const LodSelector *lod, const Frustum *frustum)
+{
+    std::vector<Mesh> &meshes = model.getAsset()->meshes;
+    model.updateTransforms();
+
+    const std::vector<uint8_t> *visible = frustum ? &model.cull(*frustum) : nullptr;
+
+    std::vector<unsigned int> levels(meshes.size(), 0);
+    size_t readyCount = 0, drawCount = 0;
+
+    for (size_t i = 0; i < meshes.size(); ++i)
+    {
+        if (!meshes[i].ready)
+            continue;
+
+        ++readyCount;
+        if (visible && !(*visible)[i])
+        {
+            levels[i] = culledLevel;
+            continue;
+        }
+
+        ++drawCount;
+        if (lod)
+            levels[i] = lod->select(meshes[i], model.getMeshMatrix(meshes[i]));
+    }
+
+    if (drawCount == 0)
+        return;
+
+    // A mesh coming into view changes the count unless another left at the same time, whose level then differs
+    bool rebuild = readyCount != builtReadyCount || drawCount != drawMeshes.size();
+    for (size_t d = 0; d < drawMeshes.size() && !rebuild; ++d)
+        rebuild = drawLevels[d] != levels[drawMeshes[d]];
+
+    if (rebuild)
+        build(levels, readyCount);
+
+    uploadTransforms();
+
+    if (materialTable)
+        materialTable->update();
+
+    shader.use();
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, drawBindingPoint, drawBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, transformBindingPoint, transformBuffer);
+
+    // Groups of one pool come in material group order, the arrays are only rebound when the group changes
+    int64_t boundMaterialGroup = -1;
+
+    for (const Group &group : groups)
+    {
+        if (materialTable && group.materialGroup != boundMaterialGroup)
+        {
+            materialTable->bind(shader, group.materialGroup);
+            boundMaterialGroup = group.materialGroup;
+        }
+
+        // gl_DrawID restarts at 0 for every multi draw
+        shader.setInt("drawBase", static_cast<int>(group.firstDraw));
+
+        group.pool->bind();
+        glMultiDrawElementsIndirect(GL_TRIANGLES, group.indexType,
+                                    reinterpret_cast<const void *>(size_t(group.firstDraw) * sizeof(DrawElementsIndirectCommand)),
+                                    static_cast<GLsizei>(group.drawCount), 0);
+    }
+
+    for (const DrawElementsIndirectCommand &command : commands)
+        Mesh::drawnTriangles += command.count / 3;
+    Mesh::drawnMeshes += commands.size();
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, drawBindingPoint, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, transformBindingPoint, 0);
+    if (materialTable)
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MaterialTable::bindingPoint, 0);
+}
+
+size_t MultiDrawBatch::getDrawCount() const
+{
+    return commands.size();
+}
+
+const MaterialTable *MultiDrawBatch::getMaterialTable() const
+{
+    return materialTable.get();
+}
+
+size_t MultiDrawBatch::getGroupCount() const
+{
+    return groups.size();
+}
+
+MultiDrawBatch::~MultiDrawBatch()
+{
+    glDeleteBuffers(1, &commandBuffer);
+    glDeleteBuffers(1, &drawBuffer);
+    glDeleteBuffers(1, &transformBuffer);
+}
@@ -0,0 +1,122 @@
+#ifndef __MULTIDRAW_H__
+#define __MULTIDRAW_H__
+#include "Model.h"
+#include "MaterialTable.h"
+
+// Layout glMultiDrawElementsIndirect reads from the GL_DRAW_INDIRECT_BUFFER
+struct DrawElementsIndirectCommand
+{
+    uint32_t count;
+    uint32_t instanceCount;
+    uint32_t firstIndex;
+    int32_t baseVertex;
+    uint32_t baseInstance;
+};
+
+// Per draw entry of the draw buffer, read as draws[drawBase + gl_DrawID] by the MULTI_DRAW shader variants (std430)
+struct DrawData
+{
+    uint32_t transformIndex;
+    uint32_t materialIndex;
+    uint32_t padding[2];
+    // xyz used, see VertexLayout
+    glm::vec4 positionOffset;
+    glm::vec4 positionScale;
+};
+
+struct DrawTransform
+{
+    glm::mat4 model;
+    glm::mat4 normalMatrix;
+};
+
+static_assert(sizeof(DrawData) == 48, "DrawData must match the std430 layout of the shaders");
+static_assert(sizeof(DrawTransform) == 128, "DrawTransform must match the std430 layout of the shaders");
+
+// Submits all meshes of a model with glMultiDrawElementsIndirect instead of one glDrawElements each.
+// Draws are grouped by vertex pool and index type, and for textured passes by the texture arrays their materials
+// sample (a single group with bindless textures, see MaterialTable); every group is one multi draw. The command buffer is only rewritten when the set
+// of ready meshes or their selected detail levels change, so every pass should own its own batch
+class MultiDrawBatch
+{
+    struct Group
+    {
+        MeshPool *pool;
+        unsigned int indexType;
+        // MaterialTable group the draws sample, 0 for untextured batches
+        uint32_t materialGroup;
+        uint32_t firstDraw;
+        uint32_t drawCount;
+    };
+
+    Model &model;
+
+    bool textured;
+
+    unsigned int commandBuffer, drawBuffer, transformBuffer;
+
+    std::vector<DrawElementsIndirectCommand> commands;
+    std::vector<DrawData> draws;
+    std::vector<Group> groups;
+
+    // Level of the meshes culled by the frustum, never built into a draw
+    static constexpr unsigned int culledLevel = ~0u;
+
+    // Mesh index of every draw, and the level it was built with
+    std::vector<unsigned int> drawMeshes;
+    std::vector<unsigned int> drawLevels;
+
+    size_t builtReadyCount;
+
+    // One per scene node (a single one for models without nodes), drawn meshes index them with their node
+    std::vector<DrawTransform> transforms;
+
+    // SceneGraph version the transforms were uploaded at
+    unsigned long long transformVersion;
+
+    // Material index of every mesh, meshes with the same textures share one
+    std::vector<uint32_t> materials;
+
+    // Textures of the materials, textured batches only
+    std::unique_ptr<MaterialTable> materialTable;
+
+    void build(const std::vector<unsigned int> &levels, size_t readyCount);
+
+    void assignMaterials();
+
+    void uploadTransforms();
+
+public:
+    static constexpr unsigned int drawBindingPoint = 3;
+
+    static constexpr unsigned int transformBindingPoint = 4;
+
+    // 'textured' batches read their materials' textures through a MaterialTable, shadow batches skip it
+    MultiDrawBatch(Model &model, bool textured);
+
+    MultiDrawBatch(const MultiDrawBatch &) = delete;
+
+    MultiDrawBatch &operator=(const MultiDrawBatch &) = delete;
+
+    // 'shader' has to be a MULTI_DRAW variant. Meshes outside the frustum are left out of the command buffer,
+    // which is rebuilt when the visible set changes
+    void render(MShader &shader, const LodSelector *lod = nullptr, const Frustum *frustum = nullptr);
+
+    size_t getDrawCount() const;
+
+    // Null for untextured batches
+    const MaterialTable *getMaterialTable() const;
+
+    // glMultiDrawElementsIndirect calls per render
+    size_t getGroupCount() const;
+
+    ~MultiDrawBatch();
+};
+
+// Inserted after the vertex format defines to build the MULTI_DRAW variant of a shader
+constexpr const char *multiDrawDefine = "#define MULTI_DRAW\n";
+
+// Vertex format, MULTI_DRAW and material mode defines of the MULTI_DRAW variants
+std::string getMultiDrawDefines(VertexFormat format);
+
+#endif // __MULTIDRAW_H__
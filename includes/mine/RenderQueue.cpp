@@ -0,0 +1,186 @@
+#include "RenderQueue.h"
+#include <algorithm>
+
+unsigned long long RenderQueue::programBindsAvoided = 0;
+
+unsigned long long RenderQueue::textureBindsAvoided = 0;
+
+unsigned long long RenderQueue::vertexArrayBindsAvoided = 0;
+
+namespace
+{
+    constexpr int passShift = 60;
+    constexpr int shaderShift = 48;
+    constexpr int materialShift = 32;
+    constexpr int poolShift = 24;
+
+    constexpr uint64_t depthMask = 0xFFFFFF;
+}
+
+RenderQueue::RenderQueue() : sorted(true), viewPosition(0.f), maxDepth(1.f)
+{
+}
+
+uint32_t RenderQueue::getShaderId(const Shader *shader)
+{
+    auto found = std::find(shaderIds.begin(), shaderIds.end(), shader);
+    if (found != shaderIds.end())
+        return static_cast<uint32_t>(found - shaderIds.begin());
+
+    shaderIds.push_back(shader);
+    return static_cast<uint32_t>(shaderIds.size() - 1);
+}
+
+uint32_t RenderQueue::getPoolId(const MeshPool *pool)
+{
+    auto found = std::find(poolIds.begin(), poolIds.end(), pool);
+    if (found != poolIds.end())
+        return static_cast<uint32_t>(found - poolIds.begin());
+
+    poolIds.push_back(pool);
+    return static_cast<uint32_t>(poolIds.size() - 1);
+}
+
+uint32_t RenderQueue::getMaterialId(const Mesh &mesh, bool numberedSamplers)
+{
+    // FNV-1a over the texture ids, the naming scheme changes which units the samplers read
+    uint64_t hash = 14695981039346656037ull ^ numberedSamplers;
+    for (const MTexture &texture : mesh.textures)
+    {
+        hash ^= texture.getId();
+        hash *= 1099511628211ull;
+    }
+
+    // 0 is left to untextured draws
+    auto inserted = materialIds.emplace(hash, static_cast<uint32_t>(materialIds.size() + 1));
+    return inserted.first->second;
+}
+
+void RenderQueue::clear()
+{
+    items.clear();
+    entries.clear();
+    sorted = true;
+}
+
+void RenderQueue::setView(const glm::vec3 &viewPosition, float maxDepth)
+{
+    this->viewPosition = viewPosition;
+    this->maxDepth = maxDepth;
+}
+
+void RenderQueue::submit(RenderPass pass, Shader &shader, Mesh &mesh, const glm::mat4 &model, unsigned int lod, bool hasTexture,
+                         bool numberedSamplers)
+{
+    uint64_t material = hasTexture ? getMaterialId(mesh, numberedSamplers) : 0;
+
+    glm::vec3 center = glm::vec3(model * glm::vec4((mesh.boundsMin + mesh.boundsMax) * 0.5f, 1.f));
+    float depth = std::clamp(glm::length(center - viewPosition) / maxDepth, 0.f, 1.f);
+
+    uint64_t key = (static_cast<uint64_t>(pass) & 0xF) << passShift |
+                   (static_cast<uint64_t>(getShaderId(&shader)) & 0xFFF) << shaderShift |
+                   (material & 0xFFFF) << materialShift |
+                   (static_cast<uint64_t>(getPoolId(mesh.pool)) & 0xFF) << poolShift |
+                   static_cast<uint64_t>(depth * depthMask);
+
+    entries.push_back({key, static_cast<uint32_t>(items.size())});
+    items.push_back({&mesh, &shader, &model, lod, hasTexture, numberedSamplers});
+    sorted = false;
+}
+
+void RenderQueue::radixSort()
+{
+    size_t count = entries.size();
+    if (count < 2)
+        return;
+
+    scratch.resize(count);
+
+    // All eight histograms in one read of the keys
+    uint32_t histograms[8][256] = {};
+    for (const SortEntry &entry : entries)
+        for (int byte = 0; byte < 8; ++byte)
+            ++histograms[byte][(entry.key >> (byte * 8)) & 0xFF];
+
+    for (int byte = 0; byte < 8; ++byte)
+    {
+        uint32_t *histogram = histograms[byte];
+
+        // Every key has the same value in this byte, the pass would not move anything
+        if (histogram[(entries[0].key >> (byte * 8)) & 0xFF] == count)
+            continue;
+
+        uint32_t offset = 0;
+        for (int bucket = 0; bucket < 256; ++bucket)
+        {
+            uint32_t bucketCount = histogram[bucket];
+            histogram[bucket] = offset;
+            offset += bucketCount;
+        }
+
+        // Stable, so the bytes sorted by earlier passes keep their order within a bucket
+        for (const SortEntry &entry : entries)
+            scratch[histogram[(entry.key >> (byte * 8)) & 0xFF]++] = entry;
+
+        entries.swap(scratch);
+    }
+}
+
+void RenderQueue::sort()
+{
+    if (sorted)
+        return;
+
+    radixSort();
+    sorted = true;
+}
+
+void RenderQueue::flush(RenderPass pass)
+{
+    sort();
+
+    uint64_t passKey = static_cast<uint64_t>(pass) << passShift;
+    auto first = std::lower_bound(entries.begin(), entries.end(), passKey,
+                                  [](const SortEntry &entry, uint64_t key) { return entry.key < key; });
+    auto last = std::lower_bound(first, entries.end(), passKey + (1ull << passShift),
+                                 [](const SortEntry &entry, uint64_t key) { return entry.key < key; });
+
+    // Other code binds textures between flushes, so nothing is known about the units yet
+    unsigned int boundTextures[trackedTextureUnits];
+    std::fill(std::begin(boundTextures), std::end(boundTextures), ~0u);
+
+    Shader *shader = nullptr;
+    Uniform<glm::mat4> modelUniform;
+    const MeshPool *pool = nullptr;
+
+    for (auto entry = first; entry != last; ++entry)
+    {
+        DrawItem &item = items[entry->item];
+
+        if (item.shader != shader)
+        {
+            shader = item.shader;
+            shader->use();
+            modelUniform = shader->getUniform<glm::mat4>("model");
+        }
+        else
+            ++programBindsAvoided;
+
+        modelUniform.set(*item.model);
+        item.mesh->bindLayout(*shader);
+
+        if (item.hasTexture)
+            textureBindsAvoided += item.mesh->bindTextures(*shader, item.numberedSamplers, boundTextures, trackedTextureUnits);
+
+        if (item.mesh->pool == pool)
+            ++vertexArrayBindsAvoided;
+        pool = item.mesh->pool;
+
+        item.mesh->draw(item.lod, 1, 0);
+    }
+}
+
+size_t RenderQueue::getItemCount() const
+{
+    return items.size();
+}
@@ -0,0 +1,97 @@
+#ifndef __RENDERQUEUE_H__
+#define __RENDERQUEUE_H__
+#include "Mesh.h"
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Passes of a frame in the order they are drawn, the top field of the sort key
+enum class RenderPass : uint8_t
+{
+    // Casters that don't move, only drawn when the cached shadow map is redrawn, see ShadowCascades
+    STATIC_SHADOW,
+    SHADOW,
+    OPAQUE
+};
+
+// One mesh draw waiting in the queue. The matrix is read when the queue is flushed, so it has to stay alive until then
+struct DrawItem
+{
+    Mesh *mesh;
+    Shader *shader;
+    const glm::mat4 *model;
+    unsigned int lod;
+    bool hasTexture;
+    // Numbered sampler names, see Mesh::bindTextures
+    bool numberedSamplers;
+};
+
+// Collects the draws of a frame, sorts them by a packed 64 bit key and submits them while skipping the program,
+// texture and vertex array binds the previous draw already made. From the top, the key holds:
+//   pass (4 bits) | shader (12) | material (16) | vertex pool (8) | depth (24)
+// Shaders, materials and pools get small ids the first time they are seen, kept for the queue's lifetime so the order
+// is the same every frame. Depth sorts front to back from the view set when the item was submitted
+class RenderQueue
+{
+    struct SortEntry
+    {
+        uint64_t key;
+        uint32_t item;
+    };
+
+    std::vector<DrawItem> items;
+
+    // 'entries' is sorted, 'scratch' is the other half of each radix pass
+    std::vector<SortEntry> entries, scratch;
+
+    bool sorted;
+
+    glm::vec3 viewPosition;
+
+    float maxDepth;
+
+    std::vector<const Shader *> shaderIds;
+
+    std::vector<const MeshPool *> poolIds;
+
+    // Keyed by a hash of the texture ids, a collision only costs binds since the flush compares the ids themselves
+    std::unordered_map<uint64_t, uint32_t> materialIds;
+
+    uint32_t getShaderId(const Shader *shader);
+
+    uint32_t getPoolId(const MeshPool *pool);
+
+    uint32_t getMaterialId(const Mesh &mesh, bool numberedSamplers);
+
+    // LSD radix sort of 'entries' by key, one pass per byte, skipping the bytes every key shares
+    void radixSort();
+
+public:
+    // Texture units whose bindings are tracked during a flush, meshes with more textures always rebind the rest
+    static constexpr unsigned int trackedTextureUnits = 16;
+
+    // Binds the queue did not have to make since the counters were last reset, compared to binding everything per draw
+    static unsigned long long programBindsAvoided;
+    static unsigned long long textureBindsAvoided;
+    static unsigned long long vertexArrayBindsAvoided;
+
+    RenderQueue();
+
+    // Per frame, before the first submit
+    void clear();
+
+    // Where depth is measured from for the following submits, 'maxDepth' maps to the largest depth key
+    void setView(const glm::vec3 &viewPosition, float maxDepth);
+
+    void submit(RenderPass pass, Shader &shader, Mesh &mesh, const glm::mat4 &model, unsigned int lod, bool hasTexture,
+                bool numberedSamplers = false);
+
+    void sort();
+
+    // Draws the items of one pass in key order, sorting first if needed. Texture bindings are assumed unknown on entry
+    void flush(RenderPass pass);
+
+    size_t getItemCount() const;
+};
+
+#endif // __RENDERQUEUE_H__
@@ -0,0 +1,153 @@
+#include "ResourceCache.h"
+#include <filesystem>
+
+TextureResource::~TextureResource()
+{
+    if (id != 0 && !duplicateOf)
+        glDeleteTextures(1, &id);
+
+    ResourceCache::get().onTextureReleased(*this);
+}
+
+ResourceCache &ResourceCache::get()
+{
+    static ResourceCache cache;
+    return cache;
+}
+
+std::string ResourceCache::getKey(const std::string &path)
+{
+    std::error_code error;
+    std::filesystem::path canonical = std::filesystem::weakly_canonical(path, error);
+    if (error)
+        return path;
+
+    return canonical.generic_string();
+}
+
+std::shared_ptr<ModelAsset> ResourceCache::acquireModel(const std::string &path, VertexFormat format, bool &created)
+{
+    std::string key = getKey(path);
+    if (format != VertexFormat::FULL)
+        key += '#' + std::to_string(static_cast<uint32_t>(format));
+    std::weak_ptr<ModelAsset> &entry = models[key];
+
+    std::shared_ptr<ModelAsset> asset = entry.lock();
+    created = asset == nullptr;
+
+    if (!created)
+    {
+        ++stats.modelHits;
+        return asset;
+    }
+
+    ++stats.modelMisses;
+    ++stats.residentModels;
+
+    asset = std::make_shared<ModelAsset>();
+    asset->path = path;
+    asset->directory = path.substr(0, path.find_last_of('/'));
+    asset->format = format;
+    asset->cacheKey = key;
+    entry = asset;
+    return asset;
+}
+
+std::shared_ptr<TextureResource> ResourceCache::acquireTexture(const std::string &path, bool &created)
+{
+    std::string key = getKey(path);
+    std::weak_ptr<TextureResource> &entry = textures[key];
+
+    std::shared_ptr<TextureResource> texture = entry.lock();
+    created = texture == nullptr;
+
+    if (!created)
+    {
+        ++stats.textureHits;
+        return texture;
+    }
+
+    ++stats.textureMisses;
+    ++stats.residentTextures;
+
+    texture = std::make_shared<TextureResource>();
+    texture->cacheKey = key;
+    entry = texture;
+    return texture;
+}
+
+bool ResourceCache::deduplicate(const std::shared_ptr<TextureResource> &texture, uint64_t contentHash, size_t bytes)
+{
+    if (contentHash == 0)
+        return true;
+
+    std::weak_ptr<TextureResource> &entry = contents[contentHash];
+    std::shared_ptr<TextureResource> original = entry.lock();
+
+    if (!original || original == texture)
+    {
+        texture->contentHash = contentHash;
+        entry = texture;
+        return true;
+    }
+
+    if (texture->id != 0)
+        glDeleteTextures(1, &texture->id);
+
+    texture->id = original->id;
+    texture->duplicateOf = original;
+
+    ++stats.textureDuplicates;
+    stats.duplicateTextureBytes += bytes;
+    --stats.residentTextures;
+    return false;
+}
+
+void ResourceCache::setResidentBytes(ModelAsset &asset)
+{
+    if (asset.cacheKey.empty())
+        return;
+
+    size_t bytes = asset.getGeometryBytes();
+    stats.residentMeshBytes += bytes - asset.residentBytes;
+    asset.residentBytes = bytes;
+}
+
+void ResourceCache::setResidentBytes(TextureResource &texture, size_t bytes)
+{
+    stats.residentTextureBytes += bytes - texture.bytes;
+    texture.bytes = bytes;
+}
+
+void ResourceCache::onModelReleased(const ModelAsset &asset)
+{
+    if (asset.cacheKey.empty())
+        return;
+
+    stats.residentMeshBytes -= asset.residentBytes;
+    --stats.residentModels;
+
+    auto entry = models.find(asset.cacheKey);
+    if (entry != models.end() && entry->second.expired())
+        models.erase(entry);
+}
+
+void ResourceCache::onTextureReleased(const TextureResource &texture)
+{
+    stats.residentTextureBytes -= texture.bytes;
+    if (!texture.duplicateOf)
+        --stats.residentTextures;
+
+    auto entry = textures.find(texture.cacheKey);
+    if (entry != textures.end() && entry->second.expired())
+        textures.erase(entry);
+
+    auto content = contents.find(texture.contentHash);
+    if (content != contents.end() && content->second.expired())
+        contents.erase(content);
+}
+
+const ResourceStats &ResourceCache::getStats() const
+{
+    return stats;
+}
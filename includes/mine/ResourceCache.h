@@ -0,0 +1,97 @@
+#ifndef __RESOURCECACHE_H__
+#define __RESOURCECACHE_H__
+#include "ModelAsset.h"
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+// GL texture shared through the ResourceCache, deleted with the last MTexture that references it
+struct TextureResource
+{
+    unsigned int id = 0;
+    size_t bytes = 0;
+
+    std::string cacheKey;
+
+    // Hash of the decoded image, see ResourceCache::deduplicate
+    uint64_t contentHash = 0;
+
+    // Set when the same image was already loaded under another path, 'id' is then that texture's name
+    std::shared_ptr<TextureResource> duplicateOf;
+
+    // Storage of the full image, set once it is uploaded. Streamed textures only hold the levels from 'baseLevel' on
+    int width = 0;
+    int height = 0;
+    int levelCount = 0;
+    // Sized, GL_RGBA8 or the compressed format
+    unsigned int internalFormat = 0;
+    int baseLevel = 0;
+
+    // Bumped whenever the streamer changes the resident levels, copies of the texture compare it (see MaterialTable)
+    uint32_t version = 0;
+
+    ~TextureResource();
+};
+
+struct ResourceStats
+{
+    size_t modelHits = 0;
+    size_t modelMisses = 0;
+    size_t textureHits = 0;
+    size_t textureMisses = 0;
+    // Textures whose content matched one already loaded under another path, and the bytes they did not upload
+    size_t textureDuplicates = 0;
+    size_t duplicateTextureBytes = 0;
+
+    size_t residentModels = 0;
+    size_t residentTextures = 0;
+
+    size_t residentMeshBytes = 0;
+    size_t residentTextureBytes = 0;
+};
+
+// Process wide, reference counted cache of model assets and textures keyed by canonical file path.
+// Entries are held weakly, so a resource goes away as soon as nothing uses it anymore.
+class ResourceCache
+{
+    std::unordered_map<std::string, std::weak_ptr<ModelAsset>> models;
+
+    std::unordered_map<std::string, std::weak_ptr<TextureResource>> textures;
+
+    std::unordered_map<uint64_t, std::weak_ptr<TextureResource>> contents;
+
+    ResourceStats stats;
+
+    ResourceCache() = default;
+
+    friend struct ModelAsset;
+    friend struct TextureResource;
+
+    void onModelReleased(const ModelAsset &asset);
+
+    void onTextureReleased(const TextureResource &texture);
+
+public:
+    static ResourceCache &get();
+
+    static std::string getKey(const std::string &path);
+
+    // On a miss a new, empty entry is created and 'created' is set, the caller is then responsible for loading it.
+    // The same file imported with different vertex formats gives separate assets
+    std::shared_ptr<ModelAsset> acquireModel(const std::string &path, VertexFormat format, bool &created);
+
+    std::shared_ptr<TextureResource> acquireTexture(const std::string &path, bool &created);
+
+    // Content addressed lookup for a texture decoded after acquireTexture created it, before anything is uploaded.
+    // Returns false when a texture with the same content hash is resident, 'texture' then drops its own name and
+    // shares that one's, so the caller skips the upload. 'bytes' is what the upload would have taken
+    bool deduplicate(const std::shared_ptr<TextureResource> &texture, uint64_t contentHash, size_t bytes);
+
+    void setResidentBytes(ModelAsset &asset);
+
+    void setResidentBytes(TextureResource &texture, size_t bytes);
+
+    const ResourceStats &getStats() const;
+};
+
+#endif // __RESOURCECACHE_H__
@@ -0,0 +1,97 @@
+#include "SceneGraph.h"
+#include <algorithm>
+#include <stdexcept>
+
+unsigned long long SceneGraph::updatedNodes = 0;
+
+SceneGraph::SceneGraph() : root(1.f), anyDirty(false), version(0)
+{
+}
+
+void SceneGraph::build(const std::vector<SceneNode> &nodes)
+{
+    parents.resize(nodes.size());
+    locals.resize(nodes.size());
+    worlds.assign(nodes.size(), glm::mat4(1.f));
+    dirty.assign(nodes.size(), 1);
+
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        if (nodes[i].parent >= int32_t(i))
+            throw std::runtime_error("Scene node stored before its parent");
+
+        parents[i] = nodes[i].parent;
+        locals[i] = nodes[i].local;
+    }
+
+    anyDirty = !nodes.empty();
+}
+
+size_t SceneGraph::size() const
+{
+    return parents.size();
+}
+
+void SceneGraph::setRoot(const glm::mat4 &root)
+{
+    this->root = root;
+
+    for (size_t i = 0; i < parents.size(); ++i)
+        if (parents[i] < 0)
+        {
+            dirty[i] = 1;
+            anyDirty = true;
+        }
+}
+
+void SceneGraph::setLocal(size_t node, const glm::mat4 &local)
+{
+    locals.at(node) = local;
+    dirty[node] = 1;
+    anyDirty = true;
+}
+
+const glm::mat4 &SceneGraph::getLocal(size_t node) const
+{
+    return locals.at(node);
+}
+
+bool SceneGraph::update()
+{
+    if (!anyDirty)
+        return false;
+
+    // Parents come first, so their flag and matrix are final by the time the children are reached
+    for (size_t i = 0; i < parents.size(); ++i)
+    {
+        int32_t parent = parents[i];
+        if (parent >= 0 && dirty[parent])
+            dirty[i] = 1;
+
+        if (!dirty[i])
+            continue;
+
+        worlds[i] = (parent < 0 ? root : worlds[parent]) * locals[i];
+        ++updatedNodes;
+    }
+
+    std::fill(dirty.begin(), dirty.end(), 0);
+    anyDirty = false;
+    ++version;
+    return true;
+}
+
+const glm::mat4 &SceneGraph::getWorld(size_t node) const
+{
+    return worlds[node];
+}
+
+const std::vector<glm::mat4> &SceneGraph::getWorldMatrices() const
+{
+    return worlds;
+}
+
+unsigned long long SceneGraph::getVersion() const
+{
+    return version;
+}
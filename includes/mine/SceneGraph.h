@@ -0,0 +1,66 @@
+#ifndef __SCENEGRAPH_H__
+#define __SCENEGRAPH_H__
+#include "../glm/glm.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Node of an imported hierarchy, nodes are stored depth first so a parent always comes before its children
+struct SceneNode
+{
+    std::string name;
+
+    // -1 for the root
+    int32_t parent;
+
+    // Relative to the parent, Assimp's mTransformation
+    glm::mat4 local;
+};
+
+// World matrices of one copy of a node hierarchy, kept in node order in one array so they can be uploaded as they are.
+// Changing a local matrix or the root only flags the node, update() then recomputes the flagged subtrees in a single
+// pass over the array, so a hierarchy nothing changed in costs no matrix math at all
+class SceneGraph
+{
+    std::vector<int32_t> parents;
+    std::vector<glm::mat4> locals;
+    std::vector<glm::mat4> worlds;
+    std::vector<unsigned char> dirty;
+
+    // Parent of the root nodes, the owning model's matrix
+    glm::mat4 root;
+
+    bool anyDirty;
+
+    unsigned long long version;
+
+public:
+    // World matrices recomputed by all graphs since the counter was last reset
+    static unsigned long long updatedNodes;
+
+    SceneGraph();
+
+    // Starts over from the nodes' local matrices, every node is dirty afterwards
+    void build(const std::vector<SceneNode> &nodes);
+
+    size_t size() const;
+
+    void setRoot(const glm::mat4 &root);
+
+    void setLocal(size_t node, const glm::mat4 &local);
+
+    const glm::mat4 &getLocal(size_t node) const;
+
+    // Recomputes the dirty nodes and everything below them, returns false without touching a matrix when nothing changed
+    bool update();
+
+    // Valid after update()
+    const glm::mat4 &getWorld(size_t node) const;
+
+    const std::vector<glm::mat4> &getWorldMatrices() const;
+
+    // Changes with every update() that recomputed something, copies of the matrices compare it to skip unchanged frames
+    unsigned long long getVersion() const;
+};
+
+#endif // __SCENEGRAPH_H__
@@ -1,9 +1,12 @@
 #include "Shader.h"
+#include "LoadProfiler.h"
+#include <filesystem>
 #include <iostream>
 #include <fstream>
+#include <cstring>
 #include "ToPtr.hpp"
 
-bool Shader::compileShader(const char *filepath, unsigned int shaderType)
+bool Shader::compileShader(const char *filepath, unsigned int shaderType, const char *defines)
 {
     std::ifstream *file = new std::ifstream(filepath, std::ios::ate | std::ios::binary);
 
@@ -20,7 +23,19 @@ bool Shader::compileShader(const char *filepath, unsigned int shaderType)
     delete file;
 
     unsigned int shader = glCreateShader(shaderType);
-    glShaderSource(shader, 1, &shaderCode, nullptr);
+
+    if (defines && *defines)
+    {
+        // #version has to stay the first line
+        const char *body = std::strchr(shaderCode, '\n');
+        body = body ? body + 1 : shaderCode + shaderSize;
+
+        const char *sources[3] = {shaderCode, defines, body};
+        const int lengths[3] = {static_cast<int>(body - shaderCode), -1, -1};
+        glShaderSource(shader, 3, sources, lengths);
+    }
+    else
+        glShaderSource(shader, 1, &shaderCode, nullptr);
     glCompileShader(shader);
 
     int success;
@@ -32,6 +47,8 @@ bool Shader::compileShader(const char *filepath, unsigned int shaderType)
         glGetShaderInfoLog(shader, 512, NULL, infoLog);
         if (shaderType == GL_VERTEX_SHADER)
             std::cout << std::string("ERROR::SHADER::VERTEX::COMPILATION_FAILED\n in file: ") + std::string(filepath) << infoLog << std::endl;
+        else if (shaderType == GL_GEOMETRY_SHADER)
+            std::cout << std::string("ERROR::SHADER::GEOMETRY::COMPILATION_FAILED\n in file: ") + std::string(filepath) << infoLog << std::endl;
         else
             std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n in file: " + std::string(filepath)
                       << infoLog << std::endl;
@@ -43,6 +60,8 @@ bool Shader::compileShader(const char *filepath, unsigned int shaderType)
 
     if (shaderType == GL_VERTEX_SHADER)
         vertexShader = shader;
+    else if (shaderType == GL_GEOMETRY_SHADER)
+        geometryShader = shader;
     else
         fragmentShader = shader;
 
@@ -54,6 +73,8 @@ bool Shader::linkShaders()
     program = glCreateProgram();
 
     glAttachShader(program, vertexShader);
+    if (geometryShader)
+        glAttachShader(program, geometryShader);
     glAttachShader(program, fragmentShader);
 
     glLinkProgram(program);
@@ -70,53 +91,196 @@ bool Shader::linkShaders()
         return false;
     }
     glDeleteShader(vertexShader);
+    if (geometryShader)
+        glDeleteShader(geometryShader);
     glDeleteShader(fragmentShader);
 
+    reflectUniforms();
+
     return true;
 }
 
-bool Shader::autoCompileAndLink(const char *vertexShaderFilepath, const char *fragmentShaderFilepath)
+void Shader::reflectUniforms()
 {
-    return compileShader(vertexShaderFilepath, GL_VERTEX_SHADER) &&
-           compileShader(fragmentShaderFilepath, GL_FRAGMENT_SHADER) &&
+    uniformSlots.clear();
+    uniformNames.clear();
+
+    GLint count = 0;
+    glGetProgramInterfaceiv(program, GL_UNIFORM, GL_ACTIVE_RESOURCES, &count);
+
+    const GLenum properties[] = {GL_LOCATION, GL_ARRAY_SIZE, GL_TYPE, GL_NAME_LENGTH};
+
+    for (GLint i = 0; i < count; ++i)
+    {
+        GLint values[4];
+        glGetProgramResourceiv(program, GL_UNIFORM, i, 4, properties, 4, nullptr, values);
+
+        // Members of uniform blocks have no location
+        if (values[0] < 0)
+            continue;
+
+        std::string name(values[3], '\0');
+        glGetProgramResourceName(program, GL_UNIFORM, i, values[3], nullptr, name.data());
+        name.resize(values[3] - 1);
+
+        // Elements of arrays of basic types get consecutive locations, the array is reported as its first element
+        int arraySize = values[1];
+        std::string base = name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0 ? name.substr(0, name.size() - 3) : std::string();
+
+        for (int element = 0; element < (base.empty() ? 1 : arraySize); ++element)
+        {
+            UniformSlot slot{};
+            slot.program = program;
+            slot.location = values[0] + element;
+            slot.type = values[2];
+            uniformSlots.push_back(slot);
+
+            uniformNames.emplace(base.empty() ? name : base + '[' + std::to_string(element) + ']', uniformSlots.size() - 1);
+            if (!base.empty() && element == 0)
+                uniformNames.emplace(base, uniformSlots.size() - 1);
+        }
+    }
+}
+
+bool Shader::autoCompileAndLink(const char *vertexShaderFilepath, const char *fragmentShaderFilepath, const char *defines)
+{
+    LoadAssetScope profileScope(std::string(vertexShaderFilepath) + " + " + fragmentShaderFilepath);
+    ScopedLoadTimer timer(LoadStage::SHADER_COMPILE);
+
+    std::error_code error;
+    for (const char *path : {vertexShaderFilepath, fragmentShaderFilepath})
+    {
+        uintmax_t size = std::filesystem::file_size(path, error);
+        if (!error)
+            timer.addBytesRead(size);
+    }
+
+    return compileShader(vertexShaderFilepath, GL_VERTEX_SHADER, defines) &&
+           compileShader(fragmentShaderFilepath, GL_FRAGMENT_SHADER, defines) &&
+           linkShaders();
+}
+
+bool Shader::autoCompileAndLink(const char *vertexShaderFilepath, const char *geometryShaderFilepath, const char *fragmentShaderFilepath,
+                                const char *defines)
+{
+    LoadAssetScope profileScope(std::string(vertexShaderFilepath) + " + " + geometryShaderFilepath + " + " + fragmentShaderFilepath);
+    ScopedLoadTimer timer(LoadStage::SHADER_COMPILE);
+
+    std::error_code error;
+    for (const char *path : {vertexShaderFilepath, geometryShaderFilepath, fragmentShaderFilepath})
+    {
+        uintmax_t size = std::filesystem::file_size(path, error);
+        if (!error)
+            timer.addBytesRead(size);
+    }
+
+    return compileShader(vertexShaderFilepath, GL_VERTEX_SHADER, defines) &&
+           compileShader(geometryShaderFilepath, GL_GEOMETRY_SHADER, defines) &&
+           compileShader(fragmentShaderFilepath, GL_FRAGMENT_SHADER, defines) &&
            linkShaders();
 }
 
+bool UniformSlot::update(const void *data, size_t size)
+{
+    if (written && std::memcmp(value, data, size) == 0)
+        return false;
+
+    std::memcpy(value, data, size);
+    written = true;
+    return true;
+}
+
+template <>
+void Uniform<int>::set(const int &value) const
+{
+    if (!slot || !slot->update(&value, sizeof(value)))
+        return;
+
+    glProgramUniform1i(slot->program, slot->location, value);
+    ++Shader::uniformWrites;
+}
+
+template <>
+void Uniform<float>::set(const float &value) const
+{
+    if (!slot || !slot->update(&value, sizeof(value)))
+        return;
+
+    glProgramUniform1f(slot->program, slot->location, value);
+    ++Shader::uniformWrites;
+}
+
+template <>
+void Uniform<glm::vec3>::set(const glm::vec3 &value) const
+{
+    if (!slot || !slot->update(glm::value_ptr(value), sizeof(value)))
+        return;
+
+    glProgramUniform3fv(slot->program, slot->location, 1, glm::value_ptr(value));
+    ++Shader::uniformWrites;
+}
+
+template <>
+void Uniform<glm::mat4>::set(const glm::mat4 &value) const
+{
+    if (!slot || !slot->update(glm::value_ptr(value), sizeof(value)))
+        return;
+
+    glProgramUniformMatrix4fv(slot->program, slot->location, 1, GL_FALSE, glm::value_ptr(value));
+    ++Shader::uniformWrites;
+}
+
+unsigned int Shader::boundProgram = 0;
+
+unsigned long long Shader::uniformWrites = 0;
+
+unsigned long long Shader::programBinds = 0;
+
 void Shader::use()
 {
+    if (boundProgram == program)
+        return;
+
     glUseProgram(program);
+    boundProgram = program;
+    ++programBinds;
+}
+
+size_t Shader::getUniformCount() const
+{
+    return uniformSlots.size();
 }
 
 void Shader::setInt(const char *name, int t)
 {
-    use();
-    glUniform1i(glGetUniformLocation(program, name), t);
+    getUniform<int>(name).set(t);
 }
 
 void Shader::setFloat(const char *name, float t)
 {
-    glUniform1f(glGetUniformLocation(program, name), t);
+    getUniform<float>(name).set(t);
 }
 
 void Shader::setVec3(const char* name, const glm::vec3& vec3)
 {
-    use();
-    glUniform3fv(glGetUniformLocation(program, name), 1, glm::value_ptr(vec3));
+    getUniform<glm::vec3>(name).set(vec3);
 }
 
-
 void Shader::setMat4(const char* name, const glm::mat4& mat4)
 {
-    use();
-    glUniformMatrix4fv(glGetUniformLocation(program, name), 1, GL_FALSE, glm::value_ptr(mat4));
+    getUniform<glm::mat4>(name).set(mat4);
 }
 
 Shader::~Shader()
 {
+    if (boundProgram == program)
+        boundProgram = 0;
+
     glDeleteProgram(program);
 }
 
 Shader::Shader()
 {
     vertexShader = fragmentShader = program = -1;
+    geometryShader = 0;
 }
@@ -4,30 +4,117 @@
 #include "../glm/gtc/matrix_transform.hpp"
 #include "../glm/gtc/type_ptr.hpp"
 #include "../glm/glm.hpp"
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// One active uniform of a linked program, with a copy of the last value written so unchanged values cost no GL call
+struct UniformSlot
+{
+    unsigned int program;
+    int location;
+    // GL_FLOAT_VEC3, GL_SAMPLER_2D, ...
+    unsigned int type;
+
+    bool written;
+    unsigned char value[sizeof(glm::mat4)];
+
+    // Copies 'size' bytes of 'data' in, false when they match what was last written
+    bool update(const void *data, size_t size);
+};
+
+// Uniform resolved once through Shader::getUniform, written with glProgramUniform* so the program doesn't have to be bound.
+// Handles of uniforms the program doesn't use write nothing. Valid as long as the Shader is
+template <typename T>
+class Uniform
+{
+    UniformSlot *slot;
+
+public:
+    Uniform(UniformSlot *slot = nullptr) : slot(slot)
+    {
+    }
+
+    bool isActive() const
+    {
+        return slot != nullptr;
+    }
+
+    void set(const T &value) const;
+};
+
+template <> void Uniform<int>::set(const int &value) const;
+template <> void Uniform<float>::set(const float &value) const;
+template <> void Uniform<glm::vec3>::set(const glm::vec3 &value) const;
+template <> void Uniform<glm::mat4>::set(const glm::mat4 &value) const;
 
 class Shader
 {
+    struct NameHash
+    {
+        using is_transparent = void;
+
+        size_t operator()(std::string_view name) const
+        {
+            return std::hash<std::string_view>()(name);
+        }
+    };
+
     unsigned int program;
     unsigned int vertexShader;
     unsigned int fragmentShader;
+    // 0 unless a geometry stage was compiled
+    unsigned int geometryShader;
+
+    std::vector<UniformSlot> uniformSlots;
+
+    // Every name glGetUniformLocation would accept for the active uniforms, arrays also by their bare name and every element
+    std::unordered_map<std::string, size_t, NameHash, std::equal_to<>> uniformNames;
+
+    // Program last bound through use()
+    static unsigned int boundProgram;
+
+    // Fills the tables from glGetProgramResource*, called after linking
+    void reflectUniforms();
+
     public:
+    // GL calls made by the uniform setters and use() since the counters were last reset
+    static unsigned long long uniformWrites;
+    static unsigned long long programBinds;
+
     Shader();
 
-    bool compileShader(const char* filepath, unsigned int shaderType);
+    // 'defines' is inserted right after the #version line, used to build variants of one source file
+    bool compileShader(const char* filepath, unsigned int shaderType, const char* defines = nullptr);
 
     bool linkShaders();
 
-    bool autoCompileAndLink(const char* vertexShaderFilepath, const char* fragmentShaderFilepath);
+    bool autoCompileAndLink(const char* vertexShaderFilepath, const char* fragmentShaderFilepath, const char* defines = nullptr);
+
+    // Same with a geometry stage between the two
+    bool autoCompileAndLink(const char* vertexShaderFilepath, const char* geometryShaderFilepath, const char* fragmentShaderFilepath,
+                            const char* defines);
 
+    // Binds the program unless it already is, draws need it bound while the setters don't
     void use();
 
+    // Hash lookup, no GL call. Keep the handle instead of calling the setters below in hot loops
+    template <typename T>
+    Uniform<T> getUniform(std::string_view name)
+    {
+        auto entry = uniformNames.find(name);
+        return Uniform<T>(entry != uniformNames.end() ? &uniformSlots[entry->second] : nullptr);
+    }
+
+    size_t getUniformCount() const;
+
     void setInt(const char* name, int t);
 
     void setFloat(const char* name, float t);
 
     void setVec3(const char* name, const glm::vec3& vec3);
 
-
     void setMat4(const char* name, const glm::mat4& mat4);
 
     ~Shader();
@@ -0,0 +1,335 @@
+#include "ShadowCascades.h"
+#include "../glm/gtc/matrix_transform.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+unsigned long long ShadowCascades::staticPasses = 0;
+unsigned long long ShadowCascades::staticTexels = 0;
+
+ShadowCascades::ShadowCascades(int resolution)
+    : resolution(resolution), block{}, blockWritten(false), origins{}, depthRanges{}, staticLightDirection(0.f), staticLayers{}, staticRegions{},
+      staticPassCount(0), staticBoundsSet(false), staticBoundsMin(0.f), staticBoundsMax(0.f),
+      staticBoundsMatrix(1.f)
+{
+    createTarget(framebuffer, depthArray);
+    createTarget(staticFramebuffer, staticArray);
+
+    glGenTextures(1, &scrollTexture);
+    glBindTexture(GL_TEXTURE_2D, scrollTexture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, resolution, resolution);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenBuffers(1, &cascadeBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, cascadeBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(CascadeBlock), &block, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    glBindBufferBase(GL_UNIFORM_BUFFER, bindingPoint, cascadeBuffer);
+}
+
+void ShadowCascades::createTarget(unsigned int &framebuffer, unsigned int &texture)
+{
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT32F, resolution, resolution, maxCascades, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    float borderColor[] = {1.0f, 1.0f, 1.0f, 1.0f};
+    glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, borderColor);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    // Layered attachment, gl_Layer picks the cascade
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    if (!complete)
+        throw std::runtime_error("Shadow cascade framebuffer incomplete");
+}
+
+void ShadowCascades::update(const Camera &camera, const glm::vec3 &lightDirection)
+{
+    int count = std::clamp(cascadeCount, 1, maxCascades);
+
+    // Near and far plane of the camera's perspective projection
+    const glm::mat4 &projection = camera.getProjection();
+    float nearDepth = projection[3][2] / (projection[2][2] - 1.f);
+    float farDepth = projection[3][2] / (projection[2][2] + 1.f);
+    float shadowFar = std::clamp(shadowDistance, nearDepth + 0.01f, farDepth);
+
+    // The frustum's edges are rays from the eye, a point at some view depth lies at the same fraction along each of them
+    glm::mat4 inverseViewProjection = glm::inverse(projection * camera.getView());
+    glm::vec3 nearCorners[4], farCorners[4];
+    for (int corner = 0; corner < 4; ++corner)
+    {
+        float x = corner & 1 ? 1.f : -1.f, y = corner & 2 ? 1.f : -1.f;
+        glm::vec4 nearCorner = inverseViewProjection * glm::vec4(x, y, -1.f, 1.f);
+        glm::vec4 farCorner = inverseViewProjection * glm::vec4(x, y, 1.f, 1.f);
+        nearCorners[corner] = glm::vec3(nearCorner) / nearCorner.w;
+        farCorners[corner] = glm::vec3(farCorner) / farCorner.w;
+    }
+
+    // Fixed orientation around the world origin, the texel grid only moves when the light does
+    glm::vec3 direction = glm::normalize(lightDirection);
+    glm::vec3 up = std::abs(direction.y) > 0.99f ? glm::vec3(0.f, 0.f, 1.f) : glm::vec3(0.f, 1.f, 0.f);
+    glm::mat4 lightView = glm::lookAt(glm::vec3(0.f), direction, up);
+
+    // A turned light sees the static casters from somewhere else
+    if (direction != staticLightDirection)
+    {
+        staticLightDirection = direction;
+        invalidateStatic();
+    }
+
+    // Looking down -z, distances along the light of the static casters snapped outwards
+    glm::vec2 staticDepthRange(0.f);
+    if (staticBoundsSet)
+    {
+        float nearest = INFINITY, furthest = -INFINITY;
+        for (int corner = 0; corner < 8; ++corner)
+        {
+            glm::vec3 point(corner & 1 ? staticBoundsMax.x : staticBoundsMin.x, corner & 2 ? staticBoundsMax.y : staticBoundsMin.y,
+                            corner & 4 ? staticBoundsMax.z : staticBoundsMin.z);
+            float depth = -(lightView * staticBoundsMatrix * glm::vec4(point, 1.f)).z;
+            nearest = std::min(nearest, depth);
+            furthest = std::max(furthest, depth);
+        }
+        staticDepthRange = glm::vec2(std::floor(nearest / depthStep) * depthStep, std::ceil(furthest / depthStep) * depthStep + depthStep);
+    }
+
+    CascadeBlock next{};
+    next.cascadeCount = count;
+    next.blendBand = blendBand;
+
+    glm::vec3 boxMin(INFINITY), boxMax(-INFINITY);
+    float sliceStart = nearDepth;
+    for (int cascade = 0; cascade < count; ++cascade)
+    {
+        float t = float(cascade + 1) / count;
+        float logSplit = nearDepth * std::pow(shadowFar / nearDepth, t);
+        float uniformSplit = nearDepth + (shadowFar - nearDepth) * t;
+        float sliceEnd = splitLambda * logSplit + (1.f - splitLambda) * uniformSplit;
+
+        glm::vec3 corners[8];
+        glm::vec3 center(0.f);
+        for (int corner = 0; corner < 4; ++corner)
+        {
+            glm::vec3 edge = farCorners[corner] - nearCorners[corner];
+            corners[corner] = nearCorners[corner] + edge * ((sliceStart - nearDepth) / (farDepth - nearDepth));
+            corners[corner + 4] = nearCorners[corner] + edge * ((sliceEnd - nearDepth) / (farDepth - nearDepth));
+            center += corners[corner] + corners[corner + 4];
+        }
+        center /= 8.f;
+
+        // The corners keep their distances to their mean as the camera turns, rounding keeps float noise out of it
+        float radius = 0.f;
+        for (const glm::vec3 &corner : corners)
+            radius = std::max(radius, glm::length(corner - center));
+        radius = std::ceil(radius * 16.f) / 16.f;
+
+        float texelSize = 2.f * radius / resolution;
+        glm::vec3 lightCenter = glm::vec3(lightView * glm::vec4(center, 1.f));
+        glm::ivec2 origin(int(std::floor(lightCenter.x / texelSize)), int(std::floor(lightCenter.y / texelSize)));
+        lightCenter.x = origin.x * texelSize;
+        lightCenter.y = origin.y * texelSize;
+
+        // Depth moves in whole steps too, the far plane is pushed out by one since flooring only moves the center closer.
+        // The near plane is pulled towards the light for the casters in front of the slice
+        glm::vec2 depthRange = staticDepthRange;
+        if (!staticBoundsSet)
+        {
+            float centerDepth = std::floor(-lightCenter.z / depthStep) * depthStep;
+            depthRange = glm::vec2(centerDepth - radius - casterDepth, centerDepth + radius + depthStep);
+        }
+
+        glm::vec3 sliceMin(lightCenter.x - radius, lightCenter.y - radius, depthRange.x);
+        glm::vec3 sliceMax(lightCenter.x + radius, lightCenter.y + radius, depthRange.y);
+        glm::mat4 lightProjection = glm::ortho(sliceMin.x, sliceMax.x, sliceMin.y, sliceMax.y, sliceMin.z, sliceMax.z);
+
+        next.lightSpaceMatrices[cascade] = lightProjection * lightView;
+        next.splitDepths[cascade] = sliceEnd;
+        next.texelSizes[cascade] = texelSize;
+        next.depthBiases[cascade] = texelSize / (sliceMax.z - sliceMin.z);
+
+        // A layer drawn at another scale or depth can't be scrolled into this one
+        StaticLayer &layer = staticLayers[cascade];
+        if (layer.texelSize != texelSize || layer.depthRange != depthRange)
+            layer.valid = false;
+        origins[cascade] = origin;
+        depthRanges[cascade] = depthRange;
+
+        boxMin = glm::min(boxMin, sliceMin);
+        boxMax = glm::max(boxMax, sliceMax);
+        sliceStart = sliceEnd;
+    }
+
+    casterFrustum = Frustum::fromMatrix(glm::ortho(boxMin.x, boxMax.x, boxMin.y, boxMax.y, boxMin.z, boxMax.z) * lightView);
+
+    if (blockWritten && std::memcmp(&next, &block, sizeof(block)) == 0)
+        return;
+
+    block = next;
+    blockWritten = true;
+    glBindBuffer(GL_UNIFORM_BUFFER, cascadeBuffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(CascadeBlock), &block);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+const CascadeBlock &ShadowCascades::getBlock() const
+{
+    return block;
+}
+
+const Frustum &ShadowCascades::getCasterFrustum() const
+{
+    return casterFrustum;
+}
+
+int ShadowCascades::getResolution() const
+{
+    return resolution;
+}
+
+void ShadowCascades::setStaticBounds(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, const glm::mat4 &matrix)
+{
+    if (staticBoundsSet && boundsMin == staticBoundsMin && boundsMax == staticBoundsMax && matrix == staticBoundsMatrix)
+        return;
+
+    staticBoundsSet = true;
+    staticBoundsMin = boundsMin;
+    staticBoundsMax = boundsMax;
+    staticBoundsMatrix = matrix;
+    invalidateStatic();
+}
+
+void ShadowCascades::invalidateStatic()
+{
+    for (StaticLayer &layer : staticLayers)
+        layer.valid = false;
+}
+
+bool ShadowCascades::isStaticValid() const
+{
+    for (int cascade = 0; cascade < block.cascadeCount; ++cascade)
+        if (!staticLayers[cascade].valid || staticLayers[cascade].origin != origins[cascade])
+            return false;
+    return true;
+}
+
+int ShadowCascades::updateStatic()
+{
+    staticPassCount = 0;
+
+    for (int cascade = 0; cascade < maxCascades; ++cascade)
+    {
+        staticRegions[0][cascade] = staticRegions[1][cascade] = StaticRegion{};
+        if (cascade >= block.cascadeCount)
+            continue;
+
+        StaticLayer &layer = staticLayers[cascade];
+        glm::ivec2 shift = origins[cascade] - layer.origin;
+        if (layer.valid && shift == glm::ivec2(0))
+            continue;
+
+        StaticRegion regions[2] = {};
+        if (!layer.valid || std::abs(shift.x) >= resolution || std::abs(shift.y) >= resolution)
+            regions[0] = {0, 0, resolution, resolution};
+        else
+        {
+            // Texel (x, y) of the moved cascade is texel (x + shift.x, y + shift.y) of the cached one. Copies within one
+            // image can't overlap, so the layer takes a round trip through the scroll texture
+            int width = resolution - std::abs(shift.x), height = resolution - std::abs(shift.y);
+            glCopyImageSubData(staticArray, GL_TEXTURE_2D_ARRAY, 0, 0, 0, cascade, scrollTexture, GL_TEXTURE_2D, 0, 0, 0, 0,
+                               resolution, resolution, 1);
+            glCopyImageSubData(scrollTexture, GL_TEXTURE_2D, 0, std::max(shift.x, 0), std::max(shift.y, 0), 0,
+                               staticArray, GL_TEXTURE_2D_ARRAY, 0, std::max(-shift.x, 0), std::max(-shift.y, 0), cascade, width, height, 1);
+
+            // The columns that came into view, then the rows next to them
+            int columnsStart = shift.x > 0 ? width : 0;
+            int rowsStart = shift.y > 0 ? height : 0;
+            regions[0] = {columnsStart, 0, std::abs(shift.x), resolution};
+            regions[1] = {shift.x < 0 ? -shift.x : 0, rowsStart, width, std::abs(shift.y)};
+        }
+
+        // Empty regions don't take up a pass
+        int pass = 0;
+        for (const StaticRegion &region : regions)
+            if (region.width > 0 && region.height > 0)
+            {
+                staticRegions[pass++][cascade] = region;
+                staticTexels += static_cast<unsigned long long>(region.width) * region.height;
+            }
+        staticPassCount = std::max(staticPassCount, pass);
+
+        layer.origin = origins[cascade];
+        layer.texelSize = block.texelSizes[cascade];
+        layer.depthRange = depthRanges[cascade];
+        layer.valid = true;
+    }
+
+    return staticPassCount;
+}
+
+void ShadowCascades::beginStaticPass(int pass)
+{
+    ++staticPasses;
+
+    // Cleared per layer, glClear would only take the scissor box of the first viewport
+    const float farDepth = 1.f;
+    for (int cascade = 0; cascade < maxCascades; ++cascade)
+    {
+        const StaticRegion &region = staticRegions[pass][cascade];
+        if (region.width > 0 && region.height > 0)
+            glClearTexSubImage(staticArray, 0, region.x, region.y, cascade, region.width, region.height, 1, GL_DEPTH_COMPONENT, GL_FLOAT, &farDepth);
+        glScissorIndexed(cascade, region.x, region.y, region.width, region.height);
+    }
+
+    // The geometry shader sends every cascade through the viewport of its index, so each one gets its own scissor box
+    glViewport(0, 0, resolution, resolution);
+    glBindFramebuffer(GL_FRAMEBUFFER, staticFramebuffer);
+    glEnable(GL_SCISSOR_TEST);
+    glEnable(GL_DEPTH_CLAMP);
+}
+
+void ShadowCascades::beginPass()
+{
+    // Stands in for the clear, only the layers in use
+    glCopyImageSubData(staticArray, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, depthArray, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0,
+                       resolution, resolution, block.cascadeCount);
+
+    glViewport(0, 0, resolution, resolution);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glEnable(GL_DEPTH_CLAMP);
+}
+
+void ShadowCascades::endPass()
+{
+    glDisable(GL_SCISSOR_TEST);
+    glDisable(GL_DEPTH_CLAMP);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void ShadowCascades::bindTexture(unsigned int unit) const
+{
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, depthArray);
+}
+
+ShadowCascades::~ShadowCascades()
+{
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteFramebuffers(1, &staticFramebuffer);
+    glDeleteTextures(1, &depthArray);
+    glDeleteTextures(1, &staticArray);
+    glDeleteTextures(1, &scrollTexture);
+    glDeleteBuffers(1, &cascadeBuffer);
+}
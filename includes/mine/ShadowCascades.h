@@ -0,0 +1,170 @@
+#ifndef __SHADOWCASCADES_H__
+#define __SHADOWCASCADES_H__
+#include "../GL/glad.h"
+#include "Camera.h"
+#include "Frustum.h"
+#include "../glm/glm.hpp"
+#include <cstdint>
+
+// Mirror of the std140 Cascades block, 'cascades' in the shaders
+struct CascadeBlock
+{
+    glm::mat4 lightSpaceMatrices[4];
+    // View depth where each cascade ends
+    glm::vec4 splitDepths;
+    // World size of one texel of each cascade, receivers move their lookups along the normal by it
+    glm::vec4 texelSizes;
+    // One texel worth of each cascade's [0, 1] depth range
+    glm::vec4 depthBiases;
+    int32_t cascadeCount;
+    // Fraction of a cascade's depth range blended into the next one
+    float blendBand;
+    float padding[2];
+};
+
+static_assert(sizeof(CascadeBlock) == 320, "CascadeBlock must match the std140 layout of the shaders");
+
+// Cascaded shadow map of the directional light: the camera's view is split in depth with the practical split scheme
+// and every slice gets its own orthographic projection and layer of one depth texture array.
+// Each projection is fitted to the bounding sphere of its slice, so its size doesn't change as the camera turns, and
+// moved in whole texels and depth steps, so the shadow edges don't shimmer as the camera moves. The casters are drawn
+// once with a geometry shader copying them into every layer.
+// Static casters are kept in a second array, every frame starts from a copy of it and only draws the dynamic casters
+// on top. As the camera moves the cascades slide over the light's texel grid, the cached layers are scrolled along by
+// whole texels and only the strips that came into view are drawn again. With the static casters' bounds set the depth
+// range doesn't follow the camera either, so a whole layer is only drawn again when the light turns, a cascade changes
+// size (split settings) or the static casters were invalidated
+class ShadowCascades
+{
+    // What a layer of the static array was drawn for
+    struct StaticLayer
+    {
+        // Lower left corner of the cascade in texels of the light's grid
+        glm::ivec2 origin;
+        float texelSize;
+        glm::vec2 depthRange;
+        bool valid;
+    };
+
+    // Region of a static layer one static pass draws, empty when width or height is 0
+    struct StaticRegion
+    {
+        int x, y, width, height;
+    };
+
+    unsigned int framebuffer, depthArray, cascadeBuffer;
+
+    unsigned int staticFramebuffer, staticArray;
+
+    // One layer, the static layers are scrolled through it
+    unsigned int scrollTexture;
+
+    int resolution;
+
+    CascadeBlock block;
+
+    bool blockWritten;
+
+    // Grid position and depth range of every cascade as of the last update()
+    glm::ivec2 origins[4];
+    glm::vec2 depthRanges[4];
+
+    // Light the static layers were drawn for
+    glm::vec3 staticLightDirection;
+
+    StaticLayer staticLayers[4];
+
+    // Per static pass and cascade, the column and the row strip a scroll exposed or the whole layer
+    StaticRegion staticRegions[2][4];
+
+    int staticPassCount;
+
+    bool staticBoundsSet;
+    glm::vec3 staticBoundsMin, staticBoundsMax;
+    glm::mat4 staticBoundsMatrix;
+
+    // Light space box around every cascade, caster depth included
+    Frustum casterFrustum;
+
+    // Depth array with the layout of the cascades, attached layered to 'framebuffer'
+    void createTarget(unsigned int &framebuffer, unsigned int &texture);
+
+public:
+    static constexpr int maxCascades = 4;
+
+    // Uniform block binding, 0 is the View block of FrameUniforms
+    static constexpr unsigned int bindingPoint = 1;
+
+    // Makes the shadow map shaders emit world positions for the cascade geometry shader
+    static constexpr const char *define = "#define CASCADES\n";
+
+    int cascadeCount = maxCascades;
+
+    // 0 splits uniformly, 1 logarithmically, the practical split scheme blends both
+    float splitLambda = 0.75f;
+
+    // Camera depth covered by the cascades, there is no shadow past it
+    float shadowDistance = 30.f;
+
+    // How far before a cascade towards the light casters still land in it
+    float casterDepth = 20.f;
+
+    // The depth range of a cascade only moves in steps of this many units along the light
+    float depthStep = 1.f;
+
+    float blendBand = 0.1f;
+
+    // Times the static casters were drawn and texels of the static layers they were drawn into since the counters were
+    // last reset
+    static unsigned long long staticPasses;
+    static unsigned long long staticTexels;
+
+    // 'resolution' texels square per cascade
+    explicit ShadowCascades(int resolution);
+
+    ShadowCascades(const ShadowCascades &) = delete;
+
+    ShadowCascades &operator=(const ShadowCascades &) = delete;
+
+    // Per frame, after the camera moved. 'lightDirection' points from the light into the scene
+    void update(const Camera &camera, const glm::vec3 &lightDirection);
+
+    const CascadeBlock &getBlock() const;
+
+    // Casters outside of it can't land in any cascade
+    const Frustum &getCasterFrustum() const;
+
+    int getResolution() const;
+
+    // Box around the static casters that 'matrix' places in the world, before update(). Their depth range then fixes
+    // the cascades' one, otherwise it follows the camera in steps of 'depthStep' and every step draws the static layers
+    // again. Changes invalidate
+    void setStaticBounds(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, const glm::mat4 &matrix);
+
+    // The static casters are drawn again in the next static passes
+    void invalidateStatic();
+
+    // False when the static layers need drawing somewhere, the static casters only need to be submitted then
+    bool isStaticValid() const;
+
+    // Scrolls the static layers along with the cascades and returns the number of static passes drawing what that
+    // exposed, and the layers that changed otherwise, 0 while the cache covers every cascade. Call once per frame after
+    // update(), before beginPass()
+    int updateStatic();
+
+    // Binds the static framebuffer with the regions of 'pass' cleared and everything else scissored away, the static
+    // casters are drawn and the pass is closed with endPass()
+    void beginStaticPass(int pass);
+
+    // Binds the framebuffer holding a copy of the static casters, the dynamic ones are drawn on top of it.
+    // Depth is clamped in both passes so casters before the near plane still land on it
+    void beginPass();
+
+    void endPass();
+
+    void bindTexture(unsigned int unit) const;
+
+    ~ShadowCascades();
+};
+
+#endif // __SHADOWCASCADES_H__
@@ -0,0 +1,575 @@
+#include "TextureCache.h"
+#include "MeshCache.h"
+#include "LoadProfiler.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace
+{
+    const unsigned char ktxIdentifier[12] = {0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+
+    // Level data starts on this boundary, a multiple of both block sizes as KTX2 requires
+    constexpr size_t levelAlignment = 16;
+
+    constexpr char sourceKey[] = "mine.source";
+
+    struct KtxHeader
+    {
+        unsigned char identifier[12];
+        uint32_t vkFormat;
+        uint32_t typeSize;
+        uint32_t pixelWidth;
+        uint32_t pixelHeight;
+        uint32_t pixelDepth;
+        uint32_t layerCount;
+        uint32_t faceCount;
+        uint32_t levelCount;
+        uint32_t supercompressionScheme;
+        uint32_t dfdByteOffset;
+        uint32_t dfdByteLength;
+        uint32_t kvdByteOffset;
+        uint32_t kvdByteLength;
+        uint64_t sgdByteOffset;
+        uint64_t sgdByteLength;
+    };
+
+    struct KtxLevel
+    {
+        uint64_t byteOffset;
+        uint64_t byteLength;
+        uint64_t uncompressedByteLength;
+    };
+
+    static_assert(sizeof(KtxHeader) == 80, "KtxHeader must match the KTX2 file layout");
+
+    // VkFormat and data format descriptor colour model of every codec
+    struct CodecInfo
+    {
+        TextureCodec codec;
+        uint32_t vkFormat;
+        uint32_t colorModel;
+        int channels;
+    };
+
+    const CodecInfo codecInfos[] = {
+        {TextureCodec::BC1, 131, 128, 3},
+        {TextureCodec::BC3, 137, 130, 4},
+        {TextureCodec::BC4, 139, 131, 1},
+        {TextureCodec::BC5, 141, 132, 2},
+        {TextureCodec::BC7, 145, 134, 4}};
+
+    const CodecInfo &getCodecInfo(TextureCodec codec)
+    {
+        return codecInfos[static_cast<uint32_t>(codec)];
+    }
+
+    const CodecInfo *findVkFormat(uint32_t vkFormat)
+    {
+        for (const CodecInfo &info : codecInfos)
+            if (info.vkFormat == vkFormat)
+                return &info;
+        return nullptr;
+    }
+
+    size_t alignUp(size_t value, size_t alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    // Basic data format descriptor of a codec, with the samples of the Khronos format tables
+    std::vector<uint32_t> makeDescriptor(TextureCodec codec)
+    {
+        struct Sample
+        {
+            uint32_t bitOffset;
+            uint32_t bitLength;
+            uint32_t channel;
+        };
+
+        std::vector<Sample> samples;
+        switch (codec)
+        {
+        case TextureCodec::BC3:
+            samples = {{0, 64, 15}, {64, 64, 0}};
+            break;
+        case TextureCodec::BC5:
+            samples = {{0, 64, 0}, {64, 64, 1}};
+            break;
+        case TextureCodec::BC7:
+            samples = {{0, 128, 0}};
+            break;
+        default:
+            samples = {{0, 64, 0}};
+            break;
+        }
+
+        uint32_t blockSize = 24 + 16 * static_cast<uint32_t>(samples.size());
+
+        std::vector<uint32_t> words;
+        words.push_back(4 + blockSize);
+        // Khronos vendor, basic descriptor type, version 2
+        words.push_back(0);
+        words.push_back(2 | blockSize << 16);
+        // BT.709 primaries, linear transfer, straight alpha
+        words.push_back(getCodecInfo(codec).colorModel | 1 << 8 | 1 << 16);
+        // 4x4 texel blocks, stored as dimension - 1
+        words.push_back(3 | 3 << 8);
+        words.push_back(static_cast<uint32_t>(getBlockBytes(codec)));
+        words.push_back(0);
+
+        for (const Sample &sample : samples)
+        {
+            words.push_back(sample.bitOffset | (sample.bitLength - 1) << 16 | sample.channel << 24);
+            words.push_back(0);
+            words.push_back(0);
+            words.push_back(0xFFFFFFFF);
+        }
+
+        return words;
+    }
+
+    bool getSourceStamp(const std::string &sourcePath, bool flipVertically, std::string &stamp)
+    {
+        std::error_code error;
+        auto lastWrite = std::filesystem::last_write_time(sourcePath, error);
+        if (error)
+            return false;
+
+        uintmax_t size = std::filesystem::file_size(sourcePath, error);
+        if (error)
+            return false;
+
+        stamp = std::to_string(lastWrite.time_since_epoch().count()) + ' ' + std::to_string(size) + (flipVertically ? " flipped" : " upright");
+        return true;
+    }
+
+    // Value of 'key' in KTX2 key/value data, empty if it is missing
+    std::string findKeyValue(const unsigned char *data, size_t size, const char *key)
+    {
+        size_t offset = 0;
+        while (offset + sizeof(uint32_t) <= size)
+        {
+            uint32_t length;
+            std::memcpy(&length, data + offset, sizeof(length));
+            offset += sizeof(length);
+            if (length > size - offset)
+                break;
+
+            const char *entry = reinterpret_cast<const char *>(data + offset);
+            size_t keyLength = strnlen(entry, length);
+            if (keyLength < length && std::strcmp(entry, key) == 0)
+            {
+                std::string value(entry + keyLength + 1, length - keyLength - 1);
+                if (!value.empty() && value.back() == '\0')
+                    value.pop_back();
+                return value;
+            }
+
+            offset += alignUp(length, 4);
+        }
+
+        return std::string();
+    }
+
+    std::vector<unsigned char> expandToRgba(const DecodedImage &image)
+    {
+        size_t texels = size_t(image.width) * image.height;
+        std::vector<unsigned char> rgba(texels * 4);
+
+        const unsigned char *source = image.pixels.get();
+        for (size_t i = 0; i < texels; ++i, source += image.channels)
+        {
+            unsigned char *texel = &rgba[i * 4];
+            if (image.channels <= 2)
+            {
+                texel[0] = texel[1] = texel[2] = source[0];
+                texel[3] = image.channels == 2 ? source[1] : 255;
+            }
+            else
+            {
+                texel[0] = source[0];
+                texel[1] = source[1];
+                texel[2] = source[2];
+                texel[3] = image.channels == 4 ? source[3] : 255;
+            }
+        }
+
+        return rgba;
+    }
+
+    // Box filter to half size, normal maps are renormalized so distant mips keep their bumps at full strength
+    std::vector<unsigned char> downsample(const std::vector<unsigned char> &rgba, int width, int height, bool normals)
+    {
+        int halfWidth = std::max(1, width / 2), halfHeight = std::max(1, height / 2);
+        std::vector<unsigned char> result(size_t(halfWidth) * halfHeight * 4);
+
+        for (int y = 0; y < halfHeight; ++y)
+            for (int x = 0; x < halfWidth; ++x)
+            {
+                float average[4] = {};
+                for (int dy = 0; dy < 2; ++dy)
+                    for (int dx = 0; dx < 2; ++dx)
+                    {
+                        int sourceX = std::min(x * 2 + dx, width - 1);
+                        int sourceY = std::min(y * 2 + dy, height - 1);
+                        const unsigned char *texel = &rgba[(size_t(sourceY) * width + sourceX) * 4];
+                        for (int c = 0; c < 4; ++c)
+                            average[c] += texel[c] / 4.f;
+                    }
+
+                if (normals)
+                {
+                    float normal[3], length = 0.f;
+                    for (int c = 0; c < 3; ++c)
+                    {
+                        normal[c] = average[c] / 127.5f - 1.f;
+                        length += normal[c] * normal[c];
+                    }
+
+                    length = std::sqrt(length);
+                    if (length > 1e-6f)
+                        for (int c = 0; c < 3; ++c)
+                            average[c] = (normal[c] / length + 1.f) * 127.5f;
+                }
+
+                unsigned char *texel = &result[(size_t(y) * halfWidth + x) * 4];
+                for (int c = 0; c < 4; ++c)
+                    texel[c] = static_cast<unsigned char>(std::clamp(average[c] + 0.5f, 0.f, 255.f));
+            }
+
+        return result;
+    }
+
+    // Checks a file written by TextureCache::write against the source's stamp, the level offsets are file offsets
+    const CodecInfo *readLevels(const unsigned char *file, size_t size, const std::string &stamp, KtxHeader &header, std::vector<ImageLevel> &levels)
+    {
+        if (size < sizeof(KtxHeader))
+            return nullptr;
+
+        std::memcpy(&header, file, sizeof(header));
+
+        const CodecInfo *info = findVkFormat(header.vkFormat);
+        if (std::memcmp(header.identifier, ktxIdentifier, sizeof(ktxIdentifier)) != 0 || !info ||
+            header.pixelWidth == 0 || header.pixelHeight == 0 || header.pixelDepth != 0 ||
+            header.layerCount != 0 || header.faceCount != 1 || header.supercompressionScheme != 0 ||
+            header.levelCount == 0 || header.levelCount > 32 ||
+            sizeof(KtxHeader) + header.levelCount * sizeof(KtxLevel) > size ||
+            uint64_t(header.kvdByteOffset) + header.kvdByteLength > size)
+            return nullptr;
+
+        if (findKeyValue(file + header.kvdByteOffset, header.kvdByteLength, sourceKey) != stamp)
+            return nullptr;
+
+        levels.clear();
+        for (uint32_t level = 0; level < header.levelCount; ++level)
+        {
+            KtxLevel entry;
+            std::memcpy(&entry, file + sizeof(KtxHeader) + level * sizeof(KtxLevel), sizeof(entry));
+
+            int width = std::max(1, int(header.pixelWidth >> level));
+            int height = std::max(1, int(header.pixelHeight >> level));
+            if (entry.byteLength != getCompressedSize(info->codec, width, height) || entry.byteOffset > size || entry.byteLength > size - entry.byteOffset)
+                return nullptr;
+
+            levels.push_back({width, height, static_cast<size_t>(entry.byteOffset), static_cast<size_t>(entry.byteLength)});
+        }
+
+        return info;
+    }
+
+    // Slots that may hold a grey single channel map
+    bool isSingleChannelType(const std::string &type)
+    {
+        static const char *const singleChannelTypes[] = {
+            "texture_ao", "texture_lightmap", "texture_metalness", "texture_roughness", "texture_shininess",
+            "texture_specular", "texture_height", "texture_displacement", "texture_opacity"};
+
+        return std::find(std::begin(singleChannelTypes), std::end(singleChannelTypes), type) != std::end(singleChannelTypes);
+    }
+
+    // Workers cooking the same texture write their own temporary file, the rename publishes whichever finishes last
+    std::atomic<uint64_t> tempCounter{0};
+}
+
+GLenum getCompressedFormat(TextureCodec codec)
+{
+    switch (codec)
+    {
+    case TextureCodec::BC1:
+        return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case TextureCodec::BC3:
+        return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    case TextureCodec::BC4:
+        return GL_COMPRESSED_RED_RGTC1;
+    case TextureCodec::BC5:
+        return GL_COMPRESSED_RG_RGTC2;
+    default:
+        return GL_COMPRESSED_RGBA_BPTC_UNORM;
+    }
+}
+
+TextureCodec chooseTextureCodec(const std::string &type, const unsigned char *rgba, int width, int height)
+{
+    if (type.find("normal") != std::string::npos)
+        return TextureCodec::BC5;
+
+    bool grey = true, opaque = true;
+    for (size_t i = 0; i < size_t(width) * height; ++i)
+    {
+        const unsigned char *texel = rgba + i * 4;
+        grey = grey && texel[0] == texel[1] && texel[1] == texel[2];
+        opaque = opaque && texel[3] == 255;
+    }
+
+    if (isSingleChannelType(type) && grey && opaque)
+        return TextureCodec::BC4;
+
+    return opaque ? TextureCodec::BC1 : TextureCodec::BC7;
+}
+
+bool cookTexture(const std::string &path, const std::string &type, bool flipVertically, DecodedImage &image)
+{
+    DecodedImage source;
+    if (!decodeImage(path, flipVertically, source))
+        return false;
+
+    int width = source.width, height = source.height;
+    std::vector<unsigned char> rgba = expandToRgba(source);
+    source.pixels.reset();
+
+    TextureCodec codec = chooseTextureCodec(type, rgba.data(), width, height);
+
+    std::vector<ImageLevel> levels;
+    size_t totalSize = 0;
+    for (int levelWidth = width, levelHeight = height;; levelWidth = std::max(1, levelWidth / 2), levelHeight = std::max(1, levelHeight / 2))
+    {
+        size_t size = getCompressedSize(codec, levelWidth, levelHeight);
+        levels.push_back({levelWidth, levelHeight, totalSize, size});
+        totalSize += size;
+
+        if (levelWidth == 1 && levelHeight == 1)
+            break;
+    }
+
+    std::vector<unsigned char> blocks(totalSize);
+
+    for (size_t level = 0; level < levels.size(); ++level)
+    {
+        const ImageLevel &data = levels[level];
+        if (level > 0)
+            rgba = downsample(rgba, levels[level - 1].width, levels[level - 1].height, codec == TextureCodec::BC5);
+
+        double error = compressImage(codec, rgba.data(), data.width, data.height, blocks.data() + data.offset);
+
+        // Mode 6 BC7 ties alpha to the colour axis, BC3 codes it on its own which keeps cut-out masks sharper.
+        // Both use 16 byte blocks, so whichever fits the full size level better is used for the whole chain
+        if (level == 0 && codec == TextureCodec::BC7)
+        {
+            std::vector<unsigned char> alternative(data.size);
+            if (compressImage(TextureCodec::BC3, rgba.data(), data.width, data.height, alternative.data()) < error)
+            {
+                codec = TextureCodec::BC3;
+                std::copy(alternative.begin(), alternative.end(), blocks.begin() + data.offset);
+            }
+        }
+    }
+
+    image.pixels.reset();
+    image.width = width;
+    image.height = height;
+    image.channels = getCodecInfo(codec).channels;
+    image.compressed = true;
+    image.codec = codec;
+    image.levels = std::move(levels);
+    image.blocks = std::move(blocks);
+    return true;
+}
+
+bool TextureCache::enabled = true;
+
+std::string TextureCache::getCachePath(const std::string &sourcePath, const std::string &type)
+{
+    // One file per set of codecs chooseTextureCodec() can pick for the slot
+    if (type.find("normal") != std::string::npos)
+        return sourcePath + ".normal.ktx2";
+    if (isSingleChannelType(type))
+        return sourcePath + ".channel.ktx2";
+    return sourcePath + ".ktx2";
+}
+
+bool TextureCache::write(const std::string &sourcePath, const std::string &type, bool flipVertically, const DecodedImage &image)
+{
+    std::string stamp;
+    if (!image.compressed || !getSourceStamp(sourcePath, flipVertically, stamp))
+        return false;
+
+    std::vector<uint32_t> descriptor = makeDescriptor(image.codec);
+
+    // One entry: length, NUL terminated key and value, padding to 4 bytes
+    std::vector<unsigned char> keyValues;
+    uint32_t entryLength = static_cast<uint32_t>(sizeof(sourceKey) + stamp.size() + 1);
+    keyValues.resize(sizeof(entryLength));
+    std::memcpy(keyValues.data(), &entryLength, sizeof(entryLength));
+    keyValues.insert(keyValues.end(), sourceKey, sourceKey + sizeof(sourceKey));
+    keyValues.insert(keyValues.end(), stamp.begin(), stamp.end());
+    keyValues.push_back(0);
+    keyValues.resize(alignUp(keyValues.size(), 4), 0);
+
+    size_t levelCount = image.levels.size();
+
+    KtxHeader header{};
+    std::memcpy(header.identifier, ktxIdentifier, sizeof(ktxIdentifier));
+    header.vkFormat = getCodecInfo(image.codec).vkFormat;
+    header.typeSize = 1;
+    header.pixelWidth = static_cast<uint32_t>(image.width);
+    header.pixelHeight = static_cast<uint32_t>(image.height);
+    header.faceCount = 1;
+    header.levelCount = static_cast<uint32_t>(levelCount);
+    header.dfdByteOffset = static_cast<uint32_t>(sizeof(KtxHeader) + levelCount * sizeof(KtxLevel));
+    header.dfdByteLength = static_cast<uint32_t>(descriptor.size() * sizeof(uint32_t));
+    header.kvdByteOffset = header.dfdByteOffset + header.dfdByteLength;
+    header.kvdByteLength = static_cast<uint32_t>(keyValues.size());
+
+    // Level data is stored smallest level first while the index stays in level order
+    std::vector<KtxLevel> levelIndex(levelCount);
+    size_t offset = header.kvdByteOffset + header.kvdByteLength;
+    for (size_t level = levelCount; level-- > 0;)
+    {
+        offset = alignUp(offset, levelAlignment);
+        levelIndex[level] = {offset, image.levels[level].size, image.levels[level].size};
+        offset += image.levels[level].size;
+    }
+
+    std::string cachePath = getCachePath(sourcePath, type);
+    std::string tempPath = cachePath + '.' + std::to_string(tempCounter++) + ".tmp";
+
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        if (!out.is_open())
+            return false;
+
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char *>(levelIndex.data()), levelIndex.size() * sizeof(KtxLevel));
+        out.write(reinterpret_cast<const char *>(descriptor.data()), descriptor.size() * sizeof(uint32_t));
+        out.write(reinterpret_cast<const char *>(keyValues.data()), keyValues.size());
+
+        static const char zeros[levelAlignment] = {};
+        for (size_t level = levelCount; level-- > 0;)
+        {
+            size_t position = static_cast<size_t>(out.tellp());
+            out.write(zeros, levelIndex[level].byteOffset - position);
+            out.write(reinterpret_cast<const char *>(image.blocks.data() + image.levels[level].offset), image.levels[level].size);
+        }
+
+        if (!out.good())
+            return false;
+    }
+
+    std::error_code error;
+    std::filesystem::rename(tempPath, cachePath, error);
+    if (error)
+    {
+        std::filesystem::remove(tempPath, error);
+        return false;
+    }
+
+    return true;
+}
+
+bool TextureCache::load(const std::string &sourcePath, const std::string &type, bool flipVertically, DecodedImage &image)
+{
+    std::string stamp;
+    if (!getSourceStamp(sourcePath, flipVertically, stamp))
+        return false;
+
+    std::ifstream in(getCachePath(sourcePath, type), std::ios::binary | std::ios::ate);
+    if (!in.is_open())
+        return false;
+
+    size_t size = static_cast<size_t>(in.tellg());
+
+    std::vector<unsigned char> file(size);
+    in.seekg(0);
+    if (!in.read(reinterpret_cast<char *>(file.data()), size))
+        return false;
+
+    KtxHeader header;
+    std::vector<ImageLevel> levels;
+    const CodecInfo *info = readLevels(file.data(), size, stamp, header, levels);
+    if (!info)
+        return false;
+
+    image.pixels.reset();
+    image.width = static_cast<int>(header.pixelWidth);
+    image.height = static_cast<int>(header.pixelHeight);
+    image.channels = info->channels;
+    image.compressed = true;
+    image.codec = info->codec;
+    image.levels = std::move(levels);
+    image.blocks = std::move(file);
+    return true;
+}
+
+bool TextureCache::map(const std::string &sourcePath, const std::string &type, bool flipVertically, MappedFile &file, std::vector<ImageLevel> &levels)
+{
+    std::string stamp;
+    if (!getSourceStamp(sourcePath, flipVertically, stamp) || !file.open(getCachePath(sourcePath, type)))
+        return false;
+
+    KtxHeader header;
+    if (readLevels(file.getData(), file.getSize(), stamp, header, levels))
+        return true;
+
+    file.close();
+    return false;
+}
+
+bool loadTextureImage(const std::string &path, const std::string &type, bool flipVertically, DecodedImage &image)
+{
+    std::error_code error;
+    uintmax_t sourceSize = std::filesystem::file_size(path, error);
+    if (error)
+        sourceSize = 0;
+
+    if (!TextureCache::enabled)
+    {
+        ScopedLoadTimer timer(LoadStage::IMAGE_DECODE);
+        if (!decodeImage(path, flipVertically, image))
+            return false;
+
+        timer.addBytesRead(sourceSize);
+        image.contentHash = hashImage(image);
+        return true;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    bool cached;
+    {
+        ScopedLoadTimer timer(LoadStage::TEXTURE_CACHE_READ);
+        cached = TextureCache::load(path, type, flipVertically, image);
+        if (cached)
+            timer.addBytesRead(image.blocks.size());
+    }
+
+    if (!cached)
+    {
+        ScopedLoadTimer timer(LoadStage::TEXTURE_COOK);
+        if (!cookTexture(path, type, flipVertically, image))
+            return false;
+
+        timer.addBytesRead(sourceSize);
+        if (!TextureCache::write(path, type, flipVertically, image))
+            std::cout << "Failed to write texture cache for " << path << '\n';
+    }
+
+    image.contentHash = hashImage(image);
+    image.decodeTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return true;
+}
@@ -0,0 +1,51 @@
+#ifndef __TEXTURECACHE_H__
+#define __TEXTURECACHE_H__
+#include "TextureLoader.h"
+#include <string>
+#include <vector>
+
+class MappedFile;
+
+// EXT_texture_compression_s3tc, exposed by every desktop driver but not part of the core profile loader
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+GLenum getCompressedFormat(TextureCodec codec);
+
+// Format for a texture bound to the material slot 'type' (the Model::texturesMap strings):
+// normal maps BC5, grey single channel maps (ao, metalness, height, ...) BC4, opaque colour BC1 and colour with alpha BC7.
+// Single channel slots holding colour data (packed occlusion/roughness/metalness) are treated as colour
+TextureCodec chooseTextureCodec(const std::string &type, const unsigned char *rgba, int width, int height);
+
+// Decodes the source image and builds its compressed mip chain down to 1x1 on the calling thread
+bool cookTexture(const std::string &path, const std::string &type, bool flipVertically, DecodedImage &image);
+
+// Cooked textures are kept next to their source image as KTX2 files with every mip level, one per group of material
+// slots sharing their codec choices since the slot decides the codec.
+// A key/value entry records the source's modification time and size and the vertical flip, a mismatch cooks the texture again
+class TextureCache
+{
+public:
+    static bool enabled;
+
+    // 'type' is the material slot the texture was cooked for
+    static std::string getCachePath(const std::string &sourcePath, const std::string &type);
+
+    static bool write(const std::string &sourcePath, const std::string &type, bool flipVertically, const DecodedImage &image);
+
+    static bool load(const std::string &sourcePath, const std::string &type, bool flipVertically, DecodedImage &image);
+
+    // Maps a current cache file without reading it, 'levels' gets the offsets of the levels inside the mapping
+    static bool map(const std::string &sourcePath, const std::string &type, bool flipVertically, MappedFile &file, std::vector<ImageLevel> &levels);
+};
+
+// Used by the texture loaders on worker threads: the cached texture if it is current, otherwise the texture is cooked
+// and written to the cache. With the cache disabled the image is only decoded, as before compression existed.
+// Either way the image's contentHash is set
+bool loadTextureImage(const std::string &path, const std::string &type, bool flipVertically, DecodedImage &image);
+
+#endif // __TEXTURECACHE_H__
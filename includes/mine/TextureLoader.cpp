@@ -0,0 +1,343 @@
+#include "TextureLoader.h"
+#include "TextureCache.h"
+#include "TextureStreamer.h"
+#include "ThreadPool.h"
+#include "ResourceCache.h"
+#include "LoadProfiler.h"
+#include "stb_image.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+
+void ImageDeleter::operator()(unsigned char *pixels) const
+{
+    stbi_image_free(pixels);
+}
+
+bool DecodedImage::isValid() const
+{
+    return pixels != nullptr || !blocks.empty();
+}
+
+bool decodeImage(const std::string &path, bool flipVertically, DecodedImage &image)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    stbi_set_flip_vertically_on_load_thread(flipVertically);
+    image.pixels.reset(stbi_load(path.c_str(), &image.width, &image.height, &image.channels, 0));
+
+    image.decodeTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return image.pixels != nullptr;
+}
+
+namespace
+{
+    constexpr uint64_t hashPrime1 = 0x9E3779B185EBCA87ull;
+    constexpr uint64_t hashPrime2 = 0xC2B2AE3D27D4EB4Full;
+    constexpr uint64_t hashPrime3 = 0x165667B19E3779F9ull;
+
+    uint64_t rotateLeft(uint64_t value, int bits)
+    {
+        return (value << bits) | (value >> (64 - bits));
+    }
+
+    // xxHash64's single lane steps, 8 bytes at a time
+    uint64_t hashBytes(uint64_t hash, const unsigned char *data, size_t size)
+    {
+        size_t i = 0;
+        for (; i + 8 <= size; i += 8)
+        {
+            uint64_t word;
+            std::memcpy(&word, data + i, sizeof(word));
+            hash ^= rotateLeft(word * hashPrime2, 31) * hashPrime1;
+            hash = rotateLeft(hash, 27) * hashPrime1 + hashPrime3;
+        }
+
+        for (; i < size; ++i)
+        {
+            hash ^= data[i] * hashPrime3;
+            hash = rotateLeft(hash, 11) * hashPrime1;
+        }
+
+        return hash;
+    }
+}
+
+uint64_t hashImage(const DecodedImage &image)
+{
+    uint64_t header[4] = {uint64_t(image.width), uint64_t(image.height), uint64_t(image.channels),
+                          image.compressed ? uint64_t(image.codec) + 1 : 0};
+    uint64_t hash = hashBytes(hashPrime3, reinterpret_cast<const unsigned char *>(header), sizeof(header));
+
+    if (image.compressed)
+        for (const ImageLevel &level : image.levels)
+            hash = hashBytes(hash, image.blocks.data() + level.offset, level.size);
+    else if (image.pixels)
+        hash = hashBytes(hash, image.pixels.get(), size_t(image.width) * image.height * image.channels);
+
+    hash ^= hash >> 33;
+    hash *= hashPrime2;
+    hash ^= hash >> 29;
+    hash *= hashPrime3;
+    hash ^= hash >> 32;
+    return hash == 0 ? 1 : hash;
+}
+
+GLenum getImageFormat(int channels)
+{
+    if (channels == 1)
+        return GL_RED;
+    else if (channels == 2)
+        return GL_RG;
+    else if (channels == 3)
+        return GL_RGB;
+    return GL_RGBA;
+}
+
+GLenum getSizedImageFormat(int channels)
+{
+    if (channels == 1)
+        return GL_R8;
+    else if (channels == 2)
+        return GL_RG8;
+    else if (channels == 3)
+        return GL_RGB8;
+    return GL_RGBA8;
+}
+
+size_t getTextureBytes(int width, int height, int channels)
+{
+    // RGB is padded to four bytes per texel by the driver, the mip chain adds a third
+    size_t texelBytes = channels == 3 ? 4 : size_t(channels);
+    return size_t(width) * height * texelBytes * 4 / 3;
+}
+
+size_t getTextureBytes(const DecodedImage &image, int firstLevel)
+{
+    if (!image.compressed)
+        return getTextureBytes(image.width, image.height, image.channels);
+
+    size_t bytes = 0;
+    for (size_t level = firstLevel; level < image.levels.size(); ++level)
+        bytes += image.levels[level].size;
+    return bytes;
+}
+
+void allocateTexture(const DecodedImage &image, int firstLevel)
+{
+    if (!image.compressed)
+    {
+        GLenum format = getImageFormat(image.channels);
+        glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, nullptr);
+        return;
+    }
+
+    GLenum format = getCompressedFormat(image.codec);
+    if (firstLevel == 0)
+    {
+        glTexStorage2D(GL_TEXTURE_2D, GLsizei(image.levels.size()), format, image.width, image.height);
+        return;
+    }
+
+    for (size_t level = firstLevel; level < image.levels.size(); ++level)
+    {
+        const ImageLevel &data = image.levels[level];
+        glCompressedTexImage2D(GL_TEXTURE_2D, GLint(level), format, data.width, data.height, 0, GLsizei(data.size), nullptr);
+    }
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, firstLevel);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, GLint(image.levels.size()) - 1);
+}
+
+void uploadTexture(unsigned int id, const DecodedImage &image, int firstLevel)
+{
+    glBindTexture(GL_TEXTURE_2D, id);
+
+    {
+        ScopedLoadTimer timer(LoadStage::TEXTURE_UPLOAD);
+        allocateTexture(image, firstLevel);
+
+        if (image.compressed)
+        {
+            GLenum format = getCompressedFormat(image.codec);
+
+            for (size_t level = firstLevel; level < image.levels.size(); ++level)
+            {
+                const ImageLevel &data = image.levels[level];
+                glCompressedTexSubImage2D(GL_TEXTURE_2D, GLint(level), 0, 0, data.width, data.height, format,
+                                          GLsizei(data.size), image.blocks.data() + data.offset);
+            }
+            timer.addBytesUploaded(getTextureBytes(image, firstLevel));
+        }
+        else
+        {
+            GLenum format = getImageFormat(image.channels);
+
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, image.width, image.height, format, GL_UNSIGNED_BYTE, image.pixels.get());
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            timer.addBytesUploaded(size_t(image.width) * image.height * image.channels);
+        }
+    }
+
+    if (!image.compressed)
+    {
+        ScopedLoadTimer timer(LoadStage::MIP_GENERATION);
+        glGenerateMipmap(GL_TEXTURE_2D);
+    }
+
+    setTextureSampling(image);
+}
+
+void setTextureSampling(const DecodedImage &image)
+{
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    // Single channel textures read like the grey RGB images they were cooked from
+    if (image.compressed && image.codec == TextureCodec::BC4)
+    {
+        const GLint swizzle[] = {GL_RED, GL_RED, GL_RED, GL_ONE};
+        glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+    }
+}
+
+void allocatePlaceholderTexture(const std::string &type)
+{
+    const unsigned char white[4] = {255, 255, 255, 255};
+    const unsigned char flat[4] = {128, 128, 255, 255};
+
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, 1, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, type == "texture_normal" ? flat : white);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+}
+
+bool TextureLoader::printReport = true;
+
+void TextureLoader::request(const std::shared_ptr<TextureResource> &texture, const std::string &path, const std::string &type, bool flipVertically)
+{
+    if (pending.empty() && timings.empty())
+        firstRequest = std::chrono::steady_clock::now();
+
+    PendingTexture pendingTexture;
+    glGenTextures(1, &texture->id);
+    pendingTexture.texture = texture;
+    pendingTexture.path = path;
+    pendingTexture.type = type;
+    pendingTexture.flipVertically = flipVertically;
+    pendingTexture.profileAsset = LoadAssetScope::getCurrent();
+    pendingTexture.image = ThreadPool::getShared().submit([path, type, flipVertically, asset = pendingTexture.profileAsset]()
+                                                   {
+        LoadAssetScope profileScope(asset);
+        DecodedImage image;
+        loadTextureImage(path, type, flipVertically, image);
+        return image; });
+
+    pending.push_back(std::move(pendingTexture));
+}
+
+void TextureLoader::upload(PendingTexture &texture)
+{
+    DecodedImage image = texture.image.get();
+    if (!image.isValid())
+        throw std::runtime_error("Failed to load texture: " + texture.path);
+
+    LoadAssetScope profileScope(texture.profileAsset);
+
+    if (!ResourceCache::get().deduplicate(texture.texture, image.contentHash, getTextureBytes(image)))
+    {
+        timings.push_back({texture.path, "dup", image.width, image.height, image.channels, image.decodeTime, 0.0});
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    int firstLevel = TextureStreamer::get().add(texture.texture, texture.path, texture.type, texture.flipVertically, image);
+    uploadTexture(texture.texture->id, image, firstLevel);
+
+    TextureResource &resource = *texture.texture;
+    resource.width = image.width;
+    resource.height = image.height;
+    resource.internalFormat = image.compressed ? getCompressedFormat(image.codec) : getSizedImageFormat(image.channels);
+    resource.levelCount = image.compressed ? int(image.levels.size()) : int(std::log2(std::max(image.width, image.height))) + 1;
+    resource.baseLevel = firstLevel;
+    ResourceCache::get().setResidentBytes(*texture.texture, getTextureBytes(image, firstLevel));
+    double uploadTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    std::string format = image.compressed ? getCodecName(image.codec) : "raw";
+    timings.push_back({texture.path, format, image.width, image.height, image.channels, image.decodeTime, uploadTime});
+}
+
+void TextureLoader::finish()
+{
+    if (pending.empty())
+        return;
+
+    auto start = std::chrono::steady_clock::now();
+
+    // Upload in completion order so the context thread never idles behind one slow decode
+    while (!pending.empty())
+    {
+        bool uploaded = false;
+
+        for (size_t i = 0; i < pending.size();)
+        {
+            if (pending[i].image.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+            {
+                upload(pending[i]);
+                pending[i] = std::move(pending.back());
+                pending.pop_back();
+                uploaded = true;
+            }
+            else
+                ++i;
+        }
+
+        if (!uploaded)
+            pending.front().image.wait_for(std::chrono::milliseconds(1));
+    }
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    auto end = std::chrono::steady_clock::now();
+    double waitTime = std::chrono::duration<double, std::milli>(end - start).count();
+    double wallTime = std::chrono::duration<double, std::milli>(end - firstRequest).count();
+
+    if (printReport)
+    {
+        double decodeTotal = 0.0, uploadTotal = 0.0;
+        size_t duplicates = 0;
+
+        std::cout << std::fixed << std::setprecision(2)
+                  << "\nTexture report (" << ThreadPool::getShared().getThreadCount() << " decode threads)\n"
+                  << std::setw(12) << "decode ms" << std::setw(12) << "upload ms" << std::setw(14) << "size" << std::setw(8) << "format" << "  path\n";
+
+        for (const TextureTiming &timing : timings)
+        {
+            std::string size = std::to_string(timing.width) + "x" + std::to_string(timing.height) + "x" + std::to_string(timing.channels);
+            std::cout << std::setw(12) << timing.decodeTime << std::setw(12) << timing.uploadTime
+                      << std::setw(14) << size << std::setw(8) << timing.format << "  " << timing.path << '\n';
+
+            decodeTotal += timing.decodeTime;
+            uploadTotal += timing.uploadTime;
+            if (timing.format == "dup")
+                ++duplicates;
+        }
+
+        std::cout << timings.size() << " textures (" << duplicates << " duplicates sharing a texture loaded under another path), " << decodeTotal << " ms decode (summed over threads), "
+                  << uploadTotal << " ms upload, " << wallTime << " ms wall (" << waitTime << " ms after import)\n";
+    }
+
+    timings.clear();
+}
+
+size_t TextureLoader::getPendingCount() const
+{
+    return pending.size();
+}
@@ -0,0 +1,127 @@
+#ifndef __TEXTURELOADER_H__
+#define __TEXTURELOADER_H__
+#include "../GL/glad.h"
+#include "BlockCompression.h"
+#include <chrono>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct TextureResource;
+
+struct ImageDeleter
+{
+    void operator()(unsigned char *pixels) const;
+};
+
+// One mip level inside DecodedImage::blocks
+struct ImageLevel
+{
+    int width;
+    int height;
+    size_t offset;
+    size_t size;
+};
+
+struct DecodedImage
+{
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+
+    std::unique_ptr<unsigned char, ImageDeleter> pixels;
+
+    // Images from the TextureCache carry their whole mip chain block compressed instead of 'pixels'
+    bool compressed = false;
+    TextureCodec codec = TextureCodec::BC1;
+    std::vector<ImageLevel> levels;
+    std::vector<unsigned char> blocks;
+
+    double decodeTime = 0.0;
+
+    // Set by loadTextureImage, see hashImage
+    uint64_t contentHash = 0;
+
+    bool isValid() const;
+};
+
+// Thread safe, the vertical flip is applied per call instead of through stb_image's global flag
+bool decodeImage(const std::string &path, bool flipVertically, DecodedImage &image);
+
+// 64 bit hash of the size, format and texel data (the compressed levels for compressed images, never the file around them).
+// The same image cooked from two files hashes the same, which is what the ResourceCache deduplicates textures by
+uint64_t hashImage(const DecodedImage &image);
+
+GLenum getImageFormat(int channels);
+
+// Sized internal format the driver picks for getImageFormat's formats, GL_RGBA8 for 4 channels
+GLenum getSizedImageFormat(int channels);
+
+// Approximate VRAM use of the image with a full mip chain
+size_t getTextureBytes(int width, int height, int channels);
+
+// Exact for compressed images, which count their levels from 'firstLevel' on
+size_t getTextureBytes(const DecodedImage &image, int firstLevel = 0);
+
+// Defines the storage of the bound texture without data. Compressed images starting past level 0 get mutable storage
+// for the levels from 'firstLevel' on with GL_TEXTURE_BASE_LEVEL at it, so the TextureStreamer can add and drop the finer ones
+void allocateTexture(const DecodedImage &image, int firstLevel = 0);
+
+// Uploads the image into an already generated texture name, uncompressed images get their mip chain built on the GPU
+void uploadTexture(unsigned int id, const DecodedImage &image, int firstLevel = 0);
+
+// Wrap and filter modes of the bound texture, plus the swizzle single channel (BC4) images are sampled through
+void setTextureSampling(const DecodedImage &image);
+
+// Gives the bound texture a single texel standing in for an image that failed to load of the material type 'type',
+// a flat normal for normal maps and white for everything else
+void allocatePlaceholderTexture(const std::string &type);
+
+// Decodes textures on the shared thread pool while the GL uploads stay on the calling (context) thread
+class TextureLoader
+{
+    struct PendingTexture
+    {
+        std::shared_ptr<TextureResource> texture;
+        std::string path;
+        // Material slot, picks the cache file
+        std::string type;
+        bool flipVertically;
+        // LoadAssetScope at the time of the request
+        std::string profileAsset;
+        std::future<DecodedImage> image;
+    };
+
+    struct TextureTiming
+    {
+        std::string path;
+        std::string format;
+        int width;
+        int height;
+        int channels;
+        double decodeTime;
+        double uploadTime;
+    };
+
+    std::vector<PendingTexture> pending;
+
+    std::vector<TextureTiming> timings;
+
+    std::chrono::steady_clock::time_point firstRequest;
+
+    void upload(PendingTexture &texture);
+
+public:
+    static bool printReport;
+
+    // Generates the texture name right away, its storage is filled in by finish().
+    // 'type' is the material slot (Model::texturesMap), it picks the block compression format
+    void request(const std::shared_ptr<TextureResource> &texture, const std::string &path, const std::string &type, bool flipVertically = true);
+
+    void finish();
+
+    size_t getPendingCount() const;
+};
+
+#endif // __TEXTURELOADER_H__
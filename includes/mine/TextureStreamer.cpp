@@ -0,0 +1,377 @@
+#include "TextureStreamer.h"
+#include "LodSelector.h"
+#include "MeshCache.h"
+#include "ResourceCache.h"
+#include "TextureCache.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+
+TextureStreamer &TextureStreamer::get()
+{
+    static TextureStreamer streamer;
+    return streamer;
+}
+
+int TextureStreamer::add(const std::shared_ptr<TextureResource> &texture, const std::string &path, const std::string &type, bool flipVertically,
+                         const DecodedImage &image)
+{
+    if (!enabled || !image.compressed)
+        return 0;
+
+    int initialLevel = int(image.levels.size()) - 1;
+    while (initialLevel > 0 && std::max(image.levels[initialLevel - 1].width, image.levels[initialLevel - 1].height) <= initialResolution)
+        --initialLevel;
+
+    if (initialLevel == 0)
+        return 0;
+
+    // Finer levels are read straight from the cache file, the decoded image is dropped once its upload completes
+    StreamedTexture streamed;
+    streamed.file = std::make_shared<MappedFile>();
+    if (!TextureCache::map(path, type, flipVertically, *streamed.file, streamed.levels) || streamed.levels.size() != image.levels.size())
+        return 0;
+
+    streamed.texture = texture;
+    streamed.path = path;
+    streamed.codec = image.codec;
+    streamed.initialLevel = streamed.residentLevel = streamed.requestedLevel = initialLevel;
+    streamed.residentBytes = getTextureBytes(image, initialLevel);
+    streamed.lastUsed = frame;
+    streamed.requestFrame = ~0ull;
+
+    auto existing = textures.find(texture.get());
+    if (existing != textures.end())
+    {
+        residentBytes -= existing->second.residentBytes;
+        copyBytes -= existing->second.residentBytes * existing->second.copies;
+        if (existing->second.pendingLevel >= 0)
+            pendingBytes -= existing->second.levels[existing->second.pendingLevel].size;
+        streamed.copies = existing->second.copies;
+        textures.erase(existing);
+    }
+
+    residentBytes += streamed.residentBytes;
+    copyBytes += streamed.residentBytes * streamed.copies;
+    textures.emplace(texture.get(), std::move(streamed));
+    return initialLevel;
+}
+
+void TextureStreamer::request(Model &model, const Camera &camera, int viewportHeight)
+{
+    if (textures.empty())
+        return;
+
+    LodSelector projection = LodSelector::forCamera(camera, viewportHeight, 1.f);
+    model.updateTransforms();
+
+    for (const Mesh &mesh : model.getAsset()->meshes)
+    {
+        if (!mesh.ready || mesh.textures.empty())
+            continue;
+
+        float pixelsPerUnit = projection.getProjectedScale(mesh.getBoundsMin(), mesh.getBoundsMax(), model.getMeshMatrix(mesh));
+
+        for (const MTexture &texture : mesh.textures)
+        {
+            if (!texture.resource)
+                continue;
+
+            // Duplicates share the storage of the texture they matched
+            const TextureResource *resource = texture.resource->duplicateOf ? texture.resource->duplicateOf.get() : texture.resource.get();
+            auto entry = textures.find(resource);
+            if (entry == textures.end())
+                continue;
+
+            StreamedTexture &streamed = entry->second;
+            int coarsest = int(streamed.levels.size()) - 1;
+
+            // The level whose texels match the pixels one unit of the mesh covers, the finest one with the viewer inside the bounds
+            int level = 0;
+            if (mesh.getUvDensity() <= 0.f)
+                level = coarsest;
+            else if (pixelsPerUnit > 0.f)
+            {
+                const ImageLevel &full = streamed.levels[0];
+                float texelsPerUnit = mesh.getUvDensity() * float(std::max(full.width, full.height));
+                float wanted = std::floor(std::log2(texelsPerUnit / pixelsPerUnit) + levelBias);
+                level = int(std::clamp(wanted, 0.f, float(coarsest)));
+            }
+
+            if (streamed.requestFrame != frame)
+            {
+                streamed.requestedLevel = level;
+                streamed.requestFrame = frame;
+            }
+            else
+                streamed.requestedLevel = std::min(streamed.requestedLevel, level);
+
+            streamed.lastUsed = frame;
+        }
+    }
+}
+
+bool TextureStreamer::addCopy(const TextureResource &texture)
+{
+    auto entry = textures.find(&texture);
+    if (entry == textures.end())
+        return false;
+
+    ++entry->second.copies;
+    copyBytes += entry->second.residentBytes;
+    return true;
+}
+
+void TextureStreamer::removeCopy(const TextureResource &texture)
+{
+    auto entry = textures.find(&texture);
+    if (entry == textures.end() || entry->second.copies == 0)
+        return;
+
+    --entry->second.copies;
+    copyBytes -= entry->second.residentBytes;
+}
+
+void TextureStreamer::setCopyOverhead(const void *owner, size_t bytes)
+{
+    auto entry = copyOverheads.find(owner);
+    if (entry != copyOverheads.end())
+    {
+        copyOverheadBytes -= entry->second;
+        copyOverheads.erase(entry);
+    }
+
+    if (bytes == 0)
+        return;
+
+    copyOverheads.emplace(owner, bytes);
+    copyOverheadBytes += bytes;
+}
+
+size_t TextureStreamer::getUsedBytes() const
+{
+    return residentBytes + copyBytes + copyOverheadBytes + pendingBytes;
+}
+
+int TextureStreamer::getWantedLevel(const StreamedTexture &texture) const
+{
+    if (frame - texture.lastUsed > idleFrames)
+        return texture.initialLevel;
+
+    return std::min(texture.requestedLevel, texture.initialLevel);
+}
+
+void TextureStreamer::finishReads()
+{
+    for (auto &entry : textures)
+    {
+        StreamedTexture &streamed = entry.second;
+        if (streamed.pendingLevel < 0 || streamed.pendingData.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            continue;
+
+        std::vector<unsigned char> data = streamed.pendingData.get();
+        int level = streamed.pendingLevel;
+        const ImageLevel &info = streamed.levels[level];
+
+        streamed.pendingLevel = -1;
+        pendingBytes -= info.size;
+
+        // The next finer level may have been dropped since the read started
+        std::shared_ptr<TextureResource> texture = streamed.texture.lock();
+        if (!texture || level != streamed.residentLevel - 1)
+            continue;
+
+        glBindTexture(GL_TEXTURE_2D, texture->id);
+        glCompressedTexImage2D(GL_TEXTURE_2D, level, getCompressedFormat(streamed.codec), info.width, info.height, 0,
+                               GLsizei(info.size), data.data());
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+        texture->baseLevel = level;
+        ++texture->version;
+
+        streamed.residentLevel = level;
+        streamed.residentBytes += info.size;
+        residentBytes += info.size;
+        copyBytes += info.size * streamed.copies;
+        ResourceCache::get().setResidentBytes(*texture, streamed.residentBytes);
+    }
+}
+
+void TextureStreamer::dropLevel(StreamedTexture &streamed)
+{
+    int level = streamed.residentLevel;
+    size_t size = streamed.levels[level].size;
+
+    streamed.residentLevel = level + 1;
+    streamed.residentBytes -= size;
+    residentBytes -= size;
+    copyBytes -= size * streamed.copies;
+
+    std::shared_ptr<TextureResource> texture = streamed.texture.lock();
+    if (!texture)
+        return;
+
+    // Sampling moves to the next level first, then the dropped one is redefined empty to release its memory
+    glBindTexture(GL_TEXTURE_2D, texture->id);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level + 1);
+    glCompressedTexImage2D(GL_TEXTURE_2D, level, getCompressedFormat(streamed.codec), 0, 0, 0, 0, nullptr);
+    texture->baseLevel = level + 1;
+    ++texture->version;
+
+    ResourceCache::get().setResidentBytes(*texture, streamed.residentBytes);
+}
+
+TextureStreamer::StreamedTexture *TextureStreamer::findVictim(unsigned long long usedBefore, const StreamedTexture *keep)
+{
+    StreamedTexture *victim = nullptr;
+    bool victimSurplus = false;
+
+    for (auto &entry : textures)
+    {
+        StreamedTexture &streamed = entry.second;
+        if (&streamed == keep || streamed.residentLevel >= streamed.initialLevel)
+            continue;
+
+        bool surplus = streamed.residentLevel < getWantedLevel(streamed);
+        if (!surplus && streamed.lastUsed >= usedBefore)
+            continue;
+
+        if (!victim || (surplus && !victimSurplus) || (surplus == victimSurplus && streamed.lastUsed < victim->lastUsed))
+        {
+            victim = &streamed;
+            victimSurplus = surplus;
+        }
+    }
+
+    return victim;
+}
+
+void TextureStreamer::update()
+{
+    for (auto entry = textures.begin(); entry != textures.end();)
+    {
+        if (!entry->second.texture.expired())
+        {
+            ++entry;
+            continue;
+        }
+
+        residentBytes -= entry->second.residentBytes;
+        copyBytes -= entry->second.residentBytes * entry->second.copies;
+        if (entry->second.pendingLevel >= 0)
+            pendingBytes -= entry->second.levels[entry->second.pendingLevel].size;
+        entry = textures.erase(entry);
+    }
+
+    finishReads();
+
+    // A lowered budget drops levels still in use as well
+    while (getUsedBytes() > budgetBytes)
+    {
+        StreamedTexture *victim = findVictim(frame + 1, nullptr);
+        if (!victim)
+            break;
+        dropLevel(*victim);
+    }
+
+    // Recently used textures first, then the ones furthest from the level they ask for
+    std::vector<StreamedTexture *> raises;
+    for (auto &entry : textures)
+        if (entry.second.pendingLevel < 0 && getWantedLevel(entry.second) < entry.second.residentLevel)
+            raises.push_back(&entry.second);
+
+    std::sort(raises.begin(), raises.end(), [this](const StreamedTexture *a, const StreamedTexture *b)
+              {
+        if (a->lastUsed != b->lastUsed)
+            return a->lastUsed > b->lastUsed;
+        return a->residentLevel - getWantedLevel(*a) > b->residentLevel - getWantedLevel(*b); });
+
+    for (StreamedTexture *streamed : raises)
+    {
+        int level = streamed->residentLevel - 1;
+        ImageLevel data = streamed->levels[level];
+
+        if (pendingBytes > 0 && pendingBytes + data.size > uploadBytesPerFrame)
+            break;
+
+        // The copies take the level as well once it is uploaded
+        size_t cost = data.size * (1 + streamed->copies);
+
+        // Only textures used less recently give up their levels for this one
+        while (getUsedBytes() + cost > budgetBytes)
+        {
+            StreamedTexture *victim = findVictim(streamed->lastUsed, streamed);
+            if (!victim)
+                break;
+            dropLevel(*victim);
+        }
+
+        if (getUsedBytes() + cost > budgetBytes)
+            continue;
+
+        std::shared_ptr<MappedFile> file = streamed->file;
+        streamed->pendingData = ThreadPool::getShared().submit([file, data]()
+                                                               { return std::vector<unsigned char>(file->getData() + data.offset,
+                                                                                                   file->getData() + data.offset + data.size); });
+        streamed->pendingLevel = level;
+        pendingBytes += data.size;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    ++frame;
+}
+
+size_t TextureStreamer::getResidentBytes() const
+{
+    return residentBytes;
+}
+
+size_t TextureStreamer::getCopyBytes() const
+{
+    return copyBytes + copyOverheadBytes;
+}
+
+size_t TextureStreamer::getRequestedBytes() const
+{
+    size_t bytes = 0;
+    for (const auto &entry : textures)
+        for (size_t level = getWantedLevel(entry.second); level < entry.second.levels.size(); ++level)
+            bytes += entry.second.levels[level].size;
+    return bytes;
+}
+
+size_t TextureStreamer::getPendingReads() const
+{
+    size_t count = 0;
+    for (const auto &entry : textures)
+        if (entry.second.pendingLevel >= 0)
+            ++count;
+    return count;
+}
+
+std::vector<TextureStreamer::TextureInfo> TextureStreamer::getTextureInfos() const
+{
+    std::vector<TextureInfo> infos;
+    infos.reserve(textures.size());
+
+    for (const auto &entry : textures)
+    {
+        const StreamedTexture &streamed = entry.second;
+
+        TextureInfo info;
+        info.path = streamed.path;
+        info.width = streamed.levels[0].width;
+        info.height = streamed.levels[0].height;
+        info.levelCount = int(streamed.levels.size());
+        info.residentLevel = streamed.residentLevel;
+        info.requestedLevel = getWantedLevel(streamed);
+        info.residentBytes = streamed.residentBytes;
+        info.requestedBytes = 0;
+        for (size_t level = info.requestedLevel; level < streamed.levels.size(); ++level)
+            info.requestedBytes += streamed.levels[level].size;
+        infos.push_back(info);
+    }
+
+    std::sort(infos.begin(), infos.end(), [](const TextureInfo &a, const TextureInfo &b)
+              { return a.path < b.path; });
+    return infos;
+}
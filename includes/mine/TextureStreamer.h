@@ -0,0 +1,148 @@
+#ifndef __TEXTURESTREAMER_H__
+#define __TEXTURESTREAMER_H__
+#include "Model.h"
+#include "TextureLoader.h"
+#include <future>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class MappedFile;
+struct TextureResource;
+
+// Keeps only the mip levels of cooked textures that the visible meshes need resident, within a VRAM budget.
+// Textures start at a coarse level, every frame the meshes request the finest level their projected texel density asks for,
+// missing levels are read from the mapped KTX2 cache on the thread pool and uploaded one at a time, and when the budget runs out
+// the finest level of the least recently used textures is dropped, levels nobody requests going first.
+// Streamed textures have mutable storage with GL_TEXTURE_BASE_LEVEL at their finest resident level
+class TextureStreamer
+{
+public:
+    struct TextureInfo
+    {
+        std::string path;
+        int width;
+        int height;
+        int levelCount;
+        int residentLevel;
+        int requestedLevel;
+        size_t residentBytes;
+        size_t requestedBytes;
+    };
+
+    // Only affects textures loaded afterwards, disabled textures are uploaded whole
+    bool enabled = true;
+
+    // Covers the resident levels and their copies in MaterialTable arrays
+    size_t budgetBytes = 128 * 1024 * 1024;
+
+    // Level reads in flight are limited to this many bytes, a single larger level is still read on its own
+    size_t uploadBytesPerFrame = 4 * 1024 * 1024;
+
+    // Textures start with their largest level that is no larger than this
+    int initialResolution = 64;
+
+    // Added to the requested levels, positive values give up sharpness for memory
+    float levelBias = 0.f;
+
+    // Textures not requested for this many frames only ask for their initial level
+    unsigned int idleFrames = 120;
+
+    static TextureStreamer &get();
+
+    TextureStreamer(const TextureStreamer &) = delete;
+
+    TextureStreamer &operator=(const TextureStreamer &) = delete;
+
+    // Called by the texture loaders once the image is decoded, before its storage is defined.
+    // Returns the first level to upload, 0 when the texture is not streamed (uncompressed, not cached or already small)
+    int add(const std::shared_ptr<TextureResource> &texture, const std::string &path, const std::string &type, bool flipVertically,
+            const DecodedImage &image);
+
+    // Requests the levels the model's ready meshes need at their projected size, call for every visible model before update()
+    void request(Model &model, const Camera &camera, int viewportHeight);
+
+    // Call once per frame on the context thread
+    void update();
+
+    // A MaterialTable array holds the resident levels of 'texture' too, they count against the budget once more.
+    // False when the texture isn't streamed
+    bool addCopy(const TextureResource &texture);
+
+    void removeCopy(const TextureResource &texture);
+
+    // Storage of the arrays of 'owner' that addCopy() doesn't cover (textures that aren't streamed, levels only some
+    // layers have), also counted against the budget. 0 forgets the owner
+    void setCopyOverhead(const void *owner, size_t bytes);
+
+    size_t getResidentBytes() const;
+
+    // Copies of the resident levels and the overhead of the arrays holding them
+    size_t getCopyBytes() const;
+
+    // Bytes resident if every texture had the level it asks for
+    size_t getRequestedBytes() const;
+
+    size_t getPendingReads() const;
+
+    std::vector<TextureInfo> getTextureInfos() const;
+
+private:
+    struct StreamedTexture
+    {
+        std::weak_ptr<TextureResource> texture;
+        std::string path;
+
+        std::shared_ptr<MappedFile> file;
+        std::vector<ImageLevel> levels;
+        TextureCodec codec;
+
+        int initialLevel;
+        int residentLevel;
+        int requestedLevel;
+        size_t residentBytes;
+
+        // MaterialTable arrays holding the resident levels as well
+        unsigned int copies = 0;
+
+        unsigned long long lastUsed;
+        unsigned long long requestFrame;
+
+        std::future<std::vector<unsigned char>> pendingData;
+        int pendingLevel = -1;
+    };
+
+    std::unordered_map<const TextureResource *, StreamedTexture> textures;
+
+    unsigned long long frame = 0;
+
+    size_t residentBytes = 0;
+
+    size_t pendingBytes = 0;
+
+    // Resident bytes times the copies of every texture
+    size_t copyBytes = 0;
+
+    std::unordered_map<const void *, size_t> copyOverheads;
+
+    size_t copyOverheadBytes = 0;
+
+    TextureStreamer() = default;
+
+    int getWantedLevel(const StreamedTexture &texture) const;
+
+    // Everything counted against the budget
+    size_t getUsedBytes() const;
+
+    // Uploads finished level reads
+    void finishReads();
+
+    void dropLevel(StreamedTexture &texture);
+
+    // Least recently used texture with a level that can go, textures wanting their finest level are only picked
+    // when they were used before 'usedBefore'
+    StreamedTexture *findVictim(unsigned long long usedBefore, const StreamedTexture *keep);
+};
+
+#endif // __TEXTURESTREAMER_H__
@@ -0,0 +1,57 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(unsigned int threadCount) : stopping(false)
+{
+    if (threadCount == 0)
+        threadCount = 1;
+
+    workers.reserve(threadCount);
+    for (unsigned int i = 0; i < threadCount; ++i)
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+}
+
+void ThreadPool::workerLoop()
+{
+    while (true)
+    {
+        std::function<void()> task;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this]()
+                           { return stopping || !tasks.empty(); });
+
+            if (stopping && tasks.empty())
+                return;
+
+            task = std::move(tasks.front());
+            tasks.pop();
+        }
+
+        task();
+    }
+}
+
+size_t ThreadPool::getThreadCount() const
+{
+    return workers.size();
+}
+
+ThreadPool &ThreadPool::getShared()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+
+    condition.notify_all();
+
+    for (std::thread &worker : workers)
+        worker.join();
+}
@@ -0,0 +1,59 @@
+#ifndef __THREADPOOL_H__
+#define __THREADPOOL_H__
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+    std::vector<std::thread> workers;
+
+    std::queue<std::function<void()>> tasks;
+
+    std::mutex mutex;
+
+    std::condition_variable condition;
+
+    bool stopping;
+
+    void workerLoop();
+
+public:
+    explicit ThreadPool(unsigned int threadCount = std::thread::hardware_concurrency());
+
+    ThreadPool(const ThreadPool &) = delete;
+
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    template <typename F>
+    auto submit(F &&task) -> std::future<decltype(task())>
+    {
+        using Result = decltype(task());
+
+        auto packaged = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(task));
+        std::future<Result> result = packaged->get_future();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.emplace([packaged]()
+                          { (*packaged)(); });
+        }
+
+        condition.notify_one();
+        return result;
+    }
+
+    size_t getThreadCount() const;
+
+    // Pool shared by the asset loaders, sized to the number of hardware threads
+    static ThreadPool &getShared();
+
+    ~ThreadPool();
+};
+
+#endif // __THREADPOOL_H__
@@ -0,0 +1,168 @@
+#include "../GL/glad.h"
+#include "VertexFormat.h"
+#include "../glm/gtc/packing.hpp"
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+namespace
+{
+    // Fallback for vertices without a usable normal or tangent
+    glm::vec3 safeNormalize(const glm::vec3 &v, const glm::vec3 &fallback)
+    {
+        float length = glm::length(v);
+        return length > 1e-8f && std::isfinite(length) ? v / length : fallback;
+    }
+
+    glm::vec2 octEncode(glm::vec3 n)
+    {
+        n /= std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+
+        glm::vec2 encoded(n.x, n.y);
+        if (n.z < 0.f)
+        {
+            encoded.x = (1.f - std::abs(n.y)) * (n.x >= 0.f ? 1.f : -1.f);
+            encoded.y = (1.f - std::abs(n.x)) * (n.y >= 0.f ? 1.f : -1.f);
+        }
+        return encoded;
+    }
+
+    template <typename Vertex>
+    void packCommon(const MVertex &source, Vertex &vertex)
+    {
+        glm::vec3 normal = safeNormalize(source.normal, glm::vec3(0.f, 0.f, 1.f));
+        glm::vec3 tangent = safeNormalize(source.tangent, glm::vec3(1.f, 0.f, 0.f));
+
+        glm::vec2 normalOct = octEncode(normal);
+        vertex.normal[0] = static_cast<int16_t>(glm::packSnorm1x16(normalOct.x));
+        vertex.normal[1] = static_cast<int16_t>(glm::packSnorm1x16(normalOct.y));
+
+        vertex.texCoords[0] = glm::packHalf1x16(source.texCoords.x);
+        vertex.texCoords[1] = glm::packHalf1x16(source.texCoords.y);
+
+        // The shader rebuilds the bitangent as cross(normal, tangent) * sign
+        float sign = glm::dot(glm::cross(normal, tangent), source.biTangent) < 0.f ? -1.f : 1.f;
+
+        glm::vec2 tangentOct = octEncode(tangent);
+        vertex.tangent[0] = static_cast<int8_t>(glm::packSnorm1x8(tangentOct.x));
+        vertex.tangent[1] = static_cast<int8_t>(glm::packSnorm1x8(tangentOct.y));
+        vertex.tangent[2] = static_cast<int8_t>(glm::packSnorm1x8(sign));
+        vertex.tangent[3] = 0;
+    }
+
+    template <typename Vertex>
+    void setupPackedAttributes(GLenum positionType, GLboolean normalizePosition)
+    {
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, positionType, normalizePosition, sizeof(Vertex), (void *)offsetof(Vertex, position));
+
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(Vertex), (void *)offsetof(Vertex, normal));
+
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, texCoords));
+
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 4, GL_BYTE, GL_TRUE, sizeof(Vertex), (void *)offsetof(Vertex, tangent));
+    }
+}
+
+size_t VertexLayout::getStride() const
+{
+    switch (format)
+    {
+    case VertexFormat::PACKED:
+        return sizeof(PackedVertex);
+    case VertexFormat::PACKED_QUANTIZED:
+        return sizeof(QuantizedVertex);
+    default:
+        return sizeof(MVertex);
+    }
+}
+
+const char *getVertexFormatDefines(VertexFormat format)
+{
+    return format == VertexFormat::FULL ? "" : "#define PACKED_VERTEX\n";
+}
+
+void packVertices(const std::vector<MVertex> &vertices, VertexLayout &layout, std::vector<unsigned char> &packed)
+{
+    layout.positionOffset = glm::vec3(0.f);
+    layout.positionScale = glm::vec3(1.f);
+
+    packed.resize(vertices.size() * layout.getStride());
+
+    if (layout.format == VertexFormat::FULL)
+    {
+        if (!vertices.empty())
+            std::memcpy(packed.data(), vertices.data(), packed.size());
+        return;
+    }
+
+    if (layout.format == VertexFormat::PACKED)
+    {
+        PackedVertex *out = reinterpret_cast<PackedVertex *>(packed.data());
+        for (size_t i = 0; i < vertices.size(); ++i)
+        {
+            out[i].position = vertices[i].position;
+            packCommon(vertices[i], out[i]);
+        }
+        return;
+    }
+
+    glm::vec3 boundsMin(0.f), boundsMax(0.f);
+    if (!vertices.empty())
+        boundsMin = boundsMax = vertices[0].position;
+
+    for (const MVertex &vertex : vertices)
+    {
+        boundsMin = glm::min(boundsMin, vertex.position);
+        boundsMax = glm::max(boundsMax, vertex.position);
+    }
+
+    glm::vec3 extent = boundsMax - boundsMin;
+    for (int axis = 0; axis < 3; ++axis)
+        if (extent[axis] <= 0.f)
+            extent[axis] = 1.f;
+
+    layout.positionOffset = boundsMin;
+    layout.positionScale = extent;
+
+    QuantizedVertex *out = reinterpret_cast<QuantizedVertex *>(packed.data());
+    for (size_t i = 0; i < vertices.size(); ++i)
+    {
+        glm::vec3 normalized = (vertices[i].position - boundsMin) / extent;
+        for (int axis = 0; axis < 3; ++axis)
+            out[i].position[axis] = glm::packUnorm1x16(normalized[axis]);
+        out[i].position[3] = 0;
+
+        packCommon(vertices[i], out[i]);
+    }
+}
+
+void setupVertexAttributes(VertexFormat format)
+{
+    if (format == VertexFormat::FULL)
+    {
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(MVertex), (void *)0);
+
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(MVertex), (void *)offsetof(MVertex, normal));
+
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(MVertex), (void *)offsetof(MVertex, texCoords));
+
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(MVertex), (void *)offsetof(MVertex, tangent));
+
+        glEnableVertexAttribArray(4);
+        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(MVertex), (void *)offsetof(MVertex, biTangent));
+        return;
+    }
+
+    if (format == VertexFormat::PACKED_QUANTIZED)
+        setupPackedAttributes<QuantizedVertex>(GL_UNSIGNED_SHORT, GL_TRUE);
+    else
+        setupPackedAttributes<PackedVertex>(GL_FLOAT, GL_FALSE);
+}
@@ -0,0 +1,69 @@
+#ifndef __VERTEXFORMAT_H__
+#define __VERTEXFORMAT_H__
+#include "../glm/glm.hpp"
+#include <cstdint>
+#include <vector>
+
+struct MVertex
+{
+    glm::vec3 position;
+    glm::vec3 normal;
+    glm::vec2 texCoords;
+    glm::vec3 tangent;
+    glm::vec3 biTangent;
+};
+
+// Vertex layout a model is converted to at import, chosen per model
+enum class VertexFormat : uint32_t
+{
+    // MVertex as imported, 56 bytes
+    FULL = 0,
+    // Octahedral normal and tangent with the bitangent sign, half float UVs, float positions, 24 bytes
+    PACKED = 1,
+    // PACKED with positions quantized to 16 bits inside the mesh bounds, 20 bytes
+    PACKED_QUANTIZED = 2
+};
+
+struct PackedVertex
+{
+    glm::vec3 position;
+    int16_t normal[2];
+    uint16_t texCoords[2];
+    // Octahedral xy, bitangent sign, unused
+    int8_t tangent[4];
+};
+
+struct QuantizedVertex
+{
+    // xyz normalized inside the mesh bounds, w unused
+    uint16_t position[4];
+    int16_t normal[2];
+    uint16_t texCoords[2];
+    int8_t tangent[4];
+};
+
+static_assert(sizeof(PackedVertex) == 24, "PackedVertex must stay tightly packed");
+static_assert(sizeof(QuantizedVertex) == 20, "QuantizedVertex must stay tightly packed");
+
+// Vertex format of a mesh plus the box its quantized positions are relative to.
+// Shaders rebuild positions as 'aPos * positionScale + positionOffset', which is the identity for float positions
+struct VertexLayout
+{
+    VertexFormat format = VertexFormat::FULL;
+
+    glm::vec3 positionOffset = glm::vec3(0.f);
+    glm::vec3 positionScale = glm::vec3(1.f);
+
+    size_t getStride() const;
+};
+
+// Defines a shader needs to read meshes of this format, inserted after the #version line
+const char *getVertexFormatDefines(VertexFormat format);
+
+// Converts imported vertices to the layout's format, filling in the quantization box for PACKED_QUANTIZED
+void packVertices(const std::vector<MVertex> &vertices, VertexLayout &layout, std::vector<unsigned char> &packed);
+
+// glVertexAttribPointer setup for the vertex buffer currently bound to GL_ARRAY_BUFFER
+void setupVertexAttributes(VertexFormat format);
+
+#endif // __VERTEXFORMAT_H__
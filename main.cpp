@@ -1,9 +1,22 @@
 #include "includes/mine/auxiliary.h"
 #include "includes/mine/Model.h"
+#include "includes/mine/Benchmark.h"
+#include "includes/mine/AssetStreamer.h"
+#include "includes/mine/ModelInstance.h"
+#include "includes/mine/MultiDraw.h"
+#include "includes/mine/TextureCache.h"
+#include "includes/mine/TextureStreamer.h"
+#include "includes/mine/LoadProfiler.h"
+#include "includes/mine/FrameUniforms.h"
+#include "includes/mine/AllocationCounter.h"
+#include "includes/mine/ShadowCascades.h"
+#include "includes/mine/GpuTimer.h"
 #include <iostream>
 #include <thread>
 #include <future>
 #include <fstream>
+#include <cmath>
+#include <chrono>
 
 enum class LightType
 {
@@ -41,70 +54,61 @@ struct Light
         constant = 1.f;
         linear = 0.2f;
         quadratic = 0.032f;
+        cutoff = 0.f;
     }
 
-    void apply_to_shader(MShader &shader, int index = 0)
+    // Entry of the Lights uniform block, every field is written whatever the type uses
+    LightData getData() const
     {
-        if (type == LightType::POINT)
-        {
-            shader.setInt(("light[" + std::to_string(index) + "].type").c_str(), 0);
-            shader.setVec3(("light[" + std::to_string(index) + "].position").c_str(), source.position);
-            shader.setVec3(("light[" + std::to_string(index) + "].diffuse").c_str(), diffuse);
-            shader.setVec3(("light[" + std::to_string(index) + "].specular").c_str(), specular);
-            shader.setVec3(("light[" + std::to_string(index) + "].ambient").c_str(), ambient);
-            shader.setVec3(("light[" + std::to_string(index) + "].color").c_str(), color);
-            shader.setFloat(("light[" + std::to_string(index) + "].linear").c_str(), linear);
-            shader.setFloat(("light[" + std::to_string(index) + "].constant").c_str(), constant);
-            shader.setFloat(("light[" + std::to_string(index) + "].quadratic").c_str(), quadratic);
-        }
-        else if (type == LightType::DIRECTIONAL)
-        {
-            shader.setInt(("light[" + std::to_string(index) + "].type").c_str(), 1);
-            shader.setVec3(("light[" + std::to_string(index) + "].direction").c_str(), direction);
-            shader.setVec3(("light[" + std::to_string(index) + "].ambient").c_str(), ambient);
-        }
-        else if (type == LightType::POINT_DIRECTIONAL)
-        {
-            shader.setInt(("light[" + std::to_string(index) + "].type").c_str(), 2);
-            shader.setVec3(("light[" + std::to_string(index) + "].direction").c_str(), direction);
-            shader.setVec3(("light[" + std::to_string(index) + "].ambient").c_str(), ambient);
-            shader.setFloat(("light[" + std::to_string(index) + "].cutoff").c_str(), cutoff);
-        }
-        else if (type == LightType::PBR)
-        {
-            shader.setInt(("light[" + std::to_string(index) + "].type").c_str(), 3);
-            shader.setVec3(("light[" + std::to_string(index) + "].position").c_str(), source.position);
-            shader.setVec3(("light[" + std::to_string(index) + "].color").c_str(), color);
-        }
+        LightData data{};
+        data.position = source.position;
+        data.direction = direction;
+        data.ambient = ambient;
+        data.diffuse = diffuse;
+        data.specular = specular;
+        data.color = color;
+        data.constant = constant;
+        data.linear = linear;
+        data.quadratic = quadratic;
+        data.cutoff = cutoff;
+        data.type = static_cast<int32_t>(type);
+        return data;
     }
 };
 
-unsigned int depthMapFBO, depthMap;
-constexpr unsigned int SHADOW_WIDTH = 2048, SHADOW_HEIGHT = 2048;
+// Texels per side of each shadow cascade, four of them hold as many texels as the single 2048 map did
+constexpr int SHADOW_CASCADE_SIZE = 1024;
+
+// What the cached static shadow casters were drawn with besides the cascades, any change draws them again.
+// The cascades themselves only redraw the strips a camera move scrolls into view, see ShadowCascades. Detail levels are
+// picked when a region is drawn, so the cached ones don't follow the camera
+struct StaticShadowState
+{
+    glm::mat4 sceneModel = glm::mat4(1.f);
+    unsigned long long sceneNodesVersion = 0;
+    size_t sceneReadyMeshes = 0;
+    bool sceneMultiDraw = false;
+    bool frustumCulling = false;
+    bool lodEnabled = false;
+    float lodTexelError = 0.f;
+    int lodBias = 0;
+    int lodForcedLevel = -1;
+
+    bool operator==(const StaticShadowState &) const = default;
+};
+
+// The interactive scene. Every GL object it creates is a local released when it returns, while the context still exists
+void runViewer(GLFWwindow *window, Camera &camera);
 
-void setupShadowMap()
+// Everything holding GL objects has to be gone by the time the context is destroyed
+void shutdown(GLFWwindow *window)
 {
-    glGenFramebuffers(1, &depthMapFBO);
-
-    glGenTextures(1, &depthMap);
-    glBindTexture(GL_TEXTURE_2D, depthMap);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-    float borderColor[] = {1.0f, 1.0f, 1.0f, 1.0f};
-
-    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
-
-    glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMap, 0);
-    glDrawBuffer(GL_NONE);
-    glReadBuffer(GL_NONE);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    MeshPool::releaseAll();
+    terminateImGui();
+    terminateGLFW(window);
 }
 
-int main()
+int main(int argc, char **argv)
 {
     GLFWwindow *window = initGLFWGLAD();
 
@@ -114,35 +118,137 @@ int main()
 
     Camera camera(window, glm::vec3(0.f, 1.f, 1.f), 3.f);
 
+    // The benchmarks never reach the frame loop that streams finer texture levels in, so they load whole mip chains
+    if (argc > 1)
+        TextureStreamer::get().enabled = false;
+
+    if (argc > 1 && std::string(argv[1]) == "--bench-loader")
+    {
+        runLoaderBenchmark(argc > 2 ? argv[2] : "models/sponza/Sponza.gltf", camera);
+        shutdown(window);
+        return 0;
+    }
+
+    if (argc > 1 && std::string(argv[1]) == "--bench-memory")
+    {
+        VertexFormat format = VertexFormat::FULL;
+        for (int i = 3; i < argc; ++i)
+        {
+            std::string option = argv[i];
+            if (option == "--keep-cpu-geometry")
+                Mesh::retainCpuGeometry = true;
+            else if (option == "--packed")
+                format = VertexFormat::PACKED;
+            else if (option == "--quantized")
+                format = VertexFormat::PACKED_QUANTIZED;
+            else if (option == "--uncompressed-textures")
+                TextureCache::enabled = false;
+        }
+
+        runMemoryReport(argc > 2 ? argv[2] : "models/sponza/Sponza.gltf", camera, format);
+        shutdown(window);
+        return 0;
+    }
+
+    if (argc > 1 && std::string(argv[1]) == "--cook-textures")
+    {
+        runTextureCook(argc > 2 ? argv[2] : "models/sponza/Sponza.gltf");
+        shutdown(window);
+        return 0;
+    }
+
+    if (argc > 1 && std::string(argv[1]) == "--bench-lod")
+    {
+        runLodBenchmark("models/highPolySphere/sphere.gltf", camera, argc > 2 ? std::stoi(argv[2]) : 400);
+        shutdown(window);
+        return 0;
+    }
+
+    if (argc > 1 && std::string(argv[1]) == "--bench-mdi")
+    {
+        runMultiDrawBenchmark(argc > 2 ? argv[2] : "models/sponza/Sponza.gltf", camera);
+        shutdown(window);
+        return 0;
+    }
+
+    if (argc > 1 && std::string(argv[1]) == "--bench-instances")
+    {
+        runInstancingBenchmark("models/highPolySphere/sphere.gltf", camera, argc > 2 ? std::stoi(argv[2]) : 10000);
+        shutdown(window);
+        return 0;
+    }
+
+    runViewer(window, camera);
+
+    shutdown(window);
+}
+
+void runViewer(GLFWwindow *window, Camera &camera)
+{
     MShader shader;
     shader.autoCompileAndLink("shaders/common.vert", "shaders/ar.frag");
 
     MShader sunShader;
     sunShader.autoCompileAndLink("shaders/common.vert", "shaders/lightSource.frag");
 
+    // Sponza and the sphere are imported packed, the shaders reading them need the matching variant
+    constexpr VertexFormat sceneVertexFormat = VertexFormat::PACKED_QUANTIZED;
+
     MShader sponzaShader;
-    sponzaShader.autoCompileAndLink("shaders/common.vert", "shaders/sponzaScene.frag");
+    sponzaShader.autoCompileAndLink("shaders/common.vert", "shaders/sponzaScene.frag", getVertexFormatDefines(sceneVertexFormat));
+
+    // The scene is submitted with glMultiDrawElementsIndirect by default, these variants read their per draw data from SSBOs
+    std::string multiDrawDefines = getMultiDrawDefines(sceneVertexFormat);
+
+    MShader sponzaMultiDrawShader;
+    sponzaMultiDrawShader.autoCompileAndLink("shaders/common.vert", "shaders/sponzaScene.frag", multiDrawDefines.c_str());
 
     MShader sphereShader;
-    sphereShader.autoCompileAndLink("shaders/pbrSphere.vert", "shaders/pbrSphere.frag");
+    sphereShader.autoCompileAndLink("shaders/pbrSphere.vert", "shaders/pbrSphere.frag", getVertexFormatDefines(sceneVertexFormat));
+
+    MShader sphereInstancedShader;
+    sphereInstancedShader.autoCompileAndLink("shaders/pbrSphereInstanced.vert", "shaders/pbrSphere.frag", getVertexFormatDefines(sceneVertexFormat));
 
     MShader rectShader;
     rectShader.autoCompileAndLink("shaders/pbrRect.vert", "shaders/pbrRect.frag");
 
+    // Casters go into every cascade at once, the geometry shader picks the layers
     MShader shadowMapShader;
-    shadowMapShader.autoCompileAndLink("shaders/shadowMap.vert", "shaders/shadowMap.frag");
+    shadowMapShader.autoCompileAndLink("shaders/shadowMap.vert", "shaders/shadowMap.geom", "shaders/shadowMap.frag", ShadowCascades::define);
 
-    setupShadowMap();
+    MShader shadowMapInstancedShader;
+    shadowMapInstancedShader.autoCompileAndLink("shaders/shadowMapInstanced.vert", "shaders/shadowMap.geom", "shaders/shadowMap.frag",
+                                                ShadowCascades::define);
 
-    Model scene("models/sponza/Sponza.gltf", camera);
+    std::string shadowMultiDrawDefines = multiDrawDefines + ShadowCascades::define;
 
-    scene.scale = glm::vec3(0.005f);
+    MShader shadowMapMultiDrawShader;
+    shadowMapMultiDrawShader.autoCompileAndLink("shaders/shadowMap.vert", "shaders/shadowMap.geom", "shaders/shadowMap.frag",
+                                                shadowMultiDrawDefines.c_str());
+
+    ShadowCascades shadowCascades(SHADOW_CASCADE_SIZE);
+
+    // Sponza never moves, it is drawn into the static cascades. The sphere, its instances and the light gizmos are dynamic
+    bool shadowCaching = true;
+    StaticShadowState staticShadowState;
+    GpuTimer shadowTimer;
+
+    AssetStreamer streamer;
+
+    std::shared_ptr<Model> sceneHandle = streamer.loadModel("models/sponza/Sponza.gltf", camera, sceneVertexFormat);
+
+    Model &scene = *sceneHandle;
+
+    // On top of the 0.008 of Sponza's root node
+    scene.scale = glm::vec3(0.625f);
 
     scene.position = glm::vec3(0.f, 0.f, -4.1f);
 
     scene.angles = glm::vec3(0.f, 83.72f, 0.f);
 
-    Model sphere("models/highPolySphere/sphere.gltf", camera);
+    std::shared_ptr<Model> sphereHandle = streamer.loadModel("models/highPolySphere/sphere.gltf", camera, sceneVertexFormat);
+
+    Model &sphere = *sphereHandle;
 
     sphere.position = glm::vec3(0.f, 0.635f, 0.f);
 
@@ -153,6 +259,12 @@ int main()
     float sphereMetallic = 0.5f;
     float sphereAO = 1.f;
 
+    // Copies of the sphere sharing its asset, laid out on a grid in front of it
+    InstanceBatch sphereInstances(sphere.getAsset());
+    int sphereInstanceCount = 0;
+    float sphereInstanceSpacing = 0.25f;
+    bool sphereInstancesDirty = true;
+
     constexpr int lightCount = 1;
 
     std::vector<Light> lights;
@@ -169,98 +281,202 @@ int main()
 
     lights[0].source.position = glm::vec3(-0.116f, 1.977f, 0.f);
 
-    std::vector<Light> pbrLights;
+    // Camera and light blocks read by every scene shader, the PBR shaders only use the lights' position and color
+    FrameUniforms frameUniforms;
+    std::vector<LightData> lightData;
 
-    for (int i = 0; i < lightCount; i++)
-        pbrLights.emplace_back(camera, LightType::PBR);
+    MultiDrawBatch sceneShadowDraws(scene, false);
+    MultiDrawBatch sceneDraws(scene, true);
+    bool sceneMultiDraw = true;
 
-    for (Light &light : pbrLights)
-        light.type = LightType::PBR;
+    // Every per mesh draw of the frame, the multi draw and instanced batches are already grouped and stay outside
+    RenderQueue renderQueue;
 
-    for (int i = 0; i < lightCount; i++)
-    {
-        pbrLights[i].source.position = lights[i].source.position;
-        pbrLights[i].color = lights[i].color;
-    }
+    bool frustumCulling = true;
+    // Smoothed CPU time spent submitting the scene in each pass
+    double sceneShadowCpuMs = 0.0, sceneMainCpuMs = 0.0;
 
-    shader.setInt("lightCount", lightCount);
-    rectShader.setInt("lightCount", lightCount);
+    glm::vec3 sunColor = glm::vec3(1.f, 1.f, 0.f);
 
+    bool freeScale = false;
 
+    float perspFov = 45.f;
 
-    sponzaShader.setInt("lightCount", lightCount);
-    sponzaShader.setInt("light[0].type", 0);
+    int uploadBudgetMB = static_cast<int>(streamer.budget.bytesPerFrame / (1024 * 1024));
 
-    sphereShader.setInt("lightCount", lightCount);
+    TextureStreamer &textureStreamer = TextureStreamer::get();
+    int textureBudgetMB = static_cast<int>(textureStreamer.budgetBytes / (1024 * 1024));
 
-    glm::vec3 sunColor = glm::vec3(1.f, 1.f, 0.f);
+    // The shadow pass uses a coarser policy, its errors are measured in shadow map texels and it starts one level lower
+    bool lodEnabled = true;
+    float lodPixelError = 1.f;
+    float shadowLodTexelError = 2.f;
+    int shadowLodBias = 1;
+    int lodForcedLevel = -1;
+    unsigned long long shadowTriangles = 0, mainTriangles = 0;
+    unsigned long long shadowDraws = 0, mainDraws = 0;
+    CullStats shadowCullStats, mainCullStats;
 
-    bool freeScale = false;
-
-    float perspFov = 45.f;
-    float perspNear = 0.1f;
-    float perspFar = 10.f;
+    bool loadProfileReported = false;
 
-    float orthoSize = 10.f;
+    unsigned long long heapAllocationsAtFrameStart = getHeapAllocationCount(), heapAllocationsLastFrame = 0;
 
     while (!glfwWindowShouldClose(window))
     {
-        glm::mat4 lightProjection = glm::ortho(-orthoSize, orthoSize, -orthoSize, orthoSize, perspNear, perspFar);
+        // Whole previous frame, worker threads included
+        unsigned long long heapAllocations = getHeapAllocationCount();
+        heapAllocationsLastFrame = heapAllocations - heapAllocationsAtFrameStart;
+        heapAllocationsAtFrameStart = heapAllocations;
 
-        glm::mat4 lightView = glm::lookAt(
-            lights[0].source.position,
-            glm::vec3(0.f),
-            glm::vec3(0.0f, 1.0f, 0.0f));
+        streamer.update();
 
-        glm::mat4 lightSpaceMatrix = lightProjection * lightView;
+        // Startup ends with the last streamed model
+        if (!loadProfileReported && streamer.isIdle())
+        {
+            LoadProfiler::get().printReport(std::cout);
+            if (!LoadProfiler::get().writeJson("load_profile.json"))
+                std::cout << "Failed to write load_profile.json\n";
+            loadProfileReported = true;
+        }
 
-        shadowMapShader.setMat4("lightSpaceMatrix", lightSpaceMatrix);
+        if (sphereInstancesDirty)
+        {
+            int side = std::max(1, static_cast<int>(std::ceil(std::sqrt(static_cast<float>(sphereInstanceCount)))));
 
-        glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-        glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-        glClear(GL_DEPTH_BUFFER_BIT);
+            sphereInstances.instances.resize(sphereInstanceCount);
+            for (int i = 0; i < sphereInstanceCount; ++i)
+            {
+                ModelInstance &instance = sphereInstances.instances[i];
+                instance.position = sphere.position + glm::vec3((i % side - side * 0.5f) * sphereInstanceSpacing, 0.f, (i / side + 1) * sphereInstanceSpacing);
+                instance.scale = sphere.scale;
+                instance.albedo = sphereAlbedo;
+                instance.roughness = sphereRoughness;
+                instance.metallic = sphereMetallic;
+                instance.ao = sphereAO;
+            }
 
-        shadowMapShader.setMat4("model", scene.getModel());
-        scene.render(shadowMapShader, false);
+            sphereInstances.update();
+            sphereInstancesDirty = false;
+        }
 
-        shadowMapShader.setMat4("model", sphere.getModel());
-        sphere.render(shadowMapShader, false);
+        if (windowResized)
+            camera.updateProjection(WINDOW_WIDTH, WINDOW_HEIGHT);
 
-        for (auto& light : lights) {
-            shadowMapShader.setMat4("model", light.source.getModel());
-            light.source.render(shadowMapShader, false);
+        // The first light shines at the origin
+        glm::vec3 lightDirection = glm::normalize(-lights[0].source.position);
+
+        // Sponza is the only static caster, its box keeps the depth range of the cascades still
+        glm::vec3 sceneBoundsMin, sceneBoundsMax;
+        scene.getAsset()->getBounds(sceneBoundsMin, sceneBoundsMax);
+        shadowCascades.setStaticBounds(sceneBoundsMin, sceneBoundsMax, scene.getModel());
+        shadowCascades.update(camera, lightDirection);
+
+        // Cascade texels grow with the distance to the camera about like its pixels do, so the shadow pass selects like the
+        // camera would at the cascade resolution
+        LodSelector shadowLod = LodSelector::forCamera(camera, SHADOW_CASCADE_SIZE, shadowLodTexelError);
+        shadowLod.levelBias = shadowLodBias;
+        shadowLod.forcedLevel = lodForcedLevel;
+        const LodSelector *shadowLodSelector = lodEnabled ? &shadowLod : nullptr;
+
+        LodSelector mainLod = LodSelector::forCamera(camera, WINDOW_HEIGHT, lodPixelError);
+        mainLod.forcedLevel = lodForcedLevel;
+        const LodSelector *mainLodSelector = lodEnabled ? &mainLod : nullptr;
+
+        Frustum cameraFrustum = Frustum::fromCamera(camera);
+        cameraFrustum.stats = &mainCullStats;
+        const Frustum *mainFrustum = frustumCulling ? &cameraFrustum : nullptr;
+
+        // Static casters only have to be inside a cascade, the camera can turn towards them while the cache stays
+        Frustum staticShadowFrustum = shadowCascades.getCasterFrustum();
+        staticShadowFrustum.stats = &shadowCullStats;
+        const Frustum *staticCasterFrustum = frustumCulling ? &staticShadowFrustum : nullptr;
+
+        scene.updateTransforms();
+        StaticShadowState shadowState;
+        shadowState.sceneModel = scene.getModel();
+        shadowState.sceneNodesVersion = scene.getSceneGraph().getVersion();
+        shadowState.sceneReadyMeshes = scene.getReadyMeshCount();
+        shadowState.sceneMultiDraw = sceneMultiDraw;
+        shadowState.frustumCulling = frustumCulling;
+        shadowState.lodEnabled = lodEnabled;
+        shadowState.lodTexelError = shadowLodTexelError;
+        shadowState.lodBias = shadowLodBias;
+        shadowState.lodForcedLevel = lodForcedLevel;
+        if (!shadowCaching || shadowState != staticShadowState)
+        {
+            shadowCascades.invalidateStatic();
+            staticShadowState = shadowState;
         }
+        bool staticShadowPass = !shadowCascades.isStaticValid();
+
+        // Dynamic casters have to be inside a cascade and their shadow, the sphere dragged as far as a cascade reaches, has to
+        // reach the camera's view
+        glm::vec3 lightSweep = lightDirection * (shadowCascades.casterDepth + shadowCascades.shadowDistance);
+        Frustum shadowFrustum = shadowCascades.getCasterFrustum().intersect(cameraFrustum.extrude(lightSweep));
+        shadowFrustum.stats = &shadowCullStats;
+        const Frustum *casterFrustum = frustumCulling ? &shadowFrustum : nullptr;
+
+        // Both passes are queued up front so the queue is sorted once per frame
+        renderQueue.clear();
+
+        renderQueue.setView(lights[0].source.position, glm::length(lights[0].source.position) + shadowCascades.shadowDistance);
+        if (staticShadowPass && !sceneMultiDraw)
+            scene.submit(renderQueue, RenderPass::STATIC_SHADOW, shadowMapShader, false, shadowLodSelector, staticCasterFrustum);
+        sphere.submit(renderQueue, RenderPass::SHADOW, shadowMapShader, false, shadowLodSelector, casterFrustum);
+        for (auto &light : lights)
+            light.source.submit(renderQueue, RenderPass::SHADOW, shadowMapShader, false, shadowLodSelector, casterFrustum);
 
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        renderQueue.setView(camera.getPosition(), 100.f);
+        if (!sceneMultiDraw)
+            scene.submit(renderQueue, RenderPass::OPAQUE, sponzaShader, true, mainLodSelector, mainFrustum);
+        sphere.submit(renderQueue, RenderPass::OPAQUE, sphereShader, true, mainLodSelector, mainFrustum);
+        for (auto &light : lights)
+            light.source.submit(renderQueue, RenderPass::OPAQUE, sunShader, true, mainLodSelector, mainFrustum);
 
-        if (windowResized)
-            camera.updateProjection(WINDOW_WIDTH, WINDOW_HEIGHT);
+        renderQueue.sort();
 
-        sunShader.setVec3("color", sunColor);
+        Mesh::drawnTriangles = Mesh::drawnMeshes = 0;
 
-        int lightIndex = 0;
+        shadowTimer.begin();
 
-        for (auto &light : lights)
+        // Without multi draw the scene is part of the queued pass
+        auto sceneShadowStart = std::chrono::steady_clock::now();
+        int staticShadowPasses = shadowCascades.updateStatic();
+        for (int pass = 0; pass < staticShadowPasses; ++pass)
         {
-            light.apply_to_shader(sponzaShader, lightIndex);
-            ++lightIndex;
+            shadowCascades.beginStaticPass(pass);
+            if (sceneMultiDraw)
+                sceneShadowDraws.render(shadowMapMultiDrawShader, shadowLodSelector, staticCasterFrustum);
+            renderQueue.flush(RenderPass::STATIC_SHADOW);
+            shadowCascades.endPass();
         }
+        sceneShadowCpuMs += (std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - sceneShadowStart).count() - sceneShadowCpuMs) * 0.05;
 
-        lightIndex = 0;
-        for (auto &light : pbrLights)
-        {
-            light.apply_to_shader(sphereShader, lightIndex);
-            light.apply_to_shader(rectShader, lightIndex);
-            ++lightIndex;
-        }
+        shadowCascades.beginPass();
+        renderQueue.flush(RenderPass::SHADOW);
+        sphereInstances.render(shadowMapInstancedShader, false, shadowLodSelector);
 
-        for (int i = 0; i < lightCount; i++)
-        {
-            pbrLights[i].source.position = lights[i].source.position;
-            pbrLights[i].color = lights[i].color;
-        }
+        shadowTriangles = Mesh::drawnTriangles;
+        shadowDraws = Mesh::drawnMeshes;
+        Mesh::drawnTriangles = Mesh::drawnMeshes = 0;
+
+        shadowCascades.endPass();
+        shadowTimer.end();
+        glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        textureStreamer.request(scene, camera, WINDOW_HEIGHT);
+        textureStreamer.request(sphere, camera, WINDOW_HEIGHT);
+        textureStreamer.update();
+
+        sunShader.setVec3("color", sunColor);
+
+        frameUniforms.setView(camera);
+
+        lightData.clear();
+        for (const Light &light : lights)
+            lightData.push_back(light.getData());
+        frameUniforms.setLights(lightData);
 
         sphereShader.setVec3("material.albedo", sphereAlbedo);
         sphereShader.setFloat("material.roughness", sphereRoughness);
@@ -272,23 +488,22 @@ int main()
         rectShader.setFloat("material.metallic", sphereMetallic);
         rectShader.setFloat("material.ao", sphereAO);
 
-        glActiveTexture(GL_TEXTURE0 + 10);
-        glBindTexture(GL_TEXTURE_2D, depthMap);
-
-        sphereShader.setMat4("lightSpaceMatrix", lightSpaceMatrix);
-
-        sphereShader.setInt("shadowMap", 10);
-
-        sponzaShader.setMat4("lightSpaceMatrix", lightSpaceMatrix);
+        shadowCascades.bindTexture(10);
 
         sponzaShader.setInt("shadowMap", 10);
 
-        scene.render(sponzaShader);
+        sponzaMultiDrawShader.setInt("shadowMap", 10);
 
-        sphere.render(sphereShader);
+        auto sceneMainStart = std::chrono::steady_clock::now();
+        if (sceneMultiDraw)
+            sceneDraws.render(sponzaMultiDrawShader, mainLodSelector, mainFrustum);
+        renderQueue.flush(RenderPass::OPAQUE);
+        sceneMainCpuMs += (std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - sceneMainStart).count() - sceneMainCpuMs) * 0.05;
 
-        for (auto &light : lights)
-            light.source.render(sunShader);
+        sphereInstances.render(sphereInstancedShader, true, mainLodSelector);
+
+        mainTriangles = Mesh::drawnTriangles;
+        mainDraws = Mesh::drawnMeshes;
 
 
 
@@ -298,9 +513,31 @@ int main()
 
         ImGui::SliderFloat("FOV", &perspFov, 1.f, 179.f);
 
-        ImGui::SliderFloat("Near", &perspNear, 0.1f, 10.f);
+        ImGui::End();
+
+        ImGui::Begin("Shadows");
+
+        ImGui::SliderInt("Cascades", &shadowCascades.cascadeCount, 1, ShadowCascades::maxCascades);
+
+        ImGui::SliderFloat("Split lambda", &shadowCascades.splitLambda, 0.f, 1.f);
+
+        ImGui::SliderFloat("Distance", &shadowCascades.shadowDistance, 1.f, 100.f);
+
+        ImGui::SliderFloat("Caster depth", &shadowCascades.casterDepth, 0.f, 50.f);
+
+        ImGui::SliderFloat("Depth step", &shadowCascades.depthStep, 0.1f, 5.f);
+
+        ImGui::SliderFloat("Blend band", &shadowCascades.blendBand, 0.f, 0.5f);
+
+        ImGui::Checkbox("Cache static casters", &shadowCaching);
+
+        ImGui::Text("Shadow pass GPU: %.3f ms, static casters drawn %llu times into %.2f layers", shadowTimer.getMilliseconds(),
+                    ShadowCascades::staticPasses, double(ShadowCascades::staticTexels) / (double(SHADOW_CASCADE_SIZE) * SHADOW_CASCADE_SIZE));
+        ShadowCascades::staticPasses = ShadowCascades::staticTexels = 0;
 
-        ImGui::SliderFloat("Far", &perspFar, 0.f, 100.f);
+        const CascadeBlock &cascadeBlock = shadowCascades.getBlock();
+        for (int cascade = 0; cascade < cascadeBlock.cascadeCount; ++cascade)
+            ImGui::Text("Cascade %d: to %.2f, %.4f units per texel", cascade, cascadeBlock.splitDepths[cascade], cascadeBlock.texelSizes[cascade]);
 
         ImGui::End();
 
@@ -320,11 +557,24 @@ int main()
 
         ImGui::End();
 
+        ImGui::Begin("Sphere instances");
+
+        sphereInstancesDirty |= ImGui::SliderInt("Count", &sphereInstanceCount, 0, 20000);
+
+        sphereInstancesDirty |= ImGui::SliderFloat("Spacing", &sphereInstanceSpacing, 0.05f, 2.f);
+
+        if (ImGui::Button("Copy sphere material"))
+            sphereInstancesDirty = true;
+
+        ImGui::Text("%zu instances drawn with %zu calls", sphereInstances.getInstanceCount(), sphereInstances.getAsset()->meshes.size());
+
+        ImGui::End();
+
         ImGui::Begin("City");
 
         ImGui::SliderFloat3("Position", glm::value_ptr(scene.position), -5.f, 5.f);
 
-        ImGui::SliderFloat3("Scale", glm::value_ptr(scene.scale), 0.001f, 0.015f);
+        ImGui::SliderFloat3("Scale", glm::value_ptr(scene.scale), 0.125f, 1.875f);
 
         ImGui::SliderFloat3("Rotation", glm::value_ptr(scene.rotation), 0.f, 1.f);
 
@@ -403,6 +653,66 @@ int main()
 
         ImGui::End();
 
+        ImGui::Begin("LOD");
+
+        ImGui::Checkbox("Enabled", &lodEnabled);
+
+        ImGui::SliderFloat("Pixel error", &lodPixelError, 0.1f, 16.f);
+
+        ImGui::SliderFloat("Shadow texel error", &shadowLodTexelError, 0.1f, 32.f);
+
+        ImGui::SliderInt("Shadow level bias", &shadowLodBias, 0, static_cast<int>(maxLodLevels) - 1);
+
+        ImGui::SliderInt("Forced level", &lodForcedLevel, -1, static_cast<int>(maxLodLevels) - 1);
+
+        ImGui::Text("Main pass: %llu draws, %llu triangles", mainDraws, mainTriangles);
+        ImGui::Text("Shadow pass: %llu draws, %llu triangles", shadowDraws, shadowTriangles);
+
+        ImGui::End();
+
+        ImGui::Begin("Texture streaming");
+
+        // Bindless handles were made for textures with fixed storage
+        ImGui::BeginDisabled(MaterialTable::getMode() == MaterialMode::BINDLESS);
+        ImGui::Checkbox("Stream new textures", &textureStreamer.enabled);
+        ImGui::EndDisabled();
+
+        if (ImGui::SliderInt("VRAM budget (MB)", &textureBudgetMB, 8, 1024))
+            textureStreamer.budgetBytes = static_cast<size_t>(textureBudgetMB) * 1024 * 1024;
+
+        ImGui::SliderFloat("Level bias", &textureStreamer.levelBias, -2.f, 4.f);
+
+        ImGui::Text("Resident: %.2f MB, requested: %.2f MB, %zu reads in flight", textureStreamer.getResidentBytes() / (1024.f * 1024.f),
+                    textureStreamer.getRequestedBytes() / (1024.f * 1024.f), textureStreamer.getPendingReads());
+
+        ImGui::Text("Material array copies: %.2f MB", textureStreamer.getCopyBytes() / (1024.f * 1024.f));
+
+        if (ImGui::BeginTable("Streamed textures", 4, ImGuiTableFlags_RowBg | ImGuiTableFlags_ScrollY, ImVec2(0.f, 300.f)))
+        {
+            ImGui::TableSetupColumn("Texture");
+            ImGui::TableSetupColumn("Resident");
+            ImGui::TableSetupColumn("Requested");
+            ImGui::TableSetupColumn("MB");
+            ImGui::TableHeadersRow();
+
+            for (const TextureStreamer::TextureInfo &info : textureStreamer.getTextureInfos())
+            {
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                ImGui::TextUnformatted(info.path.substr(info.path.find_last_of('/') + 1).c_str());
+                ImGui::TableNextColumn();
+                ImGui::Text("%d (%d px)", info.residentLevel, std::max(1, std::max(info.width, info.height) >> info.residentLevel));
+                ImGui::TableNextColumn();
+                ImGui::Text("%d (%d px)", info.requestedLevel, std::max(1, std::max(info.width, info.height) >> info.requestedLevel));
+                ImGui::TableNextColumn();
+                ImGui::Text("%.2f / %.2f", info.residentBytes / (1024.f * 1024.f), info.requestedBytes / (1024.f * 1024.f));
+            }
+
+            ImGui::EndTable();
+        }
+
+        ImGui::End();
+
         ImGui::Begin("Misc");
 
         if (ImGui::Button("Cap FPS"))
@@ -411,6 +721,49 @@ int main()
         if (ImGui::Button("Uncap FPS"))
             glfwSwapInterval(0);
 
+        if (ImGui::SliderInt("Upload budget (MB)", &uploadBudgetMB, 1, 64))
+            streamer.budget.bytesPerFrame = static_cast<size_t>(uploadBudgetMB) * 1024 * 1024;
+
+        ImGui::SliderFloat("Upload budget (ms)", &streamer.budget.millisecondsPerFrame, 0.25f, 16.f);
+
+        ImGui::Text("Streaming: %zu pending, %.2f MB last frame", streamer.getPendingUploads(),
+                    streamer.getUploadedLastFrame() / (1024.f * 1024.f));
+
+        const ResourceStats &resources = ResourceCache::get().getStats();
+        ImGui::Text("Models: %zu resident, %zu hits, %zu misses", resources.residentModels, resources.modelHits, resources.modelMisses);
+        ImGui::Text("Textures: %zu resident, %zu hits, %zu misses", resources.residentTextures, resources.textureHits, resources.textureMisses);
+        ImGui::Text("Duplicate textures: %zu, %.2f MB not uploaded", resources.textureDuplicates,
+                    resources.duplicateTextureBytes / (1024.f * 1024.f));
+        ImGui::Text("Resident: %.2f MB meshes, %.2f MB textures", resources.residentMeshBytes / (1024.f * 1024.f),
+                    resources.residentTextureBytes / (1024.f * 1024.f));
+        ImGui::Checkbox("Multi-draw indirect scene", &sceneMultiDraw);
+        ImGui::Text("Scene submit: %.3f ms shadow, %.3f ms main (%zu draws in %zu multi draws)", sceneShadowCpuMs, sceneMainCpuMs,
+                    sceneDraws.getDrawCount(), sceneDraws.getGroupCount());
+        ImGui::Text("Scene materials: %s, %zu texture arrays",
+                    MaterialTable::getMode() == MaterialMode::BINDLESS ? "bindless" : "texture arrays",
+                    sceneDraws.getMaterialTable()->getArrayCount());
+
+        // Counted since this panel was last drawn, zero while nothing moves
+        ImGui::Text("Node transforms recomputed: %llu", SceneGraph::updatedNodes);
+        SceneGraph::updatedNodes = 0;
+        ImGui::Text("Uniform writes: %llu, program binds: %llu", Shader::uniformWrites, Shader::programBinds);
+        Shader::uniformWrites = Shader::programBinds = 0;
+        ImGui::Text("Heap allocations last frame: %llu", heapAllocationsLastFrame);
+        ImGui::Checkbox("Frustum culling", &frustumCulling);
+        ImGui::Text("Visible: %llu / %llu meshes, %llu / %llu triangles", mainCullStats.visibleMeshes, mainCullStats.testedMeshes,
+                    mainCullStats.visibleTriangles, mainCullStats.testedTriangles);
+        ImGui::Text("Casting: %llu / %llu meshes, %llu / %llu triangles", shadowCullStats.visibleMeshes, shadowCullStats.testedMeshes,
+                    shadowCullStats.visibleTriangles, shadowCullStats.testedTriangles);
+        mainCullStats = shadowCullStats = CullStats();
+        ImGui::Text("Render queue: %zu draws, binds avoided: %llu program, %llu texture, %llu vertex array", renderQueue.getItemCount(),
+                    RenderQueue::programBindsAvoided, RenderQueue::textureBindsAvoided, RenderQueue::vertexArrayBindsAvoided);
+        RenderQueue::programBindsAvoided = RenderQueue::textureBindsAvoided = RenderQueue::vertexArrayBindsAvoided = 0;
+        ImGui::Text("Light buffer bytes written: %llu", FrameUniforms::lightBytesWritten);
+        FrameUniforms::lightBytesWritten = 0;
+
+        ImGui::Text("Mesh pools: %.2f of %.2f MB used", MeshPool::getTotalUsedBytes() / (1024.f * 1024.f),
+                    MeshPool::getTotalCapacityBytes() / (1024.f * 1024.f));
+
         ImGui::End();
 
         renderFrame();
@@ -422,6 +775,4 @@ int main()
         camera.update(window);
     }
 
-    terminateImGui();
-    terminateGLFW(window);
 }
\ No newline at end of file